@@ -0,0 +1,1569 @@
+/**
+ * Muvuku: An STK data collection framework
+ *
+ * Copyright 2011-2012 Medic Mobile, Inc. <hello@medicmobile.org>
+ * All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MEDIC MOBILE BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "muvuku.h"
+#include "gateway.h"
+
+
+/* Bulk decoder:
+    Reads newline-delimited messages from files (or standard input),
+    decodes them across a pool of worker threads, and writes one line
+    of CSV or JSON per record, in input order; batched messages hold
+    several records. Text records are decoded by the decoder generated
+    for their form, and compact and delta records by
+    `schema_list_unserialize`; sequenced records are unwrapped first,
+    and (with `-a') acknowledged once decoded. Messages holding delta
+    records are decoded on the main thread instead, in input order,
+    since each may need a base from an earlier message by the same
+    sender. Input is read in batches: while the workers
+    decode one batch, the main thread writes the previous batch's
+    results and reads the next batch, so neither side waits for
+    the other unless it is actually slower. */
+
+#define GATEWAY_BATCH_SIZE (4096)
+
+
+/* Claim this many records at a time from the current batch */
+#define GATEWAY_CLAIM_SIZE (64)
+
+
+typedef enum gateway_status {
+
+    GATEWAY_OK,
+    GATEWAY_REJECTED,
+    GATEWAY_UNKNOWN_FORM,
+    GATEWAY_BAD_PDU
+
+} gateway_status_t;
+
+
+#define GATEWAY_STATUS_COUNT (4)
+
+
+typedef enum gateway_format {
+
+    GATEWAY_FORMAT_CSV,
+    GATEWAY_FORMAT_JSON
+
+} gateway_format_t;
+
+
+/* Growable string:
+    Holds one record's input line, or its formatted output. The
+    storage is kept between records, and only ever grows. */
+
+typedef struct gateway_string {
+
+    char *p;
+    size_t len;
+    size_t size;
+
+} gateway_string_t;
+
+
+typedef struct gateway_job {
+
+    unsigned long number;
+    gateway_string_t line;
+    gateway_string_t output;
+    gateway_status_t status;
+
+    /* Records per status; a batched message holds several */
+    unsigned long counts[GATEWAY_STATUS_COUNT];
+
+    /* Sender, for records read from PDUs; see `-p' */
+    char from[GATEWAY_ADDRESS_MAX];
+
+    /* Generated decoder and generic parser disagree; see `-c' */
+    u8 mismatch;
+
+    /* Sequence numbers of decoded records; see `-a' */
+    uint32_t *acks;
+    size_t nr_acks;
+    size_t acks_size;
+
+    /* Holds delta records; left for the main thread */
+    u8 deferred;
+
+} gateway_job_t;
+
+
+typedef struct gateway_batch {
+
+    gateway_job_t jobs[GATEWAY_BATCH_SIZE];
+    size_t count;
+
+} gateway_batch_t;
+
+
+/* Delta bases:
+    The text record for each complete delta record decoded, kept by
+    sender (empty without `-p'), form and sequence number; partial
+    delta records are rebuilt against them. Only the newest few for
+    each sender and form are kept. */
+
+#define GATEWAY_BASES_PER_FORM (4)
+
+
+#define GATEWAY_BASE_BUCKETS (1024)
+
+
+typedef struct gateway_base {
+
+    struct gateway_base *next;
+    char from[GATEWAY_ADDRESS_MAX];
+    unsigned int form;
+    uint32_t sequence;
+    size_t len;
+    char text[MAX_SMS_LENGTH + 1];
+
+} gateway_base_t;
+
+
+typedef struct gateway_bases {
+
+    gateway_base_t *buckets[GATEWAY_BASE_BUCKETS];
+
+} gateway_bases_t;
+
+
+struct gateway_pool;
+
+typedef struct gateway_worker {
+
+    pthread_t thread;
+    struct gateway_pool *pool;
+
+    /* One list per form, each with its own arena */
+    schema_list_t **lists;
+
+    /* The same again, for the generic parser's results; see `-c' */
+    schema_list_t **check_lists;
+
+    /* Delta bases; only the main thread has these */
+    gateway_bases_t *bases;
+
+} gateway_worker_t;
+
+
+/* Worker pool:
+    The main thread hands over a batch by incrementing `generation`;
+    workers claim records from it until `next` reaches `count`, and
+    the last one to finish signals `done`. */
+
+typedef struct gateway_pool {
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+
+    gateway_format_t format;
+    u8 generic;
+    u8 check;
+    u8 pdu;
+    u8 ack;
+
+    gateway_batch_t *batch;
+    size_t next;
+    size_t finished;
+    unsigned long generation;
+    u8 stopping;
+
+    unsigned int nr_workers;
+    gateway_worker_t *workers;
+
+    /* The main thread's own lists, for deferred messages */
+    gateway_worker_t serial;
+
+} gateway_pool_t;
+
+
+/**
+ */
+static void gateway_string_reserve(gateway_string_t *s, size_t n)
+{
+    if (s->len + n + 1 <= s->size) {
+        return;
+    }
+
+    size_t size = (s->size ? s->size : 128);
+
+    while (s->len + n + 1 > size) {
+        size *= 2;
+    }
+
+    s->p = (char *) realloc(s->p, size);
+
+    if (s->p == NULL) {
+        muvuku_panic(panic_memory);
+    }
+
+    s->size = size;
+}
+
+
+/**
+ */
+static void gateway_string_append(gateway_string_t *s,
+                                  const char *data, size_t len)
+{
+    gateway_string_reserve(s, len);
+    memcpy(&s->p[s->len], data, len);
+
+    s->len += len;
+    s->p[s->len] = '\0';
+}
+
+
+/**
+ */
+static void gateway_string_append_c(gateway_string_t *s, char c)
+{
+    gateway_string_append(s, &c, 1);
+}
+
+
+/**
+ */
+static void gateway_string_append_number(gateway_string_t *s,
+                                         unsigned long n)
+{
+    char number[24];
+    int len = snprintf(number, sizeof(number), "%lu", n);
+
+    gateway_string_append(s, number, len);
+}
+
+
+/**
+ * Append `value` to `s` as one CSV field, quoted if necessary.
+ */
+static void gateway_csv_field(gateway_string_t *s, const char *value)
+{
+    if (strpbrk(value, ",\"\r\n") == NULL) {
+        gateway_string_append(s, value, strlen(value));
+        return;
+    }
+
+    gateway_string_append_c(s, '"');
+
+    for (const char *p = value; *p != '\0'; ++p) {
+        if (*p == '"') {
+            gateway_string_append_c(s, '"');
+        }
+        gateway_string_append_c(s, *p);
+    }
+
+    gateway_string_append_c(s, '"');
+}
+
+
+/**
+ * Append `value` to `s` as a quoted JSON string.
+ */
+static void gateway_json_string(gateway_string_t *s, const char *value)
+{
+    gateway_string_append_c(s, '"');
+
+    for (const unsigned char *p = (const unsigned char *) value;
+            *p != '\0'; ++p) {
+
+        if (*p == '"' || *p == '\\') {
+            gateway_string_append_c(s, '\\');
+            gateway_string_append_c(s, *p);
+        } else if (*p < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", *p);
+            gateway_string_append(s, escape, 6);
+        } else {
+            gateway_string_append_c(s, *p);
+        }
+    }
+
+    gateway_string_append_c(s, '"');
+}
+
+
+/**
+ */
+static const char *gateway_status_name(gateway_status_t status)
+{
+    switch (status) {
+        case GATEWAY_OK:
+            return "ok";
+        case GATEWAY_UNKNOWN_FORM:
+            return "unknown-form";
+        case GATEWAY_BAD_PDU:
+            return "bad-pdu";
+        default:
+        case GATEWAY_REJECTED:
+            return "rejected";
+    }
+}
+
+
+/**
+ * Add the result for `job` to its output buffer: the line number,
+ * form code, status, and (for PDUs) sender, then (if the record
+ * was decoded) one value for each field of `l`, named from the
+ * registry entry `f`.
+ */
+static void gateway_format_job(gateway_job_t *job, gateway_pool_t *pool,
+                               const gateway_form_t *f, schema_list_t *l)
+{
+    gateway_format_t format = pool->format;
+
+    /* Large enough for any `int`; see `schema_item_text` */
+    char number[16];
+    gateway_string_t *s = &job->output;
+
+    job->counts[job->status]++;
+
+    if (format == GATEWAY_FORMAT_JSON) {
+
+        gateway_string_append(s, "{\"line\":", 8);
+        gateway_string_append_number(s, job->number);
+
+        if (f != NULL) {
+            gateway_string_append(s, ",\"form\":", 8);
+            gateway_json_string(s, f->code);
+        }
+
+        gateway_string_append(s, ",\"status\":", 10);
+        gateway_json_string(s, gateway_status_name(job->status));
+
+        if (pool->pdu) {
+            gateway_string_append(s, ",\"from\":", 8);
+            gateway_json_string(s, job->from);
+        }
+
+        if (job->status == GATEWAY_OK) {
+
+            gateway_string_append(s, ",\"fields\":{", 11);
+
+            for (u8 n = 0; n < l->length; n++) {
+
+                schema_item_t *i = &l->list[n];
+                const char *value = schema_item_text(i, number);
+
+                if (n > 0) {
+                    gateway_string_append_c(s, ',');
+                }
+
+                gateway_json_string(s, f->names[n]);
+                gateway_string_append_c(s, ':');
+
+                if (value == NULL) {
+                    gateway_string_append(s, "null", 4);
+                } else if (value == number) {
+                    gateway_string_append(s, value, strlen(value));
+                } else {
+                    gateway_json_string(s, value);
+                }
+            }
+
+            gateway_string_append_c(s, '}');
+        }
+
+        gateway_string_append(s, "}\n", 2);
+
+    } else {
+
+        gateway_string_append_number(s, job->number);
+        gateway_string_append_c(s, ',');
+
+        if (f != NULL) {
+            gateway_csv_field(s, f->code);
+        }
+
+        gateway_string_append_c(s, ',');
+        gateway_csv_field(s, gateway_status_name(job->status));
+
+        if (pool->pdu) {
+            gateway_string_append_c(s, ',');
+            gateway_csv_field(s, job->from);
+        }
+
+        if (job->status == GATEWAY_OK) {
+            for (u8 n = 0; n < l->length; n++) {
+
+                const char *value = schema_item_text(&l->list[n], number);
+                gateway_string_append_c(s, ',');
+
+                if (value != NULL) {
+                    gateway_csv_field(s, value);
+                }
+            }
+        }
+
+        gateway_string_append_c(s, '\n');
+    }
+}
+
+
+/**
+ * Return the list for the `n`th form in the registry, `f`, from
+ * `lists`, creating it (with an arena) if necessary. The list is
+ * cleared, ready for the next record.
+ */
+static schema_list_t *gateway_worker_list(schema_list_t **lists,
+                                          unsigned int n,
+                                          const gateway_form_t *f)
+{
+    if (lists[n] == NULL) {
+        lists[n] = schema_list_new(f->form);
+        schema_list_enable_arena(lists[n], 0);
+    }
+
+    schema_list_clear_result(lists[n]);
+    return lists[n];
+}
+
+
+/**
+ * Return true if `a` and `b`, lists for the same form, hold the
+ * same values. Where each value is stored doesn't matter.
+ */
+static u8 gateway_lists_equal(schema_list_t *a, schema_list_t *b)
+{
+    char x[16], y[16];
+
+    if (a->valid_count != b->valid_count) {
+        return FALSE;
+    }
+
+    for (u8 n = 0; n < a->length; n++) {
+
+        schema_item_t *i = &a->list[n], *j = &b->list[n];
+
+        if ((i->validity & ~VL_IN_ARENA) != (j->validity & ~VL_IN_ARENA)) {
+            return FALSE;
+        }
+
+        const char *p = schema_item_text(i, x);
+        const char *q = schema_item_text(j, y);
+
+        if ((p == NULL) != (q == NULL) || (p && strcmp(p, q) != 0)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/**
+ * Add `sequence` to the numbers that `job` will acknowledge.
+ */
+static void gateway_job_ack(gateway_job_t *job, uint32_t sequence)
+{
+    if (job->nr_acks == job->acks_size) {
+
+        job->acks_size = (job->acks_size ? job->acks_size * 2 : 16);
+
+        job->acks = (uint32_t *) realloc(
+            job->acks, job->acks_size * sizeof(uint32_t)
+        );
+
+        if (job->acks == NULL) {
+            muvuku_panic(panic_memory);
+        }
+    }
+
+    job->acks[job->nr_acks++] = sequence;
+}
+
+
+/**
+ * Return the bucket in `bases` for records from `from` of the `form`th
+ * form in the registry. Every base for that pair is in the same one.
+ */
+static gateway_base_t **gateway_bases_bucket(gateway_bases_t *bases,
+                                             const char *from,
+                                             unsigned int form)
+{
+    unsigned long hash = 5381 + form;
+
+    while (*from != '\0') {
+        hash = (hash * 33) ^ (unsigned char) *from++;
+    }
+
+    return &bases->buckets[hash % GATEWAY_BASE_BUCKETS];
+}
+
+
+/**
+ * Find the base numbered `sequence` from `from` for the `form`th
+ * form in the registry, in `bases`. Returns null if there isn't one.
+ */
+static const gateway_base_t *gateway_bases_find(gateway_bases_t *bases,
+                                                const char *from,
+                                                unsigned int form,
+                                                uint32_t sequence)
+{
+    gateway_base_t *b = *gateway_bases_bucket(bases, from, form);
+
+    for (; b != NULL; b = b->next) {
+        if (b->form == form && b->sequence == sequence &&
+                strcmp(b->from, from) == 0) {
+            return b;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Keep the complete delta record `s` (of length `len`) from `from`,
+ * for the `form`th form in the registry, as a base in `bases`. Once
+ * the sender has `GATEWAY_BASES_PER_FORM` bases for the form, the
+ * oldest is replaced; so is one with the same sequence number.
+ */
+static void gateway_bases_add(gateway_bases_t *bases, const char *from,
+                              unsigned int form, const char *s, size_t len)
+{
+    unsigned int count = 0;
+    gateway_base_t *b, *oldest = NULL;
+    gateway_base_t **bucket = gateway_bases_bucket(bases, from, form);
+
+    char text[MAX_SMS_LENGTH + 1];
+    uint32_t sequence;
+
+    len = schema_delta_base(s, len, &sequence, text, sizeof(text));
+
+    if (len == 0) {
+        return;
+    }
+
+    for (b = *bucket; b != NULL; b = b->next) {
+
+        if (b->form != form || strcmp(b->from, from) != 0) {
+            continue;
+        }
+
+        if (b->sequence == sequence) {
+            oldest = b;
+            count = GATEWAY_BASES_PER_FORM;
+            break;
+        }
+
+        if (oldest == NULL || b->sequence < oldest->sequence) {
+            oldest = b;
+        }
+
+        count++;
+    }
+
+    if (count < GATEWAY_BASES_PER_FORM) {
+
+        b = (gateway_base_t *) xmalloc(sizeof(*b));
+
+        strcpy(b->from, from);
+        b->form = form;
+        b->next = *bucket;
+        *bucket = b;
+
+    } else {
+        b = oldest;
+    }
+
+    b->sequence = sequence;
+    b->len = len;
+    memcpy(b->text, text, len);
+}
+
+
+/**
+ */
+static void gateway_bases_free(gateway_bases_t *bases)
+{
+    for (unsigned int i = 0; i < GATEWAY_BASE_BUCKETS; ++i) {
+
+        gateway_base_t *b = bases->buckets[i];
+
+        while (b != NULL) {
+            gateway_base_t *next = b->next;
+            free(b);
+            b = next;
+        }
+    }
+
+    free(bases);
+}
+
+
+/**
+ * Decode the delta record `s`, of length `len`, from `from`, in to
+ * `l`, the list for the `form`th form in the registry. A partial
+ * record is rebuilt against its base from `bases`, and a complete
+ * one becomes a base itself. Returns true if the record was read.
+ */
+static u8 gateway_decode_delta(gateway_bases_t *bases, const char *from,
+                               unsigned int form, schema_list_t *l,
+                               const char *s, size_t len)
+{
+    uint32_t sequence, base_sequence;
+    const gateway_base_t *b = NULL;
+
+    if (!schema_delta_info(s, len, &sequence, &base_sequence)) {
+        return FALSE;
+    }
+
+    if (base_sequence != 0) {
+
+        b = gateway_bases_find(bases, from, form, base_sequence);
+
+        if (b == NULL) {
+            return FALSE; /* Base never arrived */
+        }
+    }
+
+    if (!schema_list_unserialize_delta(l, NULL, s, len,
+                                       (b ? b->text : NULL),
+                                       (b ? b->len : 0))) {
+        return FALSE;
+    }
+
+    if (base_sequence == 0) {
+        gateway_bases_add(bases, from, form, s, len);
+    }
+
+    return TRUE;
+}
+
+
+/* Record context:
+    Passed to `gateway_decode_record` for each record in a job. */
+
+typedef struct gateway_record_context {
+
+    gateway_worker_t *worker;
+    gateway_job_t *job;
+
+} gateway_record_context_t;
+
+
+/**
+ * Decode the record `s`, of length `len`, from the job in `ptr`,
+ * using the lists that belong to its worker, and format the result.
+ * This is a `schema_record_fn_t`, called once per batched record.
+ */
+static u8 gateway_decode_record(const char *s, size_t len, void *ptr)
+{
+    int version;
+    const char *code;
+    schema_list_t *l = NULL;
+    const gateway_form_t *f = NULL;
+
+    gateway_record_context_t *c = (gateway_record_context_t *) ptr;
+    gateway_worker_t *w = c->worker;
+    gateway_job_t *job = c->job;
+    gateway_pool_t *pool = w->pool;
+
+    /* Sequenced records: the record follows the header */
+    uint32_t sequence;
+    size_t header_len = schema_sequence_read(s, len, &sequence);
+
+    s += header_len;
+    len -= header_len;
+
+    size_t code_len = gateway_record_code(s, len, &code, &version);
+
+    if (code_len > 0) {
+        f = gateway_registry_find(code, code_len);
+    }
+
+    if (f == NULL) {
+        job->status = GATEWAY_UNKNOWN_FORM;
+        goto exit;
+    }
+
+    unsigned int n = (unsigned int) (f - gateway_forms);
+
+    /* No heap allocations:
+        Values are carved from the list's arena, and the form
+        identifier isn't needed, since the registry has it. */
+
+    u8 accepted, is_text = (
+        version != SMS_COMPACT_API_VERSION && version != SMS_DELTA_API_VERSION
+    );
+
+    /* Delta records:
+        These need the bases, which only the main thread has; the
+        whole message is put aside for it, and decoded again there. */
+
+    if (version == SMS_DELTA_API_VERSION && w->bases == NULL) {
+        job->deferred = TRUE;
+        return FALSE;
+    }
+
+    l = gateway_worker_list(w->lists, n, f);
+
+    if (version == SMS_DELTA_API_VERSION) {
+        accepted = gateway_decode_delta(w->bases, job->from, n, l, s, len);
+    } else if (is_text && !pool->generic) {
+        accepted = f->decode(l, s, len);
+    } else {
+        accepted = schema_list_unserialize(l, NULL, s, len, FL_NONE);
+    }
+
+    job->status = (accepted ? GATEWAY_OK : GATEWAY_REJECTED);
+
+    if (accepted && header_len > 0 && pool->ack) {
+        gateway_job_ack(job, sequence);
+    }
+
+    /* Check against the generic parser */
+    if (is_text && !pool->generic && pool->check) {
+
+        schema_list_t *g = gateway_worker_list(w->check_lists, n, f);
+
+        u8 expected = schema_list_unserialize(g, NULL, s, len, FL_NONE);
+
+        if (accepted != expected || (accepted && !gateway_lists_equal(l, g))) {
+            job->mismatch = TRUE;
+        }
+    }
+
+    exit:
+        gateway_format_job(job, pool, f, l);
+        return TRUE;
+}
+
+
+/**
+ * Decode the message held by `job` -- a single record, or a batch
+ * of them -- using the lists that belong to the worker `w`, and
+ * format one result per record.
+ */
+static void gateway_decode_job(gateway_worker_t *w, gateway_job_t *job)
+{
+    gateway_record_context_t c = { w, job };
+    gateway_pool_t *pool = w->pool;
+
+    const char *s = job->line.p;
+    size_t len = job->line.len;
+
+    u8 pdu[GATEWAY_PDU_MAX];
+    char text[GATEWAY_PDU_TEXT_MAX];
+
+    job->mismatch = FALSE;
+    job->deferred = FALSE;
+    job->from[0] = '\0';
+    job->output.len = 0;
+    job->nr_acks = 0;
+
+    memset(job->counts, 0, sizeof(job->counts));
+
+    /* SMS-DELIVER messages:
+        Unpacked straight from the PDU to the stack; the decoders
+        below then read the text from there, as for any other line. */
+
+    if (pool->pdu) {
+
+        gateway_pdu_t p;
+        size_t n = gateway_hex_decode(s, len, pdu, sizeof(pdu));
+
+        if (n == 0 || !gateway_pdu_parse(&p, pdu, n)) {
+            job->status = GATEWAY_BAD_PDU;
+            gateway_format_job(job, pool, NULL, NULL);
+            return;
+        }
+
+        memcpy(job->from, p.from, sizeof(job->from));
+
+        len = gateway_pdu_text(&p, text);
+        s = text;
+    }
+
+    /* Batched records:
+        Each is decoded separately; anything else is passed straight
+        through. A batch header with nothing after it is rejected. */
+
+    u8 split = schema_batch_split(s, len, &gateway_decode_record, &c);
+
+    /* Deferred: anything done so far is done again */
+    if (job->deferred) {
+        job->mismatch = FALSE;
+        job->output.len = 0;
+        job->nr_acks = 0;
+        memset(job->counts, 0, sizeof(job->counts));
+        return;
+    }
+
+    if (!split) {
+        job->status = GATEWAY_REJECTED;
+        gateway_format_job(job, pool, NULL, NULL);
+    }
+}
+
+
+/**
+ */
+static void *gateway_worker_main(void *arg)
+{
+    gateway_worker_t *w = (gateway_worker_t *) arg;
+    gateway_pool_t *pool = w->pool;
+    unsigned long generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;) {
+
+        while (pool->generation == generation && !pool->stopping) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+
+        if (pool->stopping) {
+            break;
+        }
+
+        generation = pool->generation;
+        gateway_batch_t *batch = pool->batch;
+
+        while (pool->next < batch->count) {
+
+            size_t first = pool->next;
+            size_t last = first + GATEWAY_CLAIM_SIZE;
+
+            if (last > batch->count) {
+                last = batch->count;
+            }
+
+            pool->next = last;
+            pthread_mutex_unlock(&pool->lock);
+
+            for (size_t i = first; i < last; ++i) {
+                gateway_decode_job(w, &batch->jobs[i]);
+            }
+
+            pthread_mutex_lock(&pool->lock);
+            pool->finished += (last - first);
+
+            if (pool->finished == batch->count) {
+                pthread_cond_signal(&pool->done);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+
+/**
+ * Prepare the worker `w`, belonging to `pool`, with room for a list
+ * for each of the `nr_forms` forms in the registry.
+ */
+static void gateway_worker_init(gateway_worker_t *w, gateway_pool_t *pool,
+                                unsigned int nr_forms)
+{
+    w->pool = pool;
+    w->bases = NULL;
+
+    w->lists = (schema_list_t **) calloc(
+        nr_forms + 1, sizeof(schema_list_t *)
+    );
+
+    w->check_lists = (schema_list_t **) calloc(
+        nr_forms + 1, sizeof(schema_list_t *)
+    );
+
+    if (w->lists == NULL || w->check_lists == NULL) {
+        muvuku_panic(panic_memory);
+    }
+}
+
+
+/**
+ * Release everything `w` holds, but not `w` itself.
+ */
+static void gateway_worker_free(gateway_worker_t *w, unsigned int nr_forms)
+{
+    for (unsigned int n = 0; n < nr_forms; ++n) {
+        if (w->lists[n] != NULL) {
+            schema_list_delete(w->lists[n]);
+        }
+        if (w->check_lists[n] != NULL) {
+            schema_list_delete(w->check_lists[n]);
+        }
+    }
+
+    free(w->lists);
+    free(w->check_lists);
+
+    if (w->bases != NULL) {
+        gateway_bases_free(w->bases);
+    }
+}
+
+
+/**
+ */
+static u8 gateway_pool_init(gateway_pool_t *pool, unsigned int nr_workers,
+                            gateway_format_t format,
+                            u8 generic, u8 check, u8 pdu, u8 ack)
+{
+    unsigned int nr_forms = gateway_registry_count();
+
+    memset(pool, 0, sizeof(*pool));
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->format = format;
+    pool->generic = generic;
+    pool->check = check;
+    pool->pdu = pdu;
+    pool->ack = ack;
+    pool->nr_workers = nr_workers;
+
+    pool->workers = (gateway_worker_t *) xmalloc(
+        nr_workers * sizeof(gateway_worker_t)
+    );
+
+    /* Main thread: decodes deferred messages, so it has the bases */
+    gateway_worker_init(&pool->serial, pool, nr_forms);
+
+    pool->serial.bases =
+        (gateway_bases_t *) calloc(1, sizeof(gateway_bases_t));
+
+    if (pool->serial.bases == NULL) {
+        muvuku_panic(panic_memory);
+    }
+
+    for (unsigned int i = 0; i < nr_workers; ++i) {
+
+        gateway_worker_t *w = &pool->workers[i];
+        gateway_worker_init(w, pool, nr_forms);
+
+        if (pthread_create(&w->thread, NULL, gateway_worker_main, w) != 0) {
+            pool->nr_workers = i;
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/**
+ * Hand the records in `batch` to the workers in `pool`.
+ */
+static void gateway_pool_dispatch(gateway_pool_t *pool,
+                                  gateway_batch_t *batch)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    pool->batch = batch;
+    pool->next = 0;
+    pool->finished = 0;
+    pool->generation++;
+
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ * Wait for the workers in `pool` to finish the current batch.
+ */
+static void gateway_pool_wait(gateway_pool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->finished < pool->batch->count) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ */
+static void gateway_pool_destroy(gateway_pool_t *pool)
+{
+    unsigned int nr_forms = gateway_registry_count();
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = TRUE;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned int i = 0; i < pool->nr_workers; ++i) {
+
+        gateway_worker_t *w = &pool->workers[i];
+
+        pthread_join(w->thread, NULL);
+        gateway_worker_free(w, nr_forms);
+    }
+
+    gateway_worker_free(&pool->serial, nr_forms);
+    free(pool->workers);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+
+/* Input files:
+    Named on the command line, and read one after another;
+    standard input is used if none are named, or for `-'. When
+    listening on a Unix socket (see `-l'), each connection is read
+    as an input file instead, up to `count' of them if nonzero. */
+
+typedef struct gateway_input {
+
+    char **paths;
+    int count;
+    int index;
+    FILE *file;
+
+    int listener;
+
+    /* Message delimiter: newline, or NUL (see `-0') */
+    int delimiter;
+
+} gateway_input_t;
+
+
+/**
+ * Listen on the Unix socket at `path`, replacing anything
+ * already there. Returns the listening socket, or -1.
+ */
+static int gateway_socket_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    unlink(addr.sun_path);
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+            listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/**
+ * Read the next line from `in` in to `s`, without its line ending.
+ * Returns false at the end of the last input file, or on error.
+ */
+static u8 gateway_input_read(gateway_input_t *in, gateway_string_t *s)
+{
+    ssize_t len;
+
+    for (;;) {
+
+        if (in->file == NULL && in->listener >= 0) {
+
+            if (in->count > 0 && in->index >= in->count) {
+                return FALSE;
+            }
+
+            int fd = accept(in->listener, NULL, NULL);
+
+            if (fd < 0 || (in->file = fdopen(fd, "r")) == NULL) {
+                fprintf(stderr, "muvuku-decode: unable to accept\n");
+
+                /* Stop listening */
+                in->count = ++in->index;
+
+                if (fd >= 0) {
+                    close(fd);
+                }
+
+                return FALSE;
+            }
+
+            in->index++;
+        }
+
+        if (in->file == NULL) {
+
+            if (in->index >= in->count) {
+                return FALSE;
+            }
+
+            const char *path = in->paths[in->index++];
+
+            if (strcmp(path, "-") == 0) {
+                in->file = stdin;
+            } else if ((in->file = fopen(path, "r")) == NULL) {
+                fprintf(stderr, "muvuku-decode: unable to open `%s'\n", path);
+                return FALSE;
+            }
+        }
+
+        if ((len = getdelim(&s->p, &s->size, in->delimiter, in->file)) >= 0) {
+            break;
+        }
+
+        /* End of file: move on to the next one */
+        if (in->file != stdin) {
+            fclose(in->file);
+        }
+
+        in->file = NULL;
+
+        /* End of connection: the sender may be a while */
+        if (in->listener >= 0) {
+            s->len = 0;
+            return FALSE;
+        }
+    }
+
+    if (in->delimiter != '\n') {
+        len -= (len > 0 && s->p[len - 1] == in->delimiter);
+    } else {
+        while (len > 0 && (s->p[len - 1] == '\n' || s->p[len - 1] == '\r')) {
+            len--;
+        }
+    }
+
+    s->p[len] = '\0';
+    s->len = (size_t) len;
+
+    return TRUE;
+}
+
+
+/**
+ * Fill `batch` with lines from `in`, numbering them from `*number`.
+ * Returns the number of lines read.
+ */
+static size_t gateway_batch_read(gateway_batch_t *batch,
+                                 gateway_input_t *in, unsigned long *number)
+{
+    batch->count = 0;
+
+    while (batch->count < GATEWAY_BATCH_SIZE) {
+
+        gateway_job_t *job = &batch->jobs[batch->count];
+
+        if (!gateway_input_read(in, &job->line)) {
+
+            /* Listening: hand over what the last connection sent,
+                or (if it sent nothing) wait for the next one */
+
+            if (in->listener >= 0 && batch->count == 0 &&
+                    (in->count == 0 || in->index < in->count)) {
+                continue;
+            }
+
+            break;
+        }
+
+        job->number = ++(*number);
+        batch->count++;
+    }
+
+    return batch->count;
+}
+
+
+/* Acknowledgements:
+    Written to a file (see `-a'), one message per line, in the
+    form the gateway would send back to the SIM; with `-p', each
+    is preceded by the number it's for, and a comma. Numbers from
+    consecutive messages by the same sender share a message. */
+
+typedef struct gateway_acks {
+
+    FILE *out;
+    u8 pdu;
+    schema_ack_t ack;
+    char to[GATEWAY_ADDRESS_MAX];
+    unsigned long count;
+
+} gateway_acks_t;
+
+
+/**
+ * Write out the acknowledgement being built in `a`, if it lists
+ * anything, and start a new one.
+ */
+static void gateway_acks_flush(gateway_acks_t *a)
+{
+    if (a->ack.count > 0) {
+
+        if (a->pdu) {
+            fprintf(a->out, "%s,", a->to);
+        }
+
+        fprintf(a->out, "%s\n", schema_ack_message(&a->ack));
+        a->count++;
+    }
+
+    schema_ack_init(&a->ack);
+}
+
+
+/**
+ * Acknowledge every record that `job` decoded, in `a`.
+ */
+static void gateway_acks_add(gateway_acks_t *a, gateway_job_t *job)
+{
+    if (job->nr_acks == 0) {
+        return;
+    }
+
+    if (a->pdu && strcmp(a->to, job->from) != 0) {
+        gateway_acks_flush(a);
+        memcpy(a->to, job->from, sizeof(a->to));
+    }
+
+    for (size_t i = 0; i < job->nr_acks; ++i) {
+        if (!schema_ack_add(&a->ack, job->acks[i])) {
+            gateway_acks_flush(a);
+            schema_ack_add(&a->ack, job->acks[i]);
+        }
+    }
+}
+
+
+/**
+ * Write the results in `batch`, in order, to `out`, and add
+ * each record's status to `counts`. Messages the workers left for
+ * the main thread are decoded here first, using `pool`. Records that
+ * the generated decoder got wrong are reported, and counted in
+ * `*mismatches`. If `acks` is non-null, decoded records are
+ * acknowledged there; nothing is held back once the batch is written.
+ */
+static void gateway_batch_write(gateway_batch_t *batch, gateway_pool_t *pool,
+                                FILE *out, gateway_acks_t *acks,
+                                unsigned long *counts,
+                                unsigned long *mismatches)
+{
+    for (size_t i = 0; i < batch->count; ++i) {
+
+        gateway_job_t *job = &batch->jobs[i];
+
+        if (job->deferred) {
+            gateway_decode_job(&pool->serial, job);
+        }
+
+        fwrite(job->output.p, 1, job->output.len, out);
+
+        if (acks != NULL) {
+            gateway_acks_add(acks, job);
+        }
+
+        for (int n = 0; n < GATEWAY_STATUS_COUNT; ++n) {
+            counts[n] += job->counts[n];
+        }
+
+        if (job->mismatch) {
+            fprintf(stderr,
+                "muvuku-decode: line %lu: generated decoder disagrees "
+                    "with schema_list_unserialize\n", job->number
+            );
+            (*mismatches)++;
+        }
+    }
+
+    if (acks != NULL) {
+        gateway_acks_flush(acks);
+        fflush(acks->out);
+    }
+}
+
+
+/**
+ */
+static void gateway_batch_free(gateway_batch_t *batch)
+{
+    for (size_t i = 0; i < GATEWAY_BATCH_SIZE; ++i) {
+        free(batch->jobs[i].line.p);
+        free(batch->jobs[i].output.p);
+        free(batch->jobs[i].acks);
+    }
+}
+
+
+/**
+ */
+static void usage(void)
+{
+    fprintf(stderr,
+        "Usage: muvuku-decode [-0gcp] [-j threads] [-f csv|json] [-a file]\n"
+        "                     [-l socket [-n connections] | file...]\n"
+        "Decode newline-delimited Muvuku records, in parallel.\n"
+        "  -0  Messages end with NUL, not newline; batched records are\n"
+        "      separated by newlines, as sent by the host transports\n"
+        "  -l  Listen on a Unix socket, and read each connection in turn\n"
+        "  -n  Exit after this many connections; see `-l'\n"
+        "  -p  Read SMS-DELIVER PDUs in hexadecimal, one per line, and\n"
+        "      add each sender to the output, after the status\n"
+        "  -g  Use the generic parser, not the generated decoders\n"
+        "  -c  Check the generated decoders against the generic parser\n"
+        "  -a  Write acknowledgements for decoded sequenced records to a\n"
+        "      file, one message per line, after the sender with `-p'\n"
+    );
+}
+
+
+/**
+ */
+int main(int argc, char *argv[])
+{
+    int c, rv = 1;
+    u8 generic = FALSE, check = FALSE, pdu = FALSE;
+    long nr_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    gateway_format_t format = GATEWAY_FORMAT_CSV;
+
+    char *stdin_paths[] = { "-" };
+    unsigned long counts[GATEWAY_STATUS_COUNT] = { 0, 0, 0, 0 };
+    unsigned long number = 0, mismatches = 0;
+
+    gateway_pool_t pool;
+    gateway_input_t in = { NULL, 0, 0, NULL, -1, '\n' };
+    const char *socket_path = NULL;
+    int connections = 0;
+    const char *ack_path = NULL;
+    gateway_acks_t acks, *ack_writer = NULL;
+    gateway_batch_t *batches = NULL;
+    struct timespec start, end;
+
+    while ((c = getopt(argc, argv, "0gcpj:f:l:n:a:h")) != -1) {
+        switch (c) {
+            case '0':
+                in.delimiter = '\0';
+                break;
+            case 'g':
+                generic = TRUE;
+                break;
+            case 'c':
+                check = TRUE;
+                break;
+            case 'p':
+                pdu = TRUE;
+                break;
+            case 'j':
+                nr_workers = atol(optarg);
+                break;
+            case 'l':
+                socket_path = optarg;
+                break;
+            case 'n':
+                connections = atoi(optarg);
+                break;
+            case 'a':
+                ack_path = optarg;
+                break;
+            case 'f':
+                if (strcmp(optarg, "json") == 0) {
+                    format = GATEWAY_FORMAT_JSON;
+                } else if (strcmp(optarg, "csv") == 0) {
+                    format = GATEWAY_FORMAT_CSV;
+                } else {
+                    usage();
+                    return 1;
+                }
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (nr_workers < 1) {
+        nr_workers = 1;
+    }
+
+    if (socket_path != NULL) {
+        if ((in.listener = gateway_socket_listen(socket_path)) < 0) {
+            fprintf(stderr,
+                "muvuku-decode: unable to listen on `%s'\n", socket_path);
+            return 1;
+        }
+        in.count = connections;
+    } else if (optind < argc) {
+        in.paths = &argv[optind];
+        in.count = argc - optind;
+    } else {
+        in.paths = stdin_paths;
+        in.count = 1;
+    }
+
+    if (ack_path != NULL) {
+
+        memset(&acks, 0, sizeof(acks));
+
+        if ((acks.out = fopen(ack_path, "w")) == NULL) {
+            fprintf(stderr, "muvuku-decode: unable to open `%s'\n", ack_path);
+            return 1;
+        }
+
+        acks.pdu = pdu;
+        schema_ack_init(&acks.ack);
+        ack_writer = &acks;
+    }
+
+    if (!gateway_registry_init()) {
+        fprintf(stderr, "muvuku-decode: duplicate form code in registry\n");
+        return 1;
+    }
+
+    batches = (gateway_batch_t *) calloc(2, sizeof(gateway_batch_t));
+
+    if (batches == NULL) {
+        muvuku_panic(panic_memory);
+    }
+
+    if (!gateway_pool_init(&pool, (unsigned int) nr_workers,
+                           format, generic, check, pdu,
+                           (ack_writer != NULL))) {
+        fprintf(stderr, "muvuku-decode: unable to start worker threads\n");
+        gateway_pool_destroy(&pool);
+        goto exit;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* Pipeline:
+        Decode batch `n`, while writing batch `n - 1` and
+        reading batch `n + 1` in to the same buffer. */
+
+    unsigned int n = 0;
+    u8 pending = FALSE;
+
+    gateway_batch_read(&batches[n], &in, &number);
+
+    while (batches[n].count > 0) {
+
+        gateway_pool_dispatch(&pool, &batches[n]);
+
+        if (pending) {
+            gateway_batch_write(&batches[n ^ 1], &pool, stdout, ack_writer,
+                                counts, &mismatches);
+            pending = FALSE;
+        }
+
+        if (in.listener >= 0) {
+
+            /* Listening:
+                The next batch may be a long time coming, so
+                this one is written out before waiting for it. */
+
+            gateway_pool_wait(&pool);
+            gateway_batch_write(&batches[n], &pool, stdout, ack_writer,
+                                counts, &mismatches);
+            fflush(stdout);
+
+            gateway_batch_read(&batches[n ^ 1], &in, &number);
+
+        } else {
+
+            gateway_batch_read(&batches[n ^ 1], &in, &number);
+            gateway_pool_wait(&pool);
+
+            pending = TRUE;
+        }
+
+        n ^= 1;
+    }
+
+    if (pending) {
+        gateway_batch_write(&batches[n ^ 1], &pool, stdout, ack_writer,
+                            counts, &mismatches);
+    }
+
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9
+    );
+
+    unsigned long records = 0;
+
+    for (int i = 0; i < GATEWAY_STATUS_COUNT; ++i) {
+        records += counts[i];
+    }
+
+    fprintf(stderr,
+        "muvuku-decode: %lu records (%lu rejected, %lu unknown form) "
+            "in %.3f s, %.0f records/s, %ld threads\n",
+        records, counts[GATEWAY_REJECTED], counts[GATEWAY_UNKNOWN_FORM],
+        elapsed, (elapsed > 0 ? records / elapsed : 0.0), nr_workers
+    );
+
+    if (pdu) {
+        fprintf(stderr,
+            "muvuku-decode: %lu lines were not SMS-DELIVER PDUs\n",
+            counts[GATEWAY_BAD_PDU]
+        );
+    }
+
+    if (check && !generic) {
+        fprintf(stderr,
+            "muvuku-decode: %lu records disagree with the generic parser\n",
+            mismatches
+        );
+    }
+
+    if (ack_writer != NULL) {
+        fprintf(stderr,
+            "muvuku-decode: %lu acknowledgements written\n", acks.count
+        );
+    }
+
+    rv = (mismatches > 0 ? 1 : 0);
+    gateway_pool_destroy(&pool);
+
+    exit:
+        if (ack_writer != NULL) {
+            fclose(acks.out);
+        }
+
+        if (in.listener >= 0) {
+            close(in.listener);
+            unlink(socket_path);
+        }
+
+        gateway_batch_free(&batches[0]);
+        gateway_batch_free(&batches[1]);
+        free(batches);
+
+        return rv;
+}
+
@@ -0,0 +1,111 @@
+/**
+ * Muvuku: An STK data collection framework
+ *
+ * Copyright 2011-2012 Medic Mobile, Inc. <hello@medicmobile.org>
+ * All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MEDIC MOBILE BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MUVUKU_GATEWAY_H__
+#define __MUVUKU_GATEWAY_H__
+
+#include "schema.h"
+
+
+/* Generated decoder:
+    Decodes the text record (e.g. 1!PSMS!...) at `s`, which is `len`
+    bytes long, in to `l`, a list for the decoder's form; `l` must be
+    cleared first. Returns true if the record was accepted. A form's
+    decoder gives the same result as `schema_list_unserialize` does
+    for the same record, but with the form's fields written out in
+    order, instead of being looked up in its field table. */
+
+typedef u8 (*gateway_decoder_t)(schema_list_t *l, const char *s, size_t len);
+
+
+/* Form registry:
+    One entry for each form compiled in to the SIM application, as
+    generated from the same JSON by `scripts/muvuku.compile.js`. Each
+    entry has the code sent in each record's header (e.g. PSMS), the
+    form's field table, a name for each field, in schema order, and
+    a decoder generated for the form. */
+
+typedef struct gateway_form {
+
+    const char *code;
+    const schema_form_t *form;
+    const char *const *names;
+    gateway_decoder_t decode;
+
+} gateway_form_t;
+
+
+/* Generated in `output/gateway/forms.c` */
+extern const gateway_form_t gateway_forms[];
+
+
+/* Longest possible form code; see `validate_form_code` */
+#define GATEWAY_CODE_LENGTH_MAX (9)
+
+
+/* SMS-DELIVER messages:
+    As reported by the modems that receive records, one hexadecimal
+    PDU per line; see `gateway/pdu.c`. A parsed message refers to its
+    user data in the original PDU, and is unpacked to text on demand,
+    in to a buffer that the caller provides. */
+
+/* Longest sender address kept, including the terminator */
+#define GATEWAY_ADDRESS_MAX (24)
+
+/* Longest possible PDU, and user data, in bytes and septets */
+#define GATEWAY_PDU_MAX (176)
+#define GATEWAY_PDU_LENGTH_MAX (160)
+
+/* Longest possible text; see `gateway_pdu_text` */
+#define GATEWAY_PDU_TEXT_MAX (2 * GATEWAY_PDU_LENGTH_MAX)
+
+/* Coding scheme alphabets, as numbered by GSM 03.38 */
+#define GATEWAY_ALPHABET_GSM (0)
+#define GATEWAY_ALPHABET_8BIT (1)
+
+typedef struct gateway_pdu {
+
+    char from[GATEWAY_ADDRESS_MAX];
+    u8 alphabet;
+
+    /* User data: septets (or octets), and the header to skip */
+    const u8 *data;
+    size_t length;
+    size_t skip;
+
+} gateway_pdu_t;
+
+
+u8 gateway_registry_init(void);
+
+unsigned int gateway_registry_count(void);
+
+const gateway_form_t *gateway_registry_find(const char *code, size_t len);
+
+size_t gateway_hex_decode(const char *s, size_t len, u8 *dst, size_t size);
+
+u8 gateway_pdu_parse(gateway_pdu_t *p, const u8 *pdu, size_t len);
+
+size_t gateway_pdu_text(const gateway_pdu_t *p, char *s);
+
+size_t gateway_record_code(const char *s, size_t len,
+                           const char **code, int *version);
+
+
+#endif /* __MUVUKU_GATEWAY_H__ */
+
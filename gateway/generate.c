@@ -0,0 +1,659 @@
+/**
+ * Muvuku: An STK data collection framework
+ *
+ * Copyright 2011-2012 Medic Mobile, Inc. <hello@medicmobile.org>
+ * All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MEDIC MOBILE BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "muvuku.h"
+#include "gateway.h"
+
+
+/* Traffic generator:
+    Writes newline-delimited records for the forms in the registry,
+    as handsets would send them: each record is filled with random
+    answers that fit the form's field table, with questions skipped
+    by the form's skip rules left empty, and is then serialized by
+    `schema_list_serialize_to` itself. Optionally, some records are
+    damaged afterwards, to exercise the rejection paths. The output
+    goes to a file, standard output, or a Unix socket, and can be
+    paced to a fixed number of records per second. */
+
+
+/* Characters with special meaning on the wire */
+static const char gateway_special[] = "#\\!-";
+
+
+/* Ordinary characters for string answers */
+static const char gateway_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789 .,";
+
+
+typedef struct gateway_generator {
+
+    /* Random number state; never zero */
+    uint64_t state;
+
+    /* Chance of each string character being a special character */
+    double escapes;
+
+    /* Chance of a record being damaged after it's serialized */
+    double malformed;
+
+    /* Chance of a record being sent compact, if it can be */
+    double compact;
+
+    /* One list per form, and each form's share of the traffic */
+    schema_list_t **lists;
+    unsigned int *weights;
+    unsigned int total_weight;
+
+} gateway_generator_t;
+
+
+/**
+ * Return the next number from `g`'s xorshift64* generator.
+ */
+static uint64_t gateway_random(gateway_generator_t *g)
+{
+    g->state ^= g->state >> 12;
+    g->state ^= g->state << 25;
+    g->state ^= g->state >> 27;
+
+    return g->state * 2685821657736338717ULL;
+}
+
+
+/**
+ * Return a random number from zero to `n - 1`.
+ */
+static unsigned int gateway_random_below(gateway_generator_t *g,
+                                         unsigned int n)
+{
+    return (n > 0 ? (unsigned int) ((gateway_random(g) >> 32) % n) : 0);
+}
+
+
+/**
+ * Return true with probability `p`.
+ */
+static u8 gateway_random_chance(gateway_generator_t *g, double p)
+{
+    return ((gateway_random(g) >> 11) * (1.0 / 9007199254740992.0) < p);
+}
+
+
+/**
+ * Return a random length from `min` to `max`, but no more than
+ * `limit`, and no less than `floor`.
+ */
+static unsigned int gateway_random_length(gateway_generator_t *g,
+                                          unsigned int min, unsigned int max,
+                                          unsigned int floor,
+                                          unsigned int limit)
+{
+    if (max > limit) {
+        max = limit;
+    }
+
+    if (max < floor) {
+        max = floor;
+    }
+
+    if (min < floor) {
+        min = floor;
+    }
+
+    if (min > max) {
+        min = max;
+    }
+
+    return min + gateway_random_below(g, max - min + 1);
+}
+
+
+/**
+ * Write `n` random decimal digits to `s`, without a leading zero.
+ */
+static void gateway_random_digits(gateway_generator_t *g,
+                                  char *s, unsigned int n)
+{
+    for (unsigned int k = 0; k < n; ++k) {
+        s[k] = (char) (
+            (k == 0 && n > 1 ? '1' : '0') +
+                gateway_random_below(g, (k == 0 && n > 1 ? 9 : 10))
+        );
+    }
+}
+
+
+/**
+ * Answer the question `i` of the list `l` at random, within the
+ * limits set by its field table entry.
+ */
+static void gateway_answer_item(gateway_generator_t *g,
+                                schema_list_t *l, schema_item_t *i)
+{
+    char s[MAX_SMS_FIELD_LENGTH + 1];
+    unsigned int n;
+
+    unsigned int min = schema_field(i, min_length);
+    unsigned int max = schema_field(i, max_length);
+
+    switch (schema_field(i, data_type)) {
+
+        case TS_SELECT:
+            schema_item_set_select(
+                i, 1 + gateway_random_below(g, schema_field(i, select_length)),
+                    PR_NORMAL
+            );
+            break;
+
+        case TS_BOOLEAN:
+            schema_item_set_boolean(
+                i, gateway_random_below(g, 2), PR_NORMAL
+            );
+            break;
+
+        case TS_INTEGER:
+
+            /* Larger numbers won't fit in an `int` */
+            n = gateway_random_length(g, min, max, 1, 9);
+            gateway_random_digits(g, s, n);
+            s[n] = '\0';
+
+            schema_item_set(i, s, n + 1);
+            break;
+
+        case TS_PHONE:
+
+            n = gateway_random_length(g, min, max, 2, 16);
+            s[0] = '+';
+            gateway_random_digits(g, &s[1], n - 1);
+            s[n] = '\0';
+
+            schema_item_set(i, s, n + 1);
+            break;
+
+        case TS_NUMERIC:
+
+            n = gateway_random_length(g, min, max, 1, 12);
+            gateway_random_digits(g, s, n);
+
+            if (n >= 3) {
+                s[n - 2] = '.';
+            }
+
+            s[n] = '\0';
+            schema_item_set(i, s, n + 1);
+            break;
+
+        default:
+        case TS_STRING:
+
+            /* Longer values are rejected by the gateway */
+            n = gateway_random_length(g, min, max, 0, MAX_SMS_FIELD_LENGTH);
+
+            for (unsigned int k = 0; k < n; ++k) {
+                if (gateway_random_chance(g, g->escapes)) {
+                    s[k] = gateway_special[
+                        gateway_random_below(g, sizeof(gateway_special) - 1)
+                    ];
+                } else {
+                    s[k] = gateway_alphabet[
+                        gateway_random_below(g, sizeof(gateway_alphabet) - 1)
+                    ];
+                }
+            }
+
+            s[n] = '\0';
+            schema_item_set(i, s, n + 1);
+            break;
+    }
+
+    schema_item_validate(l, i);
+}
+
+
+/**
+ * Fill `l` with a random set of answers, in order, as a handset user
+ * would: questions that the form's skip rules skip are left empty.
+ */
+static void gateway_answer_list(gateway_generator_t *g, schema_list_t *l)
+{
+    schema_list_clear_result(l);
+
+    for (u8 n = 0; n < l->length; n++) {
+
+        schema_item_t *i = &l->list[n];
+
+        #ifndef _SCHEMA_DISABLE_CONDITION
+          if (!schema_item_condition(l, i)) {
+              continue;
+          }
+        #endif /* _SCHEMA_DISABLE_CONDITION */
+
+        gateway_answer_item(g, l, i);
+    }
+}
+
+
+/**
+ * Damage the `*len`-byte record in `s`, which has room for `size`
+ * bytes, in one of the ways that a real record might be damaged.
+ * Most of the results will be rejected by `schema_list_unserialize`;
+ * some (e.g. a record cut off just after a delimiter) won't be.
+ */
+static void gateway_damage_record(gateway_generator_t *g,
+                                  char *s, size_t *len, size_t size)
+{
+    size_t n = *len;
+    size_t k = gateway_random_below(g, (unsigned int) n);
+
+    switch (gateway_random_below(g, 6)) {
+
+        case 0:
+            /* Cut off part way through */
+            n = k;
+            break;
+
+        case 1:
+            /* One character changed to a special character */
+            s[k] = gateway_special[
+                gateway_random_below(g, sizeof(gateway_special) - 1)
+            ];
+            break;
+
+        case 2:
+            /* More fields than the form has */
+            if (n + 2 <= size) {
+                s[n++] = SMS_DELIMITER;
+                s[n++] = 'x';
+            }
+            break;
+
+        case 3:
+            /* Unknown version number or form code */
+            s[0] = (gateway_random_below(g, 2) ? 'x' : SMS_MAGIC_DELIMITER);
+            break;
+
+        case 4:
+            /* Escape at the very end */
+            if (n + 1 <= size) {
+                s[n++] = SMS_ESCAPE;
+            }
+            break;
+
+        default:
+        case 5:
+            /* A field longer than the parser will take */
+            if (n + MAX_SMS_FIELD_LENGTH + 1 <= size) {
+                memmove(
+                    &s[k + MAX_SMS_FIELD_LENGTH + 1], &s[k], n - k
+                );
+                memset(&s[k], 'a', MAX_SMS_FIELD_LENGTH + 1);
+                n += MAX_SMS_FIELD_LENGTH + 1;
+            }
+            break;
+    }
+
+    *len = n;
+}
+
+
+/**
+ * Generate one record in to the `size`-byte buffer `s`, choosing
+ * its form according to the weights in `g`. Returns the record's
+ * length, and sets `*damaged` if it was damaged on purpose.
+ */
+static size_t gateway_generate_record(gateway_generator_t *g,
+                                      char *s, size_t size, u8 *damaged)
+{
+    schema_buffer_t b;
+    schema_list_t *l = NULL;
+    size_t len = 0;
+
+    unsigned int w = gateway_random_below(g, g->total_weight);
+
+    for (unsigned int n = 0; gateway_forms[n].code != NULL; ++n) {
+        if (w < g->weights[n]) {
+            l = g->lists[n];
+            break;
+        }
+        w -= g->weights[n];
+    }
+
+    /* Leave room to damage the record afterwards */
+    size_t limit = size - MAX_SMS_FIELD_LENGTH - 2;
+
+    while (len == 0) {
+
+        gateway_answer_list(g, l);
+        schema_buffer_init(&b, s, limit);
+
+        #ifdef _SCHEMA_ENABLE_COMPACT
+          if (gateway_random_chance(g, g->compact)) {
+              len = schema_list_serialize_compact_to(
+                  l, &schema_sink_buffer, &b
+              );
+
+              if (len > 0) {
+                  break;
+              }
+
+              schema_buffer_init(&b, s, limit);
+          }
+        #endif /* _SCHEMA_ENABLE_COMPACT */
+
+        /* Zero if too long for a record; try again */
+        len = schema_list_serialize_to(l, &schema_sink_buffer, &b);
+    }
+
+    *damaged = gateway_random_chance(g, g->malformed);
+
+    if (*damaged) {
+        gateway_damage_record(g, s, &len, size - 1);
+    }
+
+    return len;
+}
+
+
+/**
+ * Set the share of the traffic for each form, from `spec`, which
+ * is a comma-separated list of form codes and weights (e.g.
+ * PSMS=3,ANCR=1). Forms that aren't mentioned get no traffic.
+ * Returns false if `spec` is malformed, or names an unknown form.
+ */
+static u8 gateway_parse_weights(gateway_generator_t *g, const char *spec)
+{
+    u8 rv = FALSE;
+    char *copy = strdup(spec), *saveptr = NULL;
+
+    for (unsigned int n = 0; gateway_forms[n].code != NULL; ++n) {
+        g->weights[n] = 0;
+    }
+
+    for (char *p = strtok_r(copy, ",", &saveptr);
+            p != NULL; p = strtok_r(NULL, ",", &saveptr)) {
+
+        char *weight = strchr(p, '=');
+        size_t len = (weight ? (size_t) (weight - p) : strlen(p));
+
+        const gateway_form_t *f = gateway_registry_find(p, len);
+
+        if (f == NULL) {
+            fprintf(stderr, "muvuku-generate: unknown form `%.*s'\n",
+                    (int) len, p);
+            goto exit;
+        }
+
+        g->weights[f - gateway_forms] = (weight ? atoi(weight + 1) : 1);
+    }
+
+    rv = TRUE;
+
+    exit:
+        free(copy);
+        return rv;
+}
+
+
+/**
+ * Connect to the Unix socket at `path`, and return a stream
+ * for writing to it, or null on failure.
+ */
+static FILE *gateway_socket_open(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    return fdopen(fd, "w");
+}
+
+
+/**
+ */
+static double gateway_elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (
+        (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9
+    );
+}
+
+
+/**
+ */
+static void usage(void)
+{
+    fprintf(stderr,
+        "Usage: muvuku-generate [-n count] [-r rate] [-w CODE=weight,...]\n"
+        "         [-e malformed] [-x escapes] [-c compact] [-s seed]\n"
+        "         [-o file | -u socket]\n"
+        "Write random newline-delimited Muvuku records, for load testing.\n"
+        "  -n  Number of records (default 1000000)\n"
+        "  -r  Records per second (default: as fast as possible)\n"
+        "  -w  Share of the traffic for each form (default: equal)\n"
+        "  -e  Fraction of records damaged on purpose (default 0)\n"
+        "  -x  Fraction of string characters needing escapes (default 0.05)\n"
+        "  -c  Fraction of records sent compact, where possible (default 0)\n"
+        "  -s  Random seed (default 1)\n"
+        "  -o  Write to a file (default: standard output)\n"
+        "  -u  Write to a Unix socket\n"
+    );
+}
+
+
+/**
+ */
+int main(int argc, char *argv[])
+{
+    int c, rv = 1;
+    unsigned long count = 1000000, damaged = 0;
+    unsigned long long bytes = 0;
+    double rate = 0;
+
+    const char *weights = NULL;
+    const char *path = NULL, *socket_path = NULL;
+
+    char record[MAX_RECORD_LENGTH + MAX_SMS_FIELD_LENGTH + 3];
+    struct timespec start;
+    FILE *out = stdout;
+
+    gateway_generator_t g;
+    memset(&g, 0, sizeof(g));
+
+    g.state = 1;
+    g.escapes = 0.05;
+
+    while ((c = getopt(argc, argv, "n:r:w:e:x:c:s:o:u:h")) != -1) {
+        switch (c) {
+            case 'n':
+                count = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'w':
+                weights = optarg;
+                break;
+            case 'e':
+                g.malformed = atof(optarg);
+                break;
+            case 'x':
+                g.escapes = atof(optarg);
+                break;
+            case 'c':
+                g.compact = atof(optarg);
+                break;
+            case 's':
+                g.state = strtoull(optarg, NULL, 10);
+                break;
+            case 'o':
+                path = optarg;
+                break;
+            case 'u':
+                socket_path = optarg;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (g.state == 0) {
+        g.state = 1;
+    }
+
+    if (!gateway_registry_init()) {
+        fprintf(stderr, "muvuku-generate: duplicate form code in registry\n");
+        return 1;
+    }
+
+    unsigned int nr_forms = gateway_registry_count();
+
+    g.lists = (schema_list_t **) xmalloc(nr_forms * sizeof(schema_list_t *));
+    g.weights = (unsigned int *) xmalloc(nr_forms * sizeof(unsigned int));
+
+    for (unsigned int n = 0; n < nr_forms; ++n) {
+        g.lists[n] = schema_list_new(gateway_forms[n].form);
+        g.weights[n] = 1;
+    }
+
+    if (weights != NULL && !gateway_parse_weights(&g, weights)) {
+        goto exit;
+    }
+
+    for (unsigned int n = 0; n < nr_forms; ++n) {
+        g.total_weight += g.weights[n];
+    }
+
+    if (g.total_weight == 0) {
+        fprintf(stderr, "muvuku-generate: no forms to generate\n");
+        goto exit;
+    }
+
+    if (socket_path != NULL) {
+        out = gateway_socket_open(socket_path);
+    } else if (path != NULL) {
+        out = fopen(path, "w");
+    }
+
+    if (out == NULL) {
+        fprintf(stderr, "muvuku-generate: unable to open `%s'\n",
+                (socket_path ? socket_path : path));
+        goto exit;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* Pacing:
+        Check the clock every hundredth of a second's worth of
+        records, and sleep off any time that we're ahead by. */
+
+    unsigned long pace = (rate > 0 ? (unsigned long) (rate / 100) : 0);
+
+    if (pace == 0) {
+        pace = 1;
+    }
+
+    for (unsigned long n = 1; n <= count; ++n) {
+
+        u8 is_damaged;
+
+        size_t len = gateway_generate_record(
+            &g, record, sizeof(record), &is_damaged
+        );
+
+        record[len++] = '\n';
+
+        if (fwrite(record, 1, len, out) != len) {
+            fprintf(stderr, "muvuku-generate: write failed\n");
+            goto exit;
+        }
+
+        bytes += len;
+        damaged += is_damaged;
+
+        if (rate > 0 && n % pace == 0) {
+
+            double ahead = n / rate - gateway_elapsed(&start);
+
+            if (ahead > 0) {
+
+                struct timespec delay;
+                fflush(out);
+
+                delay.tv_sec = (time_t) ahead;
+                delay.tv_nsec = (long) ((ahead - delay.tv_sec) * 1e9);
+
+                nanosleep(&delay, NULL);
+            }
+        }
+    }
+
+    if (fflush(out) != 0) {
+        fprintf(stderr, "muvuku-generate: write failed\n");
+        goto exit;
+    }
+
+    double elapsed = gateway_elapsed(&start);
+
+    fprintf(stderr,
+        "muvuku-generate: %lu records (%lu damaged), %llu bytes "
+            "in %.3f s, %.0f records/s\n",
+        count, damaged, bytes,
+        elapsed, (elapsed > 0 ? count / elapsed : 0.0)
+    );
+
+    rv = 0;
+
+    exit:
+        if (out != NULL && out != stdout) {
+            fclose(out);
+        }
+
+        for (unsigned int n = 0; n < nr_forms; ++n) {
+            schema_list_delete(g.lists[n]);
+        }
+
+        free(g.lists);
+        free(g.weights);
+
+        return rv;
+}
@@ -0,0 +1,390 @@
+/**
+ * Muvuku: An STK data collection framework
+ *
+ * Copyright 2011-2012 Medic Mobile, Inc. <hello@medicmobile.org>
+ * All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MEDIC MOBILE BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+
+#include "muvuku.h"
+#include "gateway.h"
+
+#if defined(__BMI2__) && !defined(_GATEWAY_DISABLE_SIMD)
+  #include <immintrin.h>
+#endif
+
+
+/* GSM default alphabet:
+    Handsets send records packed with `dcs_78(..., DCS_8_TO_7)`, so
+    each septet is the low seven bits of one byte of the record, and
+    everything the record syntax uses (digits, letters, and `!#-\`)
+    comes through unchanged. Text typed in to a handset, however, is
+    in the GSM default alphabet; characters that ASCII also has are
+    mapped to ASCII, and the rest to `?`. Position 0x5c, which is
+    `Ö` in the GSM alphabet, is kept as the record escape character,
+    since that's what the SIM application sends it as. */
+
+#define GATEWAY_GSM_ESCAPE (0x1b)
+
+static const char gateway_gsm_ascii[128] = {
+    '@', '?', '$', '?', '?', '?', '?', '?',
+    '?', '?', '\n', '?', '?', '\r', '?', '?',
+    '?', '_', '?', '?', '?', '?', '?', '?',
+    '?', '?', '?', '?', '?', '?', '?', '?',
+    ' ', '!', '"', '#', '?', '%', '&', '\'',
+    '(', ')', '*', '+', ',', '-', '.', '/',
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', ':', ';', '<', '=', '>', '?',
+    '?', 'A', 'B', 'C', 'D', 'E', 'F', 'G',
+    'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O',
+    'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W',
+    'X', 'Y', 'Z', '?', '\\', '?', '?', '?',
+    '?', 'a', 'b', 'c', 'd', 'e', 'f', 'g',
+    'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+    'p', 'q', 'r', 's', 't', 'u', 'v', 'w',
+    'x', 'y', 'z', '?', '?', '?', '?', '?'
+};
+
+
+/**
+ * Return the ASCII character for the GSM extension character `c`
+ * (the septet after an escape), or zero if there isn't one.
+ */
+static char gateway_gsm_extension(u8 c)
+{
+    switch (c) {
+        case 0x0a:
+            return '\f';
+        case 0x14:
+            return '^';
+        case 0x28:
+            return '{';
+        case 0x29:
+            return '}';
+        case 0x2f:
+            return '\\';
+        case 0x3c:
+            return '[';
+        case 0x3d:
+            return '~';
+        case 0x3e:
+            return ']';
+        case 0x40:
+            return '|';
+        default:
+            return 0;
+    }
+}
+
+
+/**
+ * Return the value of the hexadecimal digit `c`, or 0xff.
+ */
+static u8 gateway_hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return (u8) (c - '0');
+    }
+
+    c |= 0x20; /* Lower case */
+
+    if (c >= 'a' && c <= 'f') {
+        return (u8) (c - 'a' + 10);
+    }
+
+    return 0xff;
+}
+
+
+/**
+ * Decode the `len` hexadecimal digits at `s` in to `dst`, which has
+ * room for `size` bytes. Returns the number of bytes decoded, or zero
+ * if `s` isn't an even number of hexadecimal digits, or won't fit.
+ */
+size_t gateway_hex_decode(const char *s, size_t len, u8 *dst, size_t size)
+{
+    if (len % 2 != 0 || len / 2 > size) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < len / 2; ++i) {
+
+        u8 hi = gateway_hex_value(s[2 * i]);
+        u8 lo = gateway_hex_value(s[2 * i + 1]);
+
+        if ((hi | lo) & 0xf0) {
+            return 0;
+        }
+
+        dst[i] = (u8) ((hi << 4) | lo);
+    }
+
+    return len / 2;
+}
+
+
+/**
+ * Unpack `n` septets from the packed GSM 7-bit data at `src` in to
+ * `dst`, one per byte. Eight septets are unpacked from each seven
+ * octets at once, in a 64-bit word; the rest one at a time.
+ */
+static void gateway_unpack_septets(const u8 *src, size_t n, u8 *dst)
+{
+    size_t k = 0;
+
+    for (; k + 8 <= n; k += 8, src += 7, dst += 8) {
+
+        uint64_t x = 0, y;
+
+        for (unsigned int b = 0; b < 7; ++b) {
+            x |= (uint64_t) src[b] << (8 * b);
+        }
+
+        #if defined(__BMI2__) && !defined(_GATEWAY_DISABLE_SIMD)
+          y = _pdep_u64(x, 0x7f7f7f7f7f7f7f7fULL);
+        #else
+          y = (
+              (x & 0x7fULL) |
+              ((x << 1) & 0x7f00ULL) |
+              ((x << 2) & 0x7f0000ULL) |
+              ((x << 3) & 0x7f000000ULL) |
+              ((x << 4) & 0x7f00000000ULL) |
+              ((x << 5) & 0x7f0000000000ULL) |
+              ((x << 6) & 0x7f000000000000ULL) |
+              ((x << 7) & 0x7f00000000000000ULL)
+          );
+        #endif
+
+        for (unsigned int b = 0; b < 8; ++b) {
+            dst[b] = (u8) (y >> (8 * b));
+        }
+    }
+
+    for (size_t bit = 0; k < n; ++k, ++dst, bit += 7) {
+
+        size_t byte = bit / 8, shift = bit % 8;
+        unsigned int v = src[byte] >> shift;
+
+        if (shift > 1) {
+            v |= src[byte + 1] << (8 - shift);
+        }
+
+        *dst = (u8) (v & 0x7f);
+    }
+}
+
+
+/**
+ * Decode the address (e.g. the sender) at `s`, of `len` semi-octets,
+ * in to `dst`, which has room for `GATEWAY_ADDRESS_MAX` bytes.
+ */
+static void gateway_pdu_address(const u8 *s, u8 type, u8 len, char *dst)
+{
+    char *p = dst;
+
+    /* Alphanumeric: packed GSM 7-bit */
+    if ((type & 0x70) == 0x50) {
+
+        u8 septets[GATEWAY_ADDRESS_MAX];
+        size_t n = (len * 4) / 7;
+
+        if (n >= GATEWAY_ADDRESS_MAX) {
+            n = GATEWAY_ADDRESS_MAX - 1;
+        }
+
+        gateway_unpack_septets(s, n, septets);
+
+        for (size_t i = 0; i < n; ++i) {
+            *p++ = gateway_gsm_ascii[septets[i]];
+        }
+
+        *p = '\0';
+        return;
+    }
+
+    /* International number */
+    if ((type & 0x70) == 0x10) {
+        *p++ = '+';
+    }
+
+    /* Semi-octets, low nibble first; 0xf pads the last one */
+    for (u8 i = 0; i < len && p < dst + GATEWAY_ADDRESS_MAX - 1; ++i) {
+
+        u8 digit = (i % 2 ? s[i / 2] >> 4 : s[i / 2] & 0x0f);
+
+        if (digit <= 9) {
+            *p++ = '0' + digit;
+        } else if (digit != 0x0f) {
+            *p++ = "*#abc"[digit - 10];
+        }
+    }
+
+    *p = '\0';
+}
+
+
+/**
+ * Parse the SMS-DELIVER message at `pdu`, which is `len` bytes long
+ * and starts with the service centre address, as modems report it.
+ * Nothing is copied; `p` refers to the user data in `pdu`. Returns
+ * false if the message is malformed, isn't an SMS-DELIVER, or isn't
+ * in an alphabet that a record can be sent in.
+ */
+u8 gateway_pdu_parse(gateway_pdu_t *p, const u8 *pdu, size_t len)
+{
+    const u8 *s = pdu, *end = pdu + len;
+
+    /* Service centre address */
+    if (len < 1 || (size_t) pdu[0] + 1 >= len) {
+        return FALSE;
+    }
+
+    s += 1 + pdu[0];
+
+    /* First octet: message type, and user data header indicator */
+    u8 first = *s++;
+
+    if ((first & 0x03) != 0x00) {
+        return FALSE;
+    }
+
+    /* Originating address */
+    if (end - s < 2) {
+        return FALSE;
+    }
+
+    u8 address_len = s[0], address_type = s[1];
+    s += 2;
+
+    if (end - s < (address_len + 1) / 2) {
+        return FALSE;
+    }
+
+    gateway_pdu_address(s, address_type, address_len, p->from);
+    s += (address_len + 1) / 2;
+
+    /* Protocol identifier, coding scheme, timestamp, and length */
+    if (end - s < 10) {
+        return FALSE;
+    }
+
+    u8 dcs = s[1];
+    p->length = s[9];
+    s += 10;
+
+    /* Coding scheme: only the GSM alphabet and 8-bit data */
+    if ((dcs & 0x80) == 0x00) {
+        if (dcs & 0x20) {
+            return FALSE; /* Compressed */
+        }
+        p->alphabet = (dcs >> 2) & 0x03;
+    } else if ((dcs & 0xf0) == 0xf0) {
+        p->alphabet = (
+            dcs & 0x04 ? GATEWAY_ALPHABET_8BIT : GATEWAY_ALPHABET_GSM
+        );
+    } else if ((dcs & 0xe0) == 0xc0) {
+        p->alphabet = GATEWAY_ALPHABET_GSM;
+    } else {
+        return FALSE;
+    }
+
+    if (p->alphabet != GATEWAY_ALPHABET_GSM &&
+            p->alphabet != GATEWAY_ALPHABET_8BIT) {
+        return FALSE;
+    }
+
+    /* User data, in octets */
+    size_t octets = (
+        p->alphabet == GATEWAY_ALPHABET_GSM ?
+            (p->length * 7 + 7) / 8 : p->length
+    );
+
+    if (p->length > GATEWAY_PDU_LENGTH_MAX || (size_t) (end - s) < octets) {
+        return FALSE;
+    }
+
+    p->data = s;
+    p->skip = 0;
+
+    /* User data header:
+        Skipped, along with the fill bits that align the text
+        that follows it to a septet boundary. */
+
+    if (first & 0x40) {
+
+        size_t header = (octets > 0 ? 1 + s[0] : 1);
+
+        if (header > octets) {
+            return FALSE;
+        }
+
+        p->skip = (
+            p->alphabet == GATEWAY_ALPHABET_GSM ?
+                (header * 8 + 6) / 7 : header
+        );
+
+        if (p->skip > p->length) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/**
+ * Write the text of the message `p` to `s`, which has room for
+ * `GATEWAY_PDU_TEXT_MAX` bytes, and return its length. Septets are
+ * mapped to ASCII as described above; GSM extension characters that
+ * are also the record escape character are escaped, so that they
+ * decode as themselves. No terminator is written.
+ */
+size_t gateway_pdu_text(const gateway_pdu_t *p, char *s)
+{
+    u8 septets[GATEWAY_PDU_LENGTH_MAX];
+    char *out = s;
+
+    if (p->alphabet == GATEWAY_ALPHABET_8BIT) {
+        memcpy(s, p->data + p->skip, p->length - p->skip);
+        return p->length - p->skip;
+    }
+
+    gateway_unpack_septets(p->data, p->length, septets);
+
+    for (size_t i = p->skip; i < p->length; ++i) {
+
+        u8 c = septets[i];
+
+        if (c != GATEWAY_GSM_ESCAPE) {
+            *out++ = gateway_gsm_ascii[c];
+            continue;
+        }
+
+        /* Extension character; a trailing escape is dropped */
+        if (++i >= p->length) {
+            break;
+        }
+
+        char x = gateway_gsm_extension(septets[i]);
+
+        if (x == SMS_ESCAPE) {
+            *out++ = SMS_ESCAPE;
+        }
+
+        *out++ = (x ? x : gateway_gsm_ascii[septets[i]]);
+    }
+
+    return (size_t) (out - s);
+}
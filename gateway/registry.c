@@ -0,0 +1,195 @@
+/**
+ * Muvuku: An STK data collection framework
+ *
+ * Copyright 2011-2012 Medic Mobile, Inc. <hello@medicmobile.org>
+ * All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MEDIC MOBILE BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "muvuku.h"
+#include "gateway.h"
+
+
+/* Registry index:
+    Pointers to every entry in `gateway_forms`, sorted by form code,
+    so that each record's form can be found with a binary search. */
+
+static const gateway_form_t **gateway_index = NULL;
+static unsigned int gateway_index_count = 0;
+
+
+/* Search key for `bsearch` */
+typedef struct gateway_key {
+
+    const char *code;
+    size_t len;
+
+} gateway_key_t;
+
+
+/**
+ * Compare the form code `code`, of length `len`, to the
+ * null-terminated form code `s`, ignoring case.
+ */
+static int gateway_code_compare(const char *code, size_t len, const char *s)
+{
+    for (size_t i = 0; i < len; ++i) {
+
+        int c = toupper((unsigned char) code[i]);
+        int d = toupper((unsigned char) s[i]);
+
+        if (c != d || d == '\0') {
+            return (c - d);
+        }
+    }
+
+    return (s[len] == '\0' ? 0 : -1);
+}
+
+
+/**
+ */
+static int gateway_index_compare(const void *a, const void *b)
+{
+    const gateway_form_t *x = *(const gateway_form_t **) a;
+    const gateway_form_t *y = *(const gateway_form_t **) b;
+
+    return gateway_code_compare(x->code, strlen(x->code), y->code);
+}
+
+
+/**
+ */
+static int gateway_key_compare(const void *k, const void *e)
+{
+    const gateway_key_t *key = (const gateway_key_t *) k;
+    const gateway_form_t *f = *(const gateway_form_t **) e;
+
+    return gateway_code_compare(key->code, key->len, f->code);
+}
+
+
+/**
+ * Build the registry's index. This must be called once, before any
+ * call to `gateway_registry_find`; the index is read-only afterwards,
+ * and may be shared by any number of threads. Returns false if two
+ * forms have the same code.
+ */
+u8 gateway_registry_init(void)
+{
+    unsigned int n = 0;
+
+    while (gateway_forms[n].code != NULL) {
+        n++;
+    }
+
+    gateway_index = (const gateway_form_t **) xmalloc(
+        (n + 1) * sizeof(gateway_form_t *)
+    );
+
+    for (unsigned int i = 0; i < n; ++i) {
+        gateway_index[i] = &gateway_forms[i];
+    }
+
+    qsort(gateway_index, n, sizeof(gateway_form_t *), gateway_index_compare);
+    gateway_index_count = n;
+
+    for (unsigned int i = 1; i < n; ++i) {
+        if (gateway_index_compare(&gateway_index[i - 1],
+                                  &gateway_index[i]) == 0) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/**
+ * Return the number of forms in the registry. Each form's offset
+ * in `gateway_forms` is less than this number.
+ */
+unsigned int gateway_registry_count(void)
+{
+    return gateway_index_count;
+}
+
+
+/**
+ * Return the registry entry for the form code `code`, which is
+ * `len` bytes long and need not be null-terminated, or null if
+ * no form has that code. Form codes are compared without case.
+ */
+const gateway_form_t *gateway_registry_find(const char *code, size_t len)
+{
+    gateway_key_t key = { code, len };
+
+    const gateway_form_t **rv = (const gateway_form_t **) bsearch(
+        &key, gateway_index, gateway_index_count,
+            sizeof(gateway_form_t *), gateway_key_compare
+    );
+
+    return (rv ? *rv : NULL);
+}
+
+
+/**
+ * Find the form code in the header of the record at `s`, which is
+ * `len` bytes long (e.g. PSMS, in 1!PSMS!...). Sets `*code` to the
+ * start of the form code, and `*version` to the record's version,
+ * as `schema_parser_feed` reads it (or -1, if it's too long to be
+ * read). Returns the form code's length, or zero if the record
+ * doesn't start with a version number and form code.
+ */
+size_t gateway_record_code(const char *s, size_t len,
+                           const char **code, int *version)
+{
+    char number[MAX_SMS_FIELD_LENGTH + 1];
+    size_t i = 0, start;
+
+    while (i < len && isdigit((unsigned char) s[i])) {
+        i++;
+    }
+
+    if (i == 0 || i >= len || s[i] != SMS_MAGIC_DELIMITER) {
+        return 0;
+    }
+
+    /* Too long for the parser's field buffer */
+    if (i > MAX_SMS_FIELD_LENGTH) {
+        *version = -1;
+    } else {
+        memcpy(number, s, i);
+        number[i] = '\0';
+        *version = atoi(number);
+    }
+
+    start = ++i;
+
+    while (i < len && s[i] != SMS_MAGIC_DELIMITER) {
+        if (i - start >= GATEWAY_CODE_LENGTH_MAX) {
+            return 0;
+        }
+        i++;
+    }
+
+    if (i >= len || i == start) {
+        return 0;
+    }
+
+    *code = &s[start];
+    return (i - start);
+}
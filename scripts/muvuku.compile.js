@@ -43,6 +43,22 @@ var fs = require('fs'),
 var default_language = 'en';
 
 
+/**
+ * Maximum record length:
+ *  Records longer than one SMS are sent as several messages, and
+ *  reassembled by the gateway; the real limit is the length of a
+ *  saved string, which is one byte when `_MUVUKU_TINY_STRINGS` is
+ *  defined. A saved string also holds the record's null terminator
+ *  and, with acknowledgements enabled, its sequence header; these
+ *  mirror `SCHEMA_SEQUENCE_HEADER_MAX` and friends in `schema.h`.
+ */
+var max_saved_string_length = 255,
+    sequence_header_max = 13;
+
+var max_record_length =
+    max_saved_string_length - sequence_header_max - 1;
+
+
 /**
  * `CompilationError`:
  *    A simple exception class. An error stack is maintained
@@ -626,6 +642,7 @@ var compile_form = exports.compile_form = function (_form, _path, _i) {
                 /* Fix position */
                 for (var i = 0, len = rv.fields.length; i < len; ++i) {
                     rv.fields[i].position = i;
+                    rv.fields[i].is_last = (i == len - 1);
                 }
 
                 /* High-level field count */
@@ -1045,6 +1062,33 @@ var write_main = function (_forms, _templates, _callback) {
 };
 
 
+/**
+ */
+var write_gateway = function (_forms, _templates, _callback) {
+
+    /* Process gateway template:
+        This produces exactly one file, `output/gateway/forms.c`,
+        containing the host-side form registry used by the gateway,
+        and one decoder for each form. */
+
+    var path = 'output/gateway/forms.c';
+
+    var rendered = _templates.gateway.call(this, {
+        forms: _forms, meta: { count: _forms.length }
+    });
+
+    fs.writeFile(path, rendered, function (_err) {
+        if (_err) {
+            return _callback(new CompilationError(_err, {
+                message: 'Unable to write template output',
+                path: path
+            }));
+        }
+        _callback(null);
+    });
+};
+
+
 /**
  */
 var register_helpers = exports.register_helpers = function () {
@@ -1084,7 +1128,8 @@ var main = exports.main = function (_paths, _callback) {
 
     var template_names = {
         main: './templates/muvuku.c.template',
-        form: './templates/muvuku-data.c.template'
+        form: './templates/muvuku-data.c.template',
+        gateway: './templates/muvuku-gateway.c.template'
     };
 
     /* Helpers:
@@ -1129,14 +1174,23 @@ var main = exports.main = function (_paths, _callback) {
                         }));
                     }
 
-                    /* ...then program driver code in `output/main` */
+                    /* ...then program driver code in `output/main`... */
                     write_main(_forms, _templates, function (_e4) {
                         if (_e4) {
                             return _callback(new CompilationError(_e4, {
                                 message: 'Failure while generating `main`'
                             }));
                         }
-                        return _callback(null, _forms);
+
+                        /* ...and the gateway's form registry */
+                        write_gateway(_forms, _templates, function (_e5) {
+                            if (_e5) {
+                                return _callback(new CompilationError(_e5, {
+                                    message: 'Failure while generating gateway'
+                                }));
+                            }
+                            return _callback(null, _forms);
+                        });
                     });
                 });
 
@@ -1161,9 +1215,10 @@ main.call(
         }
 
         forms.forEach(function (_form, _i) {
-            if (_form.meta.length.upper > 160) {
+            if (_form.meta.length.upper > max_record_length) {
                 return fatal(
-                    'Maximum message length is > 160 characters', {
+                    'Maximum message length is > ' +
+                        max_record_length + ' characters', {
                         length: _form.meta.length
                     }
                 );
@@ -96,6 +96,30 @@ const lc_char PROGMEM lc_ok_send[] = {
     LC_END
 };
 
+const lc_char PROGMEM lc_send_count[] = {
+    LC_EN("Sent ")
+    LC_FR("Envoy\5s: ")
+    LC_ES("Enviados: ")
+    LC_END
+};
+
+const lc_char PROGMEM lc_send_of[] = {
+    LC_EN(" of ")
+    LC_FR(" sur ")
+    LC_ES(" de ")
+    LC_END
+};
+
+const lc_char PROGMEM lc_send_remain[] = {
+    LC_EN(" form(s). The rest remain saved; once you have a signal, "
+          "please select 'Transmit' again.")
+    LC_FR(" rapport(s). Les autres restent sauvegard\5s; quand vous "
+          "aurez acc\4s au r\5seau, re\5ssayez.")
+    LC_ES(" forma(s). Las dem\177s est\177n guardadas; cuando tenga "
+          "se\175al, intente de nuevo.")
+    LC_END
+};
+
 const lc_char PROGMEM lc_err_nothing_sent[] = {
     LC_EN("No messages available to send")
     LC_FR("Aucunes donn\5es a envoy\5r")
@@ -172,7 +196,6 @@ struct muvuku_send_state {
 
     unsigned int size;
     unsigned int count;
-    schema_list_t *settings;
 };
 
 
@@ -204,24 +227,24 @@ struct muvuku_send_state {
         char *buffer = xmalloc(len);
 
         muvuku_pool_t *p = muvuku_storage_open(s);
-        struct muvuku_send_state state = { 0, 0, settings };
+        muvuku_pool_t *o = muvuku_storage_open_overflow(s);
+        struct muvuku_send_state state = { 0, 0 };
 
         if (!p) {
             display_text(locale(lc_err_store_pool), locale(lc_err_send));
             goto exit;
         }
 
-        size_t cell_size = muvuku_pool_cell_size(p);
-        void *ptr = muvuku_pool_address(p, muvuku_storage_retrieve(s, p, l));
-
-        muvuku_stringlist_t *sl = muvuku_stringlist_open(p, ptr);
+        muvuku_tieredlist_t *tl = muvuku_storage_list(s, p, o, l);
 
-        if (!sl) {
+        if (!tl) {
             display_text(locale(lc_err_store_cell), locale(lc_err_send));
             goto exit_pool;
         }
 
-        if (!muvuku_stringlist_each(sl, _muvuku_action_show_one, &state)) {
+        size_t capacity = muvuku_tieredlist_capacity(tl);
+
+        if (!muvuku_tieredlist_each(tl, _muvuku_action_show_one, &state)) {
             goto exit_stringlist;
         }
 
@@ -237,19 +260,23 @@ struct muvuku_send_state {
         r = sprintc(r, '\n');
 
         r = sprints(r, locale(lc_show_remaining));
-        r = sprinti(r, cell_size - state.size);
+        r = sprinti(r, capacity - muvuku_tieredlist_size(tl));
         r = sprintc(r, '\n');
 
         /* Display */
         display_text(buffer, NULL);
 
         exit_stringlist:
-            muvuku_stringlist_close(sl);
+            muvuku_tieredlist_close(tl);
 
         exit_pool:
             muvuku_pool_close(p);
 
         exit:
+            if (o) {
+                muvuku_pool_close(o);
+            }
+
             free(buffer);
             return state.count;
     }
@@ -259,31 +286,22 @@ struct muvuku_send_state {
 
 
 /**
- * @name _muvuku_action_send_one
+ * @name _muvuku_action_send_report
+ *
+ * Tell the user, once, how far the stopped session `x` got.
  */
-static int _muvuku_action_send_one(muvuku_stringlist_t *sl,
-                                   char *src, size_t len, void *ptr) {
-
-    u8 rv = FALSE;
-    len = scalar_min(len, MAX_SMS_LENGTH);
-
-    char *buf = (char *) xmalloc(len + 1);
-    memset(buf, '\0', len + 1);
+static void _muvuku_action_send_report(muvuku_session_t *x) {
 
-    muvuku_pool_read(sl->pool, buf, src, len);
-    struct muvuku_send_state *state = (struct muvuku_send_state *) ptr;
+    char *buffer = xmalloc(160);
 
-    if (!muvuku_send_sms(buf, state->settings)) {
-        goto exit;
-    }
-
-    rv = TRUE;
-    state->count++;
-    state->size += len;
+    char *r = sprints(buffer, locale(lc_send_count));
+    r = sprinti(r, x->sent);
+    r = sprints(r, locale(lc_send_of));
+    r = sprinti(r, x->total);
+    r = sprints(r, locale(lc_send_remain));
 
-    exit:
-        free(buf);
-        return rv;
+    display_text(buffer, NULL);
+    free(buffer);
 }
 
 
@@ -293,46 +311,226 @@ static int _muvuku_action_send_one(muvuku_stringlist_t *sl,
 unsigned int muvuku_action_send(muvuku_settings_t *s,
                                 schema_list_t *settings, schema_list_t *l) {
 
+    muvuku_session_t session;
     muvuku_pool_t *p = muvuku_storage_open(s);
-    struct muvuku_send_state state = { 0, 0, settings };
+    muvuku_pool_t *o = muvuku_storage_open_overflow(s);
+
+    session.sent = 0;
 
     if (!p) {
         display_text(locale(lc_err_store_pool), locale(lc_err_send));
         goto exit;
     }
 
-    void *ptr = muvuku_pool_address(p, muvuku_storage_retrieve(s, p, l));
-    muvuku_stringlist_t *sl = muvuku_stringlist_open(p, ptr);
+    muvuku_tieredlist_t *tl = muvuku_storage_list(s, p, o, l);
 
-    if (!sl) {
+    if (!tl) {
         display_text(locale(lc_err_store_cell), locale(lc_err_send));
         goto exit_pool;
     }
 
-    if (!muvuku_stringlist_each(sl, _muvuku_action_send_one, &state)) {
+    if (muvuku_tieredlist_count(tl) == 0) {
+        display_text(locale(lc_err_nothing_sent), NULL);
         goto exit_stringlist;
     }
 
-    /* Success */
-    muvuku_stringlist_init(p, ptr);
+    /* Transmit session:
+        Every record, in one session; whatever was delivered is
+        reclaimed, even if the session stopped part of the way. */
 
-    if (state.count > 0) {
+    if (muvuku_outbox_transmit(&session, settings, tl, 0)) {
         display_text(locale(lc_ok_send), NULL);
-    } else {
-        display_text(locale(lc_err_nothing_sent), NULL);
+        goto exit_stringlist;
     }
-    
+
+    _muvuku_action_send_report(&session);
+
     exit_stringlist:
-        muvuku_stringlist_close(sl);
+        muvuku_tieredlist_close(tl);
 
     exit_pool:
         muvuku_pool_close(p);
 
     exit:
-        return state.count;
+        if (o) {
+            muvuku_pool_close(o);
+        }
+
+        return session.sent;
+}
+
+
+#ifdef _ENABLE_AUTO_TRANSMIT
+
+/**
+ * @name muvuku_action_drain
+ *
+ * Carry out the background transmit attempt started by the schedule
+ * `h`, using the gateway in `settings`; see `muvuku_schedule_drain`.
+ * Without a gateway, there's nothing to do until the settings change.
+ * Nothing is displayed. Returns false if the attempt failed.
+ */
+unsigned int muvuku_action_drain(muvuku_settings_t *s,
+                                 schema_list_t *settings,
+                                 muvuku_schedule_t *h) {
+    unsigned int rv;
+
+    if (settings->list->value.msisdn == NULL) {
+        muvuku_schedule_done(h, 0, TRUE, 0);
+        return TRUE;
+    }
+
+    muvuku_pool_t *p = muvuku_storage_open(s);
+    muvuku_pool_t *o = muvuku_storage_open_overflow(s);
+
+    rv = muvuku_schedule_drain(h, s, p, o, settings);
+
+    if (p) {
+        muvuku_pool_close(p);
+    }
+
+    if (o) {
+        muvuku_pool_close(o);
+    }
+
+    return rv;
+}
+
+#endif /* _ENABLE_AUTO_TRANSMIT */
+
+
+#ifdef _SCHEMA_ENABLE_ACK
+
+/* Pending acknowledgements:
+    An acknowledgement that arrives while settings are already open
+    (e.g. in the middle of a Transmit session) can't reclaim anything
+    without pulling records out from under whoever is walking them.
+    It's kept here instead, and applied once they've finished; past
+    this many, the gateway simply acknowledges the records again. */
+
+#define MUVUKU_ACK_PENDING_MAX (4)
+
+struct muvuku_ack_pending {
+
+    struct muvuku_ack_pending *next;
+    size_t len;
+    char text[MAX_SMS_LENGTH + 1];
+};
+
+static struct muvuku_ack_pending *muvuku_ack_pending = NULL;
+
+
+/**
+ * @name _muvuku_action_acknowledge_text
+ */
+static unsigned int _muvuku_action_acknowledge_text(muvuku_settings_t *s,
+                                                    const char *ack,
+                                                    size_t len) {
+    unsigned int rv = 0;
+
+    muvuku_pool_t *p = muvuku_storage_open(s);
+    muvuku_pool_t *o = muvuku_storage_open_overflow(s);
+
+    if (p) {
+        rv = muvuku_storage_acknowledge(s, p, o, ack, len);
+        muvuku_pool_close(p);
+    }
+
+    if (o) {
+        muvuku_pool_close(o);
+    }
+
+    return rv;
+}
+
+
+/**
+ * @name muvuku_action_acknowledge
+ *
+ * Reclaim the saved records listed in an acknowledgement from the
+ * gateway, delivered to the SIM in the SMS-PP download `envelope`.
+ * Messages from anyone but the number in `settings` are ignored, as
+ * is anything that isn't an acknowledgement. Nothing is displayed.
+ * If settings were already open, the acknowledgement is queued for
+ * `muvuku_action_acknowledge_pending`. Returns the number of records
+ * reclaimed.
+ */
+unsigned int muvuku_action_acknowledge(muvuku_settings_t *s,
+                                       schema_list_t *settings,
+                                       const u8 *envelope) {
+    unsigned int n = 0, rv = 0;
+    const u8 *gateway = settings->list->value.msisdn;
+    struct muvuku_ack_pending *a, **tail = &muvuku_ack_pending;
+
+    /* No gateway, no acknowledgements */
+    if (gateway == NULL) {
+        return rv;
+    }
+
+    a = (struct muvuku_ack_pending *) xmalloc(sizeof(*a));
+
+    a->next = NULL;
+    a->len = muvuku_sms_envelope_text(
+        envelope, gateway, a->text, sizeof(a->text)
+    );
+
+    if (a->len == 0) {
+        goto exit;
+    }
+
+    if (!muvuku_settings_is_nested()) {
+        rv = _muvuku_action_acknowledge_text(s, a->text, a->len);
+        goto exit;
+    }
+
+    /* Settings in use:
+        Append to the queue, oldest first, unless it's full. */
+
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+        ++n;
+    }
+
+    if (n < MUVUKU_ACK_PENDING_MAX) {
+        *tail = a;
+        return rv;
+    }
+
+    exit:
+        free(a);
+        return rv;
 }
 
 
+/**
+ * @name muvuku_action_acknowledge_pending
+ *
+ * Apply every acknowledgement queued by `muvuku_action_acknowledge`
+ * while settings were in use. Call this just before the outermost
+ * `muvuku_settings_close`; it does nothing while settings are nested.
+ * Returns the number of records reclaimed.
+ */
+unsigned int muvuku_action_acknowledge_pending(muvuku_settings_t *s) {
+
+    unsigned int rv = 0;
+    struct muvuku_ack_pending *a;
+
+    if (muvuku_settings_is_nested()) {
+        return rv;
+    }
+
+    while ((a = muvuku_ack_pending) != NULL) {
+        muvuku_ack_pending = a->next;
+        rv += _muvuku_action_acknowledge_text(s, a->text, a->len);
+        free(a);
+    }
+
+    return rv;
+}
+
+#endif /* _SCHEMA_ENABLE_ACK */
+
+
 /**
  * @name muvuku_action_save_explicit
  */
@@ -367,6 +565,134 @@ unsigned int muvuku_action_save_implicit(muvuku_settings_t *s,
 }
 
 
+/**
+ * @name _muvuku_action_serializer
+ *
+ * Choose an encoding for `l`: the compact encoding, if it's enabled
+ * and can represent this record, or text otherwise. The length of the
+ * serialized record is stored in `len`; it's zero on failure.
+ */
+static schema_serializer_t _muvuku_action_serializer(schema_list_t *l,
+                                                     size_t *len) {
+    #ifdef _SCHEMA_ENABLE_COMPACT
+      *len = 0;
+
+      if (schema_list_serialize_compact_to(l, &schema_sink_count, len)) {
+          return &schema_list_serialize_compact_to;
+      }
+    #endif /* _SCHEMA_ENABLE_COMPACT */
+
+    *len = 0;
+    schema_list_serialize_to(l, &schema_sink_count, len);
+
+    return &schema_list_serialize_to;
+}
+
+
+#ifdef _SCHEMA_ENABLE_DELTA
+
+/**
+ * @name muvuku_delta_state
+ */
+struct muvuku_delta_state {
+
+    u8 complete;
+    uint32_t sequence;
+    uint32_t base_sequence;
+    char base[MAX_SMS_LENGTH + 1];
+    char record[MAX_SMS_LENGTH + 1];
+};
+
+
+/**
+ * @name _muvuku_action_delta
+ *
+ * Serialize `l` in to `d->record` as a delta record, against the base
+ * kept for its form. If the form has no base, or the base is at least
+ * `MUVUKU_DELTA_REFRESH` sequence numbers old, the record is complete
+ * instead, and will become the new base once it's saved. Returns true
+ * if the record should be used in place of the `len`-byte record that
+ * `_muvuku_action_serializer` chose, and updates `len`.
+ */
+static u8 _muvuku_action_delta(muvuku_settings_t *s, schema_list_t *l,
+                               struct muvuku_delta_state *d, size_t *len) {
+    size_t base_len = 0;
+    schema_buffer_t b;
+    muvuku_pool_t *p = muvuku_storage_open_base(s);
+
+    if (!p) {
+        return FALSE;
+    }
+
+    d->sequence = muvuku_settings_counter(MUVUKU_COUNTER_SEQUENCE) + 1;
+
+    base_len = muvuku_storage_base_read(
+        s, p, l, &d->base_sequence, d->base, sizeof(d->base)
+    );
+
+    muvuku_pool_close(p);
+
+    d->complete = (
+        base_len == 0 ||
+            d->sequence - d->base_sequence >= MUVUKU_DELTA_REFRESH
+    );
+
+    schema_buffer_init(&b, d->record, sizeof(d->record));
+
+    size_t n = schema_list_serialize_delta_to(
+        l, d->sequence, (d->complete ? NULL : d->base),
+            base_len, d->base_sequence, &schema_sink_buffer, &b
+    );
+
+    /* A delta has to pay for itself; a new base doesn't */
+    if (!n || (!d->complete && n >= *len)) {
+        return FALSE;
+    }
+
+    *len = n;
+    return TRUE;
+}
+
+
+/**
+ * @name _muvuku_action_delta_commit
+ *
+ * Called once the record from `_muvuku_action_delta` has been saved:
+ * consume its sequence number and, if it was complete, keep the text
+ * form of `l` as the form's new base. With acknowledgements, the base
+ * only moves once the gateway lists the record; see
+ * `muvuku_storage_acknowledge`.
+ */
+static void _muvuku_action_delta_commit(muvuku_settings_t *s,
+                                        schema_list_t *l,
+                                        struct muvuku_delta_state *d) {
+    muvuku_settings_counter_add(MUVUKU_COUNTER_SEQUENCE, 1);
+
+    #ifndef _SCHEMA_ENABLE_ACK
+        schema_buffer_t b;
+
+        if (!d->complete) {
+            return;
+        }
+
+        muvuku_pool_t *p = muvuku_storage_open_base(s);
+        schema_buffer_init(&b, d->base, sizeof(d->base));
+
+        size_t len = schema_list_serialize_to(l, &schema_sink_buffer, &b);
+
+        if (p && len) {
+            muvuku_storage_base_write(s, p, l, d->sequence, d->base, len);
+        }
+
+        if (p) {
+            muvuku_pool_close(p);
+        }
+    #endif /* !_SCHEMA_ENABLE_ACK */
+}
+
+#endif /* _SCHEMA_ENABLE_DELTA */
+
+
 /**
  * @name muvuku_action_save
  */
@@ -375,51 +701,144 @@ unsigned int muvuku_action_save(muvuku_settings_t *s,
                                 schema_list_t *l, u8 silent_success) {
 
     unsigned int rv = FALSE;
+    muvuku_stringlist_writer_t *w = NULL;
     muvuku_pool_t *p = muvuku_storage_open(s);
+    muvuku_pool_t *o = muvuku_storage_open_overflow(s);
+
+    #ifdef _SCHEMA_ENABLE_DELTA
+        struct muvuku_delta_state *d = NULL;
+    #endif /* _SCHEMA_ENABLE_DELTA */
 
     if (!p) {
         display_text(locale(lc_err_store_pool), locale(lc_err_save));
         goto exit;
     }
 
-    muvuku_stringlist_t *sl = muvuku_stringlist_open(
-        p, muvuku_pool_address(p, muvuku_storage_retrieve(s, p, l))
-    );
+    /* Flash first, then EEPROM:
+        Messages spill over in to EEPROM once the form's cell
+        in flash is full; send and show visit both, in order. */
+
+    muvuku_tieredlist_t *tl = muvuku_storage_list(s, p, o, l);
 
-    if (!sl) {
+    if (!tl) {
         display_text(locale(lc_err_store_cell), locale(lc_err_save));
         goto exit_pool;
     }
 
-    char *sms = schema_list_serialize(l, FL_NONE);
+    /* Two passes:
+        The first finds the serialized length, so that space can be
+        reserved; the second writes straight in to that space. The
+        null terminator is stored too, just as it was before. */
+
+    size_t len = 0, header_len = 0;
+    const char *record = NULL;
+    schema_serializer_t serialize = _muvuku_action_serializer(l, &len);
+
+    /* Sequence number:
+        With acknowledgements, each record is saved after a header
+        holding its sequence number (the same one a delta record
+        carries), and stays saved until the gateway lists it. */
+
+    #ifdef _SCHEMA_ENABLE_ACK
+        char header[SCHEMA_SEQUENCE_HEADER_MAX];
+
+        header_len = schema_sequence_header(
+            header, muvuku_settings_counter(MUVUKU_COUNTER_SEQUENCE) + 1
+        );
+    #endif /* _SCHEMA_ENABLE_ACK */
+
+    /* Long records:
+        These are sent in parts, but are saved whole; make sure
+        the length (with null terminator) fits in a saved string. */
 
-    if (!sms) {
+    size_t size = header_len + len + 1;
+
+    if (!len || (muvuku_string_size_t) size != size) {
         display_text(locale(lc_err_store_serialize), locale(lc_err_save));
         goto exit_stringlist;
     }
 
-    if (!muvuku_stringlist_add(sl, sms, strlen(sms) + 1)) {
+    /* Delta encoding:
+        This one is rendered in to RAM up front, since it has to be
+        compared against the form's base record anyway. */
+
+    #ifdef _SCHEMA_ENABLE_DELTA
+        d = (struct muvuku_delta_state *) xmalloc(sizeof(*d));
+
+        if (_muvuku_action_delta(s, l, d, &len)) {
+            record = d->record;
+        }
+    #endif /* _SCHEMA_ENABLE_DELTA */
+
+    /* About a page in size; see `muvuku_stringlist_writer_t` */
+    w = (muvuku_stringlist_writer_t *) xmalloc(sizeof(*w));
+
+    if (!muvuku_tieredlist_begin(tl, w, header_len + len + 1)) {
         display_text(locale(lc_err_store_write), NULL);
-        goto exit_unserialize;
+        goto exit_stringlist;
     }
 
+    u8 written = TRUE;
+
+    #ifdef _SCHEMA_ENABLE_ACK
+        written = muvuku_stringlist_write(w, header, header_len);
+    #endif /* _SCHEMA_ENABLE_ACK */
+
+    written = written && (
+        record != NULL ?
+            muvuku_stringlist_write(w, record, len) :
+            serialize(l, &muvuku_stringlist_write, w) > 0
+    );
+
+    if (!written ||
+        !muvuku_stringlist_write(w, "", 1) || !muvuku_stringlist_end(w)) {
+
+        display_text(locale(lc_err_store_write), NULL);
+        goto exit_stringlist;
+    }
+
+    #ifdef _SCHEMA_ENABLE_DELTA
+        if (record != NULL) {
+            _muvuku_action_delta_commit(s, l, d);
+        }
+    #endif /* _SCHEMA_ENABLE_DELTA */
+
+    /* The delta commit consumes the sequence number, if it ran */
+    #ifdef _SCHEMA_ENABLE_ACK
+        if (record == NULL) {
+            muvuku_settings_counter_add(MUVUKU_COUNTER_SEQUENCE, 1);
+        }
+    #endif /* _SCHEMA_ENABLE_ACK */
+
     rv = TRUE;
     schema_list_clear_result(l);
+    muvuku_settings_counter_add(MUVUKU_COUNTER_SAVED, 1);
 
     if (!silent_success) {
         display_text(locale(lc_ok_save), NULL);
     }
 
-    exit_unserialize:
-        free(sms);
-
     exit_stringlist:
-        muvuku_stringlist_close(sl);
+        muvuku_tieredlist_close(tl);
 
     exit_pool:
         muvuku_pool_close(p);
 
     exit:
+        if (o) {
+            muvuku_pool_close(o);
+        }
+
+        if (w) {
+            free(w);
+        }
+
+        #ifdef _SCHEMA_ENABLE_DELTA
+            if (d) {
+                free(d);
+            }
+        #endif /* _SCHEMA_ENABLE_DELTA */
+
         return rv;
 }
 
@@ -434,21 +853,51 @@ unsigned int muvuku_action_clear(muvuku_settings_t *s,
         return FALSE;
     }
 
+    unsigned int rv = FALSE;
     muvuku_pool_t *p = muvuku_storage_open(s);
+    muvuku_pool_t *o = muvuku_storage_open_overflow(s);
 
     if (!p) {
         display_text(locale(lc_err_store_pool), NULL);
-        return FALSE;
+        goto exit;
+    }
+
+    muvuku_tieredlist_t *tl = muvuku_storage_list(s, p, o, l);
+
+    if (!tl) {
+        display_text(locale(lc_err_store_cell), NULL);
+        goto exit_pool;
     }
 
-    void *ptr = muvuku_pool_address(p, muvuku_storage_retrieve(s, p, l));
+    muvuku_tieredlist_init(tl);
+    muvuku_tieredlist_close(tl);
+
+    /* Delta base:
+        Cleared along with the records; the form's next record
+        is complete, and the gateway is never asked to hold on
+        to a base that the SIM no longer has. */
 
-    muvuku_stringlist_init(p, ptr);
+    #ifdef _SCHEMA_ENABLE_DELTA
+        muvuku_pool_t *b = muvuku_storage_open_base(s);
+
+        if (b) {
+            muvuku_storage_base_clear(s, b, l);
+            muvuku_pool_close(b);
+        }
+    #endif /* _SCHEMA_ENABLE_DELTA */
 
+    rv = TRUE;
     display_text(locale(lc_ok_clear), NULL);
-    muvuku_pool_close(p);
 
-    return TRUE;
+    exit_pool:
+        muvuku_pool_close(p);
+
+    exit:
+        if (o) {
+            muvuku_pool_close(o);
+        }
+
+        return rv;
 }
 
 
@@ -465,22 +914,41 @@ unsigned int muvuku_action_send_without_save(muvuku_settings_t *s,
         return rv;
     }
 
-    char *sms = schema_list_serialize(l, FL_NONE);
+    size_t len;
+    schema_buffer_t b;
+
+    schema_serializer_t serialize = _muvuku_action_serializer(l, &len);
 
-    if (!sms) {
+    char *sms = (char *) xmalloc(len + 1);
+    schema_buffer_init(&b, sms, len + 1);
+
+    if (!len || !serialize(l, &schema_sink_buffer, &b)) {
         display_text(locale(lc_err_send_serialize), locale(lc_err_send));
-        return rv;
+        goto exit;
     }
 
-    if (!muvuku_send_sms(sms, settings)) {
+    u8 reference = (u8) muvuku_settings_counter(MUVUKU_COUNTER_SENT);
+
+    muvuku_session_t session;
+    muvuku_session_begin(&session, settings, 1);
+
+    if (len > MAX_SMS_LENGTH) {
+        muvuku_session_send_parts(&session, sms, len, reference);
+    } else {
+        muvuku_session_send(&session, sms, 1);
+    }
+
+    /* Nothing was saved, so there's nothing to report but failure */
+    if (!muvuku_session_end(&session)) {
         display_text(locale(lc_err_send_sms), locale(lc_err_send));
-        goto exit_unserialize;
+        goto exit;
     }
 
     rv = TRUE;
     display_text(locale(lc_ok_send), NULL);
+    muvuku_settings_counter_add(MUVUKU_COUNTER_SENT, 1);
 
-    exit_unserialize:
+    exit:
         free(sms);
         return rv;
 }
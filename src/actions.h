@@ -21,6 +21,7 @@
 
 #include "schema.h"
 #include "settings.h"
+#include "transport.h"
 
 
 unsigned int muvuku_action_save_explicit(muvuku_settings_t *s,
@@ -48,5 +49,19 @@ unsigned int muvuku_action_send_without_save(muvuku_settings_t *s,
                                              schema_list_t *settings,
                                              schema_list_t *l);
 
+#ifdef _ENABLE_AUTO_TRANSMIT
+  unsigned int muvuku_action_drain(muvuku_settings_t *s,
+                                   schema_list_t *settings,
+                                   muvuku_schedule_t *h);
+#endif /* _ENABLE_AUTO_TRANSMIT */
+
+#ifdef _SCHEMA_ENABLE_ACK
+  unsigned int muvuku_action_acknowledge(muvuku_settings_t *s,
+                                         schema_list_t *settings,
+                                         const u8 *envelope);
+
+  unsigned int muvuku_action_acknowledge_pending(muvuku_settings_t *s);
+#endif /* _SCHEMA_ENABLE_ACK */
+
 #endif /* __MUVUKU_ACTIONS_H__ */
 
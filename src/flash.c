@@ -23,3 +23,12 @@
 
 u8 PROGMEM muvuku_flash_reserved[MUVUKU_FLASH_RESERVED] = { 0 };
 
+
+/* Size of reserved flash memory:
+    This is fixed when flash.c is compiled; see flash.h. */
+
+size_t muvuku_flash_reserved_size() {
+
+    return MUVUKU_FLASH_RESERVED;
+}
+
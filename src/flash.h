@@ -25,8 +25,11 @@
 
 /* Flash memory to reserve:
     This parameter determines the amount of storage to reserve
-    for Muvuku's flash memory pool driver. Note that this increases
-    the size of the resulting binary, and maxes out at about 30KiB. */
+    for Muvuku's flash memory pool driver. The AVR build measures
+    the linked application and passes every whole page left in the
+    application's flash budget (see `src/Makefile`) when compiling
+    flash.c; this default is used for builds that skip that step.
+    Other modules must use `muvuku_flash_reserved_size` instead. */
 
 #ifndef MUVUKU_FLASH_RESERVED
     #define MUVUKU_FLASH_RESERVED 2048 /* bytes */
@@ -34,9 +37,18 @@
 
 
 /* Reserved flash memory:
-    This is used by Muvuku's flash memory (pool) driver. */
+    This is used by Muvuku's flash memory (pool) driver. Its
+    first whole page holds the extent table that records which
+    pages are allocated; see `muvuku_flash_region_init`. */
 
-extern u8 PROGMEM muvuku_flash_reserved[MUVUKU_FLASH_RESERVED];
+extern u8 PROGMEM muvuku_flash_reserved[];
+
+
+/* Size of reserved flash memory:
+    Only flash.c is rebuilt once the size is known, so this
+    is the one place where `MUVUKU_FLASH_RESERVED` is reliable. */
+
+size_t muvuku_flash_reserved_size();
 
 
 #endif /* __MUVUKU_FLASH_H__ */
@@ -0,0 +1,446 @@
+/**
+ * Muvuku: An STK data collection framework
+ *
+ * Copyright 2011-2012 Medic Mobile, Inc. <hello@medicmobile.org>
+ * All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MEDIC MOBILE BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bladox.h"
+#include "prototype.h"
+
+#include "kv.h"
+#include "util.h"
+
+
+/**
+ * Return a pointer to the record at `offset` in the image of `kv`.
+ */
+static muvuku_kv_record_t *_muvuku_kv_record(muvuku_kv_t *kv, u16 offset) {
+
+    return (muvuku_kv_record_t *) &kv->image[offset];
+}
+
+
+/**
+ * Return a pointer to half `bank` (zero or one) of the store `h`,
+ * each half of which holds `capacity` bytes of records.
+ */
+static muvuku_kv_data_t *_muvuku_kv_bank(muvuku_kv_handle_t h,
+                                         u16 capacity, u8 bank) {
+    return (muvuku_kv_data_t *) (
+        (u8 *) h + bank * (sizeof(muvuku_kv_header_t) + capacity)
+    );
+}
+
+
+/**
+ * Return true if `header` describes a valid half of a store
+ * that holds `capacity` bytes of records per half.
+ */
+static u8 _muvuku_kv_valid(muvuku_kv_header_t *header, u16 capacity) {
+
+    return (
+        header->magic == MUVUKU_KV_MAGIC &&
+            header->version == MUVUKU_KV_VERSION &&
+                header->used <= capacity
+    );
+}
+
+
+/**
+ * Return the total size, in bytes, of a record holding `len` bytes.
+ */
+static u16 _muvuku_kv_record_size(size_t len) {
+
+    return (u16) (sizeof(muvuku_kv_record_t) + len);
+}
+
+
+/**
+ * Rebuild the index of `kv` by walking every record in its image.
+ * A record that claims to extend past `used` (or has an impossible
+ * key) ends the walk, and everything from that point on is dropped.
+ */
+static void _muvuku_kv_index(muvuku_kv_t *kv) {
+
+    u16 offset = 0;
+    unsigned int i;
+
+    for (i = 0; i < MUVUKU_KV_KEYS_MAX; ++i) {
+        kv->index[i] = MUVUKU_KV_NONE;
+    }
+
+    while (offset + sizeof(muvuku_kv_record_t) <= kv->used) {
+
+        muvuku_kv_record_t *r = _muvuku_kv_record(kv, offset);
+        u16 size = _muvuku_kv_record_size(r->len);
+
+        if (r->key >= MUVUKU_KV_KEYS_MAX || offset + size > kv->used) {
+            break;
+        }
+
+        kv->index[r->key] = offset;
+        offset += size;
+    }
+
+    kv->used = offset;
+}
+
+
+/**
+ * Return the number of bytes occupied by the most recent record
+ * for every key in `kv`, except for `skip`.
+ */
+static u16 _muvuku_kv_live(muvuku_kv_t *kv, muvuku_kv_key_t skip) {
+
+    unsigned int i;
+    u16 rv = 0;
+
+    for (i = 0; i < MUVUKU_KV_KEYS_MAX; ++i) {
+        if (i != skip && kv->index[i] != MUVUKU_KV_NONE) {
+            rv += _muvuku_kv_record_size(
+                _muvuku_kv_record(kv, kv->index[i])->len
+            );
+        }
+    }
+
+    return rv;
+}
+
+
+/**
+ * Squeeze superseded records out of the image of `kv`, keeping only
+ * the most recent record for each key (except `skip`, which is
+ * about to be replaced anyway). The compacted image is written in
+ * its entirety, to the other half of the store, by the next call
+ * to `muvuku_kv_commit`.
+ */
+static void _muvuku_kv_compact(muvuku_kv_t *kv, muvuku_kv_key_t skip) {
+
+    unsigned int i;
+    u16 offset = 0;
+
+    u8 *image = (u8 *) xmalloc(kv->capacity);
+
+    for (i = 0; i < MUVUKU_KV_KEYS_MAX; ++i) {
+
+        if (i == skip || kv->index[i] == MUVUKU_KV_NONE) {
+            continue;
+        }
+
+        muvuku_kv_record_t *r = _muvuku_kv_record(kv, kv->index[i]);
+        u16 size = _muvuku_kv_record_size(r->len);
+
+        memcpy(&image[offset], r, size);
+        offset += size;
+    }
+
+    free(kv->image);
+
+    kv->image = image;
+    kv->used = offset;
+    kv->committed = 0;
+    kv->dirty = TRUE;
+    kv->compacted = TRUE;
+
+    _muvuku_kv_index(kv);
+}
+
+
+/**
+ * Allocate a new, empty key-value store of `size` bytes (including
+ * the headers of both its halves) using the allocator `a`. Returns a
+ * handle that can be passed to `muvuku_kv_open`, or null if
+ * allocation failed.
+ */
+muvuku_kv_handle_t muvuku_kv_new(muvuku_allocator_t *a, size_t size) {
+
+    unsigned int i;
+
+    if (size / 2 <= sizeof(muvuku_kv_header_t)) {
+        return NULL;
+    }
+
+    u16 capacity = (u16) (size / 2 - sizeof(muvuku_kv_header_t));
+    muvuku_kv_data_t *rv = (muvuku_kv_data_t *) a->alloc(size, NULL);
+
+    if (rv == NULL) {
+        return NULL;
+    }
+
+    /* An invalid header reads as an empty half */
+    for (i = 0; i < 2; ++i) {
+        muvuku_kv_data_t *d = _muvuku_kv_bank(rv, capacity, i);
+        a->zero(&d->header, sizeof(d->header));
+    }
+
+    return rv;
+}
+
+
+/**
+ * Permanently destroy the key-value store `h`, and return its
+ * memory to the allocator `a`.
+ */
+void muvuku_kv_delete(muvuku_allocator_t *a, muvuku_kv_handle_t h) {
+
+    if (h != NULL) {
+        a->free(h);
+    }
+}
+
+
+/**
+ * Open the `size`-byte key-value store `h`, copying the header and
+ * every committed record of its newest valid half in to core memory.
+ * If neither half is formatted, or both have a different format
+ * version, it is opened as an empty store and is reformatted on
+ * the next commit.
+ */
+muvuku_kv_t *muvuku_kv_open(muvuku_allocator_t *a,
+                            muvuku_kv_handle_t h, size_t size) {
+
+    /* Pass-through for failed operations */
+    if (a == NULL || h == NULL || size / 2 <= sizeof(muvuku_kv_header_t)) {
+        return NULL;
+    }
+
+    u8 bank, valid[2];
+    unsigned int i;
+
+    muvuku_kv_header_t header[2];
+    muvuku_kv_t *rv = (muvuku_kv_t *) xmalloc(sizeof(*rv));
+
+    rv->allocator = a;
+    rv->store = h;
+
+    rv->capacity = (u16) (size / 2 - sizeof(muvuku_kv_header_t));
+    rv->image = (u8 *) xmalloc(rv->capacity);
+
+    for (i = 0; i < 2; ++i) {
+        muvuku_kv_data_t *d = _muvuku_kv_bank(h, rv->capacity, i);
+        a->read(&header[i], &d->header, sizeof(header[i]));
+        valid[i] = _muvuku_kv_valid(&header[i], rv->capacity);
+    }
+
+    /* Newest valid half:
+        Generations only ever advance by one, and wrap. */
+
+    if (valid[0] && valid[1]) {
+        bank = ((u8) (header[1].generation - header[0].generation) == 1);
+    } else {
+        bank = (valid[1] ? 1 : 0);
+    }
+
+    if (valid[bank]) {
+
+        rv->bank = bank;
+        rv->generation = header[bank].generation;
+        rv->used = header[bank].used;
+        rv->dirty = FALSE;
+        rv->compacted = FALSE;
+
+        a->read(
+            rv->image,
+                _muvuku_kv_bank(h, rv->capacity, bank)->records, rv->used
+        );
+
+    } else {
+
+        /* Unformatted:
+            Pretend the second half holds the previous generation,
+            so that the first commit formats the first half. */
+
+        rv->bank = 1;
+        rv->generation = 0xff;
+        rv->used = 0;
+        rv->dirty = TRUE;
+        rv->compacted = TRUE;
+    }
+
+    _muvuku_kv_index(rv);
+    rv->committed = rv->used;
+
+    return rv;
+}
+
+
+/**
+ * Free the in-core copy of a key-value store. This does *not*
+ * commit anything; call `muvuku_kv_commit` first to keep changes.
+ */
+void muvuku_kv_close(muvuku_kv_t *kv) {
+
+    free(kv->image);
+    free(kv);
+}
+
+
+/**
+ * Look up `key` in the key-value store `kv`, copying at most `n`
+ * bytes of its value to `buf`. Returns the full length of the value,
+ * or zero if the key isn't present. This never touches EEPROM.
+ */
+size_t muvuku_kv_get(muvuku_kv_t *kv,
+                     muvuku_kv_key_t key, void *buf, size_t n) {
+
+    if (key >= MUVUKU_KV_KEYS_MAX || kv->index[key] == MUVUKU_KV_NONE) {
+        return 0;
+    }
+
+    muvuku_kv_record_t *r = _muvuku_kv_record(kv, kv->index[key]);
+
+    if (buf != NULL) {
+        memcpy(buf, r->data, scalar_min(n, (size_t) r->len));
+    }
+
+    return r->len;
+}
+
+
+/**
+ * Set `key` to the `len`-byte value in `data`. Only the in-core
+ * image is changed. Repeated writes to a key between commits are
+ * coalesced, and writing a key's current value is free; either way,
+ * EEPROM is written at most once per commit. Returns false if the
+ * value doesn't fit, even after discarding superseded records.
+ */
+u8 muvuku_kv_set(muvuku_kv_t *kv,
+                 muvuku_kv_key_t key, void *data, size_t len) {
+
+    if (key >= MUVUKU_KV_KEYS_MAX || len > 0xff) {
+        return FALSE;
+    }
+
+    u16 offset = kv->index[key];
+    u16 size = _muvuku_kv_record_size(len);
+
+    if (offset != MUVUKU_KV_NONE) {
+
+        muvuku_kv_record_t *r = _muvuku_kv_record(kv, offset);
+
+        /* Value unchanged */
+        if (r->len == len && memcmp(r->data, data, len) == 0) {
+            return TRUE;
+        }
+
+        /* Not yet committed:
+            Overwrite the pending record, rather than appending. */
+
+        if (offset >= kv->committed) {
+
+            if (r->len == len) {
+                memcpy(r->data, data, len);
+                return TRUE;
+            }
+
+            if (offset + _muvuku_kv_record_size(r->len) == kv->used) {
+                kv->used = offset;
+                _muvuku_kv_index(kv);
+            }
+        }
+    }
+
+    /* Out of space:
+        Compact, but only if that would make enough room;
+        otherwise, the key's current value must be kept. */
+
+    if (kv->used + size > kv->capacity) {
+
+        if (_muvuku_kv_live(kv, key) + size > kv->capacity) {
+            return FALSE;
+        }
+
+        _muvuku_kv_compact(kv, key);
+    }
+
+    muvuku_kv_record_t *r = _muvuku_kv_record(kv, kv->used);
+
+    r->key = key;
+    r->len = (u8) len;
+    memcpy(r->data, data, len);
+
+    kv->index[key] = kv->used;
+    kv->used += size;
+    kv->dirty = TRUE;
+
+    return TRUE;
+}
+
+
+/**
+ * Write pending changes in `kv` back to persistent memory. New
+ * records are written first, and the header last; if power is lost
+ * part-way through a commit, the store still holds its previous
+ * contents. A commit that follows compaction writes the entire log
+ * to the other half of the store, which only becomes valid (and
+ * current) once its magic value is written, at the very end.
+ * Returns true.
+ */
+u8 muvuku_kv_commit(muvuku_kv_t *kv) {
+
+    muvuku_kv_header_t header;
+    muvuku_allocator_t *a = kv->allocator;
+
+    u8 bank = kv->bank;
+    u8 generation = kv->generation;
+
+    if (!kv->dirty) {
+        return TRUE;
+    }
+
+    if (kv->compacted) {
+        bank = !bank;
+        generation++;
+    }
+
+    muvuku_kv_data_t *d = _muvuku_kv_bank(kv->store, kv->capacity, bank);
+
+    header.magic = MUVUKU_KV_MAGIC;
+    header.version = MUVUKU_KV_VERSION;
+    header.generation = generation;
+    header.used = kv->used;
+
+    /* Switching halves:
+        Invalidate the other half before writing to it; it's
+        made valid again only once every record is in place. */
+
+    if (kv->compacted) {
+        header.magic = 0;
+        a->write(&d->header, &header, sizeof(header));
+        header.magic = MUVUKU_KV_MAGIC;
+    }
+
+    if (kv->used > kv->committed) {
+        a->write(
+            &d->records[kv->committed],
+                &kv->image[kv->committed], kv->used - kv->committed
+        );
+    }
+
+    if (kv->compacted) {
+        a->write(&d->header.magic, &header.magic, sizeof(header.magic));
+    } else {
+        a->write(&d->header, &header, sizeof(header));
+    }
+
+    kv->bank = bank;
+    kv->generation = generation;
+    kv->committed = kv->used;
+    kv->dirty = FALSE;
+    kv->compacted = FALSE;
+
+    return TRUE;
+}
+
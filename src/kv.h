@@ -0,0 +1,152 @@
+/**
+ * Muvuku: An STK data collection framework
+ *
+ * Copyright 2011-2012 Medic Mobile, Inc. <hello@medicmobile.org>
+ * All rights reserved.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MEDIC MOBILE BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MUVUKU_KV_H__
+#define __MUVUKU_KV_H__
+
+#include "pool.h"
+
+
+/** @name muvuku_kv_t **/
+
+/* "Magic" value:
+    This occupies the first field of a key-value store's header,
+    and tells `muvuku_kv_open` that the records that follow are valid. */
+
+#define MUVUKU_KV_MAGIC (0x4b56)
+
+
+/* Format version:
+    Increment this if the record layout ever changes. A store with
+    a different version is discarded, and starts out empty. */
+
+#define MUVUKU_KV_VERSION (2)
+
+
+/* Maximum number of keys:
+    Keys are small integers, from zero up to (but not including)
+    this value. Each key costs two bytes of RAM while a store is open. */
+
+#ifndef MUVUKU_KV_KEYS_MAX
+    #define MUVUKU_KV_KEYS_MAX (16)
+#endif /* MUVUKU_KV_KEYS_MAX */
+
+
+/* Null value for index entries */
+#define MUVUKU_KV_NONE (0xffff)
+
+
+typedef u8 muvuku_kv_key_t;
+
+
+/* Persistent header:
+    The `used` field is written last, during a commit; records
+    beyond it are ignored, so an interrupted append is harmless.
+    The `generation` field tells the two halves apart; see below. */
+
+typedef struct muvuku_kv_header {
+
+    u16 magic;
+    u8 version;
+    u8 generation;
+    u16 used;
+
+} __attribute__((packed)) muvuku_kv_header_t;
+
+
+/* Single record:
+    Records are appended, never modified in place. The most
+    recent record for a given key holds that key's value. */
+
+typedef struct muvuku_kv_record {
+
+    muvuku_kv_key_t key;
+    u8 len;
+    u8 data[]; /* ... */
+
+} __attribute__((packed)) muvuku_kv_record_t;
+
+
+/* Persistent storage for key-value store:
+    A store is made up of two of these, each taking half of its
+    size. Appends go to the current half; compaction writes the
+    surviving records to the other half, with the next generation
+    number, and sets that half's magic value last. Until then, the
+    current half is untouched, so an interrupted compaction leaves
+    the store as it was. On open, the newest valid half wins. */
+
+typedef struct muvuku_kv_data {
+
+    muvuku_kv_header_t header;
+    u8 records[]; /* ... */
+
+} __attribute__((packed)) muvuku_kv_data_t;
+
+
+/* Opaque handle for persistent key-value store */
+typedef muvuku_kv_data_t* muvuku_kv_handle_t;
+
+
+/* In-core representation of key-value store:
+    The entire record log is copied to `image` when the store is
+    opened; reads never touch persistent memory after that. Bytes
+    in `image` beyond `committed` have not been written back yet.
+    If `compacted` is set, the next commit writes the whole image
+    to the other half of the store, rather than to `bank`. */
+
+typedef struct muvuku_kv {
+
+    muvuku_allocator_t *allocator;
+    muvuku_kv_data_t *store;
+
+    u8 *image;
+    u8 dirty;
+    u8 compacted;
+
+    u8 bank;
+    u8 generation;
+
+    u16 used;
+    u16 committed;
+    u16 capacity;
+
+    u16 index[MUVUKU_KV_KEYS_MAX];
+
+} muvuku_kv_t;
+
+
+muvuku_kv_handle_t muvuku_kv_new(muvuku_allocator_t *a, size_t size);
+
+void muvuku_kv_delete(muvuku_allocator_t *a, muvuku_kv_handle_t h);
+
+muvuku_kv_t *muvuku_kv_open(muvuku_allocator_t *a,
+                            muvuku_kv_handle_t h, size_t size);
+
+void muvuku_kv_close(muvuku_kv_t *kv);
+
+size_t muvuku_kv_get(muvuku_kv_t *kv,
+                     muvuku_kv_key_t key, void *buf, size_t n);
+
+u8 muvuku_kv_set(muvuku_kv_t *kv,
+                 muvuku_kv_key_t key, void *data, size_t len);
+
+u8 muvuku_kv_commit(muvuku_kv_t *kv);
+
+
+#endif /* __MUVUKU_KV_H__ */
+
@@ -92,6 +92,8 @@
 
     #define progmem_write(dst, src) _prototype_progmem_write(dst, src)
 
+    unsigned long muvuku_prototype_page_writes = 0;
+
     void _prototype_progmem_write(void *dst, void *src) {
 
         /* Simulated alignment requirement:
@@ -104,6 +106,7 @@
         }
 
         memcpy(dst, src, MUVUKU_PAGE_SIZE);
+        muvuku_prototype_page_writes++;
 
         #ifdef _MUVUKU_PROTOTYPE_DEBUG
             printf(
@@ -204,6 +207,14 @@
 u8 *muvuku_flash_buffer = NULL;
 
 
+/* Current flash memory region:
+    This is the extent table most recently used by the flash
+    memory allocator. It's used to locate an allocation's extent
+    when that allocation is returned to `muvuku_flash_free`. */
+
+muvuku_flash_region_t *muvuku_flash_region = NULL;
+
+
 /**
  * Find the first non-zero bit in a machine word, starting with
  * the least significant bit as offset 1. Viewed another way,
@@ -410,29 +421,141 @@ muvuku_allocator_t muvuku_eeprom_allocator = {
 
 
 /**
- * Allocator:
- *  AVR flash memory, also known as progmem. This can be
- *  used for persistent storage of relatively large objects.
+ * Counter:
+ *  A persistent 32-bit value that is rewritten often. Updates rotate
+ *  through `MUVUKU_COUNTER_SLOTS` slots, dividing wear between them.
+ */
+
+/**
+ * Allocate a new counter using the allocator `a` (typically EEPROM),
+ * with a value of zero. Returns a handle for `muvuku_counter_open`,
+ * or null if allocation failed.
  */
+muvuku_counter_handle_t muvuku_counter_new(muvuku_allocator_t *a) {
 
-void *muvuku_flash_alloc(size_t unused, void *region_ptr) {
+    size_t size = sizeof(muvuku_counter_slot_t) * MUVUKU_COUNTER_SLOTS;
+    muvuku_counter_slot_t *rv = (muvuku_counter_slot_t *) a->alloc(size, NULL);
 
-    /* Round up to page boundary:
-        Alignment may result in less available space than anticipated. */
+    if (rv != NULL) {
+        /* Equal tags:
+            The first slot is current, and every value is zero. */
+        a->zero(rv, size);
+    }
 
-    return muvuku_align_page(region_ptr, void, TRUE);
+    return rv;
 }
 
 
-void muvuku_flash_free(void *x) {
+/**
+ * Permanently destroy the counter `h`, and return its memory
+ * to the allocator `a`.
+ */
+void muvuku_counter_delete(muvuku_allocator_t *a,
+                           muvuku_counter_handle_t h) {
+    if (h != NULL) {
+        a->free(h);
+    }
+}
 
-    /* No-op:
-        No underlying allocator to which the region can be released. */
 
-    return;
+/**
+ * Open the counter `h`, finding its current slot with a single
+ * bulk read and scan. The current slot is the one whose successor's
+ * tag is not exactly one greater than its own.
+ */
+muvuku_counter_t *muvuku_counter_open(muvuku_allocator_t *a,
+                                      muvuku_counter_handle_t h) {
+
+    /* Pass-through for failed operations */
+    if (a == NULL || h == NULL) {
+        return NULL;
+    }
+
+    u8 i, next;
+    size_t size = sizeof(muvuku_counter_slot_t) * MUVUKU_COUNTER_SLOTS;
+
+    muvuku_counter_slot_t *slots = (muvuku_counter_slot_t *) xmalloc(size);
+    muvuku_counter_t *rv = (muvuku_counter_t *) xmalloc(sizeof(*rv));
+
+    a->read(slots, h, size);
+
+    for (i = 0; i < MUVUKU_COUNTER_SLOTS - 1; ++i) {
+        next = i + 1;
+        if (slots[next].tag != (u8) (slots[i].tag + 1)) {
+            break;
+        }
+    }
+
+    rv->allocator = a;
+    rv->slots = h;
+    rv->current = i;
+    rv->tag = slots[i].tag;
+    rv->value = slots[i].value;
+
+    free(slots);
+    return rv;
+}
+
+
+/**
+ * Free the in-core representation of a counter. Counter updates
+ * are written through immediately, so there is nothing to save.
+ */
+void muvuku_counter_close(muvuku_counter_t *c) {
+
+    free(c);
+}
+
+
+/**
+ * Return the current value of the counter `c`.
+ */
+uint32_t muvuku_counter_value(muvuku_counter_t *c) {
+
+    return c->value;
+}
+
+
+/**
+ * Set the counter `c` to `value`. This writes the slot after the
+ * current one: first the value, and then (to make it current) the tag.
+ */
+void muvuku_counter_set(muvuku_counter_t *c, uint32_t value) {
+
+    muvuku_allocator_t *a = c->allocator;
+
+    u8 tag = c->tag + 1;
+    u8 next = (c->current + 1) % MUVUKU_COUNTER_SLOTS;
+
+    a->write(&c->slots[next].value, &value, sizeof(value));
+    a->write(&c->slots[next].tag, &tag, sizeof(tag));
+
+    c->tag = tag;
+    c->current = next;
+    c->value = value;
+}
+
+
+/**
+ * Add `n` to the counter `c`, and return its new value. Adding
+ * zero doesn't write anything.
+ */
+uint32_t muvuku_counter_add(muvuku_counter_t *c, uint32_t n) {
+
+    if (n != 0) {
+        muvuku_counter_set(c, c->value + n);
+    }
+
+    return c->value;
 }
 
 
+/**
+ * Allocator:
+ *  AVR flash memory, also known as progmem. This can be
+ *  used for persistent storage of relatively large objects.
+ */
+
 void muvuku_flash_read(void *buf, void *x, size_t n) {
 
     /* Read interface is identical to EEPROM */
@@ -556,6 +679,284 @@ void muvuku_flash_zero(void *x, size_t n) {
 }
 
 
+/**
+ * Find the extent table for a flash region. If `region_ptr` is
+ * null, use the region most recently passed to either this function
+ * or `muvuku_flash_region_init`. Returns null if no valid table
+ * exists; otherwise, copies the table in to `t` and returns the
+ * (page-aligned) address of the table in flash memory.
+ */
+muvuku_flash_region_t *_muvuku_flash_region(void *region_ptr,
+                                            muvuku_flash_region_t *t) {
+
+    muvuku_flash_region_t *r = muvuku_flash_region;
+
+    if (region_ptr != NULL) {
+        r = muvuku_align_page(region_ptr, muvuku_flash_region_t, TRUE);
+    }
+
+    if (r == NULL) {
+        return NULL;
+    }
+
+    muvuku_flash_read(t, r, sizeof(*t));
+
+    if (t->magic != MUVUKU_FLASH_REGION_MAGIC) {
+        return NULL;
+    }
+
+    muvuku_flash_region = r;
+    return r;
+}
+
+
+/**
+ * Find the first run of at least `n` free pages in the extent
+ * table `t`. Returns the relative page number of the run's first
+ * page, or zero (i.e. the table's own page) if no run is large
+ * enough. If `largest` is non-null, the length (in pages) of the
+ * largest free run is written to the location it points to.
+ */
+u16 _muvuku_flash_region_fit(muvuku_flash_region_t *t,
+                             u16 n, u16 *largest) {
+
+    u16 rv = 0;
+    unsigned int i;
+    u16 start = 1;
+
+    if (largest) {
+        *largest = 0;
+    }
+
+    /* Walk free runs in address order:
+        Each run begins at the page following an extent (or
+        the table page), and ends at the next extent up. */
+
+    while (start < t->page_count) {
+
+        u16 end = t->page_count, next = t->page_count;
+
+        for (i = 0; i < MUVUKU_FLASH_EXTENTS_MAX; ++i) {
+
+            muvuku_flash_extent_t *e = &t->extents[i];
+            u16 e_end = e->first_page + e->page_count;
+
+            if (e->page_count == 0 || e_end <= start) {
+                continue;
+            }
+
+            if (e->first_page <= start) {
+                /* Inside an extent: skip past it */
+                end = start;
+                next = scalar_min(next, e_end);
+                break;
+            }
+
+            end = scalar_min(end, e->first_page);
+            next = scalar_min(next, e_end);
+        }
+
+        if (end > start) {
+
+            if (largest) {
+                *largest = scalar_max(*largest, end - start);
+            }
+
+            if (!rv && n > 0 && (end - start) >= n) {
+                rv = start;
+            }
+        }
+
+        start = (end > start ? end : next);
+    }
+
+    return rv;
+}
+
+
+/**
+ * Prepare the flash memory at `region_ptr` (of length `size`)
+ * for use with the flash memory allocator. The first page-aligned
+ * page of the region is used for a persistent table of extents. If
+ * a valid table is already present, it's left untouched; otherwise,
+ * an empty table is written. Returns the address of the table, or
+ * null if the region is too small to contain at least one page.
+ */
+muvuku_flash_region_t *muvuku_flash_region_init(void *region_ptr,
+                                                size_t size) {
+
+    muvuku_flash_region_t *rv =
+        muvuku_align_page(region_ptr, muvuku_flash_region_t, TRUE);
+
+    size_t skip = ((u8 *) rv - (u8 *) region_ptr);
+
+    if (rv == NULL || size <= skip) {
+        return NULL;
+    }
+
+    u16 page_count = ((size - skip) >> MUVUKU_PAGE_SHIFT);
+
+    /* Table page plus one data page */
+    if (page_count < 2) {
+        return NULL;
+    }
+
+    muvuku_flash_region_t *t =
+        (muvuku_flash_region_t *) xmalloc(sizeof(*t));
+
+    muvuku_flash_read(t, rv, sizeof(*t));
+
+    /* Existing table?
+        If the size changed, the region's been reinstalled. */
+
+    if (t->magic != MUVUKU_FLASH_REGION_MAGIC ||
+            t->page_count != page_count) {
+
+        memset(t, 0, sizeof(*t));
+
+        t->magic = MUVUKU_FLASH_REGION_MAGIC;
+        t->page_count = page_count;
+
+        muvuku_flash_write(rv, t, sizeof(*t));
+    }
+
+    free(t);
+    muvuku_flash_region = rv;
+
+    return rv;
+}
+
+
+/**
+ * Return the size, in bytes, of the largest allocation that could
+ * currently be satisfied from the flash memory region `r`. This
+ * is always a whole number of pages, and is zero if the region's
+ * extent table has no free slots remaining.
+ */
+size_t muvuku_flash_region_available(muvuku_flash_region_t *r) {
+
+    size_t rv = 0;
+    unsigned int i;
+
+    muvuku_flash_region_t *t =
+        (muvuku_flash_region_t *) xmalloc(sizeof(*t));
+
+    if (!_muvuku_flash_region(r, t)) {
+        goto exit;
+    }
+
+    for (i = 0; i < MUVUKU_FLASH_EXTENTS_MAX; ++i) {
+
+        if (t->extents[i].page_count == 0) {
+
+            u16 largest = 0;
+            _muvuku_flash_region_fit(t, 0, &largest);
+
+            rv = ((size_t) largest << MUVUKU_PAGE_SHIFT);
+            break;
+        }
+    }
+
+    exit:
+        free(t);
+        return rv;
+}
+
+
+/**
+ * Allocate a page-aligned run of whole pages, large enough to hold
+ * `n` bytes, from the flash memory region at `region_ptr`. The
+ * region must have been prepared with `muvuku_flash_region_init`.
+ * Allocations are recorded in the region's extent table, so they
+ * survive power cycles and can later be returned with `free`.
+ */
+void *muvuku_flash_alloc(size_t n, void *region_ptr) {
+
+    void *rv = NULL;
+    unsigned int i;
+
+    muvuku_flash_region_t *t =
+        (muvuku_flash_region_t *) xmalloc(sizeof(*t));
+
+    muvuku_flash_region_t *r = _muvuku_flash_region(region_ptr, t);
+
+    if (r == NULL || n <= 0) {
+        goto exit;
+    }
+
+    /* Whole pages only */
+    u16 pages = ((n + MUVUKU_PAGE_SIZE - 1) >> MUVUKU_PAGE_SHIFT);
+
+    for (i = 0; i < MUVUKU_FLASH_EXTENTS_MAX; ++i) {
+
+        muvuku_flash_extent_t *e = &t->extents[i];
+
+        if (e->page_count != 0) {
+            continue;
+        }
+
+        /* First fit:
+            Regions are small, and there are few extents. */
+
+        u16 first_page = _muvuku_flash_region_fit(t, pages, NULL);
+
+        if (first_page == 0) {
+            goto exit;
+        }
+
+        e->first_page = first_page;
+        e->page_count = pages;
+
+        muvuku_flash_write(&r->extents[i], e, sizeof(*e));
+        rv = (void *) ((u8 *) r + (first_page << MUVUKU_PAGE_SHIFT));
+
+        break;
+    }
+
+    exit:
+        free(t);
+        return rv;
+}
+
+
+/**
+ * Return the extent beginning at `x` to the flash memory region
+ * from which it was allocated. The pages aren't erased; they're
+ * simply made available for use by subsequent allocations.
+ */
+void muvuku_flash_free(void *x) {
+
+    unsigned int i;
+
+    muvuku_flash_region_t *t =
+        (muvuku_flash_region_t *) xmalloc(sizeof(*t));
+
+    muvuku_flash_region_t *r = _muvuku_flash_region(NULL, t);
+
+    if (r == NULL || (u8 *) x <= (u8 *) r) {
+        goto exit;
+    }
+
+    u16 page = (((u8 *) x - (u8 *) r) >> MUVUKU_PAGE_SHIFT);
+
+    for (i = 0; i < MUVUKU_FLASH_EXTENTS_MAX; ++i) {
+
+        muvuku_flash_extent_t *e = &t->extents[i];
+
+        if (e->page_count != 0 && e->first_page == page) {
+
+            memset(e, 0, sizeof(*e));
+            muvuku_flash_write(&r->extents[i], e, sizeof(*e));
+
+            break;
+        }
+    }
+
+    exit:
+        free(t);
+}
+
+
 muvuku_allocator_t muvuku_flash_allocator = {
 
     /* Linker issue:
@@ -570,11 +971,14 @@ muvuku_allocator_t muvuku_flash_allocator = {
 /**
  * Create a new memory pool comprised of `n` objects,
  * occupying a total size `size`. Use a single contiguous
- * allocation from the memory allocator function `a`.
+ * allocation from the memory allocator function `a`. If
+ * `flags` contains `PL_PAGE_ALIGNED`, the pool's metadata is
+ * given page(s) of its own, and every cell starts on a page
+ * boundary and occupies a whole number of pages.
  */
-muvuku_pool_t *muvuku_pool_new(muvuku_allocator_t *a, size_t size,
-                               unsigned int n, void *allocate_options) {
-
+muvuku_pool_t *_muvuku_pool_new(muvuku_allocator_t *a, size_t size,
+                                unsigned int n, void *allocate_options,
+                                unsigned int flags) {
     int overflow = FALSE;
 
     /* Length of free-space map:
@@ -590,18 +994,23 @@ muvuku_pool_t *muvuku_pool_new(muvuku_allocator_t *a, size_t size,
     }
 
     /* Structure size:
-        Total size is struct + free-space map + data blocks. */
+        Total size is struct + free-space map +
+        per-cell wear counters + data blocks. */
 
     size_t bitmap_size = safe_multiply(
         bitmap_length, sizeof(muvuku_word_t), &overflow
     );
-    
-    size_t data_size = safe_subtract(
-        size, safe_add(bitmap_size, sizeof(muvuku_pool_data_t), &overflow),
-            &overflow
+
+    size_t wear_size = safe_multiply(
+        n, sizeof(muvuku_pool_wear_t), &overflow
+    );
+
+    size_t header_size = safe_add(
+        safe_add(bitmap_size, wear_size, &overflow),
+            sizeof(muvuku_pool_data_t), &overflow
     );
 
-    if (overflow) {
+    if (overflow || n <= 0 || size <= header_size) {
         return NULL;
     }
 
@@ -613,6 +1022,37 @@ muvuku_pool_t *muvuku_pool_new(muvuku_allocator_t *a, size_t size,
         size, allocate_options
     );
 
+    if (p == NULL) {
+        return NULL;
+    }
+
+    /* Cell placement:
+        By default, cells are packed in right after the metadata.
+        Page-aligned pools start cells at the next page boundary,
+        and round each cell down to a whole number of pages. */
+
+    size_t cell_offset = header_size;
+
+    if (flags & PL_PAGE_ALIGNED) {
+        unsigned char *cells = muvuku_align_page(
+            (unsigned char *) p + header_size, unsigned char, TRUE
+        );
+        cell_offset = (cells - (unsigned char *) p);
+    }
+
+    size_t cell_size = (
+        (cell_offset < size) ? (size - cell_offset) / n : 0
+    );
+
+    if (flags & PL_PAGE_ALIGNED) {
+        cell_size &= ~((size_t) MUVUKU_PAGE_SIZE - 1);
+    }
+
+    if (cell_size <= 0) {
+        a->free(p);
+        return NULL;
+    }
+
     /* Zero entire persistent structure:
         This is important, because it zeros the memory
         that will soon be occupied by the free-space bitmap. */
@@ -627,7 +1067,8 @@ muvuku_pool_t *muvuku_pool_new(muvuku_allocator_t *a, size_t size,
 
     pool->item_count = 0;
     pool->item_limit = n;
-    pool->cell_size = data_size / n;
+    pool->cell_size = cell_size;
+    pool->cell_offset = cell_offset;
     pool->bitmap_length = bitmap_length;
 
     a->write(p, pool, sizeof(*pool));
@@ -637,6 +1078,35 @@ muvuku_pool_t *muvuku_pool_new(muvuku_allocator_t *a, size_t size,
 }
 
 
+/**
+ * Create a new memory pool with cells packed immediately after
+ * the pool's metadata. This is the most space-efficient layout.
+ */
+muvuku_pool_t *muvuku_pool_new(muvuku_allocator_t *a, size_t size,
+                               unsigned int n, void *allocate_options) {
+
+    return _muvuku_pool_new(a, size, n, allocate_options, PL_NONE);
+}
+
+
+/**
+ * Create a new memory pool with page-aligned, page-sized cells.
+ * This wastes up to a page per cell (plus the remainder of the
+ * metadata page), but a write to one cell never shares a page
+ * with the metadata or another cell. This is the layout to use
+ * with the flash memory allocator, whose partial-page writes
+ * require a read-modify-write of the entire page.
+ */
+muvuku_pool_t *muvuku_pool_new_aligned(muvuku_allocator_t *a,
+                                       size_t size, unsigned int n,
+                                       void *allocate_options) {
+
+    return _muvuku_pool_new(
+        a, size, n, allocate_options, PL_PAGE_ALIGNED
+    );
+}
+
+
 /**
  */
 muvuku_pool_t *muvuku_pool_open(muvuku_allocator_t *a,
@@ -728,23 +1198,48 @@ muvuku_word_t _muvuku_pool_bitmap(muvuku_pool_t *p,
 
 
 /**
- * Given a one-based cell number (which identifies a distinct storage
- * location in the pool), return a pointer to the memory region it
- * occupies. Note that, in the underscore-prefixed version, `rp`
- * must point to a copy of `p` that resides in *main memory* -- e.g.
- * the pool structure (minus data from its free-space map and actual
- * data cells) must be copied in to RAM before being passed to this
- * function. If you want this done for you, use the exported version.
+ * Return a pointer to the array of per-cell wear counters, which
+ * immediately follows the free-space bitmap. As with the functions
+ * below, `rp` must point to a copy of `p` in *main memory*.
  */
-void *_muvuku_pool_address(muvuku_pool_t *p,
-                           muvuku_pool_data_t *rp, muvuku_cell_t c) {
+muvuku_pool_wear_t *_muvuku_pool_wear(muvuku_pool_t *p,
+                                      muvuku_pool_data_t *rp) {
+
+    return (muvuku_pool_wear_t *) &p->pool->data[rp->bitmap_length].raw;
+}
+
+
+/**
+ * Return a pointer to the first cell of the pool `p`. The cells
+ * follow the wear counters, either immediately or at the next page
+ * boundary (see `muvuku_pool_new_aligned`). As with the functions
+ * below, `rp` must point to a copy of `p` in *main memory*.
+ */
+unsigned char *_muvuku_pool_cells(muvuku_pool_t *p,
+                                  muvuku_pool_data_t *rp) {
+
+    return ((unsigned char *) p->pool + rp->cell_offset);
+}
+
+
+/**
+ * Given a one-based cell number (which identifies a distinct storage
+ * location in the pool), return a pointer to the memory region it
+ * occupies. Note that, in the underscore-prefixed version, `rp`
+ * must point to a copy of `p` that resides in *main memory* -- e.g.
+ * the pool structure (minus data from its free-space map and actual
+ * data cells) must be copied in to RAM before being passed to this
+ * function. If you want this done for you, use the exported version.
+ */
+void *_muvuku_pool_address(muvuku_pool_t *p,
+                           muvuku_pool_data_t *rp, muvuku_cell_t c) {
 
     if (c == INVALID_CELL) {
         return NULL;
     }
 
     return (void *) (
-        &p->pool->data[rp->bitmap_length].raw + (rp->cell_size * (c - 1))
+        _muvuku_pool_cells(p, rp) + (rp->cell_size * (c - 1))
     );
 }
 
@@ -795,7 +1290,7 @@ muvuku_cell_t _muvuku_pool_cell(muvuku_pool_t *p,
                                 muvuku_pool_data_t *rp, void *x) {
 
     return (muvuku_cell_t) (
-        (((unsigned char *) x - &p->pool->data[rp->bitmap_length].raw)
+        (((unsigned char *) x - _muvuku_pool_cells(p, rp))
             / rp->cell_size) + 1
     );
 }
@@ -842,15 +1337,80 @@ muvuku_cell_t muvuku_pool_cell(muvuku_pool_t *p, void *x) {
  * Interrogate the one-based cell number `cell` in the pool `p`.
  * Returns an integer value describing the state of the cell, with
  * the lowest-order bit set if and only if the cell is in use
- * (that is, the cell has been acquired and not yet freed).
+ * (that is, the cell has been acquired and not yet freed). The
+ * cell's wear counters are returned in the remaining bits; use
+ * `muvuku_cellinfo_generation` and `muvuku_cellinfo_erases`.
  */
 muvuku_cellinfo_t muvuku_pool_cellinfo(muvuku_pool_t *p,
                                        muvuku_cell_t cell) {
 
+    muvuku_cellinfo_t rv = 0;
     muvuku_word_t bitmap = 0;
     muvuku_word_t bit = _muvuku_pool_bitmap(p, &bitmap, NULL, cell);
 
-    return (bit && (bitmap & (1 << (bit - 1))) ? 1 : 0);
+    if (!bit) {
+        return rv;
+    }
+
+    if (bitmap & ((muvuku_word_t) 1 << (bit - 1))) {
+        rv |= CL_OCCUPIED;
+    }
+
+    muvuku_pool_wear_t w;
+    muvuku_pool_data_t *pool =
+        (muvuku_pool_data_t *) xmalloc(sizeof(*pool));
+
+    _read_pool_value(p, *pool, *p->pool);
+
+    if (cell <= pool->item_limit) {
+
+        _read_pool_value(p, w, _muvuku_pool_wear(p, pool)[cell - 1]);
+
+        rv |= ((muvuku_cellinfo_t)
+            (w.generation & CL_GENERATION_MASK) << CL_GENERATION_SHIFT);
+
+        rv |= ((muvuku_cellinfo_t)
+            (w.erase_count & CL_ERASES_MASK) << CL_ERASES_SHIFT);
+    }
+
+    free(pool);
+    return rv;
+}
+
+
+/**
+ * Record that the contents of the cell at `x` have been discarded,
+ * and that the cell is about to be rewritten from the beginning.
+ * This increments the cell's erase count, which is used by
+ * `muvuku_pool_acquire` to spread wear evenly across cells.
+ */
+void muvuku_pool_mark_erased(muvuku_pool_t *p, void *x) {
+
+    muvuku_pool_wear_t w;
+
+    muvuku_pool_data_t *pool =
+        (muvuku_pool_data_t *) xmalloc(sizeof(*pool));
+
+    _read_pool_value(p, *pool, *p->pool);
+    muvuku_cell_t c = _muvuku_pool_cell(p, pool, x);
+
+    if (x == NULL || c <= 0 || c > pool->item_limit) {
+        goto exit;
+    }
+
+    muvuku_pool_wear_t *pw = &_muvuku_pool_wear(p, pool)[c - 1];
+    _read_pool_value(p, w, *pw);
+
+    /* Saturate rather than wrap:
+        A wrapped count would make a worn cell look brand new. */
+
+    if (w.erase_count < CL_ERASES_MASK) {
+        w.erase_count++;
+        _write_pool_value(p, *pw, w);
+    }
+
+    exit:
+        free(pool);
 }
 
 
@@ -890,12 +1450,19 @@ void muvuku_pool_read(muvuku_pool_t *p, void *data, void *x, size_t n) {
 }
 
 /**
- * Get a new fixed-size block of memory from the pool.
+ * Get a new fixed-size block of memory from the pool. When more
+ * than one cell is free, the cell with the lowest erase count is
+ * chosen; ties go to the cell that has been acquired least often,
+ * and then to the lowest-numbered cell.
  */
 void *muvuku_pool_acquire(muvuku_pool_t *p) {
 
     void *rv = NULL;
-    unsigned int i, bit = 0;
+
+    size_t i, best_i = 0;
+    muvuku_cell_t c, best = INVALID_CELL;
+    muvuku_word_t bitmap = 0, bit = 0, best_bitmap = 0, best_bit = 0;
+    muvuku_pool_wear_t w, best_w = { 0, 0 };
 
     muvuku_pool_data_t *pool =
         (muvuku_pool_data_t *) xmalloc(sizeof(*pool));
@@ -906,50 +1473,51 @@ void *muvuku_pool_acquire(muvuku_pool_t *p) {
         If we've reached the item limit, fail. */
 
     if (pool->item_count >= pool->item_limit) {
-        return NULL;
+        goto exit;
     }
 
-    for (i = 0; i < pool->bitmap_length; ++i) {
-
-        muvuku_word_t bitmap = 0;
-        _read_pool_value(p, bitmap, p->pool->data[i].bitmap);
+    muvuku_pool_wear_t *wear = _muvuku_pool_wear(p, pool);
 
-        if ((bit = find_first_zero(bitmap)) <= 0) {
+    for (c = 1; c <= pool->item_limit; ++c) {
 
-            /* No space available:
-                Go around and check the next machine word.
-                If there's no more index space available, and
-                we manage to get to this point somehow, bail. */
+        bit = _muvuku_pool_bitmap(p, &bitmap, &i, c);
 
-            if (i + 1 >= pool->bitmap_length) {
-                goto exit;
-            }
-
-        } else {
+        /* Skip cells that are in use */
+        if (bitmap & ((muvuku_word_t) 1 << (bit - 1))) {
+            continue;
+        }
 
-            /* Found block: mark as in-use */
-            bitmap |= (1 << (bit - 1));
-            pool->item_count++;
+        _read_pool_value(p, w, wear[c - 1]);
 
-            /* Write modified values back */
-            _write_pool_value(p, p->pool->data[i].bitmap, bitmap);
-            _write_pool_value(p, p->pool->item_count, pool->item_count);
+        /* Least-worn free cell so far? */
+        if (best == INVALID_CELL ||
+            w.erase_count < best_w.erase_count ||
+                (w.erase_count == best_w.erase_count &&
+                    w.generation < best_w.generation)) {
 
-            break;
+            best = c; best_w = w;
+            best_i = i; best_bit = bit; best_bitmap = bitmap;
         }
     }
 
-    /* Sanity check */
-    if (bit == 0) {
-        return NULL;
+    /* Sanity check:
+        The bitmap disagrees with the item count; bail. */
+
+    if (best == INVALID_CELL) {
+        goto exit;
     }
 
-    /* Use a one-based bit index as a one-based cell:
-        Then, return a pointer to the computed cell's memory region. */
+    /* Found block: mark as in-use */
+    best_bitmap |= ((muvuku_word_t) 1 << (best_bit - 1));
+    pool->item_count++;
+    best_w.generation++;
 
-    rv = _muvuku_pool_address(
-        p, pool, (i * sizeof(muvuku_word_t)) + bit
-    );
+    /* Write modified values back */
+    _write_pool_value(p, p->pool->data[best_i].bitmap, best_bitmap);
+    _write_pool_value(p, p->pool->item_count, pool->item_count);
+    _write_pool_value(p, wear[best - 1], best_w);
+
+    rv = _muvuku_pool_address(p, pool, best);
 
     exit:
         free(pool);
@@ -984,12 +1552,13 @@ muvuku_pool_t *muvuku_pool_release(muvuku_pool_t *p, void *x) {
     muvuku_word_t bit = _muvuku_pool_bitmap(p, &bitmap, &i, c);
 
     /* Check bit: if already free, exit */
-    if (!bit || (bitmap & (1 << (bit - 1))) == 0) {
+    if (!bit || (bitmap & ((muvuku_word_t) 1 << (bit - 1))) == 0) {
+        free(pool);
         return NULL;
     }
 
     /* Clear bit: block no longer in use */
-    bitmap &= ~(1 << (bit - 1));
+    bitmap &= ~((muvuku_word_t) 1 << (bit - 1));
 
     /* Decrement item count */
     pool->item_count--;
@@ -998,6 +1567,7 @@ muvuku_pool_t *muvuku_pool_release(muvuku_pool_t *p, void *x) {
     _write_pool_value(p, p->pool->data[i].bitmap, bitmap);
     _write_pool_value(p, p->pool->item_count, pool->item_count);
 
+    free(pool);
     return p;
 }
 
@@ -1041,18 +1611,30 @@ void muvuku_stringlist_close(muvuku_stringlist_t *l) {
  */
 muvuku_stringlist_t *muvuku_stringlist_init(muvuku_pool_t *p, void *addr) {
 
-    muvuku_stringlist_data_t *list =
-        (muvuku_stringlist_data_t *) xmalloc(sizeof(*list));
+    muvuku_stringlist_data_t list, current;
+    muvuku_stringlist_data_t *l = (muvuku_stringlist_data_t *) addr;
 
-    list->item_count = 0;
+    list.item_count = 0;
 
-    list->bytes_remaining =
+    list.bytes_remaining =
         muvuku_pool_cell_size(p) - sizeof(muvuku_stringlist_data_t);
 
-    /* Copy to persistent storage */
-    muvuku_stringlist_data_t *l = (muvuku_stringlist_data_t *) addr;
-    _write_pool_value(p, *l, *list);
-    free(list);
+    /* Already empty?
+        Nothing is discarded, so neither the list header nor the
+        cell's wear counters need to be written again. */
+
+    _read_pool_value(p, current, *l);
+
+    if (memcmp(&current, &list, sizeof(list)) != 0) {
+
+        /* Copy to persistent storage */
+        _write_pool_value(p, *l, list);
+
+        /* Starting over:
+            Every string in the cell will be written afresh. */
+
+        muvuku_pool_mark_erased(p, addr);
+    }
 
     return muvuku_stringlist_open(p, l);
 }
@@ -1134,6 +1716,137 @@ int muvuku_stringlist_add(muvuku_stringlist_t *l,
 }
 
 
+/**
+ * Write out whatever the writer `w` has staged, if anything.
+ */
+static void _muvuku_stringlist_flush(muvuku_stringlist_writer_t *w) {
+
+    if (w->staged > 0) {
+        w->list->pool->allocator->write(w->staged_at, w->stage, w->staged);
+        w->staged = 0;
+    }
+}
+
+
+/**
+ * Stage `len` bytes from `src` for the location the writer `w` has
+ * reached, writing out the stage each time it reaches a page
+ * boundary. The stage never reaches back before the first byte
+ * staged, so nothing outside the string is ever rewritten.
+ */
+static void _muvuku_stringlist_stage(muvuku_stringlist_writer_t *w,
+                                     const void *src, size_t len) {
+
+    const u8 *p = (const u8 *) src;
+
+    while (len > 0) {
+
+        if (w->staged == 0) {
+            w->staged_at = w->dst;
+        }
+
+        size_t room = MUVUKU_PAGE_SIZE - w->staged - (
+            (muvuku_intptr_t) w->staged_at & (MUVUKU_PAGE_SIZE - 1)
+        );
+
+        size_t n = scalar_min(len, room);
+
+        memcpy(&w->stage[w->staged], p, n);
+
+        w->staged += n;
+        w->dst += n;
+        p += n; len -= n;
+
+        if (n == room) {
+            _muvuku_stringlist_flush(w);
+        }
+    }
+}
+
+
+/**
+ * Start adding a byte string of exactly `len` bytes to the packed
+ * stringlist `l`, using the writer `w`. The string's contents are
+ * then supplied with `muvuku_stringlist_write`, and the string is
+ * added by `muvuku_stringlist_end`. Returns false if there is
+ * insufficient space; nothing is written in that case.
+ */
+int muvuku_stringlist_begin(muvuku_stringlist_t *l,
+                            muvuku_stringlist_writer_t *w,
+                            muvuku_string_size_t len) {
+    muvuku_stringlist_data_t list;
+
+    _read_pool_value(l->pool, list, *l->list);
+
+    size_t necessary = len + sizeof(muvuku_string_t);
+    size_t total_size = _muvuku_stringlist_size(l, &list);
+
+    if (len <= 0 || list.bytes_remaining < necessary) {
+        return FALSE;
+    }
+
+    muvuku_string_t *str = (muvuku_string_t *) (
+        (char *) l->list->strings + total_size
+    );
+
+    w->list = l;
+    w->dst = (char *) &str->len;
+    w->len = w->remaining = len;
+    w->staged = 0;
+
+    /* Past the end of the list until committed */
+    _muvuku_stringlist_stage(w, &len, sizeof(len));
+
+    return TRUE;
+}
+
+
+/**
+ * Write the next `len` bytes of the string being added with the
+ * writer `w` (passed as a pointer to void, so that this function
+ * can be used directly as an output sink). Fails, writing nothing,
+ * if this would exceed the length given to `muvuku_stringlist_begin`.
+ */
+int muvuku_stringlist_write(void *w, const char *src, size_t len) {
+
+    muvuku_stringlist_writer_t *sw = (muvuku_stringlist_writer_t *) w;
+
+    if (len > sw->remaining) {
+        return FALSE;
+    }
+
+    _muvuku_stringlist_stage(sw, src, len);
+    sw->remaining -= len;
+
+    return TRUE;
+}
+
+
+/**
+ * Finish adding the string started with `muvuku_stringlist_begin`.
+ * Returns false, leaving the list unchanged, if fewer bytes were
+ * written than were promised.
+ */
+int muvuku_stringlist_end(muvuku_stringlist_writer_t *w) {
+
+    muvuku_stringlist_t *l = w->list;
+    muvuku_stringlist_data_t list;
+
+    if (w->remaining > 0) {
+        return FALSE;
+    }
+
+    _muvuku_stringlist_flush(w);
+    _read_pool_value(l->pool, list, *l->list);
+
+    list.bytes_remaining -= (w->len + sizeof(muvuku_string_t));
+    list.item_count++;
+
+    _write_pool_value(l->pool, *l->list, list);
+    return TRUE;
+}
+
+
 /**
  * Iterate over some or all of the strings in the packed stringlist
  * `l` (residing inside of the pool `p`). The callback `fn will be
@@ -1187,6 +1900,306 @@ int muvuku_stringlist_each(muvuku_stringlist_t *l,
 }
 
 
+/**
+ * Return the number of strings in the packed stringlist `l`.
+ */
+size_t muvuku_stringlist_count(muvuku_stringlist_t *l) {
+
+    muvuku_stringlist_data_t list;
+
+    _read_pool_value(l->pool, list, *l->list);
+    return list.item_count;
+}
+
+
+/**
+ * Keep only those strings in the packed stringlist `l` for which
+ * the callback `fn` returns true, in their original order, and
+ * discard the rest. The callback is invoked exactly as it is by
+ * `muvuku_stringlist_each`, before the string it's given has been
+ * moved. Returns the number of strings discarded.
+ */
+size_t muvuku_stringlist_retain(muvuku_stringlist_t *l,
+                                muvuku_stringlist_fn_t fn, void *state) {
+
+    muvuku_stringlist_data_t list;
+    muvuku_allocator_t *a = l->pool->allocator;
+
+    _read_pool_value(l->pool, list, *l->list);
+
+    char *strings = (char *) l->list->strings;
+    size_t total_size = _muvuku_stringlist_size(l, &list);
+    size_t offset = 0, to = 0, pending = 0, rv = 0;
+
+    /* Compaction:
+        Kept strings move towards the start of the list, staged
+        through a page-sized buffer, so that each destination page
+        is written as few times as possible. Writes always trail
+        reads, so nothing is overwritten before it has been read. */
+
+    char *buf = NULL;
+
+    while (offset < total_size) {
+
+        muvuku_string_t *str = (muvuku_string_t *) (strings + offset);
+
+        muvuku_string_size_t len;
+        _read_pool_value(l->pool, len, str->len);
+
+        size_t n = sizeof(muvuku_string_t) + len;
+
+        if (!fn(l, str->string, (size_t) len, state)) {
+            offset += n;
+            rv++;
+            continue;
+        }
+
+        /* Still in place */
+        if (rv == 0) {
+            offset += n;
+            to += n;
+            continue;
+        }
+
+        if (buf == NULL) {
+            buf = (char *) xmalloc(MUVUKU_PAGE_SIZE);
+        }
+
+        while (n > 0) {
+
+            size_t k = scalar_min(n, MUVUKU_PAGE_SIZE - pending);
+
+            a->read(buf + pending, strings + offset, k);
+
+            offset += k;
+            pending += k;
+            n -= k;
+
+            if (pending == MUVUKU_PAGE_SIZE) {
+                a->write(strings + to, buf, pending);
+                to += pending;
+                pending = 0;
+            }
+        }
+    }
+
+    if (rv == 0) {
+        return rv;
+    }
+
+    if (pending > 0) {
+        a->write(strings + to, buf, pending);
+        to += pending;
+    }
+
+    free(buf);
+
+    list.item_count -= rv;
+    list.bytes_remaining += (total_size - to);
+
+    _write_pool_value(l->pool, *l->list, list);
+    muvuku_pool_mark_erased(l->pool, l->list);
+
+    return rv;
+}
+
+
+/**
+ * Return a new object representing the two-tier stringlist made
+ * up of `primary` and `overflow`. The new object takes ownership
+ * of both stringlists; `overflow` may be null. If `primary` is null,
+ * this function returns null and closes `overflow`, so that a failed
+ * pool/cell search can be nested directly.
+ */
+muvuku_tieredlist_t *muvuku_tieredlist_open(muvuku_stringlist_t *primary,
+                                            muvuku_stringlist_t *overflow) {
+    if (primary == NULL) {
+        if (overflow != NULL) {
+            muvuku_stringlist_close(overflow);
+        }
+        return NULL;
+    }
+
+    muvuku_tieredlist_t *rv =
+        (muvuku_tieredlist_t *) xmalloc(sizeof(*rv));
+
+    rv->primary = primary;
+    rv->overflow = overflow;
+
+    return rv;
+}
+
+
+/**
+ * Destroy an object in core memory that represents a tiered list,
+ * along with both of its stringlists. Persistent data is untouched.
+ */
+void muvuku_tieredlist_close(muvuku_tieredlist_t *t) {
+
+    if (t->overflow != NULL) {
+        muvuku_stringlist_close(t->overflow);
+    }
+
+    muvuku_stringlist_close(t->primary);
+    free(t);
+}
+
+
+/**
+ * Discard every string in both tiers of the tiered list `t`.
+ */
+void muvuku_tieredlist_init(muvuku_tieredlist_t *t) {
+
+    muvuku_stringlist_t *l = t->primary;
+    muvuku_stringlist_close(muvuku_stringlist_init(l->pool, l->list));
+
+    if ((l = t->overflow) != NULL) {
+        muvuku_stringlist_close(muvuku_stringlist_init(l->pool, l->list));
+    }
+}
+
+
+/**
+ * Add a byte string to the tiered list `t`. The string goes to
+ * the primary tier, unless it doesn't fit or something has already
+ * spilled over to the overflow tier. Returns true on success, or
+ * false if neither tier has sufficient space.
+ */
+int muvuku_tieredlist_add(muvuku_tieredlist_t *t,
+                          char *src, muvuku_string_size_t len) {
+
+    u8 spilled = (
+        t->overflow != NULL && muvuku_stringlist_size(t->overflow) > 0
+    );
+
+    if (!spilled && muvuku_stringlist_add(t->primary, src, len)) {
+        return TRUE;
+    }
+
+    if (t->overflow == NULL) {
+        return FALSE;
+    }
+
+    return muvuku_stringlist_add(t->overflow, src, len);
+}
+
+
+/**
+ * Start adding a byte string of exactly `len` bytes to the tiered
+ * list `t`. The tier is chosen just as it is by `muvuku_tieredlist_add`;
+ * the rest of the string is written with `muvuku_stringlist_write`
+ * and `muvuku_stringlist_end`.
+ */
+int muvuku_tieredlist_begin(muvuku_tieredlist_t *t,
+                            muvuku_stringlist_writer_t *w,
+                            muvuku_string_size_t len) {
+    u8 spilled = (
+        t->overflow != NULL && muvuku_stringlist_size(t->overflow) > 0
+    );
+
+    if (!spilled && muvuku_stringlist_begin(t->primary, w, len)) {
+        return TRUE;
+    }
+
+    if (t->overflow == NULL) {
+        return FALSE;
+    }
+
+    return muvuku_stringlist_begin(t->overflow, w, len);
+}
+
+
+/**
+ * Iterate over the strings in the tiered list `t`, in the order
+ * they were added. The callback is invoked exactly as it is by
+ * `muvuku_stringlist_each`; the stringlist it receives tells it
+ * which pool (and therefore which allocator) to read from.
+ */
+int muvuku_tieredlist_each(muvuku_tieredlist_t *t,
+                           muvuku_stringlist_fn_t fn, void *state) {
+
+    if (!muvuku_stringlist_each(t->primary, fn, state)) {
+        return FALSE;
+    }
+
+    if (t->overflow != NULL) {
+        return muvuku_stringlist_each(t->overflow, fn, state);
+    }
+
+    return TRUE;
+}
+
+
+/**
+ * Return the number of strings in both tiers of `t`.
+ */
+size_t muvuku_tieredlist_count(muvuku_tieredlist_t *t) {
+
+    size_t rv = muvuku_stringlist_count(t->primary);
+
+    if (t->overflow != NULL) {
+        rv += muvuku_stringlist_count(t->overflow);
+    }
+
+    return rv;
+}
+
+
+/**
+ * Keep only those strings in the tiered list `t` for which `fn`
+ * returns true, as `muvuku_stringlist_retain` does for each tier.
+ * Strings stay in insertion order. Returns the number discarded.
+ */
+size_t muvuku_tieredlist_retain(muvuku_tieredlist_t *t,
+                                muvuku_stringlist_fn_t fn, void *state) {
+
+    size_t rv = muvuku_stringlist_retain(t->primary, fn, state);
+
+    if (t->overflow != NULL) {
+        rv += muvuku_stringlist_retain(t->overflow, fn, state);
+    }
+
+    return rv;
+}
+
+
+/**
+ * Return the number of bytes in use across both tiers of `t`.
+ */
+size_t muvuku_tieredlist_size(muvuku_tieredlist_t *t) {
+
+    size_t rv = muvuku_stringlist_size(t->primary);
+
+    if (t->overflow != NULL) {
+        rv += muvuku_stringlist_size(t->overflow);
+    }
+
+    return rv;
+}
+
+
+/**
+ * Return the number of bytes available for strings (used or not)
+ * across both tiers of `t`, excluding each stringlist's header.
+ */
+size_t muvuku_tieredlist_capacity(muvuku_tieredlist_t *t) {
+
+    size_t rv = (
+        muvuku_pool_cell_size(t->primary->pool) -
+            sizeof(muvuku_stringlist_data_t)
+    );
+
+    if (t->overflow != NULL) {
+        rv += (
+            muvuku_pool_cell_size(t->overflow->pool) -
+                sizeof(muvuku_stringlist_data_t)
+        );
+    }
+
+    return rv;
+}
+
+
 /**
  * Initialize the pooled-storage subsystem. This function only has
  * a visible effect on the first call; subsequent calls are ignored.
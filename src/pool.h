@@ -20,6 +20,7 @@
 #define __MUVUKU_POOL_H__
 
 #include <stdint.h>
+#include <limits.h>
 
 #include "bladox.h"
 #include "prototype.h"
@@ -105,6 +106,121 @@ muvuku_allocator_t muvuku_ram_allocator;
 muvuku_allocator_t muvuku_flash_allocator;
 muvuku_allocator_t muvuku_eeprom_allocator;
 
+#ifdef _MUVUKU_PROTOTYPE
+  /* Number of flash pages programmed so far */
+  extern unsigned long muvuku_prototype_page_writes;
+#endif /* _MUVUKU_PROTOTYPE */
+
+
+
+/** @name muvuku_counter_t **/
+
+/* Number of slots per counter:
+    Each update is written to the slot after the current one, so
+    every slot sees 1/n of the writes. Must be less than 256. */
+
+#ifndef MUVUKU_COUNTER_SLOTS
+    #define MUVUKU_COUNTER_SLOTS (8)
+#endif /* MUVUKU_COUNTER_SLOTS */
+
+
+/* Single slot:
+    The `tag` of each slot is one greater than that of the slot
+    before it, except immediately after the current slot. The tag
+    is written last, so an interrupted update leaves the old value. */
+
+typedef struct muvuku_counter_slot {
+
+    uint32_t value;
+    u8 tag;
+
+} __attribute__((packed)) muvuku_counter_slot_t;
+
+
+/* Opaque handle for persistent counter */
+typedef muvuku_counter_slot_t* muvuku_counter_handle_t;
+
+
+/* In-core representation of counter */
+typedef struct muvuku_counter {
+
+    muvuku_allocator_t *allocator;
+    muvuku_counter_slot_t *slots;
+
+    uint32_t value;
+    u8 tag;
+    u8 current;
+
+} muvuku_counter_t;
+
+
+muvuku_counter_handle_t muvuku_counter_new(muvuku_allocator_t *a);
+
+void muvuku_counter_delete(muvuku_allocator_t *a, muvuku_counter_handle_t h);
+
+muvuku_counter_t *muvuku_counter_open(muvuku_allocator_t *a,
+                                      muvuku_counter_handle_t h);
+
+void muvuku_counter_close(muvuku_counter_t *c);
+
+uint32_t muvuku_counter_value(muvuku_counter_t *c);
+
+void muvuku_counter_set(muvuku_counter_t *c, uint32_t value);
+
+uint32_t muvuku_counter_add(muvuku_counter_t *c, uint32_t n);
+
+
+
+/** @name muvuku_flash_region_t **/
+
+/* "Magic" value:
+    This occupies the first field of a flash region's extent
+    table, and tells `muvuku_flash_region_init` that it's valid. */
+
+#define MUVUKU_FLASH_REGION_MAGIC (0x4d46)
+
+
+/* Maximum number of extents:
+    This is the number of distinct allocations that can coexist
+    in a single flash region. The extent table must fit in a page. */
+
+#ifndef MUVUKU_FLASH_EXTENTS_MAX
+    #define MUVUKU_FLASH_EXTENTS_MAX (8)
+#endif /* MUVUKU_FLASH_EXTENTS_MAX */
+
+
+/* Contiguous run of pages:
+    Page numbers are relative to the start of the region; page
+    zero holds the extent table. A zero `page_count` marks a slot
+    in the extent table as unused. */
+
+typedef struct muvuku_flash_extent {
+
+    u16 first_page;
+    u16 page_count;
+
+} __attribute__((packed)) muvuku_flash_extent_t;
+
+
+/* Persistent extent table:
+    This occupies the first (page-aligned) page of a region. */
+
+typedef struct muvuku_flash_region {
+
+    u16 magic;
+    u16 page_count;
+    muvuku_flash_extent_t extents[MUVUKU_FLASH_EXTENTS_MAX];
+
+} __attribute__((packed)) muvuku_flash_region_t;
+
+
+extern muvuku_flash_region_t *muvuku_flash_region;
+
+muvuku_flash_region_t *muvuku_flash_region_init(void *region_ptr,
+                                                size_t size);
+
+size_t muvuku_flash_region_available(muvuku_flash_region_t *r);
+
 
 /** @name muvuku_pool_t **/
 
@@ -120,6 +236,32 @@ typedef unsigned int muvuku_cell_t;
 typedef unsigned long muvuku_cellinfo_t;
 
 
+/* Wear counters for `muvuku_cellinfo_t`:
+    The generation (bits 1-15) counts acquisitions of a cell, and
+    wraps; the erase count (bits 16-31) counts how many times the
+    cell's contents have been discarded and rewritten from scratch. */
+
+#define CL_GENERATION_SHIFT     (1)
+#define CL_GENERATION_MASK      (0x7fff)
+#define CL_ERASES_SHIFT         (16)
+#define CL_ERASES_MASK          (0xffff)
+
+#define muvuku_cellinfo_generation(info) \
+    (((info) >> CL_GENERATION_SHIFT) & CL_GENERATION_MASK)
+
+#define muvuku_cellinfo_erases(info) \
+    (((info) >> CL_ERASES_SHIFT) & CL_ERASES_MASK)
+
+
+/* Persistent wear counters for a single cell */
+typedef struct muvuku_pool_wear {
+
+    u16 generation;
+    u16 erase_count;
+
+} __attribute__((packed)) muvuku_pool_wear_t;
+
+
 typedef union {
 
     muvuku_word_t bitmap;
@@ -128,16 +270,26 @@ typedef union {
 } __attribute__((packed)) muvuku_pool_union_t;
 
 
+/* Layout flags for `_muvuku_pool_new` */
+#define PL_NONE             (0)
+#define PL_PAGE_ALIGNED     (1)
+
+
 /* Persistent storage for pool */
 typedef struct muvuku_pool_data {
 
     size_t cell_size;
+    size_t cell_offset;
     size_t bitmap_length;
 
     unsigned int item_count;
     unsigned int item_limit;
 
-    /* Extensible structure */
+    /* Extensible structure:
+        Free-space bitmap, then one `muvuku_pool_wear_t`
+        per cell, then the cells themselves (which begin
+        `cell_offset` bytes from the start of this struct). */
+
     muvuku_pool_union_t data[];
     /* ... */
 
@@ -163,6 +315,10 @@ typedef muvuku_pool_data_t* muvuku_pool_handle_t;
 muvuku_pool_t *muvuku_pool_new(muvuku_allocator_t *a, size_t size,
                                unsigned int n, void *allocate_options);
 
+muvuku_pool_t *muvuku_pool_new_aligned(muvuku_allocator_t *a,
+                                       size_t size, unsigned int n,
+                                       void *allocate_options);
+
 muvuku_pool_t *muvuku_pool_open(muvuku_allocator_t *a,
                                 muvuku_pool_handle_t p);
 
@@ -185,6 +341,8 @@ muvuku_cell_t muvuku_pool_cell(muvuku_pool_t *p, void *x);
 muvuku_cellinfo_t muvuku_pool_cellinfo(muvuku_pool_t *p,
                                        muvuku_cell_t cell);
 
+void muvuku_pool_mark_erased(muvuku_pool_t *p, void *x);
+
 size_t muvuku_pool_cell_size(muvuku_pool_t *p);
 
 void muvuku_pool_write(muvuku_pool_t *p, void *x, void *data, size_t n);
@@ -254,6 +412,92 @@ size_t _muvuku_stringlist_size(muvuku_stringlist_t *l,
 
 size_t muvuku_stringlist_size(muvuku_stringlist_t *l);
 
+size_t muvuku_stringlist_count(muvuku_stringlist_t *l);
+
+size_t muvuku_stringlist_retain(muvuku_stringlist_t *l,
+                                muvuku_stringlist_fn_t fn, void *state);
+
+
+/* Streaming append:
+    Adds one string of a known length to a stringlist, a piece at a
+    time, without holding the whole string in RAM. The string doesn't
+    become part of the list until `muvuku_stringlist_end`, and then
+    only if exactly the promised number of bytes were written.
+
+    Pieces are collected in `stage` until they reach the end of a
+    page, so that each flash page is programmed once per string,
+    however small the pieces are; the last page is written by
+    `muvuku_stringlist_end`. This makes the writer about a page in
+    size, so device code should allocate it with `xmalloc`. */
+
+typedef struct muvuku_stringlist_writer {
+
+    muvuku_stringlist_t *list;
+    char *dst;
+    muvuku_string_size_t len;
+    muvuku_string_size_t remaining;
+
+    char *staged_at;
+    size_t staged;
+    u8 stage[MUVUKU_PAGE_SIZE];
+
+} muvuku_stringlist_writer_t;
+
+
+int muvuku_stringlist_begin(muvuku_stringlist_t *l,
+                            muvuku_stringlist_writer_t *w,
+                            muvuku_string_size_t len);
+
+int muvuku_stringlist_write(void *w, const char *src, size_t len);
+
+int muvuku_stringlist_end(muvuku_stringlist_writer_t *w);
+
+
+
+/** @name muvuku_tieredlist_t **/
+
+/* Stringlist with overflow:
+    Strings are added to `primary` until it fills, and then to
+    `overflow` (which typically lives in a different pool, backed
+    by a different allocator). Once anything has spilled over, all
+    later strings go to `overflow` too, so that iteration (which
+    visits `primary` first) still sees strings in insertion order.
+    The `overflow` member may be null; the list is then one tier. */
+
+typedef struct muvuku_tieredlist {
+
+    muvuku_stringlist_t *primary;
+    muvuku_stringlist_t *overflow;
+
+} muvuku_tieredlist_t;
+
+
+muvuku_tieredlist_t *muvuku_tieredlist_open(muvuku_stringlist_t *primary,
+                                            muvuku_stringlist_t *overflow);
+
+void muvuku_tieredlist_close(muvuku_tieredlist_t *t);
+
+void muvuku_tieredlist_init(muvuku_tieredlist_t *t);
+
+int muvuku_tieredlist_add(muvuku_tieredlist_t *t,
+                          char *src, muvuku_string_size_t len);
+
+int muvuku_tieredlist_each(muvuku_tieredlist_t *t,
+                           muvuku_stringlist_fn_t fn, void *state);
+
+int muvuku_tieredlist_begin(muvuku_tieredlist_t *t,
+                            muvuku_stringlist_writer_t *w,
+                            muvuku_string_size_t len);
+
+size_t muvuku_tieredlist_size(muvuku_tieredlist_t *t);
+
+size_t muvuku_tieredlist_count(muvuku_tieredlist_t *t);
+
+size_t muvuku_tieredlist_retain(muvuku_tieredlist_t *t,
+                                muvuku_stringlist_fn_t fn, void *state);
+
+size_t muvuku_tieredlist_capacity(muvuku_tieredlist_t *t);
+
 
 #endif /* __MUVUKU_POOL_H__ */
 
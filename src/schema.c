@@ -20,6 +20,16 @@
 #include "prototype.h"
 #include "util.h"
 
+#ifdef _SCHEMA_PROVIDE_UNSERIALIZE
+  #ifndef _SCHEMA_DISABLE_SIMD
+    #if defined(__AVX2__)
+      #include <immintrin.h>
+    #elif defined(__SSE2__)
+      #include <emmintrin.h>
+    #endif
+  #endif /* ! defined _SCHEMA_DISABLE_SIMD */
+#endif /* _SCHEMA_PROVIDE_UNSERIALIZE */
+
 
 /* Forward declarations
     These are type-specific backends for schema_item_prompt. */
@@ -46,22 +56,6 @@
 #endif /* _MUVUKU_PROTOTYPE */
 
 
-/* Internally-used types:
-    These should not be used outside of this subsystem. */
-
-typedef enum muvuku_unserialize_state {
-
-    ST_BEGIN,
-    ST_API_VERSION,
-    ST_FORM_IDENTIFIER,
-    ST_FIELD,
-    ST_FIELD_ESCAPE,
-    ST_ACCEPT,
-    ST_REJECT
-
-} muvuku_unserialize_state_t;
-
-
 /* Standard strings:
     Boolean values -- yes and no. */
 
@@ -122,64 +116,45 @@ schema_info_t *schema_info_init(schema_info_t *o)
 {
     o->api_version = 0;
     o->field_count = 0;
+    o->sequence = 0;
+    o->base_sequence = 0;
 
     return o;
 }
 
 
-/**
- */
-schema_item_t *schema_item_init(schema_item_t *i, const char *caption,
-                                u8 data_type, u8 min_length, u8 max_length)
-{
-    i->caption = caption;
-
-    i->data_type = data_type;
-    i->min_length = min_length;
-    i->max_length = max_length;
-
-    i->flags = 0;
-
-    #ifndef _SCHEMA_DISABLE_TRIGGER
-      i->trigger = NULL;
-    #endif /* _SCHEMA_DISABLE_TRIGGER */
-    
-    #ifndef _SCHEMA_DISABLE_VALIDATE
-      i->validate = NULL;
-      i->validate_message = NULL;
-    #endif /* _SCHEMA_DISABLE_VALIDATE */
-
-    #ifndef _SCHEMA_DISABLE_CONDITION
-      i->condition = NULL;
-    #endif /* _SCHEMA_DISABLE_CONDITION */
-
-    #ifndef _SCHEMA_DISABLE_SELECT
-      i->select_keys = NULL;
-      i->select_values = NULL;
-      i->select_length = 0;
-    #endif /* _SCHEMA_DISABLE_SELECT */
+/* Validation message:
+    Set by `schema_item_fail_validation`, and consumed (then reset) by
+    `schema_item_prompt`. Only one question is prompted at a time, so
+    this doesn't need to be kept in each item. */
 
-    return schema_item_zero(i);
-}
+#ifndef _SCHEMA_DISABLE_VALIDATE
+  static u8 *schema_validate_message = NULL;
+#endif /* ! defined _SCHEMA_DISABLE_VALIDATE */
 
 
 /**
+ * Prepare the item `i` to hold a value for the field described by
+ * `field`. The descriptor is not copied, and must outlive the item.
  */
-schema_item_t *schema_item_new(const char *caption, u8 data_type,
-                               u8 min_length, u8 max_length)
+schema_item_t *schema_item_init(schema_item_t *i,
+                                const schema_field_t *field)
 {
-    schema_item_t *i = (schema_item_t *) xmalloc(sizeof(schema_item_t));
-    schema_item_init(i, caption, data_type, min_length, max_length);
+    i->field = field;
+    i->validity = 0;
 
-    return i;
+    return schema_item_zero(i);
 }
 
 
 /**
+ * Discard the value of `i`. This leaves `VL_IS_VALID` alone, so that
+ * the owning list's `valid_count` stays correct; the next validation,
+ * or `schema_list_clear_result`, decides whether the item is valid.
  */
 schema_item_t *schema_item_zero(schema_item_t *i)
 {
-    i->validity = 0;
+    i->validity &= ~VL_IS_NULL;
     i->string_value = NULL;
 
     #ifndef _SCHEMA_DISABLE_SLV
@@ -203,6 +178,14 @@ schema_item_t *schema_item_zero(schema_item_t *i)
  */
 schema_item_t *schema_item_clear_result(schema_item_t *i)
 {
+    #ifdef _SCHEMA_ENABLE_ARENA
+      /* Values in a list's arena are released with the arena */
+      if (i->validity & VL_IN_ARENA) {
+          i->validity &= ~VL_IN_ARENA;
+          i->string_value = NULL;
+      }
+    #endif /* _SCHEMA_ENABLE_ARENA */
+
     if (i->string_value) {
         free(i->string_value);
     }
@@ -213,7 +196,7 @@ schema_item_t *schema_item_clear_result(schema_item_t *i)
       }
     #endif /* ! defined _SCHEMA_DISABLE_SLV */
 
-    if (i->data_type == TS_PHONE && i->value.msisdn != NULL) {
+    if (schema_field(i, data_type) == TS_PHONE && i->value.msisdn != NULL) {
         free(i->value.msisdn);
     }
 
@@ -225,7 +208,9 @@ schema_item_t *schema_item_clear_result(schema_item_t *i)
  */
 u8 schema_item_compare_integer(schema_item_t *i, int val)
 {
-    if (i->data_type != TS_INTEGER && i->data_type != TS_SELECT) {
+    u8 data_type = schema_field(i, data_type);
+
+    if (data_type != TS_INTEGER && data_type != TS_SELECT) {
         return FALSE;
     }
 
@@ -236,75 +221,34 @@ u8 schema_item_compare_integer(schema_item_t *i, int val)
     return TRUE;
 }
 
-#ifndef _SCHEMA_DISABLE_CONDITION
-
-/**
- */
-schema_item_t *schema_item_set_condition(schema_item_t *i,
-                                         schema_condition_t condition)
-{
-    i->condition = condition;
-    return i;
-}
-
-#endif /* _SCHEMA_DISABLE_CONDITION */
-
-#ifndef _SCHEMA_DISABLE_VALIDATE
-
-/**
- */
-schema_item_t *schema_item_set_validation(schema_item_t *i,
-                                          schema_validation_t validate)
-{
-    i->validate = validate;
-    return i;
-}
-
-#endif /* ! defined _SCHEMA_DISABLE_VALIDATE */
-
-#ifndef _SCHEMA_DISABLE_TRIGGER
-
-/**
- */
-schema_item_t *schema_item_set_trigger(schema_item_t *i,
-                                       schema_trigger_t trigger)
-{
-    i->trigger = trigger;
-    return i;
-}
-
-#endif /* ! defined _SCHEMA_DISABLE_TRIGGER */
-
 #ifndef _SCHEMA_DISABLE_VALIDATE
 
 /**
  */
 u8 schema_item_fail_validation(schema_item_t *i, u8 *message)
 {
-    i->validate_message = message;
+    schema_validate_message = message;
     return FALSE;
 }
 
 #endif /* ! defined _SCHEMA_DISABLE_VALIDATE */
 
 /**
+ * Change the validity flags of the item `i` to `v`, keeping the
+ * `valid_count` of its list `l` in step. The list may be null.
  */
-void schema_item_teardown(schema_item_t *i)
+static void schema_item_set_validity(schema_list_t *l,
+                                     schema_item_t *i, schema_validity_t v)
 {
-    schema_item_clear_result(i);
-
-    if (i->caption) {
-        i->caption = NULL;
+    if (l != NULL) {
+        if ((i->validity & VL_IS_VALID) && !(v & VL_IS_VALID)) {
+            l->valid_count--;
+        } else if (!(i->validity & VL_IS_VALID) && (v & VL_IS_VALID)) {
+            l->valid_count++;
+        }
     }
-}
-
 
-/**
- */
-void schema_item_delete(schema_item_t *i)
-{
-    schema_item_teardown(i);
-    free(i);
+    i->validity = v;
 }
 
 
@@ -312,13 +256,15 @@ void schema_item_delete(schema_item_t *i)
  */
 u8 schema_item_validate(schema_list_t *l, schema_item_t *i)
 {
-    if (!i->validate) {
-        i->validity |= VL_IS_VALID;
+    schema_validation_t validate = schema_field(i, validate);
+
+    if (!validate) {
+        schema_item_set_validity(l, i, i->validity | VL_IS_VALID);
     } else {
-        if (i->validate(l, i)) {
-          i->validity |= VL_IS_VALID;
+        if (validate(l, i)) {
+          schema_item_set_validity(l, i, i->validity | VL_IS_VALID);
         } else {
-          i->validity &= ~VL_IS_VALID;
+          schema_item_set_validity(l, i, i->validity & ~VL_IS_VALID);
           return FALSE;
         }
     }
@@ -332,8 +278,10 @@ u8 schema_item_validate(schema_list_t *l, schema_item_t *i)
  */
 u8 schema_item_trigger(schema_list_t *l, schema_item_t *i)
 {
-    if (i->trigger) {
-        return i->trigger(l, i);
+    schema_trigger_t trigger = schema_field(i, trigger);
+
+    if (trigger) {
+        return trigger(l, i);
     }
 
     return FALSE;
@@ -347,8 +295,10 @@ u8 schema_item_trigger(schema_list_t *l, schema_item_t *i)
  */
 u8 schema_item_condition(schema_list_t *l, schema_item_t *i)
 {
-    if (i->condition) {
-        return i->condition(l, i);
+    schema_condition_t condition = schema_field(i, condition);
+
+    if (condition) {
+        return condition(l, i);
     }
 
     return TRUE;
@@ -365,7 +315,7 @@ u8 schema_item_prompt(schema_list_t *l,
     u8 rv;
 
     for (;;) {
-        switch (i->data_type) {
+        switch (schema_field(i, data_type)) {
             case TS_INTEGER:
                 rv = schema_item_prompt_numeric(
                     i, (f & ~PR_DECIMAL_PORTION)
@@ -402,10 +352,11 @@ u8 schema_item_prompt(schema_list_t *l,
             #ifndef _SCHEMA_DISABLE_VALIDATE
               if (!schema_item_validate(l, i)) {
                   display_text(
-                      (i->validate_message ?
-                          i->validate_message : locale(lc_invalid_detail)),
+                      (schema_validate_message ?
+                          schema_validate_message : locale(lc_invalid_detail)),
                       locale(lc_invalid)
                   );
+                  schema_validate_message = NULL;
                   continue;
               }
             #endif /* ! defined _SCHEMA_DISABLE_VALIDATE */
@@ -430,7 +381,7 @@ schema_item_t *schema_item_set(schema_item_t *i, const char *s, size_t len)
 {
     schema_item_t *rv;
 
-    switch (i->data_type) {
+    switch (schema_field(i, data_type)) {
         case TS_INTEGER:
             rv = schema_item_set_numeric(i, s, len, PR_NORMAL);
             break;
@@ -470,24 +421,25 @@ static u8 schema_item_prompt_generic(schema_item_t *i,
                                      unsigned int stk_input_flags)
 {
     const char *string_value = i->string_value;
+    const u8 *caption = locale(schema_field(i, caption));
 
     /* Detect UCS-2 */
     #ifndef _SCHEMA_DISABLE_SLV
-      if (rb(&(i->caption[0])) == 0x84) {
+      if (rb(&(caption[0])) == 0x84) {
           stk_input_flags |= Q_GET_INPUT_UCS2;
           string_value = i->string_value_slv;
       }
     #endif /* ! defined _SCHEMA_DISABLE_SLV */
 
     /* Translate flags */
-    if (i->flags & FL_NO_ECHO) {
+    if (schema_field(i, flags) & FL_NO_ECHO) {
         stk_input_flags |= Q_GET_INPUT_NO_ECHO;
     }
 
     /* Read a string */
     u8 *res = get_input(
-        i->caption, i->min_length,
-            i->max_length, string_value, stk_input_flags
+        caption, schema_field(i, min_length),
+            schema_field(i, max_length), string_value, stk_input_flags
     );
     
     /* Null-terminate string */
@@ -542,8 +494,8 @@ static u8 schema_item_prompt_generic(schema_item_t *i,
 
 /**
  */
-schema_item_t *schema_item_set_numeric(schema_item_t *i, const char *v,
-                                       size_t len, schema_prompt_flags_t f)
+static schema_item_t *schema_item_take_numeric(schema_item_t *i, u8 *v,
+                                               schema_prompt_flags_t f)
 {
     schema_item_clear_result(i);
 
@@ -559,13 +511,23 @@ schema_item_t *schema_item_set_numeric(schema_item_t *i, const char *v,
         }
     #endif
 
-    i->string_value = (unsigned char *) xmalloc(len);
-    memcpy(i->string_value, v, len);
-
+    i->string_value = v;
     return i;
 }
 
 
+/**
+ */
+schema_item_t *schema_item_set_numeric(schema_item_t *i, const char *v,
+                                       size_t len, schema_prompt_flags_t f)
+{
+    u8 *copy = (u8 *) xmalloc(len);
+    memcpy(copy, v, len);
+
+    return schema_item_take_numeric(i, copy, f);
+}
+
+
 #ifndef _MUVUKU_PROTOTYPE
 
 /**
@@ -583,19 +545,29 @@ static u8 schema_item_prompt_numeric(schema_item_t *i,
 
 /**
  */
-schema_item_t *schema_item_set_string(schema_item_t *i, const char *v,
-                                      size_t len, schema_prompt_flags_t f)
+static schema_item_t *schema_item_take_string(schema_item_t *i, u8 *v)
 {
     schema_item_clear_result(i);
 
-    i->value.string = xmalloc(len);
+    i->value.string = v;
     i->string_value = i->value.string;
-    memcpy(i->value.string, v, len);
 
     return i;
 }
 
 
+/**
+ */
+schema_item_t *schema_item_set_string(schema_item_t *i, const char *v,
+                                      size_t len, schema_prompt_flags_t f)
+{
+    u8 *copy = (u8 *) xmalloc(len);
+    memcpy(copy, v, len);
+
+    return schema_item_take_string(i, copy);
+}
+
+
 #ifndef _MUVUKU_PROTOTYPE
 
 /**
@@ -605,7 +577,7 @@ static u8 schema_item_prompt_string(schema_item_t *i,
 {
     return schema_item_prompt_generic(
         i, f, &schema_item_set_string,
-            (i->flags & FL_INPUT_DIGITS_ONLY ?
+            (schema_field(i, flags) & FL_INPUT_DIGITS_ONLY ?
                 Q_GET_INPUT_DIGITS : Q_GET_INPUT_ALPHABET)
     );
 }
@@ -615,19 +587,29 @@ static u8 schema_item_prompt_string(schema_item_t *i,
 
 /**
  */
-schema_item_t *schema_item_set_phone(schema_item_t *i, const char *v,
-                                     size_t len, schema_prompt_flags_t f)
+static schema_item_t *schema_item_take_phone(schema_item_t *i, u8 *v)
 {
     schema_item_clear_result(i);
 
-    i->string_value = (u8 *) xmalloc(len);
-    memcpy(i->string_value, v, len);
+    i->string_value = v;
     i->value.msisdn = str2msisdn(i->string_value, MSISDN_ADN, MEM_R);
 
     return i;
 }
 
 
+/**
+ */
+schema_item_t *schema_item_set_phone(schema_item_t *i, const char *v,
+                                     size_t len, schema_prompt_flags_t f)
+{
+    u8 *copy = (u8 *) xmalloc(len);
+    memcpy(copy, v, len);
+
+    return schema_item_take_phone(i, copy);
+}
+
+
 #ifndef _MUVUKU_PROTOTYPE
 
 /**
@@ -664,7 +646,8 @@ static u8 schema_item_prompt_boolean(schema_item_t *i,
 {
     /* Prompt for a yes/no answer */
     u8 *res = select_item(
-        2, (const u8 **) locale_list(lc_boolean), i->caption,
+        2, (const u8 **) locale_list(lc_boolean),
+            locale(schema_field(i, caption)),
             NULL, (i->value.boolean ? 1 : 2), Q_SELECT_ITEM_CHOICE
     );
 
@@ -691,9 +674,10 @@ static u8 schema_item_prompt_boolean(schema_item_t *i,
 schema_item_t *schema_item_set_select(schema_item_t *i,
                                       unsigned v, schema_prompt_flags_t f)
 {
+    const u8 *select_keys = schema_field(i, select_keys);
+
     i->value.integer = (
-        i->select_keys ?
-            i->select_keys[v - 1] : v
+        select_keys ? schema_progmem(select_keys[v - 1]) : v
     );
 
     return i;
@@ -708,14 +692,18 @@ static u8 schema_item_prompt_select(schema_item_t *i,
 {
     u16 n, selected_index = i->value.integer;
 
+    const u8 *caption = locale(schema_field(i, caption));
+    const u8 *select_keys = schema_field(i, select_keys);
+    u8 select_length = schema_field(i, select_length);
+
     /* Map field value to selection index:
         This is a linear search for the field's value; n is likely
         very small, so this should not be a performance problem.
         In fact, it's likely optimal for these small-sized lists. */
 
-    if (i->select_keys) {
-        for (n = 0; n < i->select_length; n++) {
-            if (i->select_keys[n] == i->value.integer) {
+    if (select_keys) {
+        for (n = 0; n < select_length; n++) {
+            if (schema_progmem(select_keys[n]) == i->value.integer) {
                 selected_index = n;
                 break; /* Found */
             }
@@ -735,15 +723,16 @@ static u8 schema_item_prompt_select(schema_item_t *i,
 
     if (f & PR_BROKEN_STK_SELECT) {
         broken_stk_select_back:
-            if (display_text(i->caption, NULL) != APP_OK) {
+            if (display_text(caption, NULL) != APP_OK) {
                 return APP_BACK;
             }
     }
 
     /* Prompt for a list selection */
     u8 *res = select_item(
-        i->select_length, (const u8 **) i->select_values,
-            i->caption, NULL, selected_index, Q_SELECT_ITEM_CHOICE
+        select_length,
+            (const u8 **) locale_list(schema_field(i, select_values)),
+            caption, NULL, selected_index, Q_SELECT_ITEM_CHOICE
     );
 
     u8 idx = get_tag(res, T_ITEM_ID);
@@ -766,32 +755,206 @@ static u8 schema_item_prompt_select(schema_item_t *i,
 
 
 /**
+ * Allocate `n` bytes for the value of an item in `l`: from the
+ * list's arena, if it has one with enough room left, and from the
+ * heap otherwise. Sets `*in_arena` to say which.
+ */
+static u8 *schema_list_alloc(schema_list_t *l, size_t n, u8 *in_arena)
+{
+    #ifdef _SCHEMA_ENABLE_ARENA
+      schema_arena_t *a = (l != NULL ? &l->arena : NULL);
+
+      if (a != NULL && a->base != NULL && n <= a->size - a->used) {
+
+          u8 *rv = &a->base[a->used];
+          a->used += n;
+
+          *in_arena = TRUE;
+          return rv;
+      }
+    #endif /* _SCHEMA_ENABLE_ARENA */
+
+    *in_arena = FALSE;
+    return (u8 *) xmalloc(n);
+}
+
+
+/**
+ * Copy the `len` bytes at `s` in to storage for the value of an item
+ * in `l`, and null-terminate them; see `schema_list_alloc`.
+ */
+static u8 *schema_list_copy(schema_list_t *l, const char *s,
+                            size_t len, u8 *in_arena)
+{
+    u8 *v = schema_list_alloc(l, len + 1, in_arena);
+
+    memcpy(v, s, len);
+    v[len] = '\0';
+
+    return v;
+}
+
+
+/**
+ */
+static schema_item_t *schema_item_mark_arena(schema_item_t *i, u8 in_arena)
+{
+    if (in_arena) {
+        i->validity |= VL_IN_ARENA;
+    }
+
+    return i;
+}
+
+
+/**
+ * Set the numeric value of `i`, an item in `l` (or null), from the
+ * `len` bytes at `s`, which need not be null-terminated. The text is
+ * kept in the list's arena, if it has one; see `schema_list_alloc`.
+ */
+schema_item_t *schema_list_set_numeric(schema_list_t *l, schema_item_t *i,
+                                       const char *s, size_t len,
+                                       schema_prompt_flags_t f)
+{
+    u8 in_arena, *v = schema_list_copy(l, s, len, &in_arena);
+
+    schema_item_take_numeric(i, v, f);
+    return schema_item_mark_arena(i, in_arena);
+}
+
+
+/**
+ * Set the string value of `i`; see `schema_list_set_numeric`.
+ */
+schema_item_t *schema_list_set_string(schema_list_t *l, schema_item_t *i,
+                                      const char *s, size_t len)
+{
+    u8 in_arena, *v = schema_list_copy(l, s, len, &in_arena);
+
+    schema_item_take_string(i, v);
+    return schema_item_mark_arena(i, in_arena);
+}
+
+
+/**
+ * Set the phone number of `i`; see `schema_list_set_numeric`.
+ */
+schema_item_t *schema_list_set_phone(schema_list_t *l, schema_item_t *i,
+                                     const char *s, size_t len)
+{
+    u8 in_arena, *v = schema_list_copy(l, s, len, &in_arena);
+
+    schema_item_take_phone(i, v);
+    return schema_item_mark_arena(i, in_arena);
+}
+
+
+/**
+ * Set the value of `i`, an item in `l` (or null), from the `len`
+ * bytes at `s`; see `schema_item_set_span`.
+ */
+static schema_item_t *schema_item_store_span(schema_list_t *l,
+                                             schema_item_t *i,
+                                             const char *s, size_t len)
+{
+    char number[16];
+    u8 *v;
+
+    switch (schema_field(i, data_type)) {
+        case TS_BOOLEAN:
+        #ifndef _SCHEMA_DISABLE_SELECT
+          case TS_SELECT:
+        #endif /* ! defined _SCHEMA_DISABLE_SELECT */
+
+            /* Only the number is kept */
+            v = (len < sizeof(number) ? number : xmalloc(len + 1));
+            memcpy(v, s, len);
+            v[len] = '\0';
+
+            schema_item_set(i, v, len + 1);
+
+            if (v != (u8 *) number) {
+                free(v);
+            }
+
+            return i;
+
+        case TS_INTEGER:
+            return schema_list_set_numeric(l, i, s, len, PR_NORMAL);
+        #ifdef _MUVUKU_USE_FPU
+            case TS_NUMERIC:
+                return schema_list_set_numeric(
+                    l, i, s, len, PR_DECIMAL_PORTION
+                );
+        #endif
+        case TS_PHONE:
+            return schema_list_set_phone(l, i, s, len);
+        default:
+        case TS_STRING:
+            return schema_list_set_string(l, i, s, len);
+    }
+}
+
+
+/**
+ * Set the value of `i` from the `len` bytes at `s`, which need not
+ * be null-terminated. This has the same result as `schema_item_set`
+ * with a null-terminated copy of `s`, but copies the value only once.
+ */
+schema_item_t *schema_item_set_span(schema_item_t *i,
+                                    const char *s, size_t len)
+{
+    return schema_item_store_span(NULL, i, s, len);
+}
+
+
+/**
+ * Allocate a list of values for the form described by `form`. The
+ * descriptors stay where they are; only the values, the validity
+ * flags, and a copy of the form identifier are kept in RAM.
  */
-schema_list_t *schema_list_new(const char *type, size_t count)
+schema_list_t *schema_list_new(const schema_form_t *form)
 {
     int overflow = FALSE;
-    size_t type_len = strlen(type) + 1;
 
-    schema_list_t *l = (schema_list_t *) xmalloc(
-        sizeof(schema_list_t)
-    );
+    const u8 *type = schema_progmem(form->type_id);
+    const schema_field_t *fields = schema_progmem(form->fields);
+    u8 length = schema_progmem(form->length);
+
+    size_t type_len = strlen(type) + 1;
 
     /* Schema items: like calloc */
     size_t list_size = safe_multiply(
-        sizeof(schema_item_t), count, &overflow
+        sizeof(schema_item_t), length, &overflow
     );
 
     if (overflow) {
         return NULL;
     }
 
+    schema_list_t *l = (schema_list_t *) xmalloc(
+        sizeof(schema_list_t)
+    );
+
     /* Array of schema items */
     l->list = (schema_item_t *) xmalloc(list_size);
 
+    for (u8 n = 0; n < length; n++) {
+        schema_item_init(&l->list[n], &fields[n]);
+    }
+
     /* Schema identifier */
     l->type_id = (u8 *) xmalloc(type_len);
     memcpy(l->type_id, type, type_len);
 
+    l->length = length;
+    l->valid_count = 0;
+
+    #ifdef _SCHEMA_ENABLE_ARENA
+      l->arena.base = NULL;
+      l->arena.size = l->arena.used = 0;
+    #endif /* _SCHEMA_ENABLE_ARENA */
+
     return l;
 };
 
@@ -800,33 +963,59 @@ schema_list_t *schema_list_new(const char *type, size_t count)
  */
 void schema_list_clear_result(schema_list_t *l)
 {
-    schema_item_t *p = l->list; 
-
-    for (;;) {
-        schema_item_clear_result(p);
+    for (u8 n = 0; n < l->length; n++) {
+        schema_item_clear_result(&l->list[n]);
+        l->list[n].validity = 0;
+    }
 
-        if ((p->flags & FL_LIST_TERMINATOR))
-            break;
+    #ifdef _SCHEMA_ENABLE_ARENA
+      l->arena.used = 0;
+    #endif /* _SCHEMA_ENABLE_ARENA */
 
-        p++;
-    };
+    l->valid_count = 0;
 };
 
 
+#ifdef _SCHEMA_ENABLE_ARENA
+
 /**
+ * Give `l` an arena of `size` bytes for the values of its items; if
+ * `size` is zero, make it large enough for every field to have the
+ * longest value that `schema_list_unserialize` accepts. The arena
+ * is only used by the decoders, and by `schema_list_clear_result`.
+ * Returns false if `l` already has an arena.
  */
-void schema_list_teardown(schema_list_t *l)
+u8 schema_list_enable_arena(schema_list_t *l, size_t size)
 {
-    schema_item_t *p = l->list; 
+    if (l->arena.base != NULL) {
+        return FALSE;
+    }
 
-    for (;;) {
-        schema_item_teardown(p);
+    if (size == 0) {
+        size = (size_t) l->length * (MAX_SMS_FIELD_LENGTH + 1);
+    }
 
-        if ((p->flags & FL_LIST_TERMINATOR))
-            break;
+    l->arena.base = (u8 *) xmalloc(size);
+    l->arena.size = size;
+    l->arena.used = 0;
 
-        p++;
-    };
+    return TRUE;
+}
+
+#endif /* _SCHEMA_ENABLE_ARENA */
+
+
+/**
+ */
+void schema_list_teardown(schema_list_t *l)
+{
+    for (u8 n = 0; n < l->length; n++) {
+        schema_item_clear_result(&l->list[n]);
+    }
+
+    #ifdef _SCHEMA_ENABLE_ARENA
+      free(l->arena.base);
+    #endif /* _SCHEMA_ENABLE_ARENA */
 
     free(l->type_id);
     free(l->list);
@@ -843,24 +1032,12 @@ void schema_list_delete(schema_list_t *l)
 
 
 /**
+ * Return the number of items in `l`, or (if `valid_only` is set)
+ * the number of valid items. Both are cached, so this is O(1).
  */
 size_t schema_list_count(schema_list_t *l, u8 valid_only)
 {
-    schema_item_t *p = l->list; 
-    size_t rv = 0;
-
-    for (;;) {
-        if (!valid_only || (p->validity & VL_IS_VALID)) {
-            rv++;
-        }
-
-        if ((p->flags & FL_LIST_TERMINATOR))
-            break;
-
-        p++;
-    };
-
-    return rv;
+    return (valid_only ? l->valid_count : l->length);
 };
 
 
@@ -868,7 +1045,7 @@ size_t schema_list_count(schema_list_t *l, u8 valid_only)
  */
 schema_item_t *schema_list_get(schema_list_t *l, unsigned int position)
 {
-    if (position >= schema_list_count(l, FALSE)) {
+    if (position >= l->length) {
         return NULL;
     }
 
@@ -880,16 +1057,14 @@ schema_item_t *schema_list_get(schema_list_t *l, unsigned int position)
  */
 u8 schema_list_is_complete(schema_list_t *l)
 {
-    return (
-        schema_list_count(l, TRUE) == schema_list_count(l, FALSE)
-    );
+    return (l->valid_count == l->length);
 }
 
 /**
  */
 u8 schema_list_is_empty(schema_list_t *l)
 {
-    return (schema_list_count(l, TRUE) == 0);
+    return (l->valid_count == 0);
 }
 
 
@@ -902,6 +1077,12 @@ u8 schema_list_prompt(schema_list_t *l, schema_prompt_flags_t f)
     u8 last_direction = TRUE;
     schema_item_t *p = l->list;
 
+    if (l->length == 0) {
+        return APP_OK;
+    }
+
+    schema_item_t *last = &l->list[l->length - 1];
+
     do {
         #ifndef _SCHEMA_DISABLE_CONDITION
           if (schema_item_condition(l, p)) {
@@ -920,13 +1101,14 @@ u8 schema_list_prompt(schema_list_t *l, schema_prompt_flags_t f)
         #ifndef _SCHEMA_DISABLE_CONDITION
           } else {
               schema_item_clear_result(p);
-              p->validity |= VL_IS_VALID;
-              p->validity |= VL_IS_NULL;
+              schema_item_set_validity(
+                  l, p, p->validity | VL_IS_VALID | VL_IS_NULL
+              );
           }
         #endif /* _SCHEMA_DISABLE_CONDITION */
       
         /* Termination condition */
-        if ((p->flags & FL_LIST_TERMINATOR)) {
+        if (p == last) {
             break;
         }
         
@@ -941,321 +1123,2476 @@ u8 schema_list_prompt(schema_list_t *l, schema_prompt_flags_t f)
 #endif /* _MUVUKU_PROTOTYPE */
 
 
-/**
- */
-u8 *schema_list_serialize(schema_list_t *l, schema_flags_t filter)
-{
-    size_t len = MAX_SMS_LENGTH;
-    size_t bufsz = MAX_SMS_FIELD_LENGTH;
+/* Serializer state:
+    Output is staged in `chunk`, and handed to `sink` whenever the
+    chunk fills (or the record ends). Once the sink has failed, all
+    further output is discarded, as is anything past `limit`. */
 
-    schema_item_t *i = l->list;
+typedef struct schema_emitter {
 
-    /* Skip overflow checking:
-        These sizes are predefined constants, not user input. */
+    schema_sink_t sink;
+    void *ctx;
+    size_t total;
+    size_t limit;
+    u8 failed;
+    u8 n;
+    char chunk[SCHEMA_SERIALIZE_CHUNK];
 
-    u8 *buf = (u8 *) xmalloc(bufsz + 1);
-    u8 *rv = (u8 *) xmalloc(len + 1);
-    u8 *p = rv;
+    /* Compact encoding only */
+    u8 bits;
+    u8 nbits;
 
-    /* SMS API Version:
-        The API version number begins each message,
-        followed by the "magic" delimiter string (e.g. 1!). */
+} schema_emitter_t;
 
-    /* Stringify SMS API version number */
-    itoa(SMS_API_VERSION, buf, 10);
 
-    /* Copy SMS API version to output */
-    size_t version_len = strncpy_esc(
-        bufsz + 1, p, buf, SMS_MAGIC_DELIMITER, SMS_ESCAPE
-    );
+/**
+ */
+static void schema_emitter_init(schema_emitter_t *e,
+                                schema_sink_t sink, void *ctx)
+{
+    e->sink = sink;
+    e->ctx = ctx;
+    e->total = 0;
+    e->limit = MAX_RECORD_LENGTH;
+    e->failed = FALSE;
+    e->n = 0;
+    e->bits = 0;
+    e->nbits = 0;
+}
 
-    /* Advance to terminator */
-    p += version_len - 1;
 
-    /* Overwrite terminator and advance */
-    *p++ = SMS_MAGIC_DELIMITER;
-    len -= version_len;
+/**
+ */
+static void schema_emit_flush(schema_emitter_t *e)
+{
+    if (e->n > 0 && !e->failed) {
+        if (!e->sink(e->ctx, e->chunk, e->n)) {
+            e->failed = TRUE;
+        }
+    }
 
+    e->n = 0;
+}
+
+
+/**
+ * Append the character `c` to the output, unless the output
+ * has already reached the emitter's limit.
+ */
+static void schema_emit(schema_emitter_t *e, char c)
+{
+    if (e->total >= e->limit) {
+        return;
+    }
+
+    if (e->n >= SCHEMA_SERIALIZE_CHUNK) {
+        schema_emit_flush(e);
+    }
+
+    e->chunk[e->n++] = c;
+    e->total++;
+}
+
+
+/**
+ * Append the null-terminated string `s` to the output, escaping
+ * `delimiter`, `SMS_ESCAPE`, and `SMS_RECORD_DELIMITER` (so that a
+ * record can always be batched). Like `strncpy_esc`, this writes at
+ * most `MAX_SMS_FIELD_LENGTH` characters, and never splits an
+ * escape sequence.
+ */
+static void schema_emit_escaped(schema_emitter_t *e,
+                                const char *s, char delimiter)
+{
+    size_t avail = MAX_SMS_FIELD_LENGTH;
+
+    for (; *s != '\0'; s++) {
+
+        size_t necessary = (
+            (*s == delimiter || *s == SMS_ESCAPE ||
+                *s == SMS_RECORD_DELIMITER) ? 2 : 1
+        );
+
+        if (necessary > avail || e->total + necessary > e->limit) {
+            break;
+        }
+
+        if (necessary > 1) {
+            schema_emit(e, SMS_ESCAPE);
+        }
+
+        schema_emit(e, *s);
+        avail -= necessary;
+    }
+}
+
+
+/**
+ * Emit a record header: the API version `version`, then the form
+ * identifier `type_id`, each followed by the magic delimiter.
+ */
+static void schema_emit_header(schema_emitter_t *e,
+                               unsigned int version, const char *type_id)
+{
+    char number[8];
+
+    /* SMS API Version:
+        The API version number begins each message,
+        followed by the "magic" delimiter string (e.g. 1!). */
+
+    itoa(version, number, 10);
+    schema_emit_escaped(e, number, SMS_MAGIC_DELIMITER);
+    schema_emit(e, SMS_MAGIC_DELIMITER);
+
+    /* SMS Form Identifier:
+        The form identified is a four-character code that uniquely
+        identifies the sequence of fields used. This is appended
+        to the SMS version using the magic delimiter (e.g. 1!PSMS!) */
+
+    schema_emit_escaped(e, type_id, SMS_MAGIC_DELIMITER);
+    schema_emit(e, SMS_MAGIC_DELIMITER);
+}
+
+
+/**
+ * Return the text form of the item `i`, unescaped, or null if it
+ * has no value. Numbers are formatted in to `number`, which must
+ * hold at least 16 bytes; strings (including phone numbers, which
+ * keep the text they were entered as) are returned directly.
+ */
+const char *schema_item_text(schema_item_t *i, char *number)
+{
+    if (!(i->validity & VL_IS_VALID) || (i->validity & VL_IS_NULL)) {
+        return NULL;
+    }
+
+    switch (schema_field(i, data_type)) {
+        case TS_SELECT:
+        case TS_INTEGER:
+            itoa(i->value.integer, number, 10);
+            return number;
+        #ifdef USE_FPU
+            case TS_NUMERIC:
+                dtostrf(i->value.numeric, 8, 2, number);
+                return number;
+        #endif
+        default:
+        case TS_STRING:
+        case TS_PHONE:
+            return i->string_value;
+        case TS_BOOLEAN:
+            number[0] = (i->value.boolean ? '1' : '0');
+            number[1] = '\0';
+            return number;
+    }
+}
+
+
+/**
+ * Emit the fields of `l`, in schema order, each escaped and
+ * followed by its delimiter (all but the last).
+ */
+static void schema_emit_fields(schema_emitter_t *e, schema_list_t *l)
+{
+    /* Large enough for any `int`, or a `dtostrf` result */
+    char number[16];
+
+    for (u8 n = 0; n < l->length; n++) {
+
+        schema_item_t *i = &l->list[n];
+        const char *field = schema_item_text(i, number);
+
+        if (field != NULL) {
+            schema_emit_escaped(e, field, schema_item_delimiter(i));
+        }
+
+        /* Delimiter after all but the last field */
+        if (n + 1 < l->length) {
+            schema_emit(e, schema_item_delimiter(i));
+        }
+    }
+}
+
+
+/**
+ * Serialize `l`, passing the output to `sink` in pieces of at most
+ * `SCHEMA_SERIALIZE_CHUNK` bytes. No null terminator is produced.
+ * Nothing is allocated; numbers are formatted on the stack, and
+ * strings are escaped as they're copied. The output is at most
+ * `MAX_RECORD_LENGTH` bytes; records longer than one message are
+ * sent in parts (see `schema_multipart_init`). Returns the number
+ * of bytes produced, or zero if the sink failed.
+ */
+size_t schema_list_serialize_to(schema_list_t *l,
+                                schema_sink_t sink, void *ctx)
+{
+    schema_emitter_t e;
+    schema_emitter_init(&e, sink, ctx);
+
+    schema_emit_header(&e, SMS_API_VERSION, l->type_id);
+
+    /* Serialization begins here:
+        From now on, we use the regular delimiter to
+        append each serialized field to the output string. */
+
+    schema_emit_fields(&e, l);
+
+    schema_emit_flush(&e);
+    return (e.failed ? 0 : e.total);
+}
+
+
+/**
+ * Prepare `b` to collect output in the `size`-byte buffer `dst`.
+ */
+schema_buffer_t *schema_buffer_init(schema_buffer_t *b,
+                                    char *dst, size_t size)
+{
+    b->p = dst;
+    b->avail = size;
+
+    if (size > 0) {
+        *dst = '\0';
+    }
+
+    return b;
+}
+
+
+/**
+ * Sink: append to the `schema_buffer_t` at `ctx`, leaving room
+ * for a null terminator. Fails if the buffer is too small.
+ */
+int schema_sink_buffer(void *ctx, const char *data, size_t len)
+{
+    schema_buffer_t *b = (schema_buffer_t *) ctx;
+
+    if (len + 1 > b->avail) {
+        return FALSE;
+    }
+
+    memcpy(b->p, data, len);
+
+    b->p += len;
+    b->avail -= len;
+    *b->p = '\0';
+
+    return TRUE;
+}
+
+
+/**
+ * Sink: add the length of the output to the `size_t` at `ctx`.
+ */
+int schema_sink_count(void *ctx, const char *data, size_t len)
+{
+    *((size_t *) ctx) += len;
+    return TRUE;
+}
+
+
+/**
+ * Serialize `l` in to a newly-allocated, null-terminated string.
+ * The `filter` argument is currently unused.
+ */
+u8 *schema_list_serialize(schema_list_t *l, schema_flags_t filter)
+{
+    schema_buffer_t b;
+    u8 *rv = (u8 *) xmalloc(MAX_RECORD_LENGTH + 1);
+
+    schema_buffer_init(&b, rv, MAX_RECORD_LENGTH + 1);
+
+    if (!schema_list_serialize_to(l, &schema_sink_buffer, &b)) {
+        free(rv);
+        return NULL;
+    }
+
+    return rv;
+};
+
+
+#if defined(_SCHEMA_ENABLE_COMPACT) || defined(_SCHEMA_PROVIDE_UNSERIALIZE)
+
+/* Compact encoding:
+    Fields are bit-packed in schema order, using what the descriptor
+    already says about each one, and the bit stream is written six
+    bits per character. Each field starts with a presence bit; a
+    present field is then:
+
+        TS_BOOLEAN      one bit
+        TS_SELECT       the choice's index, in ceil(log2(n)) bits
+        TS_INTEGER      the value, in just enough bits for
+                        `max_length` decimal digits (at most 15)
+        TS_STRING,      the length, in just enough bits for
+        TS_PHONE        `max_length`, then four bits per character
+                        for phone numbers and digits-only fields,
+                        or seven bits per character otherwise.
+
+    The characters used are all in the GSM 7-bit default alphabet,
+    and none of them needs escaping in a text or batched message. */
+
+const char PROGMEM schema_compact_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+const char PROGMEM schema_compact_digits[] = "0123456789+*#";
+
+
+/**
+ * Return the number of bits needed to hold any value from 0 to `n`.
+ */
+static u8 schema_compact_width(unsigned long n)
+{
+    u8 rv = 0;
+
+    while (n > 0) {
+        n >>= 1;
+        rv++;
+    }
+
+    return rv;
+}
+
+
+/**
+ * Return the width of an integer field of at most `digits` digits.
+ */
+static u8 schema_compact_integer_width(u8 digits)
+{
+    unsigned long limit = 1;
+
+    while (digits-- > 0) {
+        limit *= 10;
+
+        if (limit > (1UL << SCHEMA_COMPACT_INTEGER_BITS)) {
+            return SCHEMA_COMPACT_INTEGER_BITS;
+        }
+    }
+
+    return schema_compact_width(limit - 1);
+}
+
+
+/**
+ * Return true if string fields described like `i` are packed
+ * four bits per character.
+ */
+static u8 schema_compact_is_digits(schema_item_t *i)
+{
+    return (
+        schema_field(i, data_type) == TS_PHONE ||
+            (schema_field(i, flags) & FL_INPUT_DIGITS_ONLY)
+    );
+}
+
+#endif /* _SCHEMA_ENABLE_COMPACT || _SCHEMA_PROVIDE_UNSERIALIZE */
+
+
+#ifdef _SCHEMA_ENABLE_COMPACT
+
+/**
+ * Append the low `width` bits of `v` to the compact bit stream,
+ * most significant bit first. Output that would run past the
+ * emitter's limit fails the encoding, rather than truncating it.
+ */
+static void schema_emit_bits(schema_emitter_t *e,
+                             unsigned long v, u8 width)
+{
+    while (width-- > 0) {
+
+        e->bits = (e->bits << 1) | ((v >> width) & 1);
+
+        if (++e->nbits == 6) {
+            if (e->total >= e->limit) {
+                e->failed = TRUE;
+            }
+            schema_emit(e, schema_progmem(schema_compact_alphabet[e->bits]));
+            e->bits = e->nbits = 0;
+        }
+    }
+}
+
+
+/**
+ * Append the value of the item `i` to the compact bit stream.
+ * Returns false if the value can't be represented.
+ */
+static u8 schema_compact_encode_item(schema_emitter_t *e, schema_item_t *i)
+{
+    u8 n, length;
+    const char *p;
+
+    if (!(i->validity & VL_IS_VALID) || (i->validity & VL_IS_NULL)) {
+        schema_emit_bits(e, 0, 1);
+        return TRUE;
+    }
+
+    schema_emit_bits(e, 1, 1);
+
+    switch (schema_field(i, data_type)) {
+
+        case TS_BOOLEAN:
+            schema_emit_bits(e, (i->value.boolean ? 1 : 0), 1);
+            return TRUE;
+
+        #ifndef _SCHEMA_DISABLE_SELECT
+          case TS_SELECT: {
+
+              const u8 *select_keys = schema_field(i, select_keys);
+              length = schema_field(i, select_length);
+
+              if (select_keys) {
+                  for (n = 0; n < length; n++) {
+                      if (schema_progmem(select_keys[n]) == i->value.integer) {
+                          break;
+                      }
+                  }
+              } else {
+                  n = i->value.integer - 1;
+              }
+
+              if (i->value.integer < 1 || n >= length) {
+                  return FALSE;
+              }
+
+              schema_emit_bits(e, n, schema_compact_width(length - 1));
+              return TRUE;
+          }
+        #endif /* ! defined _SCHEMA_DISABLE_SELECT */
+
+        case TS_INTEGER: {
+
+            u8 width = schema_compact_integer_width(
+                schema_field(i, max_length)
+            );
+
+            if (i->value.integer < 0 ||
+                (unsigned long) i->value.integer >= (1UL << width)) {
+                return FALSE;
+            }
+
+            schema_emit_bits(e, i->value.integer, width);
+            return TRUE;
+        }
+
+        case TS_STRING:
+        case TS_PHONE:
+            break;
+
+        default:
+            return FALSE;
+    }
+
+    /* Strings */
+    p = (i->string_value ? (const char *) i->string_value : "");
+    length = strlen(p);
+
+    if (length > schema_field(i, max_length)) {
+        return FALSE;
+    }
+
+    schema_emit_bits(
+        e, length, schema_compact_width(schema_field(i, max_length))
+    );
+
+    for (; *p != '\0'; p++) {
+
+        if (schema_compact_is_digits(i)) {
+
+            for (n = 0; n < sizeof(schema_compact_digits) - 1; n++) {
+                if (schema_progmem(schema_compact_digits[n]) == *p) {
+                    break;
+                }
+            }
+
+            if (n >= sizeof(schema_compact_digits) - 1) {
+                return FALSE;
+            }
+
+            schema_emit_bits(e, n, 4);
+
+        } else {
+
+            if ((u8) *p > 0x7f) {
+                return FALSE;
+            }
+
+            schema_emit_bits(e, *p, 7);
+        }
+    }
+
+    return TRUE;
+}
+
+
+/**
+ * Serialize `l` using the compact encoding (with API version
+ * `SMS_COMPACT_API_VERSION`), passing the output to `sink` just
+ * as `schema_list_serialize_to` does. Returns the number of bytes
+ * produced, or zero if the sink failed, if a value can't be
+ * represented, or if the record won't fit in one message; the
+ * caller can then fall back to `schema_list_serialize_to`.
+ */
+size_t schema_list_serialize_compact_to(schema_list_t *l,
+                                        schema_sink_t sink, void *ctx)
+{
+    schema_emitter_t e;
+    schema_emitter_init(&e, sink, ctx);
+
+    /* Always a single message */
+    e.limit = MAX_SMS_LENGTH;
+
+    /* Header, exactly as for text records (e.g. 3!PSMS!) */
+    schema_emit_header(&e, SMS_COMPACT_API_VERSION, l->type_id);
+
+    for (u8 n = 0; n < l->length; n++) {
+        if (!schema_compact_encode_item(&e, &l->list[n])) {
+            return 0;
+        }
+    }
+
+    /* Pad the final character with zero bits */
+    if (e.nbits > 0) {
+        schema_emit_bits(&e, 0, 6 - e.nbits);
+    }
+
+    schema_emit_flush(&e);
+    return (e.failed ? 0 : e.total);
+}
+
+#endif /* _SCHEMA_ENABLE_COMPACT */
+
+
+/**
+ * Start a new, empty batch in `b`.
+ */
+schema_batch_t *schema_batch_init(schema_batch_t *b)
+{
+    itoa(SMS_BATCH_API_VERSION, b->buf, 10);
+
+    b->header_len = strlen(b->buf);
+    b->buf[b->header_len++] = SMS_MAGIC_DELIMITER;
+    b->buf[b->header_len] = '\0';
+
+    b->len = b->header_len;
+    b->count = 0;
+
+    return b;
+}
+
+
+/**
+ * Append the serialized record `record` (of length `len`, which need
+ * not include a null terminator) to the batch `b`. Returns false,
+ * leaving the batch unchanged, if the record would not fit in one
+ * message, or if it contains an unescaped record delimiter (as a
+ * record saved by an older version might).
+ */
+u8 schema_batch_add(schema_batch_t *b, const char *record, size_t len)
+{
+    size_t i, necessary = len + (b->count > 0 ? 1 : 0);
+
+    if (len == 0 || b->len + necessary > MAX_SMS_LENGTH) {
+        return FALSE;
+    }
+
+    for (i = 0; i < len; ++i) {
+        if (record[i] == SMS_ESCAPE) {
+            ++i;
+        } else if (record[i] == SMS_RECORD_DELIMITER) {
+            return FALSE;
+        }
+    }
+
+    if (b->count > 0) {
+        b->buf[b->len++] = SMS_RECORD_DELIMITER;
+    }
+
+    memcpy(b->buf + b->len, record, len);
+
+    b->len += len;
+    b->buf[b->len] = '\0';
+    b->count++;
+
+    return TRUE;
+}
+
+
+/**
+ * Return the message for the batch `b`, as a null-terminated string.
+ * A batch of one record is sent as the record alone, exactly as it
+ * would have been without batching.
+ */
+const char *schema_batch_message(schema_batch_t *b)
+{
+    return (b->count == 1 ? b->buf + b->header_len : b->buf);
+}
+
+
+/**
+ * Prepare to split the record `record` (of length `len`) in to parts,
+ * numbered for reassembly under the reference number `reference`.
+ * The sender should vary `reference` from one record to the next.
+ * Returns false if the record is empty, or needs too many parts.
+ */
+u8 schema_multipart_init(schema_multipart_t *m, const char *record,
+                         size_t len, u8 reference)
+{
+    size_t total = (len + SCHEMA_MULTIPART_PAYLOAD - 1) /
+        SCHEMA_MULTIPART_PAYLOAD;
+
+    if (len == 0 || total > 0xff) {
+        return FALSE;
+    }
+
+    m->record = record;
+    m->len = len;
+    m->offset = 0;
+    m->reference = reference;
+    m->part = 0;
+    m->total = total;
+
+    return TRUE;
+}
+
+
+/**
+ * Return the next part prepared by `schema_multipart_init`, as a
+ * null-terminated message, or null once every part has been returned.
+ * Each part's payload is exactly `SCHEMA_MULTIPART_PAYLOAD` bytes,
+ * except the last; the returned pointer is valid until the next call.
+ */
+const char *schema_multipart_next(schema_multipart_t *m)
+{
+    char *p = m->buf;
+
+    if (m->part >= m->total) {
+        return NULL;
+    }
+
+    m->part++;
+
+    /* Header (e.g. 5!17!1!3!) */
+    u8 header[] = {
+        SMS_MULTIPART_API_VERSION, m->reference, m->part, m->total
+    };
+
+    for (u8 n = 0; n < sizeof(header); n++) {
+        itoa(header[n], p, 10);
+        p += strlen(p);
+        *p++ = SMS_MAGIC_DELIMITER;
+    }
+
+    size_t len = scalar_min(m->len - m->offset, SCHEMA_MULTIPART_PAYLOAD);
+
+    memcpy(p, m->record + m->offset, len);
+    p[len] = '\0';
+
+    m->offset += len;
+    return m->buf;
+}
+
+
+/**
+ */
+u8 is_digit(const char c) {
+
+    return (c <= '9' && c >= '0');
+}
+
+
+/**
+ */
+u8 is_alphanumeric(const char c) {
+
+    return (
+        is_digit(c) ||
+            (c <= 'Z' && c >= 'A') || (c <= 'z' && c >= 'a')
+    );
+}
+
+#if defined(_SCHEMA_ENABLE_ACK) || defined(_SCHEMA_PROVIDE_UNSERIALIZE)
+
+/**
+ * Return the value of the hexadecimal digit `c`, or 0xff.
+ */
+static u8 schema_hex_value(char c)
+{
+    if (is_digit(c)) {
+        return (c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+        return (c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+        return (c - 'A' + 10);
+    }
+
+    return 0xff;
+}
+
+#endif /* _SCHEMA_ENABLE_ACK || _SCHEMA_PROVIDE_UNSERIALIZE */
+
+
+#ifdef _SCHEMA_ENABLE_ACK
+
+/**
+ * Write `n` in decimal to `dst`, which must hold at least ten bytes,
+ * without a null terminator. Unlike `itoa`, this covers the full
+ * range of a sequence number. Returns the number of digits written.
+ */
+static size_t schema_format_sequence(char *dst, uint32_t n)
+{
+    u8 len = 0, i;
+    char digits[10];
+
+    do {
+        digits[len++] = '0' + (n % 10);
+        n /= 10;
+    } while (n > 0);
+
+    for (i = 0; i < len; ++i) {
+        dst[i] = digits[len - i - 1];
+    }
+
+    return len;
+}
+
+
+/**
+ * Read a decimal sequence number from `s` (of length `len`) at the
+ * offset `*i`, storing it in `value`, and leave `*i` just past it.
+ * Returns false if there are no digits, or too many.
+ */
+static u8 schema_parse_sequence(const char *s, size_t len,
+                                size_t *i, uint32_t *value)
+{
+    size_t start = *i;
+
+    for (*value = 0; *i < len && is_digit(s[*i]); (*i)++) {
+        *value = (*value * 10) + (s[*i] - '0');
+    }
+
+    return (*i > start && *i - start <= 10);
+}
+
+
+/**
+ * Write the header for a sequenced record numbered `sequence` to
+ * `dst`, which must hold `SCHEMA_SEQUENCE_HEADER_MAX` bytes; the
+ * record itself follows. Returns the length of the header, which
+ * is not null-terminated.
+ */
+size_t schema_sequence_header(char *dst, uint32_t sequence)
+{
+    size_t len = 0;
+
+    dst[len++] = '0' + SMS_SEQUENCED_API_VERSION;
+    dst[len++] = SMS_MAGIC_DELIMITER;
+
+    len += schema_format_sequence(&dst[len], sequence);
+    dst[len++] = SMS_MAGIC_DELIMITER;
+
+    return len;
+}
+
+
+/**
+ * Find the sequence number of the sequenced record `s` (of length
+ * `len`, which need only cover the header), and store it in
+ * `sequence`. Returns the length of the header, so that the record
+ * itself starts at `s` plus that many bytes, or zero if `s` isn't
+ * a sequenced record.
+ */
+size_t schema_sequence_read(const char *s, size_t len, uint32_t *sequence)
+{
+    size_t i = 2;
+
+    if (len < 4 || s[0] != '0' + SMS_SEQUENCED_API_VERSION ||
+            s[1] != SMS_MAGIC_DELIMITER) {
+        return 0;
+    }
+
+    if (!schema_parse_sequence(s, len, &i, sequence) ||
+            i >= len || s[i] != SMS_MAGIC_DELIMITER) {
+        return 0;
+    }
+
+    return (i + 1);
+}
+
+
+/**
+ * Read the acknowledgement `s` (of length `len`) from start to end,
+ * and set `*found` if it lists `sequence`. Returns false if `s`
+ * isn't a well-formed acknowledgement; `*found` is then meaningless.
+ */
+static u8 schema_ack_scan(const char *s, size_t len,
+                          uint32_t sequence, u8 *found)
+{
+    size_t i = 0, start;
+    uint32_t first, last;
+
+    *found = FALSE;
+
+    /* Header (e.g. 7!) */
+    if (!schema_parse_sequence(s, len, &i, &first) ||
+            first != SMS_ACK_API_VERSION ||
+            i >= len || s[i++] != SMS_MAGIC_DELIMITER) {
+        return FALSE;
+    }
+
+    for (;;) {
+
+        if (!schema_parse_sequence(s, len, &i, &first)) {
+            return FALSE;
+        }
+
+        if (i < len && s[i] == SMS_ACK_RANGE_DELIMITER) {
+
+            /* Range (e.g. 10-12) */
+            ++i;
+
+            if (!schema_parse_sequence(s, len, &i, &last) || last < first) {
+                return FALSE;
+            }
+
+            if (sequence >= first && sequence <= last) {
+                *found = TRUE;
+            }
+
+        } else if (i < len && s[i] == SMS_ACK_BITMAP_DELIMITER) {
+
+            /* Bitmap (e.g. 40*a1) */
+            for (start = ++i; i < len; ++i) {
+
+                u8 nibble = schema_hex_value(s[i]);
+
+                if (nibble == 0xff) {
+                    break;
+                }
+
+                uint32_t n = first + 4 * (uint32_t) (i - start);
+
+                if (sequence >= n && sequence - n < 4 &&
+                        (nibble & (0x08 >> (sequence - n)))) {
+                    *found = TRUE;
+                }
+            }
+
+            if (i == start) {
+                return FALSE;
+            }
+
+        } else if (sequence == first) {
+            *found = TRUE;
+        }
+
+        if (i == len) {
+            return TRUE;
+        }
+
+        if (s[i++] != SMS_ACK_ITEM_DELIMITER) {
+            return FALSE;
+        }
+    }
+}
+
+
+/**
+ * Return true if `s` (of length `len`) is a well-formed
+ * acknowledgement, listing at least one sequence number.
+ */
+u8 schema_ack_is_valid(const char *s, size_t len)
+{
+    u8 found;
+    return schema_ack_scan(s, len, 0, &found);
+}
+
+
+/**
+ * Return true if the acknowledgement `s` (of length `len`) lists
+ * `sequence`. A malformed acknowledgement lists nothing at all.
+ */
+u8 schema_ack_contains(const char *s, size_t len, uint32_t sequence)
+{
+    u8 found;
+    return (schema_ack_scan(s, len, sequence, &found) && found);
+}
+
+
+#ifdef _SCHEMA_ENABLE_DELTA
+
+/**
+ * If `s` (of length `len`) is a complete delta record, write the text
+ * record it stands for -- the one its form keeps as a base -- to `dst`
+ * (of `size` bytes), and store its sequence number in `sequence`. The
+ * result is not null-terminated. Returns its length, or zero if `s`
+ * isn't a complete delta record, or if the result doesn't fit.
+ */
+size_t schema_delta_base(const char *s, size_t len,
+                         uint32_t *sequence, char *dst, size_t size)
+{
+    size_t i = 2, code, code_len, n = 0;
+    uint32_t base_sequence;
+
+    /* Header (e.g. 4!PSMS!41!0!) */
+    if (len < 2 || s[0] != '0' + SMS_DELTA_API_VERSION ||
+            s[1] != SMS_MAGIC_DELIMITER) {
+        return 0;
+    }
+
+    for (code = i; i < len && is_alphanumeric(s[i]); ++i);
+
+    if (i >= len || i == code || s[i] != SMS_MAGIC_DELIMITER) {
+        return 0;
+    }
+
+    code_len = i++ - code;
+
+    if (!schema_parse_sequence(s, len, &i, sequence) ||
+            i >= len || s[i++] != SMS_MAGIC_DELIMITER) {
+        return 0;
+    }
+
+    if (!schema_parse_sequence(s, len, &i, &base_sequence) ||
+            base_sequence != 0 || i >= len ||
+            s[i++] != SMS_MAGIC_DELIMITER) {
+        return 0;
+    }
+
+    /* Text record (e.g. 1!PSMS!...) */
+    if (code_len + (len - i) + 3 > size) {
+        return 0;
+    }
+
+    dst[n++] = '0' + SMS_API_VERSION;
+    dst[n++] = SMS_MAGIC_DELIMITER;
+
+    memcpy(&dst[n], &s[code], code_len);
+    n += code_len;
+    dst[n++] = SMS_MAGIC_DELIMITER;
+
+    memcpy(&dst[n], &s[i], len - i);
+    return (n + len - i);
+}
+
+#endif /* _SCHEMA_ENABLE_DELTA */
+
+#endif /* _SCHEMA_ENABLE_ACK */
+
+
+#if defined(_SCHEMA_ENABLE_DELTA) || defined(_SCHEMA_PROVIDE_UNSERIALIZE)
+
+/* Delta encoding:
+    A record is sent as just the fields that differ from an earlier
+    record of the same form (its base), which the gateway is expected
+    to have kept. After the usual header come the record's sequence
+    number and the base's, then a bitmap of changed fields, and then
+    the changed fields themselves, escaped and delimited exactly as
+    in a text record (e.g. 4!PSMS!42!40!a!7#x). The bitmap is written
+    in hexadecimal, one digit per four fields, first field in the most
+    significant bit. A base of zero means there is no base: the whole
+    record follows, as in a text record, and it can serve as the base
+    for later records (e.g. 4!PSMS!40!0!3#y#7#z). */
+
+/**
+ * Return the length of the escaped field at `p`, which ends at
+ * the first unescaped `delimiter` before `end`, or at `end`.
+ */
+static size_t schema_text_field_length(const char *p, const char *end,
+                                       char delimiter)
+{
+    const char *q = p;
+
+    for (; q < end && *q != delimiter; q++) {
+        if (*q == SMS_ESCAPE && q + 1 < end) {
+            q++;
+        }
+    }
+
+    return (q - p);
+}
+
+
+/**
+ * Return a pointer to the first field of the text record `s` (of
+ * length `len`), or null if `s` isn't a text record of `type_id`.
+ */
+static const char *schema_text_body(const char *s, size_t len,
+                                    const char *type_id)
+{
+    unsigned int version = 0;
+    const char *p = s, *end = s + len;
+    size_t n = strlen(type_id);
+
+    while (p < end && is_digit(*p)) {
+        version = (version * 10) + (*p++ - '0');
+    }
+
+    if (version != SMS_API_VERSION || p >= end ||
+            *p++ != SMS_MAGIC_DELIMITER) {
+        return NULL;
+    }
+
+    if (p + n >= end || memcmp(p, type_id, n) != 0 ||
+            p[n] != SMS_MAGIC_DELIMITER) {
+        return NULL;
+    }
+
+    return (p + n + 1);
+}
+
+#endif /* _SCHEMA_ENABLE_DELTA || _SCHEMA_PROVIDE_UNSERIALIZE */
+
+
+#ifdef _SCHEMA_ENABLE_DELTA
+
+const char PROGMEM schema_delta_hex[] = "0123456789abcdef";
+
+
+/**
+ * Emit `n` in decimal, followed by the magic delimiter. Unlike
+ * `itoa`, this covers the full range of a sequence number.
+ */
+static void schema_emit_sequence(schema_emitter_t *e, uint32_t n)
+{
+    u8 len = 0;
+    char digits[10];
+
+    do {
+        digits[len++] = '0' + (n % 10);
+        n /= 10;
+    } while (n > 0);
+
+    while (len > 0) {
+        schema_emit(e, digits[--len]);
+    }
+
+    schema_emit(e, SMS_MAGIC_DELIMITER);
+}
+
+
+/**
+ * Escape the value of `i` in to `dst`, which must hold at least
+ * `MAX_SMS_FIELD_LENGTH + 1` bytes, just as `schema_emit_fields`
+ * would write it. Returns the length of the escaped value.
+ */
+static size_t schema_item_escaped(schema_item_t *i, char *dst)
+{
+    char number[16];
+    schema_buffer_t b;
+    schema_emitter_t e;
+
+    const char *field = schema_item_text(i, number);
+
+    schema_buffer_init(&b, dst, MAX_SMS_FIELD_LENGTH + 1);
+    schema_emitter_init(&e, &schema_sink_buffer, &b);
+
+    if (field != NULL) {
+        schema_emit_escaped(&e, field, schema_item_delimiter(i));
+    }
+
+    schema_emit_flush(&e);
+    return e.total;
+}
+
+
+/**
+ * Serialize `l` as a delta record with the sequence number
+ * `sequence`, against the text record `base` (of length `base_len`,
+ * as produced by `schema_list_serialize_to`) whose sequence number is
+ * `base_sequence`. If `base` is null, the whole record is written,
+ * with a base of zero. Returns the number of bytes produced, or zero
+ * if the sink failed, if `base` isn't a record of the same form, or
+ * if the delta won't fit in one message.
+ */
+size_t schema_list_serialize_delta_to(schema_list_t *l, uint32_t sequence,
+                                      const char *base, size_t base_len,
+                                      uint32_t base_sequence,
+                                      schema_sink_t sink, void *ctx)
+{
+    u8 n, more = TRUE;
+    size_t necessary = 0;
+    u8 changed[32] = { 0 };
+    char text[MAX_SMS_FIELD_LENGTH + 1];
+    const char *p = NULL, *end = base + base_len;
+
+    if (base != NULL) {
+        p = schema_text_body(base, base_len, l->type_id);
+        if (p == NULL) {
+            return 0;
+        }
+    }
+
+    schema_emitter_t e;
+    schema_emitter_init(&e, sink, ctx);
+
+    /* Always a single message */
+    e.limit = MAX_SMS_LENGTH;
+
+    schema_emit_header(&e, SMS_DELTA_API_VERSION, l->type_id);
+    schema_emit_sequence(&e, sequence);
+    schema_emit_sequence(&e, (base != NULL ? base_sequence : 0));
+
+    if (base == NULL) {
+
+        schema_emit_fields(&e, l);
+
+        /* Possibly cut short; it can't become a base */
+        if (e.total >= e.limit) {
+            return 0;
+        }
+
+        goto exit;
+    }
+
+    /* First pass:
+        Compare each field with the base, in its escaped form, and
+        add up the space needed by the fields that have changed. */
+
+    for (n = 0; n < l->length; n++) {
+
+        schema_item_t *i = &l->list[n];
+        char delimiter = schema_item_delimiter(i);
+
+        size_t len = schema_item_escaped(i, text);
+        size_t base_field_len = (
+            more ? schema_text_field_length(p, end, delimiter) : 0
+        );
+
+        if (!more || len != base_field_len || memcmp(text, p, len) != 0) {
+            changed[n / 8] |= (0x80 >> (n % 8));
+            necessary += len + 1;
+        }
+
+        if (more && p + base_field_len < end) {
+            p += base_field_len + 1;
+        } else {
+            more = FALSE;
+        }
+    }
+
+    /* Bitmap, then the changed fields */
+    for (n = 0; n < (l->length + 3) / 4; n++) {
+        u8 nibble = (changed[n / 2] >> ((n % 2) ? 0 : 4)) & 0x0f;
+        schema_emit(&e, schema_progmem(schema_delta_hex[nibble]));
+    }
+
+    schema_emit(&e, SMS_MAGIC_DELIMITER);
+
+    if (e.total + necessary > e.limit + 1) {
+        return 0;
+    }
+
+    char delimiter = '\0';
+
+    for (n = 0; n < l->length; n++) {
+
+        schema_item_t *i = &l->list[n];
+
+        if (!(changed[n / 8] & (0x80 >> (n % 8)))) {
+            continue;
+        }
+
+        /* Each changed field but the last ends with its delimiter */
+        if (delimiter != '\0') {
+            schema_emit(&e, delimiter);
+        }
+
+        size_t len = schema_item_escaped(i, text);
+
+        for (size_t j = 0; j < len; j++) {
+            schema_emit(&e, text[j]);
+        }
+
+        delimiter = schema_item_delimiter(i);
+    }
+
+    exit:
+        schema_emit_flush(&e);
+        return (e.failed ? 0 : e.total);
+}
+
+#endif /* _SCHEMA_ENABLE_DELTA */
+
+
+#ifdef _SCHEMA_PROVIDE_UNSERIALIZE
+
+/**
+ * Return the API version from the header of the message `s` (of
+ * length `len`), or zero if it doesn't begin with a version number
+ * and the magic delimiter. If `end` is non-null, the offset of the
+ * delimiter is stored there.
+ */
+static unsigned int schema_message_version(const char *s,
+                                           size_t len, size_t *end)
+{
+    size_t i = 0;
+    unsigned int rv = 0;
+
+    while (i < len && i < 4 && is_digit(s[i])) {
+        rv = (rv * 10) + (s[i++] - '0');
+    }
+
+    if (i == 0 || i >= len || s[i] != SMS_MAGIC_DELIMITER) {
+        return 0;
+    }
+
+    if (end != NULL) {
+        *end = i;
+    }
+
+    return rv;
+}
+
+
+/**
+ * Prepare the push-mode parser `p` to decode one message in to `l`,
+ * reporting on it in `o` (which may be null). Only fields with flags
+ * matching `filter` are set, unless it's `FL_NONE`. The message can
+ * then be passed to `schema_parser_feed` in pieces of any size, and
+ * is decoded entirely in `p`; nothing is allocated, other than the
+ * form identifier copied to `o`.
+ */
+schema_parser_t *schema_parser_init(schema_parser_t *p, schema_list_t *l,
+                                    schema_info_t *o, schema_flags_t filter)
+{
+    p->list = l;
+    p->info = o;
+    p->filter = filter;
+    p->state = ST_BEGIN;
+    p->item = l->list;
+    p->n = 0;
+    p->version = 0;
+
+    if (o != NULL) {
+        schema_info_init(o);
+        o->form_identifier = NULL;
+    }
+
+    return p;
+}
+
+
+/* Delimiter scan:
+    Text fields are copied a run at a time, rather than a character
+    at a time; a run ends at the field's delimiter or at an escape.
+    On the host, the search looks at 32 (AVX2) or 16 (SSE2) bytes at
+    once; define `_SCHEMA_DISABLE_SIMD` to use the plain loop only. */
+
+/**
+ * Return the offset of the first byte in the `len` bytes at `s` that
+ * is either `a` or `b`, or `len` if neither of them is found.
+ */
+static size_t schema_scan(const char *s, size_t len, char a, char b)
+{
+    size_t i = 0;
+
+    #ifndef _SCHEMA_DISABLE_SIMD
+      #if defined(__AVX2__)
+
+        const __m256i va = _mm256_set1_epi8(a);
+        const __m256i vb = _mm256_set1_epi8(b);
+
+        for (; i + 32 <= len; i += 32) {
+
+            __m256i x = _mm256_loadu_si256((const __m256i *) &s[i]);
+
+            unsigned int m = (unsigned int) _mm256_movemask_epi8(
+                _mm256_or_si256(
+                    _mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb)
+                )
+            );
+
+            if (m != 0) {
+                return i + __builtin_ctz(m);
+            }
+        }
+
+      #endif /* __AVX2__ */
+      #if defined(__SSE2__)
+
+        const __m128i wa = _mm_set1_epi8(a);
+        const __m128i wb = _mm_set1_epi8(b);
+
+        for (; i + 16 <= len; i += 16) {
+
+            __m128i x = _mm_loadu_si128((const __m128i *) &s[i]);
+
+            unsigned int m = (unsigned int) _mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(x, wa), _mm_cmpeq_epi8(x, wb))
+            );
+
+            if (m != 0) {
+                return i + __builtin_ctz(m);
+            }
+        }
+
+      #endif /* __SSE2__ */
+    #endif /* ! defined _SCHEMA_DISABLE_SIMD */
+
+    for (; i < len; ++i) {
+        if (s[i] == a || s[i] == b) {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+
+/**
+ * Append the `len` bytes at `s` to the current field (or the raw
+ * message, for `ST_BUFFER`), rejecting the message if they don't
+ * fit. Returns false if the message was rejected.
+ */
+static u8 schema_parser_append(schema_parser_t *p, const char *s, size_t len)
+{
+    char *dst = (p->state == ST_BUFFER ? p->raw : p->buf);
+
+    size_t size = (
+        p->state == ST_BUFFER ? sizeof(p->raw) : sizeof(p->buf)
+    );
+
+    if (p->n + len >= size) {
+        p->state = ST_REJECT;
+        return FALSE;
+    }
+
+    memcpy(&dst[p->n], s, len);
+    p->n += len;
+
+    return TRUE;
+}
+
+
+/**
+ * Append `c` to the current field; see `schema_parser_append`.
+ */
+static void schema_parser_push(schema_parser_t *p, char c)
+{
+    schema_parser_append(p, &c, 1);
+}
+
+
+/**
+ * Set the current item from the field just completed, which is
+ * the `len` bytes at `s`: either the field buffer, or (for fields
+ * without any escapes) the field's place in the message itself.
+ */
+static void schema_parser_push_field(schema_parser_t *p,
+                                     const char *s, size_t len)
+{
+    schema_item_t *ip = p->item;
+
+    if (p->filter != FL_NONE &&
+            (schema_field(ip, flags) & p->filter) == FL_NONE) {
+        return;
+    }
+
+    schema_item_store_span(p->list, ip, s, len);
+    schema_item_validate(p->list, ip);
+
+    if (p->info != NULL) {
+        p->info->field_count++;
+    }
+}
+
+
+/**
+ * Pass the next `len` bytes of the message, at `s`, to the parser
+ * `p`. A piece may end anywhere, even in the middle of an escape
+ * sequence. Returns false once the message has been rejected.
+ */
+u8 schema_parser_feed(schema_parser_t *p, const char *s, size_t len)
+{
+    schema_item_t *last = p->list->list + p->list->length - 1;
+
+    for (size_t i = 0; i < len && p->state != ST_REJECT; ++i) {
+
+        char c = s[i];
+
+        switch (p->state) {
+
+            /* First magic field: protocol version */
+            case ST_BEGIN:
+            case ST_API_VERSION:
+
+                if (c == SMS_MAGIC_DELIMITER && p->n > 0) {
+
+                    /* Null-terminate and parse API version */
+                    p->buf[p->n] = '\0';
+                    p->version = atoi(p->buf);
+
+                    if (p->info != NULL) {
+                        p->info->api_version = p->version;
+                    }
+
+                    /* Compact and delta records:
+                        These can't be decoded a character at a time;
+                        keep the whole message, including the header,
+                        and decode it in `schema_parser_finish`. */
+
+                    if (p->version == SMS_COMPACT_API_VERSION ||
+                            p->version == SMS_DELTA_API_VERSION) {
+
+                        memcpy(p->raw, p->buf, p->n);
+                        p->state = ST_BUFFER;
+                        schema_parser_push(p, c);
+                        break;
+                    }
+
+                    /* Reset and go to next state */
+                    p->n = 0;
+                    p->state = ST_FORM_IDENTIFIER;
+
+                } else if (is_digit(c)) {
+
+                    p->state = ST_API_VERSION;
+                    schema_parser_push(p, c);
+
+                } else {
+
+                    /* Invalid character */
+                    p->state = ST_REJECT;
+                }
+                break;
+
+            /* Second magic field: form identifier */
+            case ST_FORM_IDENTIFIER:
+
+                if (c == SMS_MAGIC_DELIMITER) {
+
+                    /* Copy form identifier to schema_info */
+                    if (p->info != NULL) {
+                        p->buf[p->n] = '\0';
+                        p->info->form_identifier = (u8 *) xmalloc(p->n + 1);
+                        memcpy(p->info->form_identifier, p->buf, p->n + 1);
+                    }
+
+                    /* Reset field buffer and go to next state */
+                    p->n = 0;
+                    p->state = ST_FIELD;
+
+                } else if (is_alphanumeric(c)) {
+
+                    schema_parser_push(p, c);
+
+                } else {
+                    /* Invalid character */
+                    p->state = ST_REJECT;
+                }
+
+                break;
+
+            /* Ordinary field */
+            case ST_FIELD:
+            {
+                const char *run = &s[i];
+
+                size_t n = schema_scan(
+                    run, len - i, schema_item_delimiter(p->item), SMS_ESCAPE
+                );
+
+                /* No delimiter yet: keep what there is */
+                if (i + n == len) {
+                    schema_parser_append(p, run, n);
+                    i = len - 1;
+                    break;
+                }
+
+                i += n;
+
+                if (s[i] == SMS_ESCAPE) {
+
+                    /* Start escape sequence */
+                    if (schema_parser_append(p, run, n)) {
+                        p->state = ST_FIELD_ESCAPE;
+                    }
+
+                    break;
+                }
+
+                if (p->n == 0) {
+
+                    /* Done with current field:
+                        It has no escapes, and is entirely within
+                        this piece, so it can be used where it is. */
+
+                    if (n >= sizeof(p->buf)) {
+                        p->state = ST_REJECT;
+                        break;
+                    }
+
+                    schema_parser_push_field(p, run, n);
+
+                } else {
+
+                    /* Done with current field */
+                    if (!schema_parser_append(p, run, n)) {
+                        break;
+                    }
+
+                    schema_parser_push_field(p, p->buf, p->n);
+                }
+
+                /* Last available form field? */
+                if (p->item == last) {
+                    p->state = ST_ACCEPT;
+                    break;
+                }
+
+                /* Next field; reset field buffer */
+                p->item++;
+                p->n = 0;
+
+                break;
+            }
+
+            /* Inside of escape sequence */
+            case ST_FIELD_ESCAPE:
+
+                /* Escaped character, then back to the field */
+                p->state = ST_FIELD;
+                schema_parser_push(p, c);
+                break;
+
+            /* Compact or delta record */
+            case ST_BUFFER:
+                schema_parser_append(p, &s[i], len - i);
+                i = len - 1;
+                break;
+
+            case ST_ACCEPT:
+                /* Additional input after end of form */
+                p->state = ST_REJECT;
+                break;
+
+            default:
+            case ST_REJECT:
+                /* Sink state */
+                break;
+        }
+    }
+
+    return (p->state != ST_REJECT);
+}
+
+
+/**
+ * Signal the end of the message given to `p`. Returns true if the
+ * entire message was accepted.
+ */
+u8 schema_parser_finish(schema_parser_t *p)
+{
+    schema_item_t *last = p->list->list + p->list->length - 1;
+
+    if (p->state == ST_BUFFER) {
+
+        size_t len = p->n;
+        p->state = ST_REJECT;
+
+        /* The decoders below report on the message themselves */
+        if (p->info != NULL) {
+            schema_info_init(p->info);
+        }
+
+        if (p->version == SMS_COMPACT_API_VERSION &&
+                schema_list_unserialize_compact(p->list, p->info,
+                                                p->raw, len)) {
+            p->state = ST_ACCEPT;
+        }
+
+        if (p->version == SMS_DELTA_API_VERSION &&
+                schema_list_unserialize_delta(p->list, p->info,
+                                              p->raw, len, NULL, 0)) {
+            p->state = ST_ACCEPT;
+        }
+
+        return (p->state == ST_ACCEPT);
+    }
+
+    if (p->state == ST_FIELD && (p->n > 0 || p->item == last)) {
+
+        /* Final field might not have delimiter:
+            Make sure that the field gets pushed anyway, even
+            if it's empty (as a skipped last question is). */
+
+        schema_parser_push_field(p, p->buf, p->n);
+        p->state = ST_ACCEPT;
+    }
+
+    if (p->item != last) {
+        p->state = ST_REJECT;
+    }
+
+    return (p->state == ST_ACCEPT);
+}
+
+
+/**
+ * Decode the message `s` (of length `len`) in to `l`, which must be
+ * the list for the form that produced it; see `schema_parser_init`.
+ * Delta records that aren't complete need their base, and must be
+ * given to `schema_list_unserialize_delta` instead.
+ */
+u8 schema_list_unserialize(schema_list_t *l, schema_info_t *o,
+                           const char *s, size_t len, schema_flags_t filter)
+{
+    schema_parser_t p;
+
+    schema_parser_init(&p, l, o, filter);
+    schema_parser_feed(&p, s, len);
+
+    return schema_parser_finish(&p);
+}
+
+
+/* Compact bit stream reader:
+    The counterpart of `schema_emit_bits`. */
+
+typedef struct schema_bit_reader {
+
+    const char *s;
+    size_t len;
+    size_t pos;
+    u8 bits;
+    u8 nbits;
+    u8 error;
+
+} schema_bit_reader_t;
+
+
+/**
+ * Return the six-bit value of the compact character `c`, or
+ * 0xff if `c` isn't part of the compact alphabet.
+ */
+static u8 schema_compact_value(char c)
+{
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    } else if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    } else if (c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    } else if (c == '+') {
+        return 62;
+    } else if (c == '/') {
+        return 63;
+    }
+
+    return 0xff;
+}
+
+
+/**
+ * Read `width` bits from the reader `r`, most significant bit first.
+ * Sets `r->error` if the input is too short or not valid.
+ */
+static unsigned long schema_read_bits(schema_bit_reader_t *r, u8 width)
+{
+    unsigned long rv = 0;
+
+    while (width-- > 0) {
+
+        if (r->nbits == 0) {
+
+            u8 v = (
+                r->pos < r->len ? schema_compact_value(r->s[r->pos]) : 0xff
+            );
+
+            if (v == 0xff) {
+                r->error = TRUE;
+                return 0;
+            }
+
+            r->bits = v;
+            r->nbits = 6;
+            r->pos++;
+        }
+
+        rv = (rv << 1) | ((r->bits >> --r->nbits) & 1);
+    }
+
+    return rv;
+}
+
+
+/**
+ * Decode the value of the item `i` from the reader `r` in to `buf`,
+ * in the same textual form used by `schema_list_unserialize`, so
+ * that it can be given to `schema_item_set`. Returns false if the
+ * field was absent, or on error (which is left in `r`).
+ */
+static u8 schema_compact_decode_item(schema_bit_reader_t *r,
+                                     schema_item_t *i, char *buf)
+{
+    u8 n, length;
+
+    if (!schema_read_bits(r, 1)) {
+        return FALSE;
+    }
+
+    switch (schema_field(i, data_type)) {
+
+        case TS_BOOLEAN:
+            itoa(schema_read_bits(r, 1) ? 1 : 0, buf, 10);
+            return !r->error;
+
+        #ifndef _SCHEMA_DISABLE_SELECT
+          case TS_SELECT:
+              length = schema_field(i, select_length);
+
+              if (length == 0) {
+                  r->error = TRUE;
+                  return FALSE;
+              }
+
+              n = schema_read_bits(r, schema_compact_width(length - 1));
+
+              if (n >= length) {
+                  r->error = TRUE;
+              }
+
+              itoa(n + 1, buf, 10);
+              return !r->error;
+        #endif /* ! defined _SCHEMA_DISABLE_SELECT */
+
+        case TS_INTEGER:
+            itoa(
+                schema_read_bits(r, schema_compact_integer_width(
+                    schema_field(i, max_length)
+                )), buf, 10
+            );
+            return !r->error;
+
+        case TS_STRING:
+        case TS_PHONE:
+            break;
+
+        default:
+            r->error = TRUE;
+            return FALSE;
+    }
+
+    /* Strings */
+    length = schema_read_bits(
+        r, schema_compact_width(schema_field(i, max_length))
+    );
+
+    if (length > MAX_SMS_FIELD_LENGTH) {
+        r->error = TRUE;
+        return FALSE;
+    }
+
+    for (n = 0; n < length && !r->error; n++) {
+        if (schema_compact_is_digits(i)) {
+
+            u8 d = schema_read_bits(r, 4);
+
+            if (d >= sizeof(schema_compact_digits) - 1) {
+                r->error = TRUE;
+            }
+
+            buf[n] = schema_progmem(schema_compact_digits[d]);
+
+        } else {
+            buf[n] = schema_read_bits(r, 7);
+        }
+    }
+
+    buf[n] = '\0';
+    return !r->error;
+}
+
+
+/**
+ * Unserialize the compact record `s` (of length `len`) in to `l`,
+ * which must be the list for the form that produced it. Fields that
+ * were absent are marked valid but null, as skipped questions are.
+ * Returns true if the entire record was read successfully.
+ */
+u8 schema_list_unserialize_compact(schema_list_t *l, schema_info_t *o,
+                                   const char *s, size_t len)
+{
+    size_t i = 0, start;
+    char buf[MAX_SMS_FIELD_LENGTH + 1];
+
+    if (o != NULL) {
+        schema_info_init(o);
+        o->form_identifier = NULL;
+    }
+
+    /* Header: version, form identifier */
+    unsigned int version = schema_message_version(s, len, &i);
+
+    if (version == 0) {
+        return FALSE;
+    }
+
+    if (o != NULL) {
+        o->api_version = version;
+    }
+
+    for (start = ++i; i < len && is_alphanumeric(s[i]); i++);
+
+    if (i >= len || s[i] != SMS_MAGIC_DELIMITER ||
+        i - start > MAX_SMS_FIELD_LENGTH) {
+        return FALSE;
+    }
+
+    if (o != NULL) {
+        o->form_identifier = (u8 *) xmalloc(i - start + 1);
+        memcpy(o->form_identifier, s + start, i - start);
+        o->form_identifier[i - start] = '\0';
+    }
+
+    /* Fields */
+    schema_bit_reader_t r = { s, len, i + 1, 0, 0, FALSE };
+
+    for (u8 n = 0; n < l->length; n++) {
+
+        schema_item_t *ip = &l->list[n];
+
+        if (schema_compact_decode_item(&r, ip, buf)) {
+            schema_item_store_span(l, ip, buf, strlen(buf));
+            schema_item_validate(l, ip);
+        } else if (!r.error) {
+            schema_item_clear_result(ip);
+            schema_item_set_validity(
+                l, ip, ip->validity | VL_IS_VALID | VL_IS_NULL
+            );
+        }
+
+        if (r.error) {
+            return FALSE;
+        }
+
+        if (o != NULL) {
+            o->field_count++;
+        }
+    }
+
+    /* Nothing but padding may remain */
+    return (r.pos == len);
+}
+
+
+/**
+ * Read a decimal sequence number, followed by the magic delimiter,
+ * from `s` (of length `len`) at the offset `*i`, storing it in
+ * `value`. On success, `*i` is left just past the delimiter.
+ */
+static u8 schema_read_sequence(const char *s, size_t len,
+                               size_t *i, uint32_t *value)
+{
+    size_t start = *i;
+
+    for (*value = 0; *i < len && is_digit(s[*i]); (*i)++) {
+        *value = (*value * 10) + (s[*i] - '0');
+    }
+
+    if (*i == start || *i >= len || s[*i] != SMS_MAGIC_DELIMITER) {
+        return FALSE;
+    }
+
+    (*i)++;
+    return TRUE;
+}
+
+
+/**
+ * Read the header of the delta record `s` (of length `len`). On
+ * success, the form identifier's offset and length are stored in
+ * `code` and `code_len`, and `*i` is left at the first byte past
+ * the header. Returns false if `s` isn't a delta record.
+ */
+static u8 schema_delta_header(const char *s, size_t len, size_t *i,
+                              size_t *code, size_t *code_len,
+                              uint32_t *sequence, uint32_t *base_sequence)
+{
+    if (schema_message_version(s, len, i) != SMS_DELTA_API_VERSION) {
+        return FALSE;
+    }
+
+    for (*code = ++(*i); *i < len && is_alphanumeric(s[*i]); (*i)++);
+
+    if (*i >= len || *i == *code || s[*i] != SMS_MAGIC_DELIMITER) {
+        return FALSE;
+    }
+
+    *code_len = (*i)++ - *code;
+
+    return (
+        schema_read_sequence(s, len, i, sequence) &&
+            schema_read_sequence(s, len, i, base_sequence)
+    );
+}
 
-    /* SMS Form Identifier:
-        The form identified is a four-character code that uniquely
-        identifies the sequence of fields used. This is appended
-        to the SMS version using the magic delimiter (e.g. 1!PSMS!) */
 
-    /* Copy form identifier to output */
-    size_t header_len = strncpy_esc(
-        bufsz + 1, p, l->type_id, SMS_MAGIC_DELIMITER, SMS_ESCAPE
+/**
+ * Find the sequence numbers of the delta record `s` (of length
+ * `len`), without decoding it. A record with a base of zero is
+ * complete, and the gateway should keep it as the base for later
+ * records from the same sender. Returns false if `s` isn't a
+ * delta record.
+ */
+u8 schema_delta_info(const char *s, size_t len,
+                     uint32_t *sequence, uint32_t *base_sequence)
+{
+    size_t i = 0, code, code_len;
+
+    return schema_delta_header(
+        s, len, &i, &code, &code_len, sequence, base_sequence
     );
+}
 
-    /* Advance to terminator */
-    p += header_len - 1;
 
-    /* Overwrite terminator and advance */
-    *p++ = SMS_MAGIC_DELIMITER;
-    len -= header_len;
+/**
+ * Decode the delta record `s` (of length `len`) in to `l`, which must
+ * be the list for the form that produced it. Unchanged fields are
+ * taken from `base` (of length `base_len`), the text record kept for
+ * the delta's base sequence number; `base` may be null if the record
+ * is complete. The record is rebuilt as a text record and parsed as
+ * one, so validation is exactly as for `schema_list_unserialize`.
+ * Returns true if the record was read successfully.
+ */
+u8 schema_list_unserialize_delta(schema_list_t *l, schema_info_t *o,
+                                 const char *s, size_t len,
+                                 const char *base, size_t base_len)
+{
+    u8 rv = FALSE;
+    size_t i = 0, n = 0, code, code_len;
+    uint32_t sequence, base_sequence;
 
+    /* Large enough for a text record built from two messages */
+    size_t size = (2 * MAX_SMS_LENGTH) + 1;
 
-    /* Serialization begins here:
-        From now on, we use the regular delimiter to
-        append each serialized field to the output string. */
+    if (!schema_delta_header(s, len, &i, &code,
+                             &code_len, &sequence, &base_sequence)) {
+        return FALSE;
+    }
 
-    /* While space is remaining in destination */
-    while (len > 0) {
+    #ifdef _SCHEMA_ENABLE_ARENA
+      /* Host only: no heap allocations per message */
+      char text[(2 * MAX_SMS_LENGTH) + 1];
+    #else
+      char *text = (char *) xmalloc(size);
+    #endif /* _SCHEMA_ENABLE_ARENA */
 
-        u8 *field;
-        size_t field_len;
+    /* Text record header (e.g. 1!PSMS!) */
+    itoa(SMS_API_VERSION, text, 10);
+    n = strlen(text);
 
-        if (i->validity & VL_IS_VALID && !(i->validity & VL_IS_NULL)) {
+    text[n++] = SMS_MAGIC_DELIMITER;
+    memcpy(text + n, s + code, code_len);
+    n += code_len;
+    text[n++] = SMS_MAGIC_DELIMITER;
 
-            /* Convert field to string */
-            switch (i->data_type) {
-                case TS_SELECT:
-                case TS_INTEGER:
-                    itoa(i->value.integer, buf, 10);
-                    field = buf;
-                    break;
-                #ifdef USE_FPU
-                    case TS_NUMERIC:
-                        dtostrf(i->value.numeric, 8, 2, buf);
-                        field = buf;
-                        break;
-                #endif
-                default:
-                case TS_STRING:
-                    field = i->string_value;
-                    break;
-                case TS_BOOLEAN:
-                    buf[0] = (i->value.boolean ? '1' : '0'); buf[1] = '\0';
-                    field = buf;
-                    break;
-                case TS_PHONE:
-                    field = msisdn2str(i->value.msisdn, MSISDN_ADN, MEM_R);
-                    break;
+    #define _append(src, src_len) \
+        do { \
+            if (n + (src_len) >= size) { \
+                goto exit; \
+            } \
+            memcpy(text + n, (src), (src_len)); \
+            n += (src_len); \
+        } while (0)
+
+    if (base_sequence == 0) {
+
+        /* Complete record */
+        _append(s + i, len - i);
+
+    } else {
+
+        /* Changed fields come from the delta, the rest from the base */
+        size_t nibbles = (l->length + 3) / 4;
+        const char *bitmap = s + i, *p = s + i + nibbles + 1, *end = s + len;
+        const char *bp = NULL, *base_end = base + base_len;
+
+        if (base == NULL || i + nibbles >= len ||
+                s[i + nibbles] != SMS_MAGIC_DELIMITER) {
+            goto exit;
+        }
+
+        bp = schema_text_body(base, base_len, l->type_id);
+
+        for (u8 f = 0; f < l->length; f++) {
+
+            char delimiter = schema_item_delimiter(&l->list[f]);
+            u8 nibble = schema_hex_value(bitmap[f / 4]);
+
+            if (nibble == 0xff) {
+                goto exit;
             }
 
-            /* Copy field to result buffer */
-            field_len = strncpy_esc(
-                bufsz + 1, p, field, schema_item_delimiter(i), SMS_ESCAPE
+            size_t base_field_len = (
+                bp != NULL ?
+                    schema_text_field_length(bp, base_end, delimiter) : 0
             );
 
-            /* Overwrite terminator */
-            len -= (field_len - 1);
-            p += (field_len - 1);
+            if (nibble & (0x08 >> (f % 4))) {
 
-            /* Free resources if necessary */
-            switch (i->data_type) {
-                case TS_PHONE:
-                    free(field);
-                    break;
-                default:
-                    break;
+                size_t field_len =
+                    schema_text_field_length(p, end, delimiter);
+
+                _append(p, field_len);
+                p += field_len;
+
+                if (p < end) {
+                    p++; /* Delimiter */
+                }
+
+            } else if (bp != NULL) {
+
+                _append(bp, base_field_len);
+
+            } else {
+                goto exit; /* Field missing from base */
+            }
+
+            if (f + 1 < l->length) {
+                _append(&delimiter, 1);
+            }
+
+            if (bp != NULL && bp + base_field_len < base_end) {
+                bp += base_field_len + 1;
+            } else {
+                bp = NULL;
             }
         }
 
-        /* Stop on last field */
-        if ((i->flags & FL_LIST_TERMINATOR)) {
-            break;
+        if (p < end) {
+            goto exit; /* Unused input */
         }
+    }
+
+    #undef _append
 
-        /* Add delimiter */
-        *p++ = schema_item_delimiter(i);
-        len -= 1;
+    rv = schema_list_unserialize(l, o, text, n, FL_NONE);
 
-        i++;
+    if (o != NULL) {
+        o->api_version = SMS_DELTA_API_VERSION;
+        o->sequence = sequence;
+        o->base_sequence = base_sequence;
     }
 
-    /* Null-terminate return string */
-    *p = '\0';
+    exit:
+        #ifndef _SCHEMA_ENABLE_ARENA
+          free(text);
+        #endif /* ! _SCHEMA_ENABLE_ARENA */
 
-    free(buf);
-    return rv;
-};
+        return rv;
+}
 
 
 /**
+ * Split the message `s` (of length `len`) in to records, and invoke
+ * `fn` once for each, with a pointer and length for the record and
+ * the pass-through pointer `ctx`. A batched message (with API version
+ * `SMS_BATCH_API_VERSION`) yields each record it contains, with the
+ * batch header removed; any other message is passed through whole,
+ * as a single record. Each record can be handed directly to
+ * `schema_list_unserialize`. Returns false if `fn` returns false,
+ * or if the batch is empty.
  */
-u8 is_digit(const char c) {
+u8 schema_batch_split(const char *s, size_t len,
+                      schema_record_fn_t fn, void *ctx)
+{
+    size_t i = 0;
 
-    return (c <= '9' && c >= '0');
+    /* Batch header: version and magic delimiter (e.g. 2!) */
+    if (schema_message_version(s, len, &i) != SMS_BATCH_API_VERSION) {
+        return fn(s, len, ctx);
+    }
+
+    size_t start = ++i;
+
+    if (start >= len) {
+        return FALSE;
+    }
+
+    /* Records:
+        Separated by unescaped record delimiters; the escape
+        sequences themselves are left for the record parser. */
+
+    for (; i <= len; ++i) {
+
+        if (i < len && s[i] == SMS_ESCAPE) {
+            /* Skip the escaped character, if there is one */
+            if (i + 1 < len) {
+                ++i;
+            }
+            continue;
+        }
+
+        if (i == len || s[i] == SMS_RECORD_DELIMITER) {
+
+            if (!fn(s + start, i - start, ctx)) {
+                return FALSE;
+            }
+
+            start = i + 1;
+        }
+    }
+
+    return TRUE;
+}
+/**
+ * Prepare the reassembler `r`, which has no parts buffered.
+ */
+schema_reassembler_t *schema_reassembler_init(schema_reassembler_t *r)
+{
+    memset(r, '\0', sizeof(*r));
+    return r;
 }
 
 
 /**
+ * Discard the partial record in the slot `p`.
  */
-u8 is_alphanumeric(const char c) {
+static void schema_partial_clear(schema_partial_t *p)
+{
+    if (p->data != NULL) {
+        free(p->data);
+    }
 
-    return (
-        is_digit(c) ||
-            (c <= 'Z' && c >= 'A') || (c <= 'z' && c >= 'a')
-    );
+    memset(p, '\0', sizeof(*p));
 }
 
-#ifdef _SCHEMA_PROVIDE_UNSERIALIZE
+
 /**
+ * Discard every part buffered by the reassembler `r`.
  */
-u8 schema_list_unserialize(schema_list_t *l, schema_info_t *o,
-                           const char *s, size_t len, schema_flags_t filter)
+void schema_reassembler_clear(schema_reassembler_t *r)
 {
-    int i;
-    schema_item_t *ip = l->list;
-    size_t bufsz = MAX_SMS_FIELD_LENGTH;
+    for (u8 n = 0; n < SCHEMA_REASSEMBLY_SLOTS; n++) {
+        schema_partial_clear(&r->slots[n]);
+    }
+}
 
-    /* Skip overflow checking:
-        These sizes are predefined constants, not user input. */
 
-    u8 *buf = (u8 *) xmalloc(bufsz + 1);
-    u8 *bufp = buf, *limit = buf + bufsz;
+/**
+ * Find the slot in `r` for the record with reference number `reference`
+ * from `source`, which has `total` parts; if there's no such slot, one
+ * is started, discarding the least-recently-used partial record if
+ * necessary. Returns null if memory couldn't be allocated.
+ */
+static schema_partial_t *schema_reassembler_slot(schema_reassembler_t *r,
+                                                 const char *source,
+                                                 u8 reference, u8 total)
+{
+    schema_partial_t *p, *rv = NULL;
 
-    if (o != NULL) {
-        o->field_count = 0;
-        o->api_version = 0;
-        o->form_identifier = (u8 *) xmalloc(bufsz + 1);
+    for (u8 n = 0; n < SCHEMA_REASSEMBLY_SLOTS; n++) {
+
+        p = &r->slots[n];
+
+        if (p->data != NULL && p->reference == reference &&
+                strcmp(p->source, source) == 0) {
+
+            if (p->total == total) {
+                return p;
+            }
+
+            /* Reference reused for a different record */
+            schema_partial_clear(p);
+            rv = p;
+            break;
+        }
+
+        if (rv == NULL || (rv->data != NULL &&
+                (p->data == NULL || p->stamp < rv->stamp))) {
+            rv = p;
+        }
     }
 
-    muvuku_unserialize_state_t state = ST_BEGIN;
+    schema_partial_clear(rv);
+    rv->data = (char *) xmalloc(total * SCHEMA_MULTIPART_PAYLOAD);
 
-    #define _bounds_check_and_push() \
-        do { \
-            if (bufp >= limit) { \
-                state = ST_REJECT; \
-                break; \
-            } \
-            *bufp++ = s[i]; \
-        } while (0)
+    if (rv->data == NULL) {
+        return NULL;
+    }
 
-    #define _push_completed_field() \
-        do { \
-            if (filter != FL_NONE && (ip->flags & filter) == FL_NONE) { \
-                break; \
-            } \
-            *bufp = '\0'; \
-            schema_item_set(ip, buf, bufp - buf + 1); \
-            schema_item_validate(l, ip); \
-            if (o != NULL) { \
-                o->field_count++; \
-            } \
-        } while (0)
+    rv->reference = reference;
+    rv->total = total;
+    strncpy(rv->source, source, SCHEMA_SOURCE_LENGTH_MAX);
+
+    return rv;
+}
 
 
-    for (i = 0; i < len; ++i) {
+/**
+ * Accept the message `s` (of length `len`) from `source` (e.g. the
+ * sender's phone number, or null). Parts of a multipart message (with
+ * API version `SMS_MULTIPART_API_VERSION`) are buffered, in whatever
+ * order they arrive, until every part of the record is present; `fn`
+ * is then invoked once, exactly as `schema_batch_split` would invoke
+ * it, with the complete record. Any other message is passed straight
+ * through to `fn`. Returns false if the message is malformed, or if
+ * `fn` returns false.
+ */
+u8 schema_reassembler_add(schema_reassembler_t *r, const char *source,
+                          const char *s, size_t len,
+                          schema_record_fn_t fn, void *ctx)
+{
+    size_t i = 0;
+    uint32_t reference, part, total;
 
-        switch (state) {
+    if (schema_message_version(s, len, &i) != SMS_MULTIPART_API_VERSION) {
+        return fn(s, len, ctx);
+    }
 
-            /* First magic field: protocol version */
-            case ST_BEGIN:
-            case ST_API_VERSION:
+    ++i;
 
-                if (s[i] == SMS_MAGIC_DELIMITER) {
+    if (!schema_read_sequence(s, len, &i, &reference) ||
+        !schema_read_sequence(s, len, &i, &part) ||
+        !schema_read_sequence(s, len, &i, &total)) {
+        return FALSE;
+    }
 
-                    /* Null-terminate and parse API version */
-                    if (o != NULL) {
-                        *bufp = '\0';
-                        o->api_version = atoi(buf);
-                    }
+    size_t payload_len = len - i;
 
-                    /* Reset and go to next state */
-                    bufp = buf;
-                    state = ST_FORM_IDENTIFIER;
+    if (reference > 0xff || total > 0xff || part < 1 || part > total ||
+        payload_len == 0 || payload_len > SCHEMA_MULTIPART_PAYLOAD ||
+        (part < total && payload_len != SCHEMA_MULTIPART_PAYLOAD)) {
+        return FALSE;
+    }
 
-                } else if (is_digit(s[i])) {
+    if (total == 1) {
+        return fn(s + i, payload_len, ctx);
+    }
 
-                    _bounds_check_and_push();
+    schema_partial_t *p = schema_reassembler_slot(
+        r, (source != NULL ? source : ""), reference, total
+    );
 
-                } else {
+    if (p == NULL) {
+        return FALSE;
+    }
 
-                    /* Invalid character */
-                    state = ST_REJECT;
-                }
-                break;
+    p->stamp = ++r->clock;
 
-            /* Second magic field: form identifier */
-            case ST_FORM_IDENTIFIER:
+    /* Duplicate parts are ignored */
+    if (p->received[(part - 1) / 8] & (0x80 >> ((part - 1) % 8))) {
+        return TRUE;
+    }
 
-                if (s[i] == SMS_MAGIC_DELIMITER) {
+    p->received[(part - 1) / 8] |= (0x80 >> ((part - 1) % 8));
+    p->count++;
 
-                    /* Copy form identifier to schema_info */
-                    if (o != NULL) {
-                        *bufp = '\0';
-                        memcpy(o->form_identifier, buf, bufsz + 1);
-                    }
+    memcpy(
+        p->data + ((part - 1) * SCHEMA_MULTIPART_PAYLOAD), s + i, payload_len
+    );
 
-                    /* Reset field buffer and go to next state */
-                    bufp = buf;
-                    state = ST_FIELD;
+    if (part == total) {
+        p->len = ((total - 1) * SCHEMA_MULTIPART_PAYLOAD) + payload_len;
+    }
 
-                } else if (is_alphanumeric(s[i])) {
+    if (p->count < p->total) {
+        return TRUE;
+    }
 
-                    _bounds_check_and_push();
+    u8 rv = fn(p->data, p->len, ctx);
+    schema_partial_clear(p);
 
-                } else {
-                    /* Invalid character */
-                    state = ST_REJECT;
-                }
+    return rv;
+}
 
-                break;
 
-            /* Ordinary field */
-            case ST_FIELD:
+#ifdef _SCHEMA_ENABLE_ACK
 
-                if (s[i] == SMS_ESCAPE) {
+/* Longest encoding of one window: a bitmap, after its base */
+#define SCHEMA_ACK_ENCODED_MAX (11 + (SCHEMA_ACK_WINDOW / 4))
 
-                    /* Start escape sequence */
-                    state = ST_FIELD_ESCAPE;
 
-                } else if (s[i] == schema_item_delimiter(ip)) {
+/**
+ * Start a new, empty acknowledgement in `a`.
+ */
+schema_ack_t *schema_ack_init(schema_ack_t *a)
+{
+    itoa(SMS_ACK_API_VERSION, a->buf, 10);
 
-                    /* Done with current field */
-                    _push_completed_field();
+    a->header_len = strlen(a->buf);
+    a->buf[a->header_len++] = SMS_MAGIC_DELIMITER;
+    a->buf[a->header_len] = '\0';
 
-                    /* Last available form field? */
-                    if (ip->flags & FL_LIST_TERMINATOR) {
-                        state = ST_ACCEPT;
-                        break;
-                    }
+    a->len = a->header_len;
+    a->count = 0;
+    a->pending = FALSE;
 
-                    /* Next field */
-                    ++ip;
+    return a;
+}
 
-                    /* Reset field buffer and go around */
-                    bufp = buf;
 
-                } else {
-                    _bounds_check_and_push();
-                }
+/**
+ * Return true if the `n`th number in the window of `a` is listed.
+ */
+static u8 schema_ack_bit(schema_ack_t *a, unsigned int n)
+{
+    return ((a->bits[n / 8] & (0x80 >> (n % 8))) != 0);
+}
 
-                break;
 
-            /* Inside of escape sequence */
-            case ST_FIELD_ESCAPE:
-                _bounds_check_and_push();
-                break;
+/**
+ * Write the window of `a` to `dst`, which must hold at least
+ * `SCHEMA_ACK_ENCODED_MAX` bytes, as a list of numbers and ranges or
+ * as a bitmap, whichever is shorter; the list wins a tie. Returns the
+ * length written, which is not null-terminated.
+ */
+static size_t schema_ack_encode(schema_ack_t *a, char *dst)
+{
+    size_t len, list_len = 0;
+    unsigned int n, first, top = 0;
 
-            case ST_ACCEPT:
-                /* Additional input after end of form */
-                state = ST_REJECT;
-                break;
+    /* Never more than one range longer than the bitmap */
+    char list[SCHEMA_ACK_ENCODED_MAX + 22];
 
-            default:
-            case ST_REJECT:
-                /* Sink state */
-                break;
+    for (n = 0; n < SCHEMA_ACK_WINDOW; ++n) {
+        if (schema_ack_bit(a, n)) {
+            top = n;
         }
     }
 
-    if (bufp > buf && state == ST_FIELD) {
+    /* Bitmap (e.g. 40*a1) */
+    len = schema_format_sequence(dst, a->base);
+    dst[len++] = SMS_ACK_BITMAP_DELIMITER;
 
-        /* Final field might not have delimiter:
-            Make sure that the field gets pushed anyway. */
+    for (n = 0; n <= top; n += 4) {
+        u8 nibble = (a->bits[n / 8] >> (4 - (n % 8))) & 0x0f;
+        dst[len++] = "0123456789abcdef"[nibble];
+    }
+
+    /* List (e.g. 40,42,47), given up once it's longer */
+    for (n = 0; n <= top && list_len <= len; ++n) {
+
+        if (!schema_ack_bit(a, n)) {
+            continue;
+        }
+
+        for (first = n; n < top && schema_ack_bit(a, n + 1); ++n);
+
+        if (list_len > 0) {
+            list[list_len++] = SMS_ACK_ITEM_DELIMITER;
+        }
+
+        list_len += schema_format_sequence(&list[list_len], a->base + first);
+
+        if (n > first) {
+            list[list_len++] = SMS_ACK_RANGE_DELIMITER;
+            list_len += schema_format_sequence(&list[list_len], a->base + n);
+        }
+    }
+
+    if (list_len <= len) {
+        memcpy(dst, list, list_len);
+        len = list_len;
+    }
+
+    return len;
+}
+
+
+/**
+ * Return true if the window of `a` can still be written out
+ * without making the acknowledgement too long for one message.
+ */
+static u8 schema_ack_fits(schema_ack_t *a)
+{
+    char text[SCHEMA_ACK_ENCODED_MAX];
+
+    size_t necessary = (
+        schema_ack_encode(a, text) + (a->len > a->header_len ? 1 : 0)
+    );
+
+    return (a->len + necessary <= MAX_SMS_LENGTH);
+}
+
+
+/**
+ * Write the window of `a`, if it has one, to the end of its message.
+ */
+static void schema_ack_flush(schema_ack_t *a)
+{
+    char text[SCHEMA_ACK_ENCODED_MAX];
 
-        _push_completed_field();
-        state = ST_ACCEPT;
+    if (!a->pending) {
+        return;
     }
 
-    if (!(ip->flags & FL_LIST_TERMINATOR)) {
-        state = ST_REJECT;
+    size_t len = schema_ack_encode(a, text);
+
+    if (a->len > a->header_len) {
+        a->buf[a->len++] = SMS_ACK_ITEM_DELIMITER;
+    }
+
+    memcpy(&a->buf[a->len], text, len);
+
+    a->len += len;
+    a->buf[a->len] = '\0';
+    a->pending = FALSE;
+}
+
+
+/**
+ * Add `sequence` to the acknowledgement `a`. Numbers are written most
+ * compactly in ascending order, but any order will do, and duplicates
+ * may be listed again. Returns false, leaving `a` listing exactly what
+ * it did before, if the acknowledgement is full; the caller should
+ * send it, start a new one, and add `sequence` to that instead.
+ */
+u8 schema_ack_add(schema_ack_t *a, uint32_t sequence)
+{
+    if (a->pending && sequence >= a->base &&
+            sequence - a->base < SCHEMA_ACK_WINDOW) {
+
+        unsigned int n = (unsigned int) (sequence - a->base);
+        u8 mask = (0x80 >> (n % 8));
+
+        if (a->bits[n / 8] & mask) {
+            return TRUE;
+        }
+
+        a->bits[n / 8] |= mask;
+
+        if (!schema_ack_fits(a)) {
+            a->bits[n / 8] &= ~mask;
+            return FALSE;
+        }
+
+        a->count++;
+        return TRUE;
+    }
+
+    /* Outside the window:
+        Write the current window out, and start a new one here. */
+
+    schema_ack_flush(a);
+
+    memset(a->bits, 0, sizeof(a->bits));
+    a->bits[0] = 0x80;
+    a->base = sequence;
+    a->pending = TRUE;
+
+    if (!schema_ack_fits(a)) {
+        a->pending = FALSE;
+        return FALSE;
     }
 
-    return (state == ST_ACCEPT);
+    a->count++;
+    return TRUE;
+}
+
+
+/**
+ * Return the acknowledgement `a`, as a null-terminated string. More
+ * sequence numbers may still be added afterwards.
+ */
+const char *schema_ack_message(schema_ack_t *a)
+{
+    schema_ack_flush(a);
+    return a->buf;
 }
+
+#endif /* _SCHEMA_ENABLE_ACK */
+
 #endif /* _SCHEMA_PROVIDE_UNSERIALIZE */
 
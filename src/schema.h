@@ -47,6 +47,7 @@ typedef u8 schema_validity_t;
 
 #define VL_IS_VALID             ((schema_validity_t) 1) /* 1 */
 #define VL_IS_NULL              ((schema_validity_t) 2) /* 2 */
+#define VL_IN_ARENA             ((schema_validity_t) 4) /* 3 */
 
 #define MAX_SMS_LENGTH          (160)
 #define MAX_SMS_FIELD_LENGTH    (64)
@@ -54,6 +55,39 @@ typedef u8 schema_validity_t;
 #define SMS_MAGIC_DELIMITER     ('!')
 #define SMS_ESCAPE              ('\\')
 #define SMS_API_VERSION         (1)
+#define SMS_BATCH_API_VERSION   (2)
+#define SMS_COMPACT_API_VERSION (3)
+#define SMS_DELTA_API_VERSION   (4)
+#define SMS_MULTIPART_API_VERSION (5)
+#define SMS_SEQUENCED_API_VERSION (6)
+#define SMS_ACK_API_VERSION     (7)
+#define SMS_RECORD_DELIMITER    ('\n')
+
+
+/* Maximum record length:
+    A text record longer than one message is sent in several parts,
+    and reassembled by the gateway. Saved records are also limited
+    by the size of `muvuku_string_size_t`. */
+
+#ifndef MAX_RECORD_LENGTH
+  #define MAX_RECORD_LENGTH (MAX_SMS_LENGTH * 4)
+#endif /* MAX_RECORD_LENGTH */
+
+
+/* Serializer staging:
+    `schema_list_serialize_to` hands its output to a sink in pieces
+    of at most this many bytes, staged on the stack. */
+
+#ifndef SCHEMA_SERIALIZE_CHUNK
+  #define SCHEMA_SERIALIZE_CHUNK (16)
+#endif /* SCHEMA_SERIALIZE_CHUNK */
+
+
+/* Compact integers:
+    The widest integer field in a compact record, in bits. This
+    must be the same on every device, and on the gateway. */
+
+#define SCHEMA_COMPACT_INTEGER_BITS (15)
 
 
 /* Flags passed to schema_item_prompt:
@@ -100,81 +134,333 @@ typedef u8 (*schema_trigger_t)(
 );
 
 
-/* Packed to conserve memory */
-typedef struct schema_item
+/* Field descriptor:
+    Everything about a question that never changes at runtime.
+    Descriptors are emitted as `const PROGMEM` tables (see the
+    `SCHEMA_BEGIN` macros below), and are read only through the
+    `schema_field` accessor. Members aren't conditionally compiled,
+    so that the table macros don't depend upon build options; the
+    `_SCHEMA_DISABLE_*` options only remove the code that uses them.
+    Captions and select values are localized when prompting. */
+
+typedef struct schema_field
 {
     u8 flags;
-    u8 validity;
     u8 data_type;
     u8 min_length;
     u8 max_length;
+    u8 special_delimiter;
+    const lc_char *caption;
+    u8 select_length;
+    const lc_list *select_values;
+    const u8 *select_keys;
+    schema_condition_t condition;
+    schema_validation_t validate;
+    schema_trigger_t trigger;
+
+} __attribute__((packed)) schema_field_t;
+
+
+/* Field accessor:
+    Read the member `_m` of the descriptor for item `_i`. On AVR,
+    descriptors live in flash, and must be read with rb/rw. */
+
+#ifdef _MUVUKU_PROTOTYPE
+  #define schema_progmem(_x) (_x)
+#else
+  #define schema_progmem(_x) \
+      ((__typeof__(_x)) (sizeof(_x) == 1 ? \
+          rb((u8 *) &(_x)) : rw((u16 *) &(_x))))
+#endif /* _MUVUKU_PROTOTYPE */
+
+#define schema_field(_i, _m) \
+    schema_progmem((_i)->field->_m)
+
+
+/* Item value:
+    This is the only per-question state kept in RAM. */
+
+typedef struct schema_item
+{
+    const schema_field_t *field;
+    u8 validity;
     u8 *string_value;
     #ifndef _SCHEMA_DISABLE_SLV
       u8 *string_value_slv;
     #endif /* ! defined _SCHEMA_DISABLE_SLV */
-    #ifndef _SCHEMA_DISABLE_SPECIAL_DELIMITERS
-      u8 special_delimiter;
-    #endif /* !defined _SCHEMA_DISABLE_SPECIAL_DELIMITERS */
-    const char *caption;
-    #ifndef _SCHEMA_DISABLE_SELECT
-      u8 select_length;
-      char **select_values;
-      const u8 *select_keys;
-    #endif /* ! defined _SCHEMA_DISABLE_SELECT */
-    const u8 *validate_message;
-    #ifndef _SCHEMA_DISABLE_CONDITION
-      schema_condition_t condition;
-    #endif /* ! defined _SCHEMA_DISABLE_CONDITION */
-    #ifndef _SCHEMA_DISABLE_VALIDATE
-      schema_validation_t validate;
-    #endif /* ! defined _SCHEMA_DISABLE_VALIDATE */
-    #ifndef _SCHEMA_DISABLE_TRIGGER
-      schema_trigger_t trigger;
-    #endif /* ! defined _SCHEMA_DISABLE_TRIGGER */
     schema_value_t value;
 
 } __attribute__((packed)) schema_item_t;
 
 
+/* Form descriptor:
+    Emitted by `SCHEMA_END`, alongside its table of fields. */
+
+typedef struct schema_form {
+
+    const u8 *type_id;
+    u8 length;
+    const schema_field_t *fields;
+
+} __attribute__((packed)) schema_form_t;
+
+
+/* Value arena:
+    A single block that the values of a list's items are carved from
+    while unserializing, instead of being allocated one at a time;
+    `schema_list_clear_result` empties it all at once. Items with
+    values in the arena have `VL_IN_ARENA` set. Values that don't fit
+    come from the heap, as usual. Only available on the host, and
+    only when `_SCHEMA_ENABLE_ARENA` is defined. */
+
+#ifdef _SCHEMA_ENABLE_ARENA
+
+typedef struct schema_arena {
+
+    u8 *base;
+    size_t size;
+    size_t used;
+
+} __attribute__((packed)) schema_arena_t;
+
+#endif /* _SCHEMA_ENABLE_ARENA */
+
+
+/* Cached counts:
+    The `length` is copied from the form descriptor; `valid_count`
+    tracks the number of items with `VL_IS_VALID` set, and is kept up
+    to date by every function that changes an item's validity through
+    its list. */
+
 typedef struct schema_list {
 
     u8 *type_id;
     schema_item_t *list;
+    u8 length;
+    u8 valid_count;
+
+    #ifdef _SCHEMA_ENABLE_ARENA
+      schema_arena_t arena;
+    #endif /* _SCHEMA_ENABLE_ARENA */
 
 } __attribute((packed)) schema_list_t;
 
 
+/* Output sink:
+    Receives `len` bytes of serialized output at `data`; returns
+    false to abort serialization. The pointer `ctx` is passed through
+    from `schema_list_serialize_to`. */
+
+typedef int (*schema_sink_t)(void *ctx, const char *data, size_t len);
+
+
+/* Serializer:
+    Any of the `schema_list_serialize_*to` functions. */
+
+typedef size_t (*schema_serializer_t)(
+    struct schema_list *l, schema_sink_t sink, void *ctx
+);
+
+
+/* Buffer sink state:
+    Used with `schema_sink_buffer`; the output is kept null-terminated. */
+
+typedef struct schema_buffer {
+
+    char *p;
+    size_t avail;
+
+} schema_buffer_t;
+
+
+/* Batched messages:
+    Several complete records, joined by `SMS_RECORD_DELIMITER`,
+    after a header made from `SMS_BATCH_API_VERSION` and the magic
+    delimiter (e.g. 2!1!ABCD!1#2\n1!ABCD!3#4). Record delimiters
+    inside field values are always escaped by the serializer. */
+
+typedef struct schema_batch {
+
+    char buf[MAX_SMS_LENGTH + 1];
+    size_t len;
+    u8 header_len;
+    u8 count;
+
+} schema_batch_t;
+
+
+/* Multipart messages:
+    One record, split in to consecutive pieces, each sent after a
+    header made from `SMS_MULTIPART_API_VERSION`, a reference number
+    shared by every part, the part number (from one), and the number
+    of parts, each followed by the magic delimiter (e.g. 5!17!1!3!).
+    Every piece but the last is exactly `SCHEMA_MULTIPART_PAYLOAD`
+    bytes long; this leaves room for the longest possible header. */
+
+#define SCHEMA_MULTIPART_PAYLOAD (MAX_SMS_LENGTH - 14)
+
+typedef struct schema_multipart {
+
+    const char *record;
+    size_t len;
+    size_t offset;
+    u8 reference;
+    u8 part;
+    u8 total;
+    char buf[MAX_SMS_LENGTH + 1];
+
+} schema_multipart_t;
+
+
+/* Sequenced records:
+    A saved record of any kind, after a header made from
+    `SMS_SEQUENCED_API_VERSION` and the record's sequence number, each
+    followed by the magic delimiter (e.g. 6!42!1!PSMS!...). Sequenced
+    records are batched and split like any other; the gateway unwraps
+    each one, and acknowledges it by its sequence number. */
+
+#define SCHEMA_SEQUENCE_HEADER_MAX (13)
+
+
+/* Acknowledgements:
+    Sent from the gateway to the SIM, listing the sequence numbers of
+    records that were received and decoded. After a header made from
+    `SMS_ACK_API_VERSION` and the magic delimiter come items separated
+    by commas; each is a sequence number (42), an inclusive range
+    (42-47), or a bitmap (42*a1): hexadecimal digits, four sequence
+    numbers per digit, the number before the asterisk in the most
+    significant bit. So 7!3,10-12,40*a1 acknowledges 3, 10, 11, 12,
+    40, 42 and 47. */
+
+#define SMS_ACK_ITEM_DELIMITER      (',')
+#define SMS_ACK_RANGE_DELIMITER     ('-')
+#define SMS_ACK_BITMAP_DELIMITER    ('*')
+
+
+/* Acknowledgement builder:
+    Sequence numbers are gathered in a window of this many, starting
+    at the first one added; when a number falls outside the window,
+    the window is written out as a list or a bitmap, whichever is
+    shorter, and a new one is started. */
+
+#ifndef SCHEMA_ACK_WINDOW
+  #define SCHEMA_ACK_WINDOW (64)
+#endif /* SCHEMA_ACK_WINDOW */
+
+typedef struct schema_ack {
+
+    char buf[MAX_SMS_LENGTH + 1];
+    size_t len;
+    u8 header_len;
+    unsigned int count;
+
+    /* Window: numbers not yet written, from `base` */
+    uint32_t base;
+    u8 bits[SCHEMA_ACK_WINDOW / 8];
+    u8 pending;
+
+} schema_ack_t;
+
+
+/* Record callback for `schema_batch_split` */
+typedef u8 (*schema_record_fn_t)(const char *record, size_t len, void *ctx);
+
+
 typedef struct schema_info {
 
     u8 api_version;
     u8 field_count;
     char *form_identifier;
 
+    /* Delta records only */
+    uint32_t sequence;
+    uint32_t base_sequence;
+
 } __attribute__((packed)) schema_info_t;
 
 
-schema_info_t *schema_info_init(schema_info_t *o);
+#ifdef _SCHEMA_PROVIDE_UNSERIALIZE
 
-schema_item_t *schema_item_new(const char *caption, u8 data_type,
-                               u8 min_length, u8 max_length);
+/* Parser states:
+    See `schema_parser_feed`. */
 
-schema_item_t *schema_item_init(schema_item_t *i,
-                                const char *caption, u8 data_type,
-                                u8 min_length, u8 max_length);
+typedef enum muvuku_unserialize_state {
 
-schema_item_t *schema_item_clear_result(schema_item_t *i);
+    ST_BEGIN,
+    ST_API_VERSION,
+    ST_FORM_IDENTIFIER,
+    ST_FIELD,
+    ST_FIELD_ESCAPE,
+    ST_BUFFER,
+    ST_ACCEPT,
+    ST_REJECT
 
-schema_item_t *schema_item_set_condition(
-    schema_item_t *i, schema_condition_t condition
-);
+} muvuku_unserialize_state_t;
 
-schema_item_t *schema_item_set_validation(
-    schema_item_t *i, schema_validation_t validate
-);
 
-schema_item_t *schema_item_set_trigger(
-    schema_item_t *i, schema_trigger_t trigger
-);
+/* Push-mode parser:
+    Everything needed to decode one message, fed to the parser in
+    pieces as it arrives. Text records are decoded as they go, in to
+    `buf`, one field at a time; compact and delta records, which are
+    never longer than one message, are collected in `raw` first. */
+
+typedef struct schema_parser {
+
+    schema_list_t *list;
+    schema_info_t *info;
+    schema_flags_t filter;
+    muvuku_unserialize_state_t state;
+    schema_item_t *item;
+    unsigned int version;
+    size_t n;
+    char buf[MAX_SMS_FIELD_LENGTH + 1];
+    char raw[MAX_SMS_LENGTH + 1];
+
+} schema_parser_t;
+
+
+/* Multipart reassembly:
+    The gateway keeps one partial record per slot, for at most
+    this many records at once, from any number of senders; the
+    least-recently-used one is discarded to make room. */
+
+#ifndef SCHEMA_REASSEMBLY_SLOTS
+  #define SCHEMA_REASSEMBLY_SLOTS (8)
+#endif /* SCHEMA_REASSEMBLY_SLOTS */
+
+#define SCHEMA_SOURCE_LENGTH_MAX (24)
+
+typedef struct schema_partial {
+
+    char *data;
+    size_t len;
+    unsigned long stamp;
+    u8 reference;
+    u8 total;
+    u8 count;
+    u8 received[32];
+    char source[SCHEMA_SOURCE_LENGTH_MAX + 1];
+
+} schema_partial_t;
+
+
+typedef struct schema_reassembler {
+
+    unsigned long clock;
+    schema_partial_t slots[SCHEMA_REASSEMBLY_SLOTS];
+
+} schema_reassembler_t;
+
+#endif /* _SCHEMA_PROVIDE_UNSERIALIZE */
+
+
+schema_info_t *schema_info_init(schema_info_t *o);
+
+
+schema_item_t *schema_item_init(schema_item_t *i,
+                                const schema_field_t *field);
+
+schema_item_t *schema_item_clear_result(schema_item_t *i);
 
 
 u8 schema_item_condition(schema_list_t *l, schema_item_t *i);
@@ -188,10 +474,6 @@ u8 schema_item_fail_validation(schema_item_t *i, u8 *message);
 u8 schema_item_compare_integer(schema_item_t *i, int val);
 
 
-void schema_item_teardown(schema_item_t *i);
-
-void schema_item_delete(schema_item_t *i);
-
 u8 schema_item_prompt(schema_list_t *l,
                       schema_item_t *i, schema_prompt_flags_t f);
 
@@ -204,6 +486,9 @@ typedef schema_item_t * (*schema_set_function_t)(
 
 schema_item_t *schema_item_set(schema_item_t *i, const char *s, size_t len);
 
+schema_item_t *schema_item_set_span(schema_item_t *i,
+                                    const char *s, size_t len);
+
 
 schema_item_t *schema_item_set_numeric(schema_item_t *i, const char *v,
                                        size_t len, schema_prompt_flags_t f);
@@ -214,6 +499,16 @@ schema_item_t *schema_item_set_string(schema_item_t *i, const char *v,
 schema_item_t *schema_item_set_phone(schema_item_t *i, const char *v,
                                      size_t len, schema_prompt_flags_t f);
 
+schema_item_t *schema_list_set_numeric(schema_list_t *l, schema_item_t *i,
+                                       const char *s, size_t len,
+                                       schema_prompt_flags_t f);
+
+schema_item_t *schema_list_set_string(schema_list_t *l, schema_item_t *i,
+                                      const char *s, size_t len);
+
+schema_item_t *schema_list_set_phone(schema_list_t *l, schema_item_t *i,
+                                     const char *s, size_t len);
+
 schema_item_t *schema_item_set_boolean(schema_item_t *i,
                                        unsigned v, schema_prompt_flags_t f);
 
@@ -224,17 +519,19 @@ schema_item_t *schema_item_set_boolean(schema_item_t *i,
 
 schema_item_t *schema_item_zero(schema_item_t *i);
 
+const char *schema_item_text(schema_item_t *i, char *number);
+
 
 #ifdef  _SCHEMA_DISABLE_SPECIAL_DELIMITERS
   #define schema_item_delimiter(i) (SMS_DELIMITER)
 #else
   #define schema_item_delimiter(i) \
-      (((i) != NULL && ((i)->flags & FL_SPECIAL_DELIMITER)) ? \
-          (i)->special_delimiter : SMS_DELIMITER)
+      (((i) != NULL && schema_field((i), special_delimiter)) ? \
+          schema_field((i), special_delimiter) : SMS_DELIMITER)
 #endif /* !defined _SCHEMA_DISABLE_SPECIAL_DELIMITERS */
 
 
-schema_list_t *schema_list_new(const char *form_identifier, size_t size);
+schema_list_t *schema_list_new(const schema_form_t *form);
 
 schema_item_t *schema_list_get(schema_list_t *l, unsigned int position);
 
@@ -242,12 +539,104 @@ u8 schema_list_prompt(schema_list_t *l, schema_prompt_flags_t f);
 
 void schema_list_clear_result(schema_list_t *l);
 
+#ifdef _SCHEMA_ENABLE_ARENA
+  u8 schema_list_enable_arena(schema_list_t *l, size_t size);
+#endif /* _SCHEMA_ENABLE_ARENA */
+
 u8 *schema_list_serialize(schema_list_t *l, schema_flags_t filter);
 
-#if 0
-u8 schema_list_unserialize(schema_list_t *l, schema_info_t *o,
-                           const char *s, size_t len, schema_flags_t filter);
-#endif
+size_t schema_list_serialize_to(schema_list_t *l,
+                                schema_sink_t sink, void *ctx);
+
+schema_buffer_t *schema_buffer_init(schema_buffer_t *b,
+                                    char *dst, size_t size);
+
+int schema_sink_buffer(void *ctx, const char *data, size_t len);
+
+int schema_sink_count(void *ctx, const char *data, size_t len);
+
+#ifdef _SCHEMA_ENABLE_COMPACT
+  size_t schema_list_serialize_compact_to(schema_list_t *l,
+                                          schema_sink_t sink, void *ctx);
+#endif /* _SCHEMA_ENABLE_COMPACT */
+
+#ifdef _SCHEMA_ENABLE_DELTA
+  size_t schema_list_serialize_delta_to(schema_list_t *l, uint32_t sequence,
+                                        const char *base, size_t base_len,
+                                        uint32_t base_sequence,
+                                        schema_sink_t sink, void *ctx);
+#endif /* _SCHEMA_ENABLE_DELTA */
+
+schema_batch_t *schema_batch_init(schema_batch_t *b);
+
+u8 schema_batch_add(schema_batch_t *b, const char *record, size_t len);
+
+const char *schema_batch_message(schema_batch_t *b);
+
+u8 schema_multipart_init(schema_multipart_t *m, const char *record,
+                         size_t len, u8 reference);
+
+const char *schema_multipart_next(schema_multipart_t *m);
+
+u8 is_digit(const char c);
+
+u8 is_alphanumeric(const char c);
+
+#ifdef _SCHEMA_ENABLE_ACK
+  size_t schema_sequence_header(char *dst, uint32_t sequence);
+
+  size_t schema_sequence_read(const char *s, size_t len, uint32_t *sequence);
+
+  u8 schema_ack_is_valid(const char *s, size_t len);
+
+  u8 schema_ack_contains(const char *s, size_t len, uint32_t sequence);
+#endif /* _SCHEMA_ENABLE_ACK */
+
+#if defined(_SCHEMA_ENABLE_ACK) && defined(_SCHEMA_ENABLE_DELTA)
+  size_t schema_delta_base(const char *s, size_t len,
+                           uint32_t *sequence, char *dst, size_t size);
+#endif /* _SCHEMA_ENABLE_ACK && _SCHEMA_ENABLE_DELTA */
+
+#ifdef _SCHEMA_PROVIDE_UNSERIALIZE
+  schema_parser_t *schema_parser_init(schema_parser_t *p, schema_list_t *l,
+                                      schema_info_t *o, schema_flags_t filter);
+
+  u8 schema_parser_feed(schema_parser_t *p, const char *s, size_t len);
+
+  u8 schema_parser_finish(schema_parser_t *p);
+
+  u8 schema_list_unserialize(schema_list_t *l, schema_info_t *o,
+                             const char *s, size_t len, schema_flags_t filter);
+
+  u8 schema_list_unserialize_compact(schema_list_t *l, schema_info_t *o,
+                                     const char *s, size_t len);
+
+  u8 schema_delta_info(const char *s, size_t len,
+                       uint32_t *sequence, uint32_t *base_sequence);
+
+  u8 schema_list_unserialize_delta(schema_list_t *l, schema_info_t *o,
+                                   const char *s, size_t len,
+                                   const char *base, size_t base_len);
+
+  u8 schema_batch_split(const char *s, size_t len,
+                        schema_record_fn_t fn, void *ctx);
+
+  schema_reassembler_t *schema_reassembler_init(schema_reassembler_t *r);
+
+  void schema_reassembler_clear(schema_reassembler_t *r);
+
+  u8 schema_reassembler_add(schema_reassembler_t *r, const char *source,
+                            const char *s, size_t len,
+                            schema_record_fn_t fn, void *ctx);
+
+  #ifdef _SCHEMA_ENABLE_ACK
+    schema_ack_t *schema_ack_init(schema_ack_t *a);
+
+    u8 schema_ack_add(schema_ack_t *a, uint32_t sequence);
+
+    const char *schema_ack_message(schema_ack_t *a);
+  #endif /* _SCHEMA_ENABLE_ACK */
+#endif /* _SCHEMA_PROVIDE_UNSERIALIZE */
 
 void schema_list_teardown(schema_list_t *l);
 
@@ -260,62 +649,59 @@ u8 schema_list_is_complete(schema_list_t *l);
 u8 schema_list_is_empty(schema_list_t *l);
 
 
-#define SCHEMA_BEGIN(_name, _type_id, _size) \
-    schema_list_t *_name = schema_list_new(_type_id, (size_t) (_size)); \
-    do { \
-        schema_item_t *__schema_ptr = (_name)->list;
+/* Form tables:
+    These macros emit a form's field descriptors, and then its form
+    descriptor, as constant tables. Each `SCHEMA_ITEM` takes a caption
+    (a `lc_char` table), a type, and length limits, optionally followed
+    by attributes from the list below, separated by whitespace. Usage:
 
-#define SCHEMA_ITEM(args...) \
-    schema_item_init(__schema_ptr, ##args); \
-    __schema_ptr++
+        SCHEMA_BEGIN(form_xyz)
+            SCHEMA_ITEM(lc_age, TS_INTEGER, 1, 3,
+                SCHEMA_VALIDATE(f) SCHEMA_TRIGGER(g))
+            SCHEMA_ITEM(lc_sex, TS_SELECT, 1, 1,
+                SCHEMA_SELECT(2, NULL, l_sexes))
+        SCHEMA_END(form_xyz, lc_xyz_code)
 
-#ifndef _SCHEMA_DISABLE_SELECT
-  #define SCHEMA_ITEM_SELECT(_size, _keys, _values) \
-      __schema_ptr--; \
-      __schema_ptr->select_keys = (_keys); \
-      __schema_ptr->select_values = (char **) (_values); \
-      __schema_ptr->select_length = (size_t) (_size); \
-      __schema_ptr++
-#endif /* ! defined _SCHEMA_DISABLE_SELECT */
+        schema_list_t *l = schema_list_new(&form_xyz); */
 
-#ifndef _SCHEMA_DISABLE_CONDITION
-  #define SCHEMA_ITEM_CONDITION(args...) \
-      __schema_ptr--; \
-      schema_item_set_condition(__schema_ptr, ##args); \
-      __schema_ptr++
-#endif /* ! defined _SCHEMA_DISABLE_CONDITION */
-
-#ifndef _SCHEMA_DISABLE_VALIDATE
-  #define SCHEMA_ITEM_VALIDATE(args...) \
-      __schema_ptr--; \
-      schema_item_set_validation(__schema_ptr, ##args); \
-      __schema_ptr++
-#endif /* ! defined _SCHEMA_DISABLE_VALIDATE */
-
-#ifndef _SCHEMA_DISABLE_TRIGGER
-  #define SCHEMA_ITEM_TRIGGER(args...) \
-      __schema_ptr--; \
-      schema_item_set_trigger(__schema_ptr, ##args); \
-      __schema_ptr++
-#endif /* ! defined _SCHEMA_DISABLE_TRIGGER */
-
-#define SCHEMA_ITEM_FLAGS(_flags) \
-    __schema_ptr--; \
-    __schema_ptr->flags |= _flags; \
-    __schema_ptr++
-
-#ifndef _SCHEMA_DISABLE_SPECIAL_DELIMITERS
-  #define SCHEMA_ITEM_DELIMITER(_delimiter) \
-      __schema_ptr--; \
-      __schema_ptr->special_delimiter = _delimiter; \
-      __schema_ptr->flags |= FL_SPECIAL_DELIMITER; \
-      __schema_ptr++
-#endif /* !defined _SCHEMA_DISABLE_SPECIAL_DELIMITERS */
+#define SCHEMA_BEGIN(_name) \
+    const schema_field_t PROGMEM _name##_fields[] = {
+
+#define SCHEMA_ITEM(_caption, _data_type, _min, _max, args...) \
+        { \
+            .caption = (const lc_char *) (_caption), \
+            .data_type = (_data_type), \
+            .min_length = (_min), \
+            .max_length = (_max), ##args \
+        },
+
+#define SCHEMA_END(_name, _type_id) \
+    }; \
+    const schema_form_t PROGMEM _name = { \
+        (const u8 *) (_type_id), \
+        (u8) (sizeof(_name##_fields) / sizeof(schema_field_t)), \
+        _name##_fields \
+    };
+
+#define SCHEMA_FLAGS(_flags) \
+    .flags = (_flags),
+
+#define SCHEMA_DELIMITER(_delimiter) \
+    .special_delimiter = (_delimiter),
+
+#define SCHEMA_SELECT(_size, _keys, _values) \
+    .select_length = (_size), \
+    .select_keys = (const u8 *) (_keys), \
+    .select_values = (const lc_list *) (_values),
+
+#define SCHEMA_CONDITION(_fn) \
+    .condition = (_fn),
+
+#define SCHEMA_VALIDATE(_fn) \
+    .validate = (_fn),
 
-#define SCHEMA_END() \
-        __schema_ptr--; \
-        __schema_ptr->flags |= FL_LIST_TERMINATOR; \
-    } while (0)
+#define SCHEMA_TRIGGER(_fn) \
+    .trigger = (_fn),
 
 
 #endif  /* __MUVUKU_SCHEMA_H__ */
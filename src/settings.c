@@ -22,6 +22,39 @@
 
 
 
+/* In-core settings store:
+    This is loaded by `muvuku_settings_open`, and is written
+    back to EEPROM (once) by `muvuku_settings_close`. */
+
+muvuku_kv_t *muvuku_settings_kv = NULL;
+
+
+/* In-core counters:
+    These are opened alongside `muvuku_settings_kv`, but
+    every update is written through to EEPROM immediately. */
+
+muvuku_counter_t *muvuku_settings_counters[MUVUKU_NR_COUNTERS];
+
+
+/* Nesting depth:
+    Handlers may open settings while another (e.g. the menu, or
+    a background transmit) already has them open. Only the last
+    `muvuku_settings_close` writes anything back, or closes. */
+
+unsigned int muvuku_settings_depth = 0;
+
+
+/* Size of a delta base cell, in pages:
+    Enough for a stringlist holding one string, made up of a
+    sequence number and a text record. The first page of the
+    pool holds its metadata. */
+
+#define MUVUKU_BASE_PAGES \
+    ((sizeof(muvuku_stringlist_data_t) + sizeof(muvuku_string_t) + \
+        sizeof(uint32_t) + MAX_SMS_LENGTH + MUVUKU_PAGE_SIZE - 1) / \
+            MUVUKU_PAGE_SIZE)
+
+
 /* Identifier for settings schema */
 const u8 PROGMEM lc_settings_code[] = "MUVU";
 
@@ -49,7 +82,7 @@ lc_char PROGMEM lc_err_phone[] = {
 
 u8 is_phone_number(schema_list_t *l, schema_item_t *i)
 {
-    if (i->data_type == TS_PHONE && i->value.msisdn != NULL) {
+    if (schema_field(i, data_type) == TS_PHONE && i->value.msisdn != NULL) {
         return TRUE;
     }
 
@@ -83,21 +116,86 @@ muvuku_settings_t *muvuku_settings_create() {
     );
 
     #ifndef _DISABLE_STORAGE
-        /* Create new pooled storage in flash */
-        muvuku_pool_t *p = muvuku_pool_new(
-            &muvuku_flash_allocator, MUVUKU_FLASH_RESERVED,
-                MUVUKU_NR_FORMS_MAX, &muvuku_flash_reserved
+        /* Prepare reserved flash for allocation */
+        muvuku_flash_region_t *r = muvuku_flash_region_init(
+            muvuku_flash_reserved, muvuku_flash_reserved_size()
+        );
+
+        /* Create storage for delta bases:
+            One page-aligned cell per form, each just large enough
+            for a single record; this is carved out first, so that
+            saved records get everything that's left over. */
+
+        #ifdef _SCHEMA_ENABLE_DELTA
+            muvuku_pool_t *b = muvuku_pool_new_aligned(
+                &muvuku_flash_allocator,
+                    MUVUKU_PAGE_SIZE * (1 + MUVUKU_NR_FORMS_MAX *
+                        MUVUKU_BASE_PAGES), MUVUKU_NR_FORMS_MAX, r
+            );
+        #endif /* _SCHEMA_ENABLE_DELTA */
+
+        /* Create new pooled storage in flash:
+            This takes the largest run of pages still available.
+            Cells are page-aligned, so that saving a record never
+            rewrites a page belonging to another form's cell. */
+
+        muvuku_pool_t *p = muvuku_pool_new_aligned(
+            &muvuku_flash_allocator, muvuku_flash_region_available(r),
+                MUVUKU_NR_FORMS_MAX, r
         );
     #endif /* _DISABLE_STORAGE */
 
     /* Zero space in EEPROM for application settings */
     eeprom->zero(s, sizeof(*s));
 
+    /* Create settings store:
+        An empty store reads back as "no settings saved". */
+
+    muvuku_kv_handle_t store =
+        muvuku_kv_new(eeprom, MUVUKU_SETTINGS_STORE_SIZE);
+
+    eeprom->write(&s->store, &store, sizeof(store));
+
+    /* Create persistent counters */
+    unsigned int i;
+
+    for (i = 0; i < MUVUKU_NR_COUNTERS; ++i) {
+        muvuku_counter_handle_t c = muvuku_counter_new(eeprom);
+        eeprom->write(&s->counters[i], &c, sizeof(c));
+    }
+
     #ifndef _DISABLE_STORAGE
         /* Save handle for new pool in EEPROM */
-        muvuku_pool_handle_t h = muvuku_pool_handle(p);
-        eeprom->write(&s->flash_pool, &h, sizeof(h));
-        muvuku_pool_close(p);
+        if (p != NULL) {
+            muvuku_pool_handle_t h = muvuku_pool_handle(p);
+            eeprom->write(&s->flash_pool, &h, sizeof(h));
+            muvuku_pool_close(p);
+        }
+
+        #ifdef _SCHEMA_ENABLE_DELTA
+            if (b != NULL) {
+                muvuku_pool_handle_t h = muvuku_pool_handle(b);
+                eeprom->write(&s->base_pool, &h, sizeof(h));
+                muvuku_pool_close(b);
+            }
+        #endif /* _SCHEMA_ENABLE_DELTA */
+
+        /* Create overflow storage in EEPROM:
+            This is optional; if there isn't enough EEPROM left,
+            saving simply fails once a form's flash cell is full. */
+
+        #if MUVUKU_EEPROM_OVERFLOW_RESERVED > 0
+            muvuku_pool_t *o = muvuku_pool_new(
+                eeprom, MUVUKU_EEPROM_OVERFLOW_RESERVED,
+                    MUVUKU_NR_FORMS_MAX, NULL
+            );
+
+            if (o != NULL) {
+                muvuku_pool_handle_t h = muvuku_pool_handle(o);
+                eeprom->write(&s->eeprom_pool, &h, sizeof(h));
+                muvuku_pool_close(o);
+            }
+        #endif /* MUVUKU_EEPROM_OVERFLOW_RESERVED > 0 */
     #endif /* _DISABLE_STORAGE */
 
     return s;
@@ -110,56 +208,213 @@ muvuku_settings_t *muvuku_settings_create() {
 
 void muvuku_settings_delete(muvuku_settings_t *s) {
 
+    muvuku_kv_handle_t store;
     muvuku_allocator_t *eeprom = &muvuku_eeprom_allocator;
 
+    eeprom->read(&store, &s->store, sizeof(store));
+    muvuku_kv_delete(eeprom, store);
+
+    unsigned int i;
+    muvuku_counter_handle_t c;
+
+    for (i = 0; i < MUVUKU_NR_COUNTERS; ++i) {
+        eeprom->read(&c, &s->counters[i], sizeof(c));
+        muvuku_counter_delete(eeprom, c);
+    }
+
     #ifndef _DISABLE_STORAGE
         muvuku_pool_handle_t h;
         eeprom->read(&h, &s->flash_pool, sizeof(h));
 
+        /* Locate extent table for reserved flash */
+        muvuku_flash_region_init(
+            muvuku_flash_reserved, muvuku_flash_reserved_size()
+        );
+
+        if (h != NULL) {
+            muvuku_pool_delete(
+                muvuku_pool_open(&muvuku_flash_allocator, h)
+            );
+        }
+
+        /* Delta bases, if any */
+        eeprom->read(&h, &s->base_pool, sizeof(h));
+
         if (h != NULL) {
             muvuku_pool_delete(
                 muvuku_pool_open(&muvuku_flash_allocator, h)
             );
         }
+
+        /* Overflow storage, if any */
+        eeprom->read(&h, &s->eeprom_pool, sizeof(h));
+
+        if (h != NULL) {
+            muvuku_pool_delete(muvuku_pool_open(eeprom, h));
+        }
     #endif /* _DISABLE_STORAGE */
 
     eeprom->free(s);
 }
 
 
+/* Load settings from EEPROM:
+    This copies the entire settings store in to core memory, in
+    a single bulk read, when a session begins. Every other settings
+    function works on the in-core copy from then on. Calls may nest,
+    as long as each is paired with a `muvuku_settings_close`. */
+
+u8 muvuku_settings_open(muvuku_settings_t *s) {
+
+    muvuku_kv_handle_t store;
+    muvuku_allocator_t *eeprom = &muvuku_eeprom_allocator;
+
+    if (muvuku_settings_depth++ > 0) {
+        return (muvuku_settings_kv != NULL); /* Already open */
+    }
+
+    eeprom->read(&store, &s->store, sizeof(store));
+
+    muvuku_settings_kv =
+        muvuku_kv_open(eeprom, store, MUVUKU_SETTINGS_STORE_SIZE);
+
+    /* Find current value of each counter */
+    unsigned int i;
+    muvuku_counter_handle_t c;
+
+    for (i = 0; i < MUVUKU_NR_COUNTERS; ++i) {
+        eeprom->read(&c, &s->counters[i], sizeof(c));
+        muvuku_settings_counters[i] = muvuku_counter_open(eeprom, c);
+    }
+
+    return (muvuku_settings_kv != NULL);
+}
+
+
+/* Save settings to EEPROM:
+    This commits every change made since the outermost call to
+    `muvuku_settings_open` in one pass, and then releases the in-core
+    copy. Nested calls only undo their matching open. */
+
+void muvuku_settings_close(muvuku_settings_t *s) {
+
+    unsigned int i;
+
+    if (muvuku_settings_depth == 0 || --muvuku_settings_depth > 0) {
+        return;
+    }
+
+    if (muvuku_settings_kv != NULL) {
+        muvuku_kv_commit(muvuku_settings_kv);
+        muvuku_kv_close(muvuku_settings_kv);
+        muvuku_settings_kv = NULL;
+    }
+
+    for (i = 0; i < MUVUKU_NR_COUNTERS; ++i) {
+        if (muvuku_settings_counters[i] != NULL) {
+            muvuku_counter_close(muvuku_settings_counters[i]);
+            muvuku_settings_counters[i] = NULL;
+        }
+    }
+}
+
+
+/* Nesting check:
+    Returns true if settings were already open when the innermost
+    open call was made; callers use this to put off work that
+    would disturb whoever opened them first. */
+
+u8 muvuku_settings_is_nested() {
+
+    return (muvuku_settings_depth > 1);
+}
+
+
+/* Setting lookup:
+    Copy at most `n` bytes of the setting `key` in to `buf`. Returns
+    the setting's full length, or zero if it has never been set. */
+
+size_t muvuku_settings_get(muvuku_kv_key_t key, void *buf, size_t n) {
+
+    if (muvuku_settings_kv == NULL) {
+        return 0;
+    }
+
+    return muvuku_kv_get(muvuku_settings_kv, key, buf, n);
+}
+
+
+/* Setting update:
+    Change the setting `key` in core memory. The change reaches
+    EEPROM when `muvuku_settings_close` is called. */
+
+u8 muvuku_settings_set(muvuku_kv_key_t key, void *data, size_t len) {
+
+    if (muvuku_settings_kv == NULL) {
+        return FALSE;
+    }
+
+    return muvuku_kv_set(muvuku_settings_kv, key, data, len);
+}
+
+
+/* Counter lookup:
+    Return the current value of the persistent counter `which`,
+    or zero if the counter isn't available. */
+
+uint32_t muvuku_settings_counter(unsigned int which) {
+
+    if (which >= MUVUKU_NR_COUNTERS ||
+            muvuku_settings_counters[which] == NULL) {
+        return 0;
+    }
+
+    return muvuku_counter_value(muvuku_settings_counters[which]);
+}
+
+
+/* Counter update:
+    Add `n` to the persistent counter `which`, writing the result
+    to EEPROM immediately. Returns the counter's new value. */
+
+uint32_t muvuku_settings_counter_add(unsigned int which, uint32_t n) {
+
+    if (which >= MUVUKU_NR_COUNTERS ||
+            muvuku_settings_counters[which] == NULL) {
+        return 0;
+    }
+
+    return muvuku_counter_add(muvuku_settings_counters[which], n);
+}
+
+
 #ifndef _MUVUKU_PROTOTYPE
 
-/* Retrieve settings stored in EEPROM:
-    This provides persistent storage for application settings,
-    or other data that needs to be saved across power cycles. */
+/* Retrieve saved settings:
+    This copies settings from the in-core settings store in to
+    `settings_schema`, using defaults for anything not yet saved. */
 
 void muvuku_settings_read(muvuku_settings_t *s,
                           schema_list_t *settings_schema) {
 
-    unsigned int magic = 0;
-    muvuku_allocator_t *eeprom = &muvuku_eeprom_allocator;
-
-    /* Read "magic" value */
-    eeprom->read(&magic, &s->magic, sizeof(unsigned int));
+    char saved_phone[MUVUKU_MSISDN_LENGTH_MAX + 1];
 
-    /* Try to read settings from EEPROM:
-        If the "magic" value doesn't match what's expected,
-        then there's no data stored -- use the default number. */
+    size_t len = muvuku_settings_get(
+        MUVUKU_SETTING_MSISDN, saved_phone, MUVUKU_MSISDN_LENGTH_MAX
+    );
 
-    if (magic == MUVUKU_SETTINGS_MAGIC) {
+    /* Saved phone number:
+        If nothing was saved, use the default number. */
 
-        size_t len = sizeof(s->msisdn_text);
-        char *saved_phone = (char *) xmalloc(len);
+    if (len > 0 && len <= MUVUKU_MSISDN_LENGTH_MAX) {
 
-        eeprom->read(saved_phone, s->msisdn_text, len);
+        saved_phone[len] = '\0';
 
         schema_item_set_phone(
             &settings_schema->list[0],
                 saved_phone, strlen(saved_phone) + 1, FL_NONE
         );
 
-        free(saved_phone);
-
     } else {
 
         schema_item_set_phone(
@@ -172,8 +427,9 @@ void muvuku_settings_read(muvuku_settings_t *s,
 #endif /* defined _MUVUKU_PROTOTYPE */
 
 
-/* Save settings to EEPROM:
-    This serializes the settings from `schema_settings` to EEPROM. */
+/* Save settings:
+    This copies the settings from `schema_settings` to the settings
+    store; they're written to EEPROM by `muvuku_settings_close`. */
 
 u8 muvuku_settings_write(muvuku_settings_t *s,
                          schema_list_t *schema_settings) {
@@ -184,26 +440,22 @@ u8 muvuku_settings_write(muvuku_settings_t *s,
 }
 
 
-/* Save phone number to EEPROM:
-    This function writes the phone number in `schema_item_phone`
-    to the `muvuku_settings_t` in EEPROM that is pointed to by `s`. */
+/* Save phone number:
+    This function copies the phone number in `schema_item_phone`
+    to the settings store. The terminating null isn't stored. */
 
 u8 muvuku_settings_write_phone(muvuku_settings_t *s,
                                schema_item_t *schema_item_phone) {
 
-    muvuku_allocator_t *eeprom = &muvuku_eeprom_allocator;
-
-    unsigned int magic = MUVUKU_SETTINGS_MAGIC;
-    size_t len = strlen(schema_item_phone->string_value) + 1;
-
-    /* Write to EEPROM:
-        This will be read back in during initialization;
-        for details, see action_menu and muvuku_read_settings. */
+    size_t len = strlen(schema_item_phone->string_value);
 
-    eeprom->write(&s->magic, &magic, sizeof(magic));
-    eeprom->write(s->msisdn_text, schema_item_phone->string_value, len);
+    if (len > MUVUKU_MSISDN_LENGTH_MAX) {
+        return FALSE;
+    }
 
-    return TRUE;
+    return muvuku_settings_set(
+        MUVUKU_SETTING_MSISDN, schema_item_phone->string_value, len
+    );
 }
 
 
@@ -239,20 +491,66 @@ muvuku_pool_t *muvuku_storage_open(muvuku_settings_t *s) {
 }
 
 
-/* Storage cell locator:
-    Find the pooled storage cell that belongs to the `schema_list`
-    specified in `l`. If the `schema_list` does not currently have
-    a storage cell assigned, assign a cell and return it. The mapping
-    between `schema_list_t` and `muvuku_cell_t` is kept in EEPROM. */
+/* Overflow pool constructor:
+    Open the pooled storage in EEPROM that receives saved SMSs
+    once a form's flash cell is full. Returns null if settings
+    were created without overflow storage. */
 
-muvuku_cell_t muvuku_storage_retrieve(muvuku_settings_t *s,
-                                      muvuku_pool_t *from_pool,
-                                      schema_list_t *for_schema_list) {
+muvuku_pool_t *muvuku_storage_open_overflow(muvuku_settings_t *s) {
+
+    muvuku_pool_handle_t h;
+    muvuku_allocator_t *eeprom = &muvuku_eeprom_allocator;
+
+    /* Read pool handle from EEPROM */
+    eeprom->read(&h, &s->eeprom_pool, sizeof(h));
+
+    /* Open EEPROM pool using handle */
+    return muvuku_pool_open(eeprom, h);
+}
+
+
+/* Storage tiers:
+    Each entry in the cell map can hold one cell from each of these;
+    see `_muvuku_storage_retrieve`. */
+
+#define MUVUKU_TIER_PRIMARY     (0)
+#define MUVUKU_TIER_OVERFLOW    (1)
+#define MUVUKU_TIER_BASE        (2)
+
+
+/* Storage cell locator, generic version:
+    Find the cell in `from_pool` that belongs to the form identified
+    by `type_id`, assigning one if necessary. The `tier` selects
+    which of the map entry's cells is used: `cell`, `overflow_cell`,
+    or `base_cell`. Each entry in the map can hold one of each. */
+
+static muvuku_cell_t *_muvuku_storage_tier(muvuku_cell_map_t *e, u8 tier) {
+
+    switch (tier) {
+        case MUVUKU_TIER_OVERFLOW:
+            return &e->overflow_cell;
+        case MUVUKU_TIER_BASE:
+            return &e->base_cell;
+        default:
+        case MUVUKU_TIER_PRIMARY:
+            return &e->cell;
+    }
+}
+
+
+static muvuku_cell_t _muvuku_storage_retrieve(muvuku_settings_t *s,
+                                              muvuku_pool_t *from_pool,
+                                              const u8 *type_id, u8 tier) {
     /* Locals */
-    u8 found_empty = FALSE;
+    u8 found = FALSE, found_empty = FALSE;
     unsigned int i, i_empty = 0;
     muvuku_cell_t rv = INVALID_CELL;
 
+    /* No pool, no cell */
+    if (from_pool == NULL) {
+        return rv;
+    }
+
     /* EEPROM read/write driver */
     muvuku_allocator_t *eeprom = &muvuku_eeprom_allocator;
 
@@ -260,7 +558,7 @@ muvuku_cell_t muvuku_storage_retrieve(muvuku_settings_t *s,
     muvuku_cell_map_t *e = xmalloc(sizeof(muvuku_cell_map_t));
 
     /* Find `type_id` comparison length */
-    size_t len = strlen(for_schema_list->type_id);
+    size_t len = strlen(type_id);
     len = scalar_min(len, MUVUKU_TYPE_LENGTH_MAX);
 
     /* Initial search:
@@ -284,42 +582,56 @@ muvuku_cell_t muvuku_storage_retrieve(muvuku_settings_t *s,
         }
 
         /* Check for matching `type_id` */
-        if (memcmp(e->type_id, for_schema_list->type_id, len) == 0) {
-            rv = e->cell;
-            goto exit; /* Cell found */
+        if (memcmp(e->type_id, type_id, len) == 0) {
+            found = TRUE;
+            break;
         }
     }
 
-    /* Did we see an empty cell?
-        If not, we've hit the storage limit */
+    if (found) {
 
-    if (!found_empty) {
-        goto exit; /* Fail */
-    }
+        /* Existing entry:
+            Return its cell for this tier, if it has one. */
+
+        rv = *_muvuku_storage_tier(e, tier);
+
+        if (rv != INVALID_CELL) {
+            goto exit; /* Cell found */
+        }
 
-    /* No match found, space available:
-        Try to add a new entry to the `cell_map` in EEPROM */
+    } else {
+
+        /* Did we see an empty cell?
+            If not, we've hit the storage limit */
+
+        if (!found_empty) {
+            goto exit; /* Fail */
+        }
+
+        /* No match found, space available:
+            Prepare a new entry for the `cell_map` in EEPROM */
+
+        i = i_empty;
+        memzero(e, sizeof(*e));
+        memcpy(e->type_id, type_id, len);
+    }
 
+    /* Acquire a cell for this tier */
     void *x = muvuku_pool_acquire(from_pool);
-    e->cell = muvuku_pool_cell(from_pool, x);
+    rv = muvuku_pool_cell(from_pool, x);
 
     /* Check status of cell acquisition */
-    if (e->cell == INVALID_CELL) {
+    if (rv == INVALID_CELL) {
         goto exit; /* Fail */
     }
 
     /* Initialize stringlist in new cell */
-    muvuku_stringlist_init(from_pool, x);
-
-    /* Copy `type_id` to new entry */
-    memzero(e->type_id, sizeof(e->type_id));
-    memcpy(e->type_id, for_schema_list->type_id, len);
+    muvuku_stringlist_close(muvuku_stringlist_init(from_pool, x));
 
-    /* Write the new map entry to EEPROM */
-    eeprom->write(&(s->cell_map[i_empty]), e, sizeof(*e));
+    *_muvuku_storage_tier(e, tier) = rv;
 
-    /* Return cell */
-    rv = e->cell;
+    /* Write the new or modified map entry to EEPROM */
+    eeprom->write(&(s->cell_map[i]), e, sizeof(*e));
 
     exit:
         free(e);
@@ -327,37 +639,518 @@ muvuku_cell_t muvuku_storage_retrieve(muvuku_settings_t *s,
 }
 
 
-#ifndef _MUVUKU_PROTOTYPE
+/* Storage cell locator:
+    Find the pooled storage cell that belongs to the `schema_list`
+    specified in `l`. If the `schema_list` does not currently have
+    a storage cell assigned, assign a cell and return it. The mapping
+    between `schema_list_t` and `muvuku_cell_t` is kept in EEPROM. */
 
-/* Settings schema constructor:
-    Create a new `schema_list_t` for settings, and return it. */
+muvuku_cell_t muvuku_storage_retrieve(muvuku_settings_t *s,
+                                      muvuku_pool_t *from_pool,
+                                      schema_list_t *for_schema_list) {
 
-schema_list_t *muvuku_settings_schema() {
+    return _muvuku_storage_retrieve(
+        s, from_pool, for_schema_list->type_id, MUVUKU_TIER_PRIMARY
+    );
+}
+
+
+/* Overflow cell locator:
+    This is `muvuku_storage_retrieve` for the overflow pool. */
 
-    SCHEMA_BEGIN(rv, lc_settings_code, 1);
-        SCHEMA_ITEM(locale(lc_phone_sms), TS_PHONE, 4, 20);
-            SCHEMA_ITEM_VALIDATE(is_phone_number);
-            SCHEMA_ITEM_TRIGGER(muvuku_settings_trigger_phone);
-    SCHEMA_END();
+muvuku_cell_t muvuku_storage_retrieve_overflow(muvuku_settings_t *s,
+                                               muvuku_pool_t *from_pool,
+                                               schema_list_t *for_schema_list) {
+
+    return _muvuku_storage_retrieve(
+        s, from_pool, for_schema_list->type_id, MUVUKU_TIER_OVERFLOW
+    );
+}
+
+
+/* Delta base pool constructor:
+    Open the pooled storage in flash that holds the base record for
+    each form's delta records. Returns null if settings were created
+    without delta encoding. */
+
+muvuku_pool_t *muvuku_storage_open_base(muvuku_settings_t *s) {
+
+    muvuku_pool_handle_t h;
+    muvuku_allocator_t *eeprom = &muvuku_eeprom_allocator;
+
+    /* Read pool handle from EEPROM */
+    eeprom->read(&h, &s->base_pool, sizeof(h));
 
+    /* Open flash pool using handle */
+    return muvuku_pool_open(&muvuku_flash_allocator, h);
+}
+
+
+/* Delta base, persistent format:
+    A single string in the form's base cell, holding the base's
+    sequence number (native byte order), then the text record. */
+
+struct muvuku_storage_base_state {
+
+    uint32_t *sequence;
+    char *dst;
+    size_t size;
+    size_t len;
+};
+
+
+static int _muvuku_storage_base_read_one(muvuku_stringlist_t *sl,
+                                         char *src, size_t len, void *ptr) {
+
+    struct muvuku_storage_base_state *state =
+        (struct muvuku_storage_base_state *) ptr;
+
+    if (len <= sizeof(uint32_t) || len - sizeof(uint32_t) > state->size) {
+        return FALSE;
+    }
+
+    state->len = len - sizeof(uint32_t);
+
+    muvuku_pool_read(sl->pool, state->sequence, src, sizeof(uint32_t));
+    muvuku_pool_read(
+        sl->pool, state->dst, src + sizeof(uint32_t), state->len
+    );
+
+    return FALSE; /* Only one */
+}
+
+
+/* Delta base lookup:
+    Copy the base record for `for_schema_list` in to `dst` (of `size`
+    bytes), and its sequence number in to `sequence`. Returns the
+    length of the record, or zero if the form has no base yet. */
+
+static size_t _muvuku_storage_base_read(muvuku_settings_t *s,
+                                        muvuku_pool_t *from_pool,
+                                        const u8 *type_id, uint32_t *sequence,
+                                        char *dst, size_t size) {
+
+    struct muvuku_storage_base_state state = { sequence, dst, size, 0 };
+
+    muvuku_stringlist_t *sl = muvuku_stringlist_open(
+        from_pool, muvuku_pool_address(
+            from_pool, _muvuku_storage_retrieve(
+                s, from_pool, type_id, MUVUKU_TIER_BASE
+            )
+        )
+    );
+
+    if (sl == NULL) {
+        return 0;
+    }
+
+    muvuku_stringlist_each(sl, _muvuku_storage_base_read_one, &state);
+    muvuku_stringlist_close(sl);
+
+    return state.len;
+}
+
+
+size_t muvuku_storage_base_read(muvuku_settings_t *s,
+                                muvuku_pool_t *from_pool,
+                                schema_list_t *for_schema_list,
+                                uint32_t *sequence, char *dst, size_t size) {
+
+    return _muvuku_storage_base_read(
+        s, from_pool, for_schema_list->type_id, sequence, dst, size
+    );
+}
+
+
+/* Delta base update:
+    Replace the base record for `for_schema_list` with the text
+    record `record` (of length `len`), numbered `sequence`. With
+    a null `record`, the form is left without a base. */
+
+static u8 _muvuku_storage_base_write(muvuku_settings_t *s,
+                                     muvuku_pool_t *from_pool,
+                                     const u8 *type_id, uint32_t sequence,
+                                     const char *record, size_t len) {
+    u8 rv = FALSE;
+    muvuku_stringlist_writer_t *w;
+
+    void *x = muvuku_pool_address(
+        from_pool, _muvuku_storage_retrieve(
+            s, from_pool, type_id, MUVUKU_TIER_BASE
+        )
+    );
+
+    if (x == NULL) {
+        return rv;
+    }
+
+    /* Start the cell over, then add the new base */
+    muvuku_stringlist_t *sl = muvuku_stringlist_init(from_pool, x);
+
+    if (record == NULL) {
+        muvuku_stringlist_close(sl);
+        return (sl != NULL);
+    }
+
+    /* About a page in size; see `muvuku_stringlist_writer_t` */
+    w = (muvuku_stringlist_writer_t *) xmalloc(sizeof(*w));
+
+    if (muvuku_stringlist_begin(sl, w, len + sizeof(sequence))) {
+        rv = (
+            muvuku_stringlist_write(w, (char *) &sequence,
+                                    sizeof(sequence)) &&
+            muvuku_stringlist_write(w, record, len) &&
+            muvuku_stringlist_end(w)
+        );
+    }
+
+    free(w);
+    muvuku_stringlist_close(sl);
     return rv;
 }
 
 
-/* Settings schema constructor:
-    Create a new `schema_list_t` for pin entry, and return it. */
+u8 muvuku_storage_base_write(muvuku_settings_t *s,
+                             muvuku_pool_t *from_pool,
+                             schema_list_t *for_schema_list,
+                             uint32_t sequence,
+                             const char *record, size_t len) {
+
+    return _muvuku_storage_base_write(
+        s, from_pool, for_schema_list->type_id, sequence, record, len
+    );
+}
+
+
+/* Delta base reset:
+    Forget the base record for `for_schema_list`; the form's next
+    record is sent complete, and becomes its new base. */
+
+u8 muvuku_storage_base_clear(muvuku_settings_t *s,
+                             muvuku_pool_t *from_pool,
+                             schema_list_t *for_schema_list) {
+
+    return _muvuku_storage_base_write(
+        s, from_pool, for_schema_list->type_id, 0, NULL, 0
+    );
+}
+
+
+/* Saved message list:
+    Open the tiered list of saved messages for `for_schema_list`,
+    with its primary tier in `from_pool` (flash) and its overflow
+    tier in `overflow_pool` (EEPROM). The overflow pool may be null.
+    Returns null if no primary storage could be located. */
+
+muvuku_tieredlist_t *muvuku_storage_list(muvuku_settings_t *s,
+                                         muvuku_pool_t *from_pool,
+                                         muvuku_pool_t *overflow_pool,
+                                         schema_list_t *for_schema_list) {
+
+    /* Primary first:
+        This creates the map entry if it doesn't already exist. */
+
+    muvuku_stringlist_t *primary = muvuku_stringlist_open(
+        from_pool, muvuku_pool_address(
+            from_pool, muvuku_storage_retrieve(s, from_pool, for_schema_list)
+        )
+    );
+
+    muvuku_stringlist_t *overflow = NULL;
+
+    if (primary != NULL && overflow_pool != NULL) {
+        overflow = muvuku_stringlist_open(
+            overflow_pool, muvuku_pool_address(
+                overflow_pool, muvuku_storage_retrieve_overflow(
+                    s, overflow_pool, for_schema_list
+                )
+            )
+        );
+    }
+
+    return muvuku_tieredlist_open(primary, overflow);
+}
+
+
+/* Every saved message list:
+    Open the tiered list of saved messages for each form that has
+    one, in turn, and pass it to `fn` along with `state`; stop early
+    if `fn` returns false. Unlike the locators above, this never
+    assigns a cell. Returns false if `fn` stopped the iteration. */
+
+int muvuku_storage_each(muvuku_settings_t *s,
+                        muvuku_pool_t *from_pool,
+                        muvuku_pool_t *overflow_pool,
+                        muvuku_storage_fn_t fn, void *state) {
+    unsigned int i;
+    int rv = TRUE;
+
+    if (from_pool == NULL) {
+        return rv;
+    }
+
+    /* EEPROM read/write driver */
+    muvuku_allocator_t *eeprom = &muvuku_eeprom_allocator;
+
+    /* In-core storage for current map entry */
+    muvuku_cell_map_t *e = xmalloc(sizeof(muvuku_cell_map_t));
+
+    for (i = 0; rv && i < MUVUKU_NR_FORMS_MAX; ++i) {
+
+        eeprom->read(e, &(s->cell_map[i]), sizeof(*e));
+
+        if (e->type_id[0] == '\0') {
+            continue;
+        }
+
+        muvuku_stringlist_t *primary = muvuku_stringlist_open(
+            from_pool, muvuku_pool_address(from_pool, e->cell)
+        );
+
+        muvuku_stringlist_t *overflow = (
+            overflow_pool != NULL ?
+                muvuku_stringlist_open(
+                    overflow_pool, muvuku_pool_address(
+                        overflow_pool, e->overflow_cell
+                    )
+                ) : NULL
+        );
+
+        muvuku_tieredlist_t *t = muvuku_tieredlist_open(primary, overflow);
 
-schema_list_t *muvuku_pin_schema(const char *caption) {
+        if (t == NULL) {
+            continue;
+        }
 
-    SCHEMA_BEGIN(rv, lc_settings_code, 1);
-        SCHEMA_ITEM(caption, TS_INTEGER, 0, 64);
-            SCHEMA_ITEM_FLAGS(FL_NO_ECHO);
-    SCHEMA_END();
+        rv = fn(t, state);
+        muvuku_tieredlist_close(t);
+    }
 
+    free(e);
     return rv;
 }
 
 
+#ifdef _SCHEMA_ENABLE_ACK
+
+/* Acknowledged delta bases:
+    With delta encoding, a complete record only becomes its form's
+    base once the gateway has it; each acknowledgement moves the base
+    on to the newest complete record it lists. */
+
+struct muvuku_storage_ack_base {
+
+    uint32_t sequence;
+    size_t len;
+    char text[MAX_SMS_LENGTH + 1];
+    char record[SCHEMA_SEQUENCE_HEADER_MAX + MAX_SMS_LENGTH + 1];
+};
+
+
+struct muvuku_storage_ack_state {
+
+    const char *ack;
+    size_t len;
+    size_t count;
+    muvuku_settings_t *settings;
+    muvuku_pool_t *base_pool;
+    struct muvuku_storage_ack_base *base;
+};
+
+
+static int _muvuku_storage_unacknowledged(muvuku_stringlist_t *sl,
+                                          char *src, size_t len, void *ptr) {
+
+    uint32_t sequence;
+    char header[SCHEMA_SEQUENCE_HEADER_MAX];
+
+    struct muvuku_storage_ack_state *state =
+        (struct muvuku_storage_ack_state *) ptr;
+
+    /* Only the header is needed */
+    size_t n = scalar_min(len, sizeof(header));
+    muvuku_pool_read(sl->pool, header, src, n);
+
+    if (!schema_sequence_read(header, n, &sequence) ||
+            !schema_ack_contains(state->ack, state->len, sequence)) {
+        return TRUE;
+    }
+
+    #ifdef _SCHEMA_ENABLE_DELTA
+        struct muvuku_storage_ack_base *b = state->base;
+
+        /* Complete delta records fit in one message */
+        if (b != NULL && len <= sizeof(b->record) &&
+                (b->len == 0 || sequence > b->sequence)) {
+
+            muvuku_pool_read(sl->pool, b->record, src, len);
+            n = schema_sequence_read(b->record, len, &sequence);
+
+            /* Saved with its null terminator */
+            if (b->record[len - 1] == '\0') {
+                len--;
+            }
+
+            len = schema_delta_base(
+                &b->record[n], len - n, &sequence, b->text, sizeof(b->text)
+            );
+
+            if (len > 0) {
+                b->len = len;
+                b->sequence = sequence;
+            }
+        }
+    #endif /* _SCHEMA_ENABLE_DELTA */
+
+    return FALSE;
+}
+
+
+#ifdef _SCHEMA_ENABLE_DELTA
+
+/* Delta base advance:
+    Make the complete record in `b` its form's base, unless the
+    form already has a newer one; the form is named in the record. */
+
+static void _muvuku_storage_acknowledge_base(muvuku_settings_t *s,
+                                             muvuku_pool_t *base_pool,
+                                             struct muvuku_storage_ack_base *b) {
+    size_t i, n;
+    uint32_t sequence;
+    u8 type_id[MUVUKU_TYPE_LENGTH_MAX + 1];
+
+    /* Text record (e.g. 1!PSMS!...) */
+    for (i = 2; i < b->len && b->text[i] != SMS_MAGIC_DELIMITER; ++i);
+
+    n = scalar_min(i - 2, MUVUKU_TYPE_LENGTH_MAX);
+    memcpy(type_id, &b->text[2], n);
+    type_id[n] = '\0';
+
+    if (_muvuku_storage_base_read(s, base_pool, type_id, &sequence,
+                                  b->record, sizeof(b->record)) > 0 &&
+            sequence >= b->sequence) {
+        return;
+    }
+
+    _muvuku_storage_base_write(
+        s, base_pool, type_id, b->sequence, b->text, b->len
+    );
+}
+
+#endif /* _SCHEMA_ENABLE_DELTA */
+
+
+static int _muvuku_storage_acknowledge_one(muvuku_tieredlist_t *t,
+                                           void *ptr) {
+
+    struct muvuku_storage_ack_state *state =
+        (struct muvuku_storage_ack_state *) ptr;
+
+    if (state->base != NULL) {
+        state->base->len = 0;
+    }
+
+    state->count += muvuku_tieredlist_retain(
+        t, _muvuku_storage_unacknowledged, state
+    );
+
+    #ifdef _SCHEMA_ENABLE_DELTA
+        if (state->base != NULL && state->base->len > 0) {
+            _muvuku_storage_acknowledge_base(
+                state->settings, state->base_pool, state->base
+            );
+        }
+    #endif /* _SCHEMA_ENABLE_DELTA */
+
+    return TRUE;
+}
+
+
+/* Acknowledged records:
+    Discard every saved record, of every form, whose sequence number
+    is listed in the acknowledgement `ack` (of length `len`). Records
+    without a sequence number are always kept. Returns the number of
+    records discarded. */
+
+size_t muvuku_storage_acknowledge(muvuku_settings_t *s,
+                                  muvuku_pool_t *from_pool,
+                                  muvuku_pool_t *overflow_pool,
+                                  const char *ack, size_t len) {
+
+    struct muvuku_storage_ack_state state = {
+        ack, len, 0, s, NULL, NULL
+    };
+
+    if (!schema_ack_is_valid(ack, len)) {
+        return 0;
+    }
+
+    #ifdef _SCHEMA_ENABLE_DELTA
+        state.base_pool = muvuku_storage_open_base(s);
+
+        if (state.base_pool != NULL) {
+            state.base = (struct muvuku_storage_ack_base *)
+                xmalloc(sizeof(*state.base));
+        }
+    #endif /* _SCHEMA_ENABLE_DELTA */
+
+    muvuku_storage_each(
+        s, from_pool, overflow_pool,
+            _muvuku_storage_acknowledge_one, &state
+    );
+
+    if (state.base_pool != NULL) {
+        free(state.base);
+        muvuku_pool_close(state.base_pool);
+    }
+
+    return state.count;
+}
+
+#endif /* _SCHEMA_ENABLE_ACK */
+
+
+#ifndef _MUVUKU_PROTOTYPE
+
+/* Settings schema:
+    A single phone number, used as the destination for forms. */
+
+SCHEMA_BEGIN(form_settings)
+    SCHEMA_ITEM(lc_phone_sms, TS_PHONE, 4, 20,
+        SCHEMA_VALIDATE(is_phone_number)
+        SCHEMA_TRIGGER(muvuku_settings_trigger_phone))
+SCHEMA_END(form_settings, lc_settings_code)
+
+
+/* Settings schema constructor:
+    Create a new `schema_list_t` for settings, and return it. */
+
+schema_list_t *muvuku_settings_schema() {
+
+    return schema_list_new(&form_settings);
+}
+
+
+/* PIN schema:
+    A single masked string of digits. */
+
+lc_char PROGMEM lc_pin_prompt[] = {
+    LC_EN("Please enter PIN")
+    LC_FR("Entrez votre code d'acc\4s")
+    LC_ES("Ingrese su contrase\175a")
+    LC_UN("\x84\x08\x2a\x80\x9\x6\x9\x2b\x9\x4d\x9\x28"
+          "\x9\x4b\x0\x20\x9\x2a\x9\x3f\x9\x28\x0\x20"
+          "\x9\x32\x9\x47\x9\x16\x9\x4d\x9\x28\x9\x41"
+          "\x9\x39\x9\x4b\x9\x38\x9\x4d\x0\x0")
+    LC_END
+};
+
+SCHEMA_BEGIN(form_pin)
+    SCHEMA_ITEM(lc_pin_prompt, TS_INTEGER, 0, 64,
+        SCHEMA_FLAGS(FL_NO_ECHO))
+SCHEMA_END(form_pin, lc_settings_code)
+
+
 /* PIN support:
     This allows certain secions of the application to be
     protected with a simple password string. This is security through
@@ -365,10 +1158,10 @@ schema_list_t *muvuku_pin_schema(const char *caption) {
     attackers, or from anyone who knows how to disassemble a binary
     (or even just get the .trb file and run strings(1) on it). */
 
-u8 muvuku_require_pin(const char *caption, const char *pin) {
+u8 muvuku_require_pin(const char *pin) {
 
     u8 rv = FALSE;
-    schema_list_t *l = muvuku_pin_schema(caption);
+    schema_list_t *l = schema_list_new(&form_pin);
 
     schema_list_prompt(l, PR_NORMAL);
     char *result = l->list[0].string_value;
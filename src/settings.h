@@ -19,6 +19,7 @@
 #ifndef __MUVUKU_SETTINGS_H__
 #define __MUVUKU_SETTINGS_H__
 
+#include "kv.h"
 #include "pool.h"
 #include "schema.h"
 
@@ -37,19 +38,69 @@
 #define MUVUKU_MSISDN_LENGTH_MAX (24)
 
 
-/* "Magic" value:
-    This value occupies the first field of `muvuku_settings`,
-    and tells `muvuku_read_settings` that data is present. */
+/* Size of settings store:
+    Application settings live in a small key-value store in EEPROM,
+    rather than at fixed offsets; see `kv.h`. This is its total size,
+    in bytes, and is split between two halves so that compaction is
+    safe. Larger values mean less frequent compaction. */
 
-#define MUVUKU_SETTINGS_MAGIC (0x55aa)
+#ifndef MUVUKU_SETTINGS_STORE_SIZE
+    #define MUVUKU_SETTINGS_STORE_SIZE (128)
+#endif /* MUVUKU_SETTINGS_STORE_SIZE */
+
+
+/* Setting keys:
+    Each setting has a permanent key in the settings store. New
+    settings get new keys; never renumber or reuse an existing key. */
+
+#define MUVUKU_SETTING_MSISDN (0)
+
+
+/* Persistent counters:
+    These change far too often for the settings store; each
+    lives in its own wear-leveled ring in EEPROM instead. Append
+    new counters before `MUVUKU_NR_COUNTERS`, never reorder them. */
+
+#define MUVUKU_COUNTER_SEQUENCE     (0)
+#define MUVUKU_COUNTER_SAVED        (1)
+#define MUVUKU_COUNTER_SENT         (2)
+#define MUVUKU_COUNTER_BACKGROUND   (3)   /* Sent by the schedule */
+#define MUVUKU_COUNTER_BUDGET_START (4)   /* ...as the budget day began */
+#define MUVUKU_COUNTER_FAILED       (5)   /* Failed background attempts */
+#define MUVUKU_COUNTER_FAILED_SEEN  (6)   /* ...as of the last success */
+#define MUVUKU_NR_COUNTERS          (7)
 
 
 /* Maximum number of forms:
     This value is used when allocating per-form resources, such
     as flash memory. The available amount of storage for each
-    form decreases as the number of available forms increases. */
+    form decreases as the number of available forms increases.
+    The AVR build sets this to the number of compiled forms. */
+
+#ifndef MUVUKU_NR_FORMS_MAX
+    #define MUVUKU_NR_FORMS_MAX (4)
+#endif /* MUVUKU_NR_FORMS_MAX */
+
+
+/* Size of EEPROM overflow storage:
+    Once a form's cell in flash is full, saved messages spill over
+    in to a smaller per-form cell in EEPROM, carved from this many
+    bytes. Set this to zero to disable overflow storage entirely. */
+
+#ifndef MUVUKU_EEPROM_OVERFLOW_RESERVED
+    #define MUVUKU_EEPROM_OVERFLOW_RESERVED (512)
+#endif /* MUVUKU_EEPROM_OVERFLOW_RESERVED */
 
-#define MUVUKU_NR_FORMS_MAX (4)
+
+/* Delta refresh interval:
+    With delta encoding enabled, records are sent as changes against
+    the last complete record of the same form. Once the base is this
+    many sequence numbers old, a complete record is sent instead, and
+    becomes the new base; this bounds the damage a lost base can do. */
+
+#ifndef MUVUKU_DELTA_REFRESH
+    #define MUVUKU_DELTA_REFRESH (8)
+#endif /* MUVUKU_DELTA_REFRESH */
 
 
 /* Structures */
@@ -57,6 +108,8 @@
 typedef struct muvuku_cell_map {
 
     muvuku_cell_t cell;
+    muvuku_cell_t overflow_cell;
+    muvuku_cell_t base_cell;
     char type_id[MUVUKU_TYPE_LENGTH_MAX + 1];
 
 } __attribute__((packed)) muvuku_cell_map_t;
@@ -64,20 +117,40 @@ typedef struct muvuku_cell_map {
 
 typedef struct muvuku_settings {
 
-    u16 magic;
+    muvuku_kv_handle_t store;
     muvuku_pool_handle_t flash_pool;
-    char msisdn_text[MUVUKU_MSISDN_LENGTH_MAX];
+    muvuku_pool_handle_t eeprom_pool;
+    muvuku_pool_handle_t base_pool;
+    muvuku_counter_handle_t counters[MUVUKU_NR_COUNTERS];
     muvuku_cell_map_t cell_map[MUVUKU_NR_FORMS_MAX];
 
 } __attribute__((packed)) muvuku_settings_t;
 
 
+/* Iterator callback for `muvuku_storage_each` */
+typedef int (*muvuku_storage_fn_t)(muvuku_tieredlist_t *, void *);
+
+
 /* Methods */
 
 muvuku_settings_t *muvuku_settings_create();
 
 void muvuku_settings_delete();
 
+u8 muvuku_settings_open(muvuku_settings_t *s);
+
+void muvuku_settings_close(muvuku_settings_t *s);
+
+u8 muvuku_settings_is_nested();
+
+size_t muvuku_settings_get(muvuku_kv_key_t key, void *buf, size_t n);
+
+u8 muvuku_settings_set(muvuku_kv_key_t key, void *data, size_t len);
+
+uint32_t muvuku_settings_counter(unsigned int which);
+
+uint32_t muvuku_settings_counter_add(unsigned int which, uint32_t n);
+
 void muvuku_settings_read(muvuku_settings_t *s, schema_list_t *l);
 
 u8 muvuku_settings_write(muvuku_settings_t *s, schema_list_t *l);
@@ -92,13 +165,56 @@ u8 muvuku_settings_trigger_phone(schema_list_t *l, schema_item_t *i);
 
 muvuku_pool_t *muvuku_storage_open(muvuku_settings_t *s);
 
+muvuku_pool_t *muvuku_storage_open_overflow(muvuku_settings_t *s);
+
 muvuku_cell_t muvuku_storage_retrieve(
     muvuku_settings_t *s,
         muvuku_pool_t *from_pool, schema_list_t *for_schema_list
 );
 
+muvuku_cell_t muvuku_storage_retrieve_overflow(
+    muvuku_settings_t *s,
+        muvuku_pool_t *from_pool, schema_list_t *for_schema_list
+);
+
+muvuku_pool_t *muvuku_storage_open_base(muvuku_settings_t *s);
+
+size_t muvuku_storage_base_read(
+    muvuku_settings_t *s, muvuku_pool_t *from_pool,
+        schema_list_t *for_schema_list, uint32_t *sequence,
+            char *dst, size_t size
+);
+
+u8 muvuku_storage_base_write(
+    muvuku_settings_t *s, muvuku_pool_t *from_pool,
+        schema_list_t *for_schema_list, uint32_t sequence,
+            const char *record, size_t len
+);
+
+u8 muvuku_storage_base_clear(
+    muvuku_settings_t *s, muvuku_pool_t *from_pool,
+        schema_list_t *for_schema_list
+);
+
+muvuku_tieredlist_t *muvuku_storage_list(
+    muvuku_settings_t *s, muvuku_pool_t *from_pool,
+        muvuku_pool_t *overflow_pool, schema_list_t *for_schema_list
+);
+
+int muvuku_storage_each(
+    muvuku_settings_t *s, muvuku_pool_t *from_pool,
+        muvuku_pool_t *overflow_pool, muvuku_storage_fn_t fn, void *state
+);
+
+#ifdef _SCHEMA_ENABLE_ACK
+  size_t muvuku_storage_acknowledge(
+      muvuku_settings_t *s, muvuku_pool_t *from_pool,
+          muvuku_pool_t *overflow_pool, const char *ack, size_t len
+  );
+#endif /* _SCHEMA_ENABLE_ACK */
+
 
-u8 muvuku_require_pin(const char *caption, const char *pin);
+u8 muvuku_require_pin(const char *pin);
 
 
 #endif /* __MUVUKU_SETTINGS_H__ */
@@ -19,73 +19,65 @@
 #include "transport.h"
 #include "schema.h"
 
+#ifdef _MUVUKU_PROTOTYPE
+    #include <signal.h>
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+#endif /* _MUVUKU_PROTOTYPE */
 
-/* Strings for send/receive user interface */
-
-lc_char PROGMEM lc_cannot_send_1[] = {
-    LC_EN("Failed to send form, but your answers remain saved.")
-    LC_FR("Ech\5s d'envoie, rapport non envoy\5.")
-    LC_ES("No pudo enviar la forma, forma esta guardado")
-    LC_UN("\x84\x08\x54\x80\x9\x2e\x9\x47\x9\x38\x9\x47\x9\x1c"
-          "\x0\x20\x9\x2a\x9\x20\x9\x3e\x9\x9\x9\x28\x0\x20"
-          "\x9\x5\x9\x38\x9\x2b\x9\x32\x0\x20\x9\x2d\x9\x2f"
-          "\x9\x4b\x0\x20\x9\x24\x9\x30\x0\x20\x9\x2e\x9\x47"
-          "\x9\x38\x9\x47\x9\x1c\x0\x20\x9\x38\x9\x47\x9\x2d\x0\x20"
-          "\x9\x2d\x9\xf\x9\x15\x9\x4b\x0\x20\x9\x1b\x9\x64\x0\x0")
-    LC_END
-};
 
-lc_char PROGMEM lc_cannot_send_2[] = {
-    LC_EN("Once you have a signal, please select 'Transmit' again.")
-    LC_FR("Assurez vous que vous avez acc\4s au r\5seau et re\5ssayez.")
-    LC_ES("Verifique que tiene se\175al e intente de nuevo.")
-    LC_UN("\x84\x08\x52\x80\x9\x2b\x9\x4b\x9\x28\x9\x15"
-          "\x9\x4b\x0\x20\x9\x1f\x9\x3e\x9\x35\x9\x30"
-          "\x0\x20\x9\x6\x9\xf\x9\x2a\x9\x1b\x9\x3f"
-          "\x0\x20\x9\x2a\x9\x41\x9\x28\x0\x3a\x0\x20"
-          "\x9\x2e\x9\x47\x9\x38\x9\x47\x9\x1c\x0\x20"
-          "\x9\x2a\x9\x20\x9\x3e\x9\x9\x9\x28\x9\x41"
-          "\x0\x20\x9\x39\x9\x4b\x9\x32\x9\x3e\x9\x64\x0\x0")
-    LC_END
-};
+#ifndef _MUVUKU_PROTOTYPE
 
+/* General results:
+    The first byte of a T_RESULT object (ETSI TS 102 223, 8.12);
+    anything not listed here is treated as a failure. */
+
+#define MUVUKU_RESULT_OK            (0x00)
+#define MUVUKU_RESULT_ME_BUSY       (0x20)
+
+
+/**
+ * Transport:
+ *  SIM Toolkit SMS, to the phone number stored in `schema_settings`.
+ */
+
+static u8 muvuku_sms_batch_begin(void *context, schema_list_t *settings)
+{
+    return TRUE;
+}
 
-lc_char PROGMEM lc_cannot_send_3[] = {
-    LC_EN("If you continue to experience problems please contact your supervisor.")
-    LC_FR("Si vous continuez a avoir des probl\4mes contactez votre superviseur.")
-    LC_ES("Si continua teniendo problemas, por favor contacte al administrador.")
-    LC_UN("\x84\x08\xa2\x80\x9\x2b\x9\x4b\x9\x28\x9\x15\x9\x4b\x0\x20\x9\x1f"
-          "\x9\x3e\x9\x35\x9\x30\x0\x20\x9\x6\x9\xf\x9\x2a\x9\x1b\x9\x3f\x0\x20"
-          "\x9\x2a\x9\x28\x9\x3f\x0\x20\x9\x2e\x9\x47\x9\x38\x9\x47\x9\x1c\x0\x20"
-          "\x9\x2a\x9\x20\x9\x3e\x9\x9\x9\x28\x0\x20\x9\x5\x9\x38\x9\x2b\x9\x32"
-          "\x0\x20\x9\x2d\x9\xf\x9\x2e\x9\x3e\x0\x20\x9\x38\x9\x4d\x9\x35\x9\x3e"
-          "\x9\x38\x9\x4d\x9\x25\x9\x4d\x9\x2f\x0\x20\x9\x38\x9\x2\x9\x38\x9\x4d"
-          "\x9\x25\x9\x3e\x9\x2e\x9\x3e\x0\x20\x9\x38\x9\x2e\x9\x4d\x9\x2a\x9\x30"
-          "\x9\x4d\x9\x15\x0\x20\x9\x17\x9\x30\x9\x4d\x9\x28\x9\x41\x9\x39\x9\x4b"
-          "\x9\x32\x9\x3e\x9\x64\x0\x0")
-    LC_END
-};
 
 /* Support for sending SMS messages:
-    This function serializes a `schema_list_t` and transmits it via
-    SMS to the phone number stored in `schema_settings`, after applying
+    This function transmits the serialized message `s` via SMS
+    to the phone number stored in `schema_settings`, after applying
     the proper checks and text encoding steps. Once the send operation
-    concludes, this function checks the result buffer to ensure that
-    message transmission was successful. If the send wasn't successful,
-    a detailed error message is displayed, and FALSE is returned. */
+    concludes, this function checks the result buffer to determine
+    whether message transmission was successful, and if not, whether
+    it is worth trying again. */
 
-u8 muvuku_send_sms(char *s, schema_list_t *settings)
+static u8 muvuku_sms_send(void *context, const char *s,
+                          size_t len, schema_list_t *settings)
 {
-    u8 rv = FALSE;
+    u8 rv = MUVUKU_SEND_FAILED;
 
     if (!settings->list->value.msisdn) {
-        goto error;
+        return rv;
     }
 
-    size_t len = dcs_78(s, strlen(s), DCS_8_TO_7);
+    /* Encoded copy:
+        The 7-bit conversion happens in place; the caller's copy
+        is left alone, in case the message has to be sent again. */
+
+    char *sms = (char *) xmalloc(len + 1);
+
+    memcpy(sms, s, len);
+    sms[len] = '\0';
+
+    len = dcs_78(sms, len, DCS_8_TO_7);
 
     u8 *result = send_sms(
-        s, len, settings->list->value.msisdn,
+        sms, len, settings->list->value.msisdn,
             MSISDN_ADN, 0x00, 0x00, NULL, NULL
     );
 
@@ -95,17 +87,1168 @@ u8 muvuku_send_sms(char *s, schema_list_t *settings)
 
     u8 tag = get_tag(result, T_RESULT); 
 
-    if (tag != 0 && result[tag + 2] == 0x00) {
+    if (tag != 0) {
+        switch (result[tag + 2]) {
+            case MUVUKU_RESULT_OK:
+                rv = MUVUKU_SEND_OK;
+                break;
+            case MUVUKU_RESULT_ME_BUSY:
+                rv = MUVUKU_SEND_BUSY;
+                break;
+        }
+    }
+
+    free(sms);
+    return rv;
+}
+
+
+static u8 muvuku_sms_batch_end(void *context)
+{
+    return TRUE;
+}
+
+
+/* Failure notification:
+    Nothing is displayed per message; the session's owner
+    reports the outcome once, after the session has ended. */
+
+static void muvuku_sms_status(void *context, u8 result)
+{
+    return;
+}
+
+
+muvuku_transport_t muvuku_sms_transport = {
+
+    /* Linker issue:
+        Initializing struct members with function pointers
+        seems to severely corrupt the memory layout on AVR.
+        Use `muvuku_subsystem_init_transport` at startup instead. */
+
+    NULL, NULL, NULL, NULL, NULL
+};
+
+#endif /* ! _MUVUKU_PROTOTYPE */
+
+
+#ifdef _MUVUKU_PROTOTYPE
+
+    /**
+     * Transports:
+     *  Host loopback (Unix socket) and file sink. Messages are
+     *  written as a gateway would read them after decoding each SMS,
+     *  NUL-terminated; see `muvuku-decode -0 -l` for the other end.
+     */
+
+    void muvuku_sink_init(muvuku_sink_t *k, const char *path) {
+
+        memset(k, '\0', sizeof(*k));
+        k->path = path;
+    }
+
+
+    static u8 muvuku_loopback_batch_begin(void *context,
+                                          schema_list_t *settings) {
+
+        muvuku_sink_t *k = (muvuku_sink_t *) context;
+        struct sockaddr_un addr;
+        int fd;
+
+        if (k->path == NULL) {
+            k->file = stdout;
+            return TRUE;
+        }
+
+        if (strlen(k->path) >= sizeof(addr.sun_path)) {
+            return FALSE;
+        }
+
+        /* A gateway that hangs up is a failed send, not a signal */
+        signal(SIGPIPE, SIG_IGN);
+
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            return FALSE;
+        }
+
+        memset(&addr, '\0', sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, k->path);
+
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+                (k->file = fdopen(fd, "w")) == NULL) {
+            close(fd);
+            return FALSE;
+        }
+
+        return TRUE;
+    }
+
+
+    static u8 muvuku_file_batch_begin(void *context,
+                                      schema_list_t *settings) {
+
+        muvuku_sink_t *k = (muvuku_sink_t *) context;
+
+        if (k->path == NULL) {
+            k->file = stdout;
+        } else {
+            k->file = fopen(k->path, "a");
+        }
+
+        return (k->file != NULL);
+    }
+
+
+    static u8 muvuku_sink_send(void *context, const char *s,
+                               size_t len, schema_list_t *settings) {
+
+        muvuku_sink_t *k = (muvuku_sink_t *) context;
+
+        if (k->file == NULL ||
+                fwrite(s, 1, len, k->file) != len ||
+                fputc('\0', k->file) == EOF) {
+            return MUVUKU_SEND_FAILED;
+        }
+
+        k->count++;
+        k->size += len;
+
+        return MUVUKU_SEND_OK;
+    }
+
+
+    static u8 muvuku_sink_batch_end(void *context) {
+
+        muvuku_sink_t *k = (muvuku_sink_t *) context;
+        u8 rv;
+
+        if (k->file == NULL) {
+            return FALSE;
+        }
+
+        rv = (fflush(k->file) == 0 && !ferror(k->file));
+
+        if (k->file != stdout && fclose(k->file) != 0) {
+            rv = FALSE;
+        }
+
+        k->file = NULL;
+        return rv;
+    }
+
+
+    static void muvuku_sink_status(void *context, u8 result) {
+
+        muvuku_sink_t *k = (muvuku_sink_t *) context;
+
+        if (result != MUVUKU_SEND_OK) {
+            k->failures++;
+        }
+    }
+
+
+    static muvuku_sink_t muvuku_loopback_sink;
+    static muvuku_sink_t muvuku_file_sink;
+
+    muvuku_transport_t muvuku_loopback_transport = {
+        NULL, NULL, NULL, NULL, NULL
+    };
+
+    muvuku_transport_t muvuku_file_transport = {
+        NULL, NULL, NULL, NULL, NULL
+    };
+
+#endif /* _MUVUKU_PROTOTYPE */
+
+
+/* Current transport:
+    Set by `muvuku_subsystem_init_transport`. */
+
+muvuku_transport_t *muvuku_transport = NULL;
+
+
+/**
+ * Start the transmit session `x` on the current transport, for
+ * `total` records. Returns false if the transport couldn't start;
+ * the session is then already stopped, and nothing will be sent.
+ */
+u8 muvuku_session_begin(muvuku_session_t *x,
+                        schema_list_t *settings, unsigned int total)
+{
+    muvuku_transport_t *t = muvuku_transport;
+
+    memset(x, '\0', sizeof(*x));
+
+    x->transport = t;
+    x->settings = settings;
+    x->total = total;
+
+    if (!t->batch_begin(t->context, settings)) {
+        x->result = MUVUKU_SEND_FAILED;
+        x->stopped = TRUE;
+        return FALSE;
+    }
+
+    x->open = TRUE;
+    return TRUE;
+}
+
+
+/**
+ * Send the message `s`, which completes `records` records (zero
+ * for all but the last part of a multipart record), as part of the
+ * session `x`. A busy handset gets `MUVUKU_SESSION_ATTEMPTS` tries;
+ * any other failure stops the session at once. Returns true if the
+ * message was sent, or false if the session has stopped.
+ */
+u8 muvuku_session_send(muvuku_session_t *x,
+                       const char *s, unsigned int records)
+{
+    muvuku_transport_t *t = x->transport;
+    size_t len = strlen(s);
+
+    if (x->stopped) {
+        return FALSE;
+    }
+
+    for (x->attempts = 1;; x->attempts++) {
+
+        x->result = t->send(t->context, s, len, x->settings);
+        t->status(t->context, x->result);
+
+        if (x->result == MUVUKU_SEND_OK) {
+            x->messages++;
+            x->sent += records;
+            return TRUE;
+        }
+
+        if (x->result != MUVUKU_SEND_BUSY ||
+                x->attempts >= MUVUKU_SESSION_ATTEMPTS) {
+            break;
+        }
+    }
+
+    x->stopped = TRUE;
+    return FALSE;
+}
+
+
+/**
+ * Finish the transmit session `x`. Returns true only if the session
+ * didn't stop early, and every message sent during the session was
+ * delivered; if not, the transport may have lost any of them, so
+ * `x->sent` is reset to zero.
+ */
+u8 muvuku_session_end(muvuku_session_t *x)
+{
+    muvuku_transport_t *t = x->transport;
+
+    if (!x->open) {
+        return FALSE;
+    }
+
+    x->open = FALSE;
+
+    if (!t->batch_end(t->context)) {
+        x->result = MUVUKU_SEND_FAILED;
+        x->stopped = TRUE;
+        x->sent = 0;
+    }
+
+    return !x->stopped;
+}
+
+
+/**
+ * Send the record `record` (of length `len`), which is too long for
+ * one message, as a sequence of parts numbered with `reference`. The
+ * record only counts as sent, in the session `x`, with its last part.
+ */
+u8 muvuku_session_send_parts(muvuku_session_t *x, const char *record,
+                             size_t len, u8 reference)
+{
+    const char *sms;
+    schema_multipart_t *m = (schema_multipart_t *) xmalloc(sizeof(*m));
+
+    u8 rv = schema_multipart_init(m, record, len, reference);
+
+    while (rv && (sms = schema_multipart_next(m)) != NULL) {
+        rv = muvuku_session_send(x, sms, (m->part == m->total));
+    }
+
+    free(m);
+    return rv;
+}
+
+
+/* Outbox:
+    Saved records go out in storage order, packed in to batched
+    messages; records that can't be batched at all go out alone. */
+
+struct muvuku_outbox_state {
+
+    unsigned int count;
+    unsigned int limit;
+    muvuku_session_t *session;
+    schema_batch_t *batch;
+};
+
+
+/**
+ * True if the outbox `state` may not start another message.
+ */
+static u8 muvuku_outbox_full(struct muvuku_outbox_state *state)
+{
+    return (state->limit > 0 && state->session->messages >= state->limit);
+}
+
+
+/**
+ * Send the current batch in `state`, if there is one.
+ */
+static int muvuku_outbox_send_batch(struct muvuku_outbox_state *state)
+{
+    schema_batch_t *b = state->batch;
+
+    if (b->count == 0) {
+        return TRUE;
+    }
+
+    if (muvuku_outbox_full(state) ||
+            !muvuku_session_send(state->session,
+                                 schema_batch_message(b), b->count)) {
+        return FALSE;
+    }
+
+    state->count += b->count;
+    schema_batch_init(b);
+
+    return TRUE;
+}
+
+
+/**
+ * Iterator callback: add one saved record to the current batch,
+ * sending the batch first if the record doesn't fit.
+ */
+static int muvuku_outbox_send_one(muvuku_stringlist_t *sl,
+                                  char *src, size_t len, void *ptr)
+{
+    u8 rv = FALSE;
+    len = scalar_min(len, MAX_RECORD_LENGTH);
+
+    char *buf = (char *) xmalloc(len + 1);
+    memset(buf, '\0', len + 1);
+
+    muvuku_pool_read(sl->pool, buf, src, len);
+    struct muvuku_outbox_state *state = (struct muvuku_outbox_state *) ptr;
+
+    /* Batching:
+        Records are packed in to the current message until the
+        next one doesn't fit; the message is then sent, and a new
+        one is started. Records that can't be batched at all go
+        out alone, in a batch of one. */
+
+    len = strlen(buf);
+
+    if (schema_batch_add(state->batch, buf, len)) {
         rv = TRUE;
-        goto success;
+        goto exit;
+    }
+
+    if (!muvuku_outbox_send_batch(state)) {
+        goto exit;
+    }
+
+    if (!schema_batch_add(state->batch, buf, len)) {
+
+        /* Too long for a single message:
+            The reference number only has to differ from that
+            of the last few multipart records, so the number of
+            records sent so far is as good as any. */
+
+        u8 reference = (u8) (
+            muvuku_settings_counter(MUVUKU_COUNTER_SENT) + state->count
+        );
+
+        if (muvuku_outbox_full(state)) {
+            goto exit;
+        }
+
+        if (len > MAX_SMS_LENGTH ?
+                !muvuku_session_send_parts(state->session, buf, len,
+                                           reference) :
+                !muvuku_session_send(state->session, buf, 1)) {
+            goto exit;
+        }
+
+        state->count++;
+    }
+
+    rv = TRUE;
+
+    exit:
+        free(buf);
+        return rv;
+}
+
+
+/**
+ * Send the saved records in `t`, in order, as part of the session
+ * `x`: every record, then the final, partially-filled message. If
+ * `limit` is non-zero, no message is started once the session has
+ * sent that many; a record in parts may still finish past it. The
+ * session stops at the first failure, and refuses everything after
+ * it; this stops the iteration, too. Returns true if every record
+ * in `t` was sent.
+ */
+u8 muvuku_outbox_send(muvuku_session_t *x,
+                      muvuku_tieredlist_t *t, unsigned int limit)
+{
+    u8 rv = FALSE;
+    schema_batch_t *b = (schema_batch_t *) xmalloc(sizeof(*b));
+
+    struct muvuku_outbox_state state = { 0, limit, x, b };
+    schema_batch_init(b);
+
+    if (muvuku_tieredlist_each(t, muvuku_outbox_send_one, &state)) {
+        rv = muvuku_outbox_send_batch(&state);
+    }
+
+    free(b);
+    return rv;
+}
+
+
+#ifndef _SCHEMA_ENABLE_ACK
+
+/**
+ * Retention callback: skip (i.e. discard) as many strings as the
+ * unsigned integer at `ptr` says, then keep everything after them.
+ */
+static int muvuku_outbox_unsent(muvuku_stringlist_t *sl,
+                                char *src, size_t len, void *ptr)
+{
+    unsigned int *skip = (unsigned int *) ptr;
+
+    if (*skip > 0) {
+        (*skip)--;
+        return FALSE;
     }
 
-    error:
-        display_text(locale(lc_cannot_send_1), NULL);
-        display_text(locale(lc_cannot_send_2), NULL);
-        display_text(locale(lc_cannot_send_3), NULL);
+    return TRUE;
+}
+
+#endif /* ! _SCHEMA_ENABLE_ACK */
+
+
+/**
+ * Send the saved records in `t` in a transmit session of their own,
+ * `x`, using the gateway in `settings`; `limit` is passed on to
+ * `muvuku_outbox_send`. Records that were delivered are reclaimed,
+ * and counted as sent -- even if the session stopped part of the
+ * way, since records go out in storage order. With acknowledgements,
+ * records stay saved until the gateway lists them; see
+ * `muvuku_storage_acknowledge`. Returns false if the session stopped.
+ */
+u8 muvuku_outbox_transmit(muvuku_session_t *x, schema_list_t *settings,
+                          muvuku_tieredlist_t *t, unsigned int limit)
+{
+    muvuku_session_begin(
+        x, settings, (unsigned int) muvuku_tieredlist_count(t)
+    );
 
-    success:
+    muvuku_outbox_send(x, t, limit);
+
+    u8 rv = muvuku_session_end(x);
+
+    if (x->sent == 0) {
         return rv;
+    }
+
+    #ifndef _SCHEMA_ENABLE_ACK
+        if (x->sent == x->total) {
+            muvuku_tieredlist_init(t);
+        } else {
+            unsigned int skip = x->sent;
+            muvuku_tieredlist_retain(t, muvuku_outbox_unsent, &skip);
+        }
+    #endif /* ! _SCHEMA_ENABLE_ACK */
+
+    muvuku_settings_counter_add(MUVUKU_COUNTER_SENT, x->sent);
+    return rv;
+}
+
+
+#if defined(_SCHEMA_ENABLE_ACK) || defined(_ENABLE_AUTO_TRANSMIT)
+
+/* Envelopes:
+    The handset passes incoming messages and events to the SIM as
+    envelopes (ETSI TS 102 223, 7): a BER-TLV, holding simple TLVs.
+    Nothing here depends on the Turbo SDK, so that the prototype can
+    be handed the same bytes. */
+
+#define MUVUKU_TAG_COMPREHENSION    (0x80)
+
+
+/**
+ * Read a BER length from `p`, no further than `end`, and store it in
+ * `len`. Returns a pointer just past it, or null if it's malformed.
+ */
+static const u8 *muvuku_ber_length(const u8 *p, const u8 *end, size_t *len)
+{
+    if (p >= end) {
+        return NULL;
+    }
+
+    if (*p == 0x81) {
+        if (++p >= end) {
+            return NULL;
+        }
+    } else if (*p > 0x7f) {
+        return NULL;
+    }
+
+    *len = *p++;
+    return (*len <= (size_t) (end - p) ? p : NULL);
+}
+
+
+/**
+ * Find the simple TLV tagged `tag` in `envelope`, which must itself
+ * be tagged `outer`; the comprehension-required bit is ignored. Sets
+ * `len` to the length of its value. Returns a pointer to the value,
+ * or null if the envelope is malformed, or has no such TLV.
+ */
+static const u8 *muvuku_envelope_find(const u8 *envelope,
+                                      u8 outer, u8 tag, size_t *len)
+{
+    const u8 *p = envelope + 1;
+
+    if (envelope[0] != outer) {
+        return NULL;
+    }
+
+    /* An envelope is never longer than this */
+    const u8 *end = envelope + 0xff + 3;
+
+    if ((p = muvuku_ber_length(p, end, len)) == NULL) {
+        return NULL;
+    }
+
+    end = p + *len;
+
+    while (p + 1 < end) {
+
+        u8 t = (*p++ & ~MUVUKU_TAG_COMPREHENSION);
+
+        if ((p = muvuku_ber_length(p, end, len)) == NULL) {
+            return NULL;
+        }
+
+        if (t == tag) {
+            return p;
+        }
+
+        p += *len;
+    }
+
+    return NULL;
+}
+
+#endif /* _SCHEMA_ENABLE_ACK || _ENABLE_AUTO_TRANSMIT */
+
+
+#ifdef _SCHEMA_ENABLE_ACK
+
+/* Incoming messages:
+    Acknowledgements from the gateway arrive as an SMS-PP download
+    envelope (ETSI TS 102 223, 7.1), holding an SMS-DELIVER TPDU
+    (3GPP TS 23.040, 9.2.2.1). */
+
+#define MUVUKU_TAG_SMS_PP_DOWNLOAD  (0xd1)
+#define MUVUKU_TPDU_MTI_MASK        (0x03)
+#define MUVUKU_TPDU_UDHI            (0x40)
+#define MUVUKU_TPDU_SCTS_LENGTH     (7)
+
+
+/* Sender matching:
+    The gateway's number is saved as dialled (e.g. +255...), but the
+    network may deliver its messages from the national form of the
+    same number (e.g. 0...), or the other way around. Numbers match
+    if they're equal once a national trunk prefix is dropped, or if
+    the shorter is the tail end of the longer, and this long. */
+
+#define MUVUKU_ADDRESS_MATCH_MIN    (7)
+#define MUVUKU_ADDRESS_DIGITS_MAX   (MUVUKU_MSISDN_LENGTH_MAX)
+#define MUVUKU_TON_MASK             (0x70)
+#define MUVUKU_TON_INTERNATIONAL    (0x10)
+
+
+/**
+ * Unpack the `len` bytes of semi-octet digits at `bcd`, of the type
+ * of number `type`, in to `dst`, one digit value per byte. Leading
+ * zeroes of a number that isn't international are dropped. Returns
+ * the number of digits written.
+ */
+static size_t muvuku_address_digits(const u8 *bcd, size_t len,
+                                    u8 type, u8 *dst)
+{
+    size_t i, n = 0;
+    u8 national = ((type & MUVUKU_TON_MASK) != MUVUKU_TON_INTERNATIONAL);
+
+    for (i = 0; i < 2 * len && n < MUVUKU_ADDRESS_DIGITS_MAX; ++i) {
+
+        u8 digit = (i % 2 ? bcd[i / 2] >> 4 : bcd[i / 2] & 0x0f);
+
+        if (digit == 0x0f) {
+            break; /* Filler */
+        }
+
+        if (national && n == 0 && digit == 0) {
+            continue; /* Trunk prefix */
+        }
+
+        dst[n++] = digit;
+    }
+
+    return n;
+}
+
+
+/**
+ * Return true if the ADN-format address `adn` and the originating
+ * address `oa`, from an SMS-DELIVER TPDU holding `len` bytes from
+ * there on, are the same number; see `MUVUKU_ADDRESS_MATCH_MIN`.
+ */
+static u8 muvuku_address_match(const u8 *adn, const u8 *oa, size_t len)
+{
+    u8 a[MUVUKU_ADDRESS_DIGITS_MAX], b[MUVUKU_ADDRESS_DIGITS_MAX];
+    size_t bytes = (oa[0] + 1) / 2;
+
+    if (adn[0] < 1 || len < 2 + bytes) {
+        return FALSE;
+    }
+
+    size_t n = muvuku_address_digits(&adn[2], adn[0] - 1, adn[1], a);
+    size_t m = muvuku_address_digits(&oa[2], bytes, oa[1], b);
+    size_t k = scalar_min(n, m);
+
+    if (k == 0 || (n != m && k < MUVUKU_ADDRESS_MATCH_MIN)) {
+        return FALSE;
+    }
+
+    return (memcmp(&a[n - k], &b[m - k], k) == 0);
+}
+
+
+/**
+ * Copy the user data of the SMS-DELIVER TPDU `tpdu` (of length
+ * `len`) to `dst`, which holds `size` bytes, as a null-terminated
+ * string. If `from` is non-null, it's an address in ADN format, and
+ * the message must have come from the same number, in either its
+ * national or international form. Septets are not
+ * translated from the GSM alphabet; every character that can appear
+ * in an acknowledgement is the same there. Returns the length of the
+ * text, or zero if the message should be ignored.
+ */
+size_t muvuku_sms_deliver_text(const u8 *tpdu, size_t len,
+                               const u8 *from, char *dst, size_t size)
+{
+    size_t i = 0, n, skip = 0, ud_len;
+    u8 alphabet_7bit, udhi;
+
+    if (len < 2 || (tpdu[0] & MUVUKU_TPDU_MTI_MASK) != TP_MTI_DELIVER) {
+        return 0;
+    }
+
+    udhi = (tpdu[0] & MUVUKU_TPDU_UDHI);
+
+    /* Originating address: digits, type, then packed digits */
+    size_t address_len = (tpdu[1] + 1) / 2;
+
+    if (len < 3 + address_len) {
+        return 0;
+    }
+
+    if (from != NULL && !muvuku_address_match(from, &tpdu[1], len - 1)) {
+        return 0;
+    }
+
+    i = 3 + address_len;
+
+    /* Protocol identifier, coding scheme, timestamp, length */
+    if (len < i + 3 + MUVUKU_TPDU_SCTS_LENGTH) {
+        return 0;
+    }
+
+    u8 dcs = tpdu[i + 1];
+
+    if ((dcs & 0xc0) == 0x00) {
+        if ((dcs & 0x20) || (dcs & 0x0c) == 0x08) {
+            return 0; /* Compressed, or UCS2 */
+        }
+        alphabet_7bit = ((dcs & 0x0c) == 0x00);
+    } else if ((dcs & 0xf0) == 0xf0) {
+        alphabet_7bit = !(dcs & 0x04);
+    } else {
+        return 0;
+    }
+
+    i += 2 + MUVUKU_TPDU_SCTS_LENGTH;
+    n = tpdu[i++];
+
+    const u8 *ud = &tpdu[i];
+    ud_len = (alphabet_7bit ? (n * 7 + 7) / 8 : n);
+
+    if (ud_len > len - i) {
+        return 0;
+    }
+
+    /* User data header: skipped, whole septets at a time */
+    if (udhi) {
+        if (ud_len == 0) {
+            return 0;
+        }
+        skip = ud[0] + 1;
+        skip = (alphabet_7bit ? (skip * 8 + 6) / 7 : skip);
+    }
+
+    if (skip >= n || n - skip >= size) {
+        return 0;
+    }
+
+    for (i = skip; i < n; ++i) {
+
+        if (!alphabet_7bit) {
+            *dst++ = (char) ud[i];
+            continue;
+        }
+
+        size_t bit = i * 7, octet = bit / 8;
+        u8 shift = bit % 8;
+        u8 septet = ud[octet] >> shift;
+
+        if (shift > 1) {
+            septet |= ud[octet + 1] << (8 - shift);
+        }
+
+        *dst++ = (char) (septet & 0x7f);
+    }
+
+    *dst = '\0';
+    return (n - skip);
+}
+
+
+/**
+ * Find the SMS-DELIVER TPDU in the SMS-PP download `envelope`, and
+ * copy its text to `dst`, as `muvuku_sms_deliver_text` does. Returns
+ * the length of the text, or zero if there's nothing to read.
+ */
+size_t muvuku_sms_envelope_text(const u8 *envelope, const u8 *from,
+                                char *dst, size_t size)
+{
+    size_t len;
+
+    const u8 *tpdu = muvuku_envelope_find(
+        envelope, MUVUKU_TAG_SMS_PP_DOWNLOAD, T_SMS_TPDU, &len
+    );
+
+    if (tpdu == NULL) {
+        return 0;
+    }
+
+    return muvuku_sms_deliver_text(tpdu, len, from, dst, size);
+}
+
+#endif /* _SCHEMA_ENABLE_ACK */
+
+
+#ifdef _ENABLE_AUTO_TRANSMIT
+
+/* Location status:
+    Reported in an event download envelope (ETSI TS 102 223, 7.5.4);
+    anything other than normal service means there's no point trying
+    to send a message. */
+
+#define MUVUKU_TAG_EVENT_DOWNLOAD   (0xd6)
+#define MUVUKU_LOCATION_NORMAL      (0x00)
+
+
+/* Wrapping comparison of two times, in seconds */
+#define muvuku_schedule_before(a, b) ((int32_t) ((a) - (b)) < 0)
+
+
+/**
+ * Start the schedule `h`: something may be waiting to be sent, and
+ * the handset is assumed to be registered until it says otherwise.
+ */
+void muvuku_schedule_init(muvuku_schedule_t *h)
+{
+    memset(h, '\0', sizeof(*h));
+
+    h->backoff = MUVUKU_SCHEDULE_BACKOFF_MIN;
+    h->registered = TRUE;
+    h->pending = TRUE;
+}
+
+
+/**
+ * Bring back the budget spent today, and any run of failed attempts,
+ * from the persistent counters; settings must be open. Call this
+ * just after `muvuku_schedule_init`. After failures, the next attempt
+ * waits just as it would have before the restart.
+ */
+void muvuku_schedule_restore(muvuku_schedule_t *h)
+{
+    uint16_t wait = 0;
+
+    uint32_t spent =
+        muvuku_settings_counter(MUVUKU_COUNTER_BACKGROUND) -
+            muvuku_settings_counter(MUVUKU_COUNTER_BUDGET_START);
+
+    uint32_t failed =
+        muvuku_settings_counter(MUVUKU_COUNTER_FAILED) -
+            muvuku_settings_counter(MUVUKU_COUNTER_FAILED_SEEN);
+
+    h->spent = (u8) scalar_min(spent, (uint32_t) MUVUKU_SCHEDULE_BUDGET);
+
+    for (; failed > 0 && wait < MUVUKU_SCHEDULE_BACKOFF_MAX; --failed) {
+        wait = h->backoff;
+        h->backoff = scalar_min(
+            h->backoff * 2, MUVUKU_SCHEDULE_BACKOFF_MAX
+        );
+    }
+
+    if (wait > 0) {
+        h->next = h->now + wait;
+    }
+}
+
+
+/**
+ * Tell the schedule `h` about `event`, one of `MUVUKU_EVENT_*`.
+ */
+void muvuku_schedule_event(muvuku_schedule_t *h, u8 event)
+{
+    switch (event) {
+
+        case MUVUKU_EVENT_MENU_OPEN:
+            h->busy = TRUE;
+            break;
+
+        /* Records may have been saved */
+        case MUVUKU_EVENT_MENU_CLOSE:
+            h->busy = FALSE;
+            h->pending = TRUE;
+            break;
+
+        case MUVUKU_EVENT_ACTIVITY:
+            h->quiet = h->now + MUVUKU_SCHEDULE_QUIET;
+            break;
+
+        case MUVUKU_EVENT_IDLE_SCREEN:
+            h->quiet = h->now;
+            break;
+
+        /* Back in coverage: try again straight away */
+        case MUVUKU_EVENT_SERVICE:
+            if (!h->registered && !h->running) {
+                h->next = h->now;
+                h->backoff = MUVUKU_SCHEDULE_BACKOFF_MIN;
+            }
+            h->registered = TRUE;
+            break;
+
+        case MUVUKU_EVENT_NO_SERVICE:
+            h->registered = FALSE;
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**
+ * Advance the schedule `h` by `elapsed` seconds. Returns the number
+ * of messages that may be sent right now, or zero if it's not time
+ * to try. A non-zero result starts an attempt, which must be ended
+ * with `muvuku_schedule_done`; an attempt that never ends is given
+ * up on after `MUVUKU_SCHEDULE_BACKOFF_MAX` seconds.
+ */
+u8 muvuku_schedule_tick(muvuku_schedule_t *h, uint16_t elapsed)
+{
+    h->now += elapsed;
+    h->allowance = 0;
+
+    /* New day, new budget */
+    if (h->now - h->day >= MUVUKU_SCHEDULE_DAY) {
+        h->day += MUVUKU_SCHEDULE_DAY * ((h->now - h->day) /
+                                         MUVUKU_SCHEDULE_DAY);
+        h->spent = 0;
+        h->new_day = TRUE;
+    }
+
+    if (h->busy || !h->registered || !h->pending ||
+            h->spent >= MUVUKU_SCHEDULE_BUDGET) {
+        return 0;
+    }
+
+    if (muvuku_schedule_before(h->now, h->quiet) ||
+            muvuku_schedule_before(h->now, h->next)) {
+        return 0;
+    }
+
+    h->allowance = scalar_min(
+        MUVUKU_SCHEDULE_MESSAGES, MUVUKU_SCHEDULE_BUDGET - h->spent
+    );
+
+    h->running = TRUE;
+    h->next = h->now + MUVUKU_SCHEDULE_BACKOFF_MAX;
+
+    return h->allowance;
+}
+
+
+/**
+ * Pass the Turbo `action`, along with its `data`, to the schedule
+ * `h`: a STATUS command is a tick, and event envelopes are events.
+ * Everything else is ignored. Returns what `muvuku_schedule_tick`
+ * does, or zero.
+ */
+u8 muvuku_schedule_action(muvuku_schedule_t *h, u8 action, const u8 *data)
+{
+    size_t len;
+    const u8 *status;
+
+    switch (action) {
+
+        case ACTION_STATUS:
+            return muvuku_schedule_tick(h, MUVUKU_SCHEDULE_TICK);
+
+        case ACTION_EVENT_USER_ACTIVITY:
+            muvuku_schedule_event(h, MUVUKU_EVENT_ACTIVITY);
+            break;
+
+        case ACTION_EVENT_IDLE_SCREEN:
+            muvuku_schedule_event(h, MUVUKU_EVENT_IDLE_SCREEN);
+            break;
+
+        case ACTION_EVENT_LOCATION_STATUS:
+
+            status = muvuku_envelope_find(
+                data, MUVUKU_TAG_EVENT_DOWNLOAD, T_LOCATION_STATUS, &len
+            );
+
+            if (status != NULL && len == 1) {
+                muvuku_schedule_event(
+                    h, (*status == MUVUKU_LOCATION_NORMAL ?
+                        MUVUKU_EVENT_SERVICE : MUVUKU_EVENT_NO_SERVICE)
+                );
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Update the persistent counters behind the schedule `h`, after an
+ * attempt that sent `messages` and ended with `result`. Nothing is
+ * written unless something changed; settings must be open.
+ */
+static void muvuku_schedule_save(muvuku_schedule_t *h,
+                                 unsigned int messages, u8 result)
+{
+    uint32_t n;
+
+    /* Budget: a new day starts from what's been sent so far */
+    if (h->new_day) {
+
+        n = muvuku_settings_counter(MUVUKU_COUNTER_BACKGROUND) -
+                muvuku_settings_counter(MUVUKU_COUNTER_BUDGET_START);
+
+        if (n > 0) {
+            muvuku_settings_counter_add(MUVUKU_COUNTER_BUDGET_START, n);
+        }
+
+        h->new_day = FALSE;
+    }
+
+    if (messages > 0) {
+        muvuku_settings_counter_add(MUVUKU_COUNTER_BACKGROUND, messages);
+    }
+
+    /* Backoff: success ends a run of failures */
+    if (!result) {
+        muvuku_settings_counter_add(MUVUKU_COUNTER_FAILED, 1);
+        return;
+    }
+
+    n = muvuku_settings_counter(MUVUKU_COUNTER_FAILED) -
+            muvuku_settings_counter(MUVUKU_COUNTER_FAILED_SEEN);
+
+    if (n > 0) {
+        muvuku_settings_counter_add(MUVUKU_COUNTER_FAILED_SEEN, n);
+    }
+}
+
+
+/**
+ * End the attempt started by `muvuku_schedule_tick`: `messages` were
+ * sent, `result` is false if the attempt failed, and `remaining` is
+ * the number of records still saved. Success schedules the next
+ * attempt for `MUVUKU_SCHEDULE_INTERVAL` seconds later, if there's
+ * anything left; failure backs off. Settings must be open, so that
+ * the outcome outlives a restart; see `muvuku_schedule_restore`.
+ */
+void muvuku_schedule_done(muvuku_schedule_t *h, unsigned int messages,
+                          u8 result, size_t remaining)
+{
+    h->running = FALSE;
+    h->allowance = 0;
+
+    muvuku_schedule_save(h, messages, result);
+
+    h->spent = (u8) scalar_min(
+        (unsigned int) h->spent + messages, MUVUKU_SCHEDULE_BUDGET
+    );
+
+    if (!result) {
+        h->next = h->now + h->backoff;
+        h->backoff = scalar_min(
+            h->backoff * 2, MUVUKU_SCHEDULE_BACKOFF_MAX
+        );
+        return;
+    }
+
+    h->backoff = MUVUKU_SCHEDULE_BACKOFF_MIN;
+    h->next = h->now + MUVUKU_SCHEDULE_INTERVAL;
+    h->pending = (remaining > 0);
+}
+
+
+struct muvuku_drain_state {
+
+    muvuku_schedule_t *schedule;
+    schema_list_t *settings;
+
+    unsigned int messages;
+    size_t remaining;
+    u8 result;
+};
+
+
+/**
+ * Storage callback: send what's left of the attempt's allowance
+ * from one form's saved records, in a session of its own.
+ */
+static int muvuku_schedule_drain_one(muvuku_tieredlist_t *t, void *ptr)
+{
+    muvuku_session_t x;
+    struct muvuku_drain_state *state = (struct muvuku_drain_state *) ptr;
+
+    unsigned int allowance = state->schedule->allowance;
+
+    if (muvuku_tieredlist_count(t) > 0 && state->messages < allowance) {
+
+        state->result = muvuku_outbox_transmit(
+            &x, state->settings, t, allowance - state->messages
+        );
+
+        state->messages += x.messages;
+    }
+
+    state->remaining += muvuku_tieredlist_count(t);
+    return state->result;
+}
+
+
+/**
+ * Carry out the attempt started by `muvuku_schedule_tick`: send the
+ * saved records of every form, oldest first within each form, until
+ * the attempt's allowance is used up, then end the attempt. Records
+ * are sent, and reclaimed, as the Transmit menu would; nothing is
+ * displayed. Returns false if nothing could be sent.
+ */
+u8 muvuku_schedule_drain(muvuku_schedule_t *h, muvuku_settings_t *s,
+                         muvuku_pool_t *from_pool,
+                         muvuku_pool_t *overflow_pool,
+                         schema_list_t *settings)
+{
+    struct muvuku_drain_state state = { h, settings, 0, 0, TRUE };
+
+    if (!h->running) {
+        return FALSE;
+    }
+
+    if (from_pool == NULL) {
+        state.result = FALSE;
+    } else {
+        muvuku_storage_each(
+            s, from_pool, overflow_pool, muvuku_schedule_drain_one, &state
+        );
+    }
+
+    muvuku_schedule_done(h, state.messages, state.result, state.remaining);
+    return state.result;
+}
+
+#endif /* _ENABLE_AUTO_TRANSMIT */
+
+
+/**
+ * Initialize the transport subsystem. This function only has
+ * a visible effect on the first call; subsequent calls are ignored.
+ */
+void muvuku_subsystem_init_transport()
+{
+    muvuku_transport_t *t;
+
+    /* Ignore duplicate calls */
+    if (muvuku_transport != NULL) {
+        return;
+    }
+
+    #ifndef _MUVUKU_PROTOTYPE
+
+        /* SIM Toolkit short messages */
+        t = &muvuku_sms_transport;
+        t->batch_begin = &muvuku_sms_batch_begin;
+        t->send = &muvuku_sms_send;
+        t->batch_end = &muvuku_sms_batch_end;
+        t->status = &muvuku_sms_status;
+        t->context = NULL;
+
+        muvuku_transport = &muvuku_sms_transport;
+
+    #else
+
+        /* Host loopback, to a gateway stand-in */
+        t = &muvuku_loopback_transport;
+        t->batch_begin = &muvuku_loopback_batch_begin;
+        t->send = &muvuku_sink_send;
+        t->batch_end = &muvuku_sink_batch_end;
+        t->status = &muvuku_sink_status;
+        t->context = &muvuku_loopback_sink;
+
+        /* Host file sink; standard output by default */
+        t = &muvuku_file_transport;
+        t->batch_begin = &muvuku_file_batch_begin;
+        t->send = &muvuku_sink_send;
+        t->batch_end = &muvuku_sink_batch_end;
+        t->status = &muvuku_sink_status;
+        t->context = &muvuku_file_sink;
+
+        muvuku_transport = &muvuku_file_transport;
+
+    #endif /* ! _MUVUKU_PROTOTYPE */
 }
 
@@ -20,10 +20,271 @@
 #define __MUVUKU_TRANSPORT_H__
 
 #include "schema.h"
+#include "settings.h"
+
+
+/* Initialize transport subsystem:
+    This must be called before any message is sent. */
+
+void muvuku_subsystem_init_transport();
+
+
+
+/** @name muvuku_transport_t **/
+
+/* Transport:
+    Delivers serialized messages to the gateway. A send session
+    opens with `batch_begin`, passes each message to `send`, and
+    closes with `batch_end`; messages are only known to have been
+    delivered once `batch_end` returns true. The `send` member
+    returns one of the results below, and must leave the message
+    unchanged, so that it can be tried again. The `status` callback
+    is told the result of every `send`. Each member is passed
+    `context` first. */
+
+typedef struct muvuku_transport {
+
+    u8      (*batch_begin)(void *, schema_list_t *);
+    u8      (*send)(void *, const char *, size_t, schema_list_t *);
+    u8      (*batch_end)(void *);
+    void    (*status)(void *, u8);
+    void *  context;
+
+} muvuku_transport_t;
+
+muvuku_transport_t muvuku_sms_transport;
+
+#ifdef _MUVUKU_PROTOTYPE
+    muvuku_transport_t muvuku_loopback_transport;
+    muvuku_transport_t muvuku_file_transport;
+#endif /* _MUVUKU_PROTOTYPE */
+
+
+/* Send results:
+    A busy handset is worth trying again, straight away; when
+    the network has refused a message, the next one will fare
+    no better, so there's no point in trying it. */
+
+#define MUVUKU_SEND_OK          (0)
+#define MUVUKU_SEND_BUSY        (1)
+#define MUVUKU_SEND_FAILED      (2)
+
+
+/* Current transport:
+    Used by every `muvuku_session_t`. This is the SMS transport,
+    unless it has been changed (e.g. in prototyping mode). */
+
+muvuku_transport_t *muvuku_transport;
+
+
+
+/** @name muvuku_session_t **/
+
+/* Attempts per message:
+    A message is tried this many times in a row while the handset
+    is busy; after that, the session gives up as if it had failed. */
+
+#ifndef MUVUKU_SESSION_ATTEMPTS
+    #define MUVUKU_SESSION_ATTEMPTS (3)
+#endif /* MUVUKU_SESSION_ATTEMPTS */
+
+
+/* Transmit session:
+    Sends the messages for `total` records on the current transport,
+    in order, and counts the records that were delivered. The session
+    stops at the first failure; everything after that is refused
+    without being attempted, so that a whole outbox costs the user
+    one failed message, and a single report at the end. */
+
+typedef struct muvuku_session {
+
+    muvuku_transport_t *transport;
+    schema_list_t *settings;
+
+    unsigned int total;
+    unsigned int sent;
+    unsigned int messages;
+
+    u8 attempts;
+    u8 result;
+    u8 stopped;
+    u8 open;
+
+} muvuku_session_t;
+
+
+
+#ifdef _ENABLE_AUTO_TRANSMIT
+
+/** @name muvuku_schedule_t **/
+
+/* Background transmit:
+    Saved records also leave without the user's involvement, a few
+    messages at a time, whenever the handset is idle and registered
+    on a network. The schedule only decides when to try, and for how
+    many messages; it is driven by the events below, by a periodic
+    tick, and by the outcome of each attempt. There's no clock on the
+    SIM, so time is the sum of the ticks' nominal lengths. */
+
+#define MUVUKU_EVENT_MENU_OPEN      (0)   /* Our menu was entered */
+#define MUVUKU_EVENT_MENU_CLOSE     (1)   /* ...and left again */
+#define MUVUKU_EVENT_ACTIVITY       (2)   /* A key was pressed */
+#define MUVUKU_EVENT_IDLE_SCREEN    (3)   /* Back at the idle screen */
+#define MUVUKU_EVENT_SERVICE        (4)   /* Registered on a network */
+#define MUVUKU_EVENT_NO_SERVICE     (5)   /* Limited or no service */
+
+
+/* Tick length:
+    The handset sends a STATUS command about this often, in seconds,
+    while idle; each one is a tick. */
+
+#ifndef MUVUKU_SCHEDULE_TICK
+    #define MUVUKU_SCHEDULE_TICK (30)
+#endif /* MUVUKU_SCHEDULE_TICK */
+
+
+/* Messages per attempt:
+    Each attempt drains at most this many messages, so that the
+    handset is never tied up for long. */
+
+#ifndef MUVUKU_SCHEDULE_MESSAGES
+    #define MUVUKU_SCHEDULE_MESSAGES (2)
+#endif /* MUVUKU_SCHEDULE_MESSAGES */
+
+
+/* Daily budget:
+    At most this many messages (no more than 255) are sent in the
+    background per day, i.e. per 86400 seconds of ticks. What's been
+    spent, and any run of failures, are kept in persistent counters,
+    so that restarting the SIM doesn't reset them; the day itself
+    starts over, though, since ticks aren't saved. The Transmit menu
+    doesn't count against the budget. */
+
+#ifndef MUVUKU_SCHEDULE_BUDGET
+    #define MUVUKU_SCHEDULE_BUDGET (24)
+#endif /* MUVUKU_SCHEDULE_BUDGET */
+
+#define MUVUKU_SCHEDULE_DAY (86400UL)
+
+
+/* Spacing:
+    Seconds between attempts while there's still more to send. With
+    acknowledgements, sent records stay saved for a while; this gives
+    the gateway time to reply before they are sent again. */
+
+#ifndef MUVUKU_SCHEDULE_INTERVAL
+    #ifdef _SCHEMA_ENABLE_ACK
+        #define MUVUKU_SCHEDULE_INTERVAL (600)
+    #else
+        #define MUVUKU_SCHEDULE_INTERVAL (60)
+    #endif /* _SCHEMA_ENABLE_ACK */
+#endif /* MUVUKU_SCHEDULE_INTERVAL */
+
+
+/* Backoff:
+    After a failed attempt, wait this many seconds before the next,
+    doubling the wait after every further failure, up to the maximum.
+    Quiet time is how long a key press keeps the handset busy. */
+
+#define MUVUKU_SCHEDULE_BACKOFF_MIN (60)
+#define MUVUKU_SCHEDULE_BACKOFF_MAX (3840)
+#define MUVUKU_SCHEDULE_QUIET       (120)
+
+
+typedef struct muvuku_schedule {
+
+    uint32_t now;
+    uint32_t next;
+    uint32_t quiet;
+    uint32_t day;
+
+    uint16_t backoff;
+    u8 spent;
+    u8 allowance;
+    u8 new_day;
+
+    u8 busy;
+    u8 running;
+    u8 registered;
+    u8 pending;
+
+} muvuku_schedule_t;
+
+#endif /* _ENABLE_AUTO_TRANSMIT */
+
+
+#ifdef _MUVUKU_PROTOTYPE
+
+    /** @name muvuku_sink_t **/
+
+    /* Host-side sink:
+        Context for the loopback and file transports. Messages are
+        written to `path` -- a Unix socket or a file, respectively --
+        each followed by a NUL, since batched messages already contain
+        newlines; a null `path` means standard output. */
+
+    typedef struct muvuku_sink {
+
+        const char *path;
+        FILE *file;
+
+        unsigned long count;
+        unsigned long size;
+        unsigned long failures;
+
+    } muvuku_sink_t;
+
+    void muvuku_sink_init(muvuku_sink_t *k, const char *path);
+
+#endif /* _MUVUKU_PROTOTYPE */
 
 
 /* Methods */
-u8 muvuku_send_sms(char *s, schema_list_t *settings);
+u8 muvuku_session_begin(muvuku_session_t *x,
+                        schema_list_t *settings, unsigned int total);
+
+u8 muvuku_session_send(muvuku_session_t *x,
+                       const char *s, unsigned int records);
+
+u8 muvuku_session_end(muvuku_session_t *x);
+
+u8 muvuku_session_send_parts(muvuku_session_t *x, const char *record,
+                             size_t len, u8 reference);
+
+u8 muvuku_outbox_send(muvuku_session_t *x,
+                      muvuku_tieredlist_t *t, unsigned int limit);
+
+u8 muvuku_outbox_transmit(muvuku_session_t *x, schema_list_t *settings,
+                          muvuku_tieredlist_t *t, unsigned int limit);
+
+#ifdef _ENABLE_AUTO_TRANSMIT
+  void muvuku_schedule_init(muvuku_schedule_t *h);
+
+  void muvuku_schedule_restore(muvuku_schedule_t *h);
+
+  void muvuku_schedule_event(muvuku_schedule_t *h, u8 event);
+
+  u8 muvuku_schedule_tick(muvuku_schedule_t *h, uint16_t elapsed);
+
+  u8 muvuku_schedule_action(muvuku_schedule_t *h,
+                            u8 action, const u8 *data);
+
+  void muvuku_schedule_done(muvuku_schedule_t *h, unsigned int messages,
+                            u8 result, size_t remaining);
+
+  u8 muvuku_schedule_drain(muvuku_schedule_t *h, muvuku_settings_t *s,
+                           muvuku_pool_t *from_pool,
+                           muvuku_pool_t *overflow_pool,
+                           schema_list_t *settings);
+#endif /* _ENABLE_AUTO_TRANSMIT */
+
+#ifdef _SCHEMA_ENABLE_ACK
+  size_t muvuku_sms_deliver_text(const u8 *tpdu, size_t len,
+                                 const u8 *from, char *dst, size_t size);
+
+  size_t muvuku_sms_envelope_text(const u8 *envelope, const u8 *from,
+                                  char *dst, size_t size);
+#endif /* _SCHEMA_ENABLE_ACK */
 
 
 #endif /* __MUVUKU_TRANSPORT_H__ */
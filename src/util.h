@@ -41,6 +41,8 @@ size_t safe_multiply(const size_t a, const size_t b, int *rv);
 
 void memzero(void *p, size_t n);
 
+extern const char panic_memory[];
+
 void *xmalloc(size_t n);
 
 void muvuku_panic(const char *detail);
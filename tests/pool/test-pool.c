@@ -184,6 +184,11 @@ lc_char PROGMEM lc_alloc_success[] = {
     LC_END
 };
 
+lc_char PROGMEM lc_alloc_fail[] = {
+    LC_EN("Couldn't allocate pool")
+    LC_END
+};
+
 u8 menu_alloc_ctx (SCtx *ctx, u8 action)
 {
     if (action == APP_ENTER) {
@@ -195,11 +200,20 @@ u8 menu_alloc_ctx (SCtx *ctx, u8 action)
             return APP_OK;
         }
 
+        /* Flash allocations come from an extent table */
+        muvuku_flash_region_t *r = muvuku_flash_region_init(
+            muvuku_flash_reserved, muvuku_flash_reserved_size()
+        );
+
         muvuku_pool_t *p = muvuku_pool_new(
-            current_allocator, sizeof(*muvuku_flash_reserved), 8,
-                &muvuku_flash_reserved
+            current_allocator, muvuku_flash_region_available(r), 8, r
         );
 
+        if (p == NULL) {
+            display_text(locale(lc_alloc_fail), NULL);
+            return APP_OK;
+        }
+
         *current_pool_handle = muvuku_pool_handle(p);
         sync_app_data();
 
@@ -239,6 +253,10 @@ u8 menu_free_ctx (SCtx *ctx, u8 action)
             return APP_OK;
         }
 
+        muvuku_flash_region_init(
+            muvuku_flash_reserved, muvuku_flash_reserved_size()
+        );
+
         muvuku_pool_t *p = muvuku_pool_open(current_allocator, h);
         muvuku_pool_delete(p);
 
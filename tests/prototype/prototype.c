@@ -31,6 +31,10 @@
 #include "bladox.h"
 #include "prototype.h"
 
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
 
 /* Reserve some memory to test in:
     This space is used throughout the tests. */
@@ -89,15 +93,17 @@ void test_simple_serialization() {
     schema_info_t o;
     schema_info_init(&o);
 
-    SCHEMA_BEGIN(l, "MUVX", 10);
-        SCHEMA_ITEM("i1", TS_INTEGER, 1, 4);
-        SCHEMA_ITEM("s2", TS_STRING, 1, 4);
-        SCHEMA_ITEM("i3", TS_INTEGER, 2, 4);
-            SCHEMA_ITEM_DELIMITER('-');
-        SCHEMA_ITEM("i4", TS_INTEGER, 2, 4);
-        SCHEMA_ITEM("s5", TS_STRING, 1, 32);
-            SCHEMA_ITEM_DELIMITER('/');
-    SCHEMA_END();
+    SCHEMA_BEGIN(form)
+        SCHEMA_ITEM("i1", TS_INTEGER, 1, 4)
+        SCHEMA_ITEM("s2", TS_STRING, 1, 4)
+        SCHEMA_ITEM("i3", TS_INTEGER, 2, 4,
+            SCHEMA_DELIMITER('-'))
+        SCHEMA_ITEM("i4", TS_INTEGER, 2, 4)
+        SCHEMA_ITEM("s5", TS_STRING, 1, 32,
+            SCHEMA_DELIMITER('/'))
+    SCHEMA_END(form, "MUVX")
+
+    schema_list_t *l = schema_list_new(&form);
 
     schema_item_t *i = l->list;
     assert(i != NULL, "Created schema_list_t successfully");
@@ -186,14 +192,16 @@ void test_simple_serialization() {
         "Yes", "Maybe", "No", "Probably Not"
     };
 
-    SCHEMA_BEGIN(ll, "MUVX", 10);
-        SCHEMA_ITEM("i1", TS_INTEGER, 4, 4);
-        SCHEMA_ITEM("c2", TS_SELECT, 1, 2);
-            SCHEMA_ITEM_SELECT(3, NULL, choices);
-        SCHEMA_ITEM("b3", TS_BOOLEAN, 1, 1);
-        SCHEMA_ITEM("s4", TS_STRING, 0, 10);
-        SCHEMA_ITEM("b5", TS_BOOLEAN, 1, 1);
-    SCHEMA_END();
+    SCHEMA_BEGIN(form2)
+        SCHEMA_ITEM("i1", TS_INTEGER, 4, 4)
+        SCHEMA_ITEM("c2", TS_SELECT, 1, 2,
+            SCHEMA_SELECT(3, NULL, choices))
+        SCHEMA_ITEM("b3", TS_BOOLEAN, 1, 1)
+        SCHEMA_ITEM("s4", TS_STRING, 0, 10)
+        SCHEMA_ITEM("b5", TS_BOOLEAN, 1, 1)
+    SCHEMA_END(form2, "MUVX")
+
+    schema_list_t *ll = schema_list_new(&form2);
 
     i = ll->list;
     assert(i != NULL, "Created schema_list_t successfully");
@@ -256,15 +264,17 @@ void test_date_serialization() {
     schema_info_t o;
     schema_info_init(&o);
 
-    SCHEMA_BEGIN(l, "MUVX", 10);
-        SCHEMA_ITEM("x", TS_INTEGER, 1, 4);
-        SCHEMA_ITEM("y", TS_INTEGER, 1, 4);
-            SCHEMA_ITEM_DELIMITER('-');
-        SCHEMA_ITEM("m", TS_INTEGER, 1, 4);
-            SCHEMA_ITEM_DELIMITER('-');
-        SCHEMA_ITEM("d", TS_INTEGER, 1, 4);
-        SCHEMA_ITEM("xx", TS_INTEGER, 1, 4);
-    SCHEMA_END();
+    SCHEMA_BEGIN(form)
+        SCHEMA_ITEM("x", TS_INTEGER, 1, 4)
+        SCHEMA_ITEM("y", TS_INTEGER, 1, 4,
+            SCHEMA_DELIMITER('-'))
+        SCHEMA_ITEM("m", TS_INTEGER, 1, 4,
+            SCHEMA_DELIMITER('-'))
+        SCHEMA_ITEM("d", TS_INTEGER, 1, 4)
+        SCHEMA_ITEM("xx", TS_INTEGER, 1, 4)
+    SCHEMA_END(form, "MUVX")
+
+    schema_list_t *l = schema_list_new(&form);
 
     schema_item_t *i = l->list;
     assert(i != NULL, "Created schema_list_t successfully");
@@ -309,19 +319,20 @@ void test_selective_serialization() {
         "Yes", "Maybe", "No", "Probably Not"
     };
 
-    SCHEMA_BEGIN(l, "MUVX", 10);
-        SCHEMA_ITEM("i1", TS_INTEGER, 4, 4);
-            SCHEMA_ITEM_FLAGS(FL_UNIQUE_KEY);
-            SCHEMA_ITEM_FLAGS(FL_PRESERVE_VALUE);
-        SCHEMA_ITEM("c2", TS_SELECT, 1, 2);
-            SCHEMA_ITEM_FLAGS(FL_PRESERVE_VALUE);
-            SCHEMA_ITEM_SELECT(3, NULL, choices);
-        SCHEMA_ITEM("b3", TS_BOOLEAN, 1, 1);
-        SCHEMA_ITEM("s4", TS_STRING, 0, 10);
-        SCHEMA_ITEM("b5", TS_BOOLEAN, 1, 1);
-            SCHEMA_ITEM_FLAGS(FL_PRESERVE_VALUE);
-        SCHEMA_ITEM("s6", TS_STRING, 0, 10);
-    SCHEMA_END();
+    SCHEMA_BEGIN(form)
+        SCHEMA_ITEM("i1", TS_INTEGER, 4, 4,
+            SCHEMA_FLAGS(FL_UNIQUE_KEY | FL_PRESERVE_VALUE))
+        SCHEMA_ITEM("c2", TS_SELECT, 1, 2,
+            SCHEMA_FLAGS(FL_PRESERVE_VALUE)
+            SCHEMA_SELECT(3, NULL, choices))
+        SCHEMA_ITEM("b3", TS_BOOLEAN, 1, 1)
+        SCHEMA_ITEM("s4", TS_STRING, 0, 10)
+        SCHEMA_ITEM("b5", TS_BOOLEAN, 1, 1,
+            SCHEMA_FLAGS(FL_PRESERVE_VALUE))
+        SCHEMA_ITEM("s6", TS_STRING, 0, 10)
+    SCHEMA_END(form, "MUVX")
+
+    schema_list_t *l = schema_list_new(&form);
 
     schema_item_t *i = l->list;
     assert(i != NULL, "Created schema_list_t successfully");
@@ -395,6 +406,141 @@ void test_selective_serialization() {
 }
 
 
+/** @name test_list_counts */
+
+
+u8 is_even(schema_list_t *l, schema_item_t *i) {
+
+    return (i->value.integer % 2 == 0);
+}
+
+
+void test_list_counts() {
+
+    puts("[>] test_list_counts");
+
+    SCHEMA_BEGIN(form)
+        SCHEMA_ITEM("i1", TS_INTEGER, 1, 4)
+        SCHEMA_ITEM("i2", TS_INTEGER, 1, 4,
+            SCHEMA_VALIDATE(is_even))
+        SCHEMA_ITEM("s3", TS_STRING, 1, 8)
+    SCHEMA_END(form, "MUVC")
+
+    schema_list_t *l = schema_list_new(&form);
+
+    assert(schema_list_count(l, FALSE) == 3, "Length copied from form");
+    assert(schema_list_count(l, TRUE) == 0, "Nothing valid yet");
+    assert(schema_list_is_empty(l), "New list is empty");
+
+    assert(schema_list_get(l, 2) == &l->list[2], "Indexed get works");
+    assert(schema_list_get(l, 3) == NULL, "Out-of-range get fails");
+
+    schema_item_set(&l->list[0], "12", 3);
+    schema_item_validate(l, &l->list[0]);
+    schema_item_validate(l, &l->list[0]);
+
+    assert(schema_list_count(l, TRUE) == 1, "Revalidation counted once");
+
+    schema_item_set(&l->list[1], "3", 2);
+    assert(!schema_item_validate(l, &l->list[1]), "Validation fails");
+    assert(schema_list_count(l, TRUE) == 1, "Invalid item not counted");
+
+    schema_item_set(&l->list[1], "4", 2);
+    schema_item_validate(l, &l->list[1]);
+
+    schema_item_set(&l->list[2], "abc", 4);
+    schema_item_validate(l, &l->list[2]);
+
+    assert(schema_list_is_complete(l), "List is complete");
+
+    schema_item_set(&l->list[1], "5", 2);
+    schema_item_validate(l, &l->list[1]);
+
+    assert(!schema_list_is_complete(l), "Failed revalidation counted");
+    assert(schema_list_count(l, TRUE) == 2, "Valid count decremented");
+
+    schema_list_clear_result(l);
+
+    assert(schema_list_is_empty(l), "Cleared list is empty");
+    assert(l->list[0].validity == 0, "Cleared item is not valid");
+
+    schema_list_delete(l);
+
+    puts("[<] test_list_counts");
+}
+
+
+/** @name test_schema_descriptors */
+
+
+u8 is_short(schema_list_t *l, schema_item_t *i) {
+
+    return schema_item_fail_validation(i, (u8 *) "too short");
+}
+
+SCHEMA_BEGIN(form_descriptors)
+    SCHEMA_ITEM("d1", TS_STRING, 1, 8,
+        SCHEMA_VALIDATE(is_short))
+    SCHEMA_ITEM("d2", TS_INTEGER, 2, 4,
+        SCHEMA_FLAGS(FL_UNIQUE_KEY | FL_NO_ECHO)
+        SCHEMA_DELIMITER('-'))
+    SCHEMA_ITEM("d3", TS_BOOLEAN, 1, 1)
+SCHEMA_END(form_descriptors, "MUVD")
+
+
+void test_schema_descriptors() {
+
+    puts("[>] test_schema_descriptors");
+
+    assert(form_descriptors.length == 3, "Form length computed");
+
+    assert(
+        sizeof(schema_item_t) < sizeof(schema_field_t),
+            "Value records are smaller than descriptors"
+    );
+
+    schema_list_t *l = schema_list_new(&form_descriptors);
+    schema_list_t *l2 = schema_list_new(&form_descriptors);
+
+    assert(l->length == 3, "List length set from form");
+    assert_string("MUVD", l->type_id, "Form identifier copied");
+
+    assert(
+        l->list[1].field == l2->list[1].field &&
+            l->list[1].field == &form_descriptors_fields[1],
+        "Lists share one descriptor table"
+    );
+
+    schema_item_t *i = &l->list[1];
+
+    assert(schema_field(i, data_type) == TS_INTEGER, "Type read");
+    assert(schema_field(i, min_length) == 2, "Minimum length read");
+    assert(schema_field(i, flags) & FL_NO_ECHO, "Flags combined");
+    assert(schema_item_delimiter(i) == '-', "Special delimiter read");
+    assert(schema_item_delimiter(&l->list[0]) == SMS_DELIMITER,
+           "Default delimiter used");
+
+    schema_item_set(&l->list[0], "abc", 4);
+    assert(!schema_item_validate(l, &l->list[0]), "Validator called");
+
+    schema_item_set(&l->list[1], "42", 3);
+    schema_item_validate(l, &l->list[1]);
+    schema_item_set(&l->list[2], "1", 2);
+    schema_item_validate(l, &l->list[2]);
+
+    u8 *sms = schema_list_serialize(l, FL_NONE);
+    assert_string("1!MUVD!#42-1", sms, "Serialized with delimiters");
+
+    assert(l2->list[1].validity == 0, "Values are per-list");
+
+    free(sms);
+    schema_list_delete(l2);
+    schema_list_delete(l);
+
+    puts("[<] test_schema_descriptors");
+}
+
+
 /** @name test_eeprom_pool */
 
 
@@ -455,6 +601,161 @@ void test_eeprom_pool() {
 }
 
 
+/** @name test_pool_wear */
+
+
+void test_pool_wear() {
+
+    puts("[>] test_pool_wear");
+
+    unsigned int i, n = (MUVUKU_WORD_BITS + 8);
+    void *x[MUVUKU_WORD_BITS + 8];
+
+    muvuku_pool_t *p = muvuku_pool_new(
+        &muvuku_eeprom_allocator, 4096, n, NULL
+    );
+
+    /* Span more than one bitmap word:
+        Every cell must be distinct, and numbered in order. */
+
+    for (i = 0; i < n; ++i) {
+        x[i] = muvuku_pool_acquire(p);
+        assert(x[i] != NULL, "Acquisition successful");
+        assert(muvuku_pool_cell(p, x[i]) == i + 1, "Cell number correct");
+    }
+
+    assert(muvuku_pool_acquire(p) == NULL, "Full pool refuses acquire");
+
+    muvuku_cellinfo_t info = muvuku_pool_cellinfo(p, 1);
+
+    assert(info & CL_OCCUPIED, "Cell is occupied");
+    assert(muvuku_cellinfo_generation(info) == 1, "Generation counted");
+    assert(muvuku_cellinfo_erases(info) == 0, "No erases yet");
+
+    /* Wear out the first cell:
+        Once released, a less-worn cell should be preferred. */
+
+    muvuku_pool_mark_erased(p, x[0]);
+    muvuku_pool_mark_erased(p, x[0]);
+
+    info = muvuku_pool_cellinfo(p, 1);
+    assert(muvuku_cellinfo_erases(info) == 2, "Erases counted");
+
+    muvuku_pool_release(p, x[0]);
+    muvuku_pool_release(p, x[2]);
+
+    info = muvuku_pool_cellinfo(p, 1);
+    assert(!(info & CL_OCCUPIED), "Released cell is free");
+    assert(muvuku_cellinfo_erases(info) == 2, "Release keeps counters");
+
+    void *y = muvuku_pool_acquire(p);
+    assert(y == x[2], "Least-worn free cell is chosen");
+
+    y = muvuku_pool_acquire(p);
+    assert(y == x[0], "Worn cell is used when nothing else is free");
+
+    info = muvuku_pool_cellinfo(p, 1);
+    assert(muvuku_cellinfo_generation(info) == 2, "Generation advanced");
+
+    /* Equal erase counts:
+        The cell acquired least often should win. */
+
+    muvuku_pool_release(p, x[3]);
+    muvuku_pool_release(p, x[2]);
+
+    y = muvuku_pool_acquire(p);
+    assert(y == x[3], "Least-acquired cell is chosen");
+
+    /* Starting a list over:
+        Only a list that held something costs an erase. */
+
+    muvuku_stringlist_t *l = muvuku_stringlist_init(p, x[0]);
+
+    info = muvuku_pool_cellinfo(p, 1);
+    assert(muvuku_cellinfo_erases(info) == 3, "Stale cell erased");
+
+    muvuku_stringlist_add(l, "abc", 4);
+    muvuku_stringlist_close(l);
+
+    muvuku_stringlist_close(muvuku_stringlist_init(p, x[0]));
+    muvuku_stringlist_close(muvuku_stringlist_init(p, x[0]));
+
+    info = muvuku_pool_cellinfo(p, 1);
+    assert(muvuku_cellinfo_erases(info) == 4, "Empty list left alone");
+
+    muvuku_pool_delete(p);
+
+    puts("[<] test_pool_wear");
+}
+
+
+/** @name test_eeprom_counter */
+
+
+void test_eeprom_counter() {
+
+    puts("[>] test_eeprom_counter");
+
+    unsigned int i;
+    unsigned int writes[MUVUKU_COUNTER_SLOTS];
+    muvuku_allocator_t *a = &muvuku_eeprom_allocator;
+
+    muvuku_counter_handle_t h = muvuku_counter_new(a);
+    assert(h != NULL, "Created counter successfully");
+
+    muvuku_counter_t *c = muvuku_counter_open(a, h);
+    assert(muvuku_counter_value(c) == 0, "New counter is zero");
+
+    memset(writes, '\0', sizeof(writes));
+
+    /* Rotate:
+        Several trips around the ring, reopening every time,
+        so that each value is recovered by scanning alone. */
+
+    for (i = 1; i <= 300; ++i) {
+
+        muvuku_counter_add(c, 1);
+        writes[c->current]++;
+        muvuku_counter_close(c);
+
+        c = muvuku_counter_open(a, h);
+
+        if (muvuku_counter_value(c) != i) {
+            break;
+        }
+    }
+
+    assert(i > 300, "Value recovered after every update");
+
+    for (i = 1; i < MUVUKU_COUNTER_SLOTS; ++i) {
+        if (writes[i] < writes[0] - 1 || writes[i] > writes[0] + 1) {
+            break;
+        }
+    }
+
+    assert(i == MUVUKU_COUNTER_SLOTS, "Writes are spread over every slot");
+
+    /* Interrupted update:
+        A value written without its tag must be ignored. */
+
+    u8 next = (c->current + 1) % MUVUKU_COUNTER_SLOTS;
+    h[next].value = 12345;
+
+    muvuku_counter_close(c);
+    c = muvuku_counter_open(a, h);
+
+    assert(muvuku_counter_value(c) == 300, "Torn update is ignored");
+
+    assert(muvuku_counter_add(c, 0) == 300, "Adding zero is harmless");
+    assert(muvuku_counter_add(c, 5) == 305, "Addition works");
+
+    muvuku_counter_close(c);
+    muvuku_counter_delete(a, h);
+
+    puts("[<] test_eeprom_counter");
+}
+
+
 /** @name test_stringlist_pool */
 
 
@@ -487,13 +788,13 @@ int verify_string(muvuku_stringlist_t *l,
 }
 
 
-void test_stringlist_pool(muvuku_allocator_t *a, void *options) {
+void test_stringlist_pool(muvuku_allocator_t *a,
+                          size_t size, void *options) {
 
     puts("[>] test_stringlist_pool");
 
-    muvuku_pool_t *p = muvuku_pool_new(
-        a, sizeof(reserved), 16, options
-    );
+    muvuku_pool_t *p = muvuku_pool_new(a, size, 16, options);
+    assert(p != NULL, "Created pool successfully");
 
     muvuku_stringlist_t *l1 =
         muvuku_stringlist_init(p, muvuku_pool_acquire(p));
@@ -536,181 +837,3204 @@ void test_stringlist_pool(muvuku_allocator_t *a, void *options) {
 }
 
 
-/** @name test_settings_storage */
+/** @name test_tiered_stringlist */
 
-void test_settings_storage_map() {
 
-    puts("[>] test_settings_storage_map");
-    memset(&reserved, '\0', sizeof(reserved));
+typedef struct retain_state {
 
-    SCHEMA_BEGIN(l1, "MUV1", 10);
-        SCHEMA_ITEM("i", TS_INTEGER, 4, 4);
-    SCHEMA_END();
+    int index;
+    int skip;
+    int every;
 
-    SCHEMA_BEGIN(l2, "MUV2", 10);
-        SCHEMA_ITEM("i", TS_INTEGER, 4, 4);
-    SCHEMA_END();
+} retain_state_t;
 
-    SCHEMA_BEGIN(l3, "MUV3", 10);
-        SCHEMA_ITEM("i", TS_INTEGER, 4, 4);
-    SCHEMA_END();
 
-    SCHEMA_BEGIN(l4, "MUV4", 10);
-        SCHEMA_ITEM("i", TS_INTEGER, 4, 4);
-    SCHEMA_END();
+/* Discard the first `skip` strings, and then every `every`th one */
+int retain_string(muvuku_stringlist_t *l,
+                  char *str, size_t len, void *retain_state) {
 
-    SCHEMA_BEGIN(l5, "MUV5", 10);
-        SCHEMA_ITEM("i", TS_INTEGER, 4, 4);
-    SCHEMA_END();
+    retain_state_t *rs = (retain_state_t *) retain_state;
+    int index = rs->index++;
 
-    muvuku_settings_t s;
-    memset(&s, '\0', sizeof(s));
+    if (index < rs->skip) {
+        return FALSE;
+    }
 
-    muvuku_pool_t *p = muvuku_pool_new(
-        &muvuku_flash_allocator, sizeof(reserved), 10, &reserved
-    );
+    return (rs->every == 0 || (index - rs->skip) % rs->every != 0);
+}
 
-    muvuku_cell_t c1 = muvuku_storage_retrieve(&s, p, l1);
-    muvuku_cell_t c2 = muvuku_storage_retrieve(&s, p, l2);
-    muvuku_cell_t c3 = muvuku_storage_retrieve(&s, p, l3);
 
-    muvuku_cell_t cc1 = muvuku_storage_retrieve(&s, p, l1);
-    muvuku_cell_t cc2 = muvuku_storage_retrieve(&s, p, l2);
-    muvuku_cell_t cc3 = muvuku_storage_retrieve(&s, p, l3);
 
-    assert(c1 != INVALID_CELL, "Valid cell returned from write path");
-    assert(c2 != INVALID_CELL, "Valid cell returned from write path");
-    assert(c3 != INVALID_CELL, "Valid cell returned from write path");
+void test_tiered_stringlist() {
 
-    assert(c1 == cc1, "Proper cell returned from read path");
-    assert(c2 == cc2, "Proper cell returned from read path");
-    assert(c3 == cc3, "Proper cell returned from read path");
+    puts("[>] test_tiered_stringlist");
+    memset(&reserved, '\0', sizeof(reserved));
 
-    assert(muvuku_pool_address(p, c1) != NULL, "Valid cell address");
-    assert(muvuku_pool_address(p, c2) != NULL, "Valid cell address");
-    assert(muvuku_pool_address(p, c3) != NULL, "Valid cell address");
-}
+    int i, n = 0;
+    char *test[3] = { "1!MUVX!1#2#3", "1!MUVX!4#5#6", "1!MUVX!7#8#9" };
 
+    muvuku_flash_region_t *r =
+        muvuku_flash_region_init(&reserved, sizeof(reserved));
 
-extern void _prototype_progmem_write(void *dst, void *src);
+    /* Small primary tier:
+        One page, so that it fills after a handful of strings. */
 
+    muvuku_pool_t *p = muvuku_pool_new_aligned(
+        &muvuku_flash_allocator, MUVUKU_PAGE_SIZE * 2, 1, r
+    );
 
-/** @name test_prototype_progmem_write */
+    muvuku_pool_t *o = muvuku_pool_new(
+        &muvuku_eeprom_allocator, 512, 2, NULL
+    );
 
-void test_prototype_progmem_write() {
+    assert(p != NULL && o != NULL, "Created pools successfully");
 
-    puts("[>] test_progmem_write");
-    memset(&reserved, '\0', sizeof(reserved));
+    muvuku_tieredlist_t *t = muvuku_tieredlist_open(
+        muvuku_stringlist_init(p, muvuku_pool_acquire(p)),
+            muvuku_stringlist_init(o, muvuku_pool_acquire(o))
+    );
 
-    unsigned int i = 0;
-    unsigned char buf[MUVUKU_PAGE_SIZE] = { 0 };
-    unsigned char *p = muvuku_align_page(&reserved, unsigned char, TRUE);
+    assert(t != NULL, "Opened tiered list");
 
-    for (i = 0; i < MUVUKU_PAGE_SIZE; ++i) {
-        buf[i] = (i % 256);
+    /* Fill the primary tier */
+    while (muvuku_stringlist_add(t->primary, test[n % 2], strlen(test[0]))) {
+        n++;
     }
-    
-    _prototype_progmem_write(p, buf);
-    
-    for (i = 0; i < MUVUKU_PAGE_SIZE; ++i) {
-        assert(p[i] == (i % 256), "Value matches expected");
+
+    assert(n > 0, "Primary tier accepted strings");
+    assert(muvuku_stringlist_size(t->overflow) == 0, "Overflow is empty");
+
+    /* Spill over:
+        These must land in EEPROM, and come back out in order. */
+
+    assert(
+        muvuku_tieredlist_add(t, test[n % 2], strlen(test[0])),
+            "Addition spills in to overflow tier"
+    );
+
+    assert(
+        muvuku_tieredlist_add(t, test[2], strlen(test[2])),
+            "Addition continues in overflow tier"
+    );
+
+    assert(
+        muvuku_stringlist_size(t->overflow) ==
+            2 * (strlen(test[0]) + sizeof(muvuku_string_t)),
+        "Overflow tier holds both strings"
+    );
+
+    char *expect[64];
+
+    for (i = 0; i <= n; ++i) {
+        expect[i] = test[i % 2];
     }
 
-    puts("[<] test_progmem_write");
-}
+    expect[n + 1] = test[2];
 
+    verify_state_t verify_state = { 0, n + 2, expect };
+    muvuku_tieredlist_each(t, &verify_string, &verify_state);
 
-/** @name test_prototype_flash_zero */
+    assert(verify_state.index == n + 2, "Both tiers visited in order");
 
-void test_prototype_flash_zero() {
+    assert(
+        muvuku_tieredlist_size(t) <= muvuku_tieredlist_capacity(t),
+            "Size is within capacity"
+    );
 
-    puts("[>] test_prototype_flash_zero");
-    memset(&reserved, '\0', sizeof(reserved));
+    assert(muvuku_tieredlist_count(t) == n + 2, "Both tiers counted");
 
-    unsigned int i = 0;
-    unsigned int len = (MUVUKU_PAGE_SIZE * 8);
-    unsigned char *buf = muvuku_align_page(&reserved, unsigned char, TRUE);
+    /* Retention:
+        Discard a prefix, which empties most of a page; then every
+        second string, which moves strings in both tiers. */
 
-    memset(buf, 0, len);
+    size_t size = muvuku_tieredlist_size(t);
+    retain_state_t retain_state = { 0, 3, 0 };
 
-    for (i = 0; i < len; ++i) {
-        buf[i] = (i % 256);
-    }
+    assert(
+        muvuku_tieredlist_retain(t, &retain_string, &retain_state) == 3,
+            "Prefix discarded"
+    );
 
-    /* Zero between 10 and 501, inclusive */
-    int l1 = 10, s1 = (MUVUKU_PAGE_SIZE * 2) - 20;
-    muvuku_flash_zero(&buf[l1], s1);
- 
-    /* Zero between 1025 and 1535, inclusive */
-    int l2 = (MUVUKU_PAGE_SIZE * 4) + 1, s2 = (MUVUKU_PAGE_SIZE * 2) - 1;
-    muvuku_flash_zero(&buf[l2], s2);
+    assert(muvuku_tieredlist_count(t) == n - 1, "Prefix no longer counted");
 
-    for (i = 0; i < len; ++i) {
-        if ((i >= l1 && i < l1 + s1) || (i >= l2 && i < l2 + s2)) {
-            assert(buf[i] == 0, "Value is zero");
-        } else {
-            assert(buf[i] == (i % 256), "Value matches expected");
+    assert(
+        muvuku_tieredlist_size(t) ==
+            size - 3 * (strlen(test[0]) + sizeof(muvuku_string_t)),
+        "Prefix space reclaimed"
+    );
+
+    verify_state_t retained = { 0, n - 1, expect + 3 };
+    muvuku_tieredlist_each(t, &verify_string, &retained);
+
+    assert(retained.index == n - 1, "Remaining strings in order");
+
+    int kept = 0;
+
+    for (i = 0; i < n - 1; ++i) {
+        if (i % 2 != 0) {
+            expect[kept++] = expect[i + 3];
         }
     }
 
-    puts("[<] test_prototype_flash_zero");
-}
-
+    retain_state_t alternate = { 0, 0, 2 };
+    muvuku_tieredlist_retain(t, &retain_string, &alternate);
 
+    assert(muvuku_tieredlist_count(t) == kept, "Every second string gone");
 
-/** @name test_flash_pool */
+    verify_state_t alternated = { 0, kept, expect };
+    muvuku_tieredlist_each(t, &verify_string, &alternated);
 
-void test_flash_pool() {
+    assert(alternated.index == kept, "Survivors still in order");
 
-    puts("[>] test_flash_pool");
-    memset(&reserved, '\0', sizeof(reserved));
+    retain_state_t none = { 0, 0, 0 };
 
-    unsigned int i = 0;
-    unsigned char buf[MUVUKU_PAGE_SIZE] = { 0 };
-    unsigned char *p = muvuku_align_page(&reserved, unsigned char, TRUE);
+    assert(
+        muvuku_tieredlist_retain(t, &retain_string, &none) == 0 &&
+            muvuku_tieredlist_count(t) == kept,
+        "Keeping everything changes nothing"
+    );
 
-    muvuku_pool_t *pool = muvuku_pool_new(
-        &muvuku_flash_allocator, sizeof(reserved) - MUVUKU_PAGE_SIZE, 16, p
+    assert(
+        muvuku_tieredlist_add(t, test[2], strlen(test[2])),
+            "Addition after retention"
     );
 
-    puts("[<] test_flash_pool");
-}
+    expect[kept] = test[2];
 
+    verify_state_t appended = { 0, kept + 1, expect };
+    muvuku_tieredlist_each(t, &verify_string, &appended);
 
-/** @name test_align_page*/
+    assert(appended.index == kept + 1, "Addition comes last");
 
-void test_align_page() {
+    /* Clear both tiers */
+    muvuku_tieredlist_init(t);
+    assert(muvuku_tieredlist_size(t) == 0, "Both tiers cleared");
 
-    puts("[>] test_align_page");
+    assert(
+        muvuku_tieredlist_add(t, test[0], strlen(test[0])) &&
+            muvuku_stringlist_size(t->overflow) == 0,
+        "Cleared list adds to primary tier"
+    );
 
-    void *p1 = NULL;
-    void *p2 = muvuku_align_page(p1, void, TRUE);
-    assert(p1 == p2, "Aligned pointer left unchanged");
+    muvuku_tieredlist_close(t);
+    muvuku_pool_delete(o);
+    muvuku_pool_delete(p);
 
-    puts("[<] test_align_page");
+    puts("[<] test_tiered_stringlist");
 }
 
-/** @name main */
 
-int main(int argc, char *argv[]) {
+/** @name test_streaming_serialization */
 
-    muvuku_subsystem_init_pool();
 
-    test_align_page();
-    test_prototype_progmem_write();
-    test_prototype_flash_zero();
+typedef struct chunk_state {
 
-    test_simple_serialization();
-    test_selective_serialization();
-    test_date_serialization();
+    char output[MAX_SMS_LENGTH + 1];
+    size_t len;
+    int calls;
+    int fail_after;
+    size_t largest;
 
-    test_eeprom_pool();
-    test_stringlist_pool(&muvuku_eeprom_allocator, NULL);
+} chunk_state_t;
 
+
+int collect_chunk(void *ctx, const char *data, size_t len) {
+
+    chunk_state_t *cs = (chunk_state_t *) ctx;
+
+    if (cs->fail_after >= 0 && cs->calls >= cs->fail_after) {
+        return FALSE;
+    }
+
+    memcpy(cs->output + cs->len, data, len);
+
+    cs->len += len;
+    cs->output[cs->len] = '\0';
+    cs->largest = (len > cs->largest ? len : cs->largest);
+    cs->calls++;
+
+    return TRUE;
+}
+
+
+void test_streaming_serialization() {
+
+    puts("[>] test_streaming_serialization");
+
+    SCHEMA_BEGIN(form)
+        SCHEMA_ITEM("s1", TS_STRING, 1, 32)
+        SCHEMA_ITEM("i2", TS_INTEGER, 1, 4,
+            SCHEMA_DELIMITER('-'))
+        SCHEMA_ITEM("b3", TS_BOOLEAN, 1, 1)
+        SCHEMA_ITEM("p4", TS_PHONE, 4, 20)
+        SCHEMA_ITEM("s5", TS_STRING, 0, 32)
+    SCHEMA_END(form, "MUVS")
+
+    schema_list_t *l = schema_list_new(&form);
+
+    char *fields[] = {
+        "A long string, with #, and \\", "-12", "1", "+15551234567", "x-y"
+    };
+
+    for (int n = 0; n < 5; n++) {
+        schema_item_set(&l->list[n], fields[n], strlen(fields[n]) + 1);
+        schema_item_validate(l, &l->list[n]);
+    }
+
+    char *expect =
+        "1!MUVS!A long string, with \\#, and \\\\#\\-12-1#+15551234567#x-y";
+
+    chunk_state_t cs;
+    memset(&cs, '\0', sizeof(cs));
+    cs.fail_after = -1;
+
+    size_t rv = schema_list_serialize_to(l, &collect_chunk, &cs);
+
+    assert_string(expect, cs.output, "Streamed output is correct");
+    assert(rv == strlen(expect), "Streamed length returned");
+    assert(cs.calls > 1, "Output arrived in pieces");
+    assert(cs.largest <= SCHEMA_SERIALIZE_CHUNK, "Pieces are bounded");
+
+    size_t counted = 0;
+    schema_list_serialize_to(l, &schema_sink_count, &counted);
+    assert(counted == strlen(expect), "Counting sink agrees");
+
+    char *s = schema_list_serialize(l, FL_NONE);
+    assert_string(expect, s, "Allocating wrapper agrees");
+    free(s);
+
+    char small[16];
+    schema_buffer_t b;
+    schema_buffer_init(&b, small, sizeof(small));
+
+    assert(
+        schema_list_serialize_to(l, &schema_sink_buffer, &b) == 0,
+            "Short buffer is reported"
+    );
+
+    memset(&cs, '\0', sizeof(cs));
+    cs.fail_after = 1;
+
+    assert(
+        schema_list_serialize_to(l, &collect_chunk, &cs) == 0,
+            "Sink failure is reported"
+    );
+
+    /* Straight in to a stringlist */
+    muvuku_pool_t *p = muvuku_pool_new(
+        &muvuku_eeprom_allocator, 512, 4, NULL
+    );
+
+    muvuku_stringlist_t *sl =
+        muvuku_stringlist_init(p, muvuku_pool_acquire(p));
+
+    muvuku_stringlist_writer_t w;
+
+    assert(muvuku_stringlist_begin(sl, &w, counted), "Space reserved");
+    assert(muvuku_stringlist_size(sl) == 0, "Nothing visible yet");
+
+    assert(
+        schema_list_serialize_to(l, &muvuku_stringlist_write, &w),
+            "Streamed in to stringlist"
+    );
+
+    assert(!muvuku_stringlist_write(&w, "!", 1), "Overrun is refused");
+    assert(muvuku_stringlist_end(&w), "String committed");
+
+    assert(
+        muvuku_stringlist_begin(sl, &w, 4) &&
+            muvuku_stringlist_write(&w, "abc", 3) &&
+                !muvuku_stringlist_end(&w),
+        "Short string is not committed"
+    );
+
+    char *expected[] = { expect };
+    verify_state_t verify_state = { 0, 1, expected };
+
+    muvuku_stringlist_each(sl, &verify_string, &verify_state);
+    assert(verify_state.index == 1, "Exactly one string stored");
+
+    muvuku_stringlist_close(sl);
+    muvuku_pool_delete(p);
+
+    /* In to flash:
+        Saved as `muvuku_action_save` does, in small pieces; still,
+        each page the record touches is programmed just once, and
+        the list header once more. */
+
+    unsigned int k, crossed = 0;
+    memset(&reserved, '\0', sizeof(reserved));
+
+    muvuku_flash_region_t *r =
+        muvuku_flash_region_init(&reserved, sizeof(reserved));
+
+    p = muvuku_pool_new_aligned(
+        &muvuku_flash_allocator, MUVUKU_PAGE_SIZE * 4, 1, r
+    );
+
+    sl = muvuku_stringlist_init(p, muvuku_pool_acquire(p));
+
+    for (k = 0; k < 5; ++k) {
+
+        size_t n = 4 + counted + 1;
+        char *start = (char *) sl->list->strings + muvuku_stringlist_size(sl);
+        char *end = start + sizeof(muvuku_string_t) + n - 1;
+
+        unsigned int pages = 1 + (
+            muvuku_align_page(end, char, FALSE) !=
+                muvuku_align_page(start, char, FALSE)
+        );
+
+        unsigned long writes = muvuku_prototype_page_writes;
+
+        assert(
+            muvuku_stringlist_begin(sl, &w, n) &&
+                muvuku_stringlist_write(&w, "6!1!", 4) &&
+                schema_list_serialize_to(l, &muvuku_stringlist_write, &w) &&
+                muvuku_stringlist_write(&w, "", 1) &&
+                muvuku_stringlist_end(&w),
+            "Record saved to flash"
+        );
+
+        assert(
+            muvuku_prototype_page_writes - writes == pages + 1,
+                "Each page programmed once per save"
+        );
+
+        crossed += (pages > 1);
+    }
+
+    assert(crossed == 1, "One record spans two pages");
+
+    char saved[128];
+    sprintf(saved, "6!1!%s", expect);
+
+    char *saved_all[] = { saved, saved, saved, saved, saved };
+    verify_state_t saved_state = { 0, 5, saved_all };
+
+    muvuku_stringlist_each(sl, &verify_string, &saved_state);
+    assert(saved_state.index == 5, "Every record kept intact");
+
+    muvuku_stringlist_close(sl);
+    muvuku_pool_delete(p);
+
+    schema_list_delete(l);
+
+    puts("[<] test_streaming_serialization");
+}
+
+
+/** @name test_batch_serialization */
+
+
+typedef struct batch_state {
+
+    schema_list_t *list;
+    int count;
+    int accepted;
+    int total;
+
+} batch_state_t;
+
+
+u8 unserialize_record(const char *record, size_t len, void *ctx) {
+
+    batch_state_t *bs = (batch_state_t *) ctx;
+
+    schema_list_clear_result(bs->list);
+
+    if (schema_list_unserialize(bs->list, NULL, record, len, FL_NONE)) {
+        bs->accepted++;
+        bs->total += bs->list->list[0].value.integer;
+    }
+
+    bs->count++;
+    return TRUE;
+}
+
+
+void test_batch_serialization() {
+
+    puts("[>] test_batch_serialization");
+
+    SCHEMA_BEGIN(form)
+        SCHEMA_ITEM("i1", TS_INTEGER, 1, 4)
+        SCHEMA_ITEM("s2", TS_STRING, 0, 32)
+    SCHEMA_END(form, "MUVB")
+
+    schema_list_t *l = schema_list_new(&form);
+
+    /* Escaping, now that it works */
+    char *escaped = "1!MUVB!7#a\\#b\\\nc";
+
+    assert(
+        schema_list_unserialize(l, NULL, escaped, strlen(escaped), FL_NONE),
+            "Escaped record accepted"
+    );
+
+    assert(l->list[0].value.integer == 7, "Escaped record field #1");
+    assert_string("a#b\nc", l->list[1].value.string, "Escaped field #2");
+
+    /* Record delimiter is escaped on the way out */
+    char *s = schema_list_serialize(l, FL_NONE);
+    assert_string(escaped, s, "Record delimiter escaped");
+
+    schema_batch_t b;
+    schema_batch_init(&b);
+
+    assert(schema_batch_add(&b, s, strlen(s)), "Escaped record batched");
+    assert_string(s, schema_batch_message(&b), "Batch of one is plain");
+
+    char *record = "1!MUVB!12#abcdefghijklmnopqrstu";
+    size_t record_len = strlen(record);
+
+    int n = 1;
+
+    while (schema_batch_add(&b, record, record_len)) {
+        n++;
+    }
+
+    assert(n == 5, "Batch holds as many records as fit");
+    assert(b.count == n, "Batch count is correct");
+    assert(strlen(schema_batch_message(&b)) <= MAX_SMS_LENGTH, "Batch fits");
+    assert(strncmp(schema_batch_message(&b), "2!1!MUVB!7#", 11) == 0,
+           "Batch header present");
+
+    batch_state_t bs = { l, 0, 0, 0 };
+
+    const char *message = schema_batch_message(&b);
+    schema_batch_split(message, strlen(message), &unserialize_record, &bs);
+
+    assert(bs.count == n, "Every record split out");
+    assert(bs.accepted == n, "Every record unserialized");
+    assert(bs.total == 7 + 12 * (n - 1), "Every record read");
+
+    /* Unbatched messages pass through */
+    memset(&bs, '\0', sizeof(bs));
+    bs.list = l;
+
+    schema_batch_split(record, record_len, &unserialize_record, &bs);
+    assert(bs.count == 1 && bs.accepted == 1, "Plain record passed through");
+
+    /* Saved before escaping existed */
+    schema_batch_init(&b);
+
+    char *unsafe = "1!MUVB!1#a\nb";
+    assert(!schema_batch_add(&b, unsafe, strlen(unsafe)), "Unsafe refused");
+    assert(b.count == 0, "Refused record not added");
+
+    free(s);
+    schema_list_delete(l);
+
+    puts("[<] test_batch_serialization");
+}
+
+
+/** @name test_compact_serialization */
+
+#ifdef _SCHEMA_ENABLE_COMPACT
+
+void test_compact_serialization() {
+
+    puts("[>] test_compact_serialization");
+
+    char *choices[] = { "A", "B", "C", "D", "E" };
+
+    SCHEMA_BEGIN(form)
+        SCHEMA_ITEM("b1", TS_BOOLEAN, 1, 1)
+        SCHEMA_ITEM("c2", TS_SELECT, 1, 1,
+            SCHEMA_SELECT(5, NULL, choices))
+        SCHEMA_ITEM("i3", TS_INTEGER, 4, 4)
+        SCHEMA_ITEM("p4", TS_PHONE, 4, 20)
+        SCHEMA_ITEM("s5", TS_STRING, 0, 32)
+        SCHEMA_ITEM("i6", TS_INTEGER, 1, 2)
+        SCHEMA_ITEM("d7", TS_STRING, 0, 8,
+            SCHEMA_FLAGS(FL_INPUT_DIGITS_ONLY))
+    SCHEMA_END(form, "MUVC")
+
+    schema_list_t *l = schema_list_new(&form);
+    schema_list_t *l2 = schema_list_new(&form);
+
+    char *fields[] = {
+        "1", "4", "2013", "+15551234567", "Hello, world", NULL, "0042"
+    };
+
+    for (int n = 0; n < 7; n++) {
+        if (fields[n]) {
+            schema_item_set(&l->list[n], fields[n], strlen(fields[n]) + 1);
+            schema_item_validate(l, &l->list[n]);
+        }
+    }
+
+    /* Skipped by a condition */
+    l->list[5].validity = VL_IS_VALID | VL_IS_NULL;
+    l->valid_count++;
+
+    char text[MAX_SMS_LENGTH + 1];
+    char compact[MAX_SMS_LENGTH + 1];
+
+    schema_buffer_t b;
+
+    schema_buffer_init(&b, text, sizeof(text));
+    schema_list_serialize_to(l, &schema_sink_buffer, &b);
+
+    schema_buffer_init(&b, compact, sizeof(compact));
+    size_t len = schema_list_serialize_compact_to(l, &schema_sink_buffer, &b);
+
+    assert(len == strlen(compact), "Compact length returned");
+    assert(strncmp(compact, "3!MUVC!", 7) == 0, "Compact header present");
+    assert(len < strlen(text), "Compact record is shorter");
+    assert(strcspn(compact, "#\\\n-") == len, "Nothing needs escaping");
+
+    schema_info_t o;
+    schema_info_init(&o);
+
+    assert(
+        schema_list_unserialize(l2, &o, compact, len, FL_NONE),
+            "Compact record decoded"
+    );
+
+    assert(o.api_version == SMS_COMPACT_API_VERSION, "Version reported");
+    assert_string("MUVC", o.form_identifier, "Form code reported");
+    assert(o.field_count == 7, "Field count reported");
+    assert(schema_list_is_complete(l2), "Every field valid");
+    assert(l2->list[5].validity & VL_IS_NULL, "Skipped field is null");
+
+    char again[MAX_SMS_LENGTH + 1];
+    schema_buffer_init(&b, again, sizeof(again));
+    schema_list_serialize_to(l2, &schema_sink_buffer, &b);
+
+    assert_string(text, again, "Decoded record matches original");
+
+    free(o.form_identifier);
+
+    /* Malformed input */
+    schema_list_clear_result(l2);
+
+    assert(
+        !schema_list_unserialize_compact(l2, NULL, compact, len - 2),
+            "Truncated record rejected"
+    );
+
+    compact[9] = '#';
+
+    assert(
+        !schema_list_unserialize_compact(l2, NULL, compact, len),
+            "Invalid character rejected"
+    );
+
+    /* Values outside the field's range */
+    schema_item_set(&l->list[2], "20000", 6);
+
+    assert(
+        schema_list_serialize_compact_to(l, &schema_sink_count, &len) == 0,
+            "Out-of-range value is not encoded"
+    );
+
+    schema_item_set(&l->list[2], "2013", 5);
+    schema_item_set(&l->list[6], "12a", 4);
+
+    assert(
+        schema_list_serialize_compact_to(l, &schema_sink_count, &len) == 0,
+            "Non-digit is not encoded"
+    );
+
+    schema_list_delete(l2);
+    schema_list_delete(l);
+
+    puts("[<] test_compact_serialization");
+}
+
+#endif /* _SCHEMA_ENABLE_COMPACT */
+
+
+/** @name test_delta_serialization */
+
+#ifdef _SCHEMA_ENABLE_DELTA
+
+void test_delta_serialization() {
+
+    puts("[>] test_delta_serialization");
+
+    SCHEMA_BEGIN(form)
+        SCHEMA_ITEM("i1", TS_INTEGER, 0, 4)
+        SCHEMA_ITEM("s2", TS_STRING, 0, 32)
+        SCHEMA_ITEM("b3", TS_BOOLEAN, 1, 1)
+        SCHEMA_ITEM("i4", TS_INTEGER, 0, 4,
+            SCHEMA_DELIMITER('-'))
+        SCHEMA_ITEM("s5", TS_STRING, 0, 32)
+    SCHEMA_END(form, "MUVE")
+
+    schema_list_t *l = schema_list_new(&form);
+    schema_list_t *l2 = schema_list_new(&form);
+
+    char *fields[] = { "17", "Kisumu district", "1", "-12", "no change" };
+
+    for (int n = 0; n < 5; n++) {
+        schema_item_set(&l->list[n], fields[n], strlen(fields[n]) + 1);
+        schema_item_validate(l, &l->list[n]);
+    }
+
+    schema_buffer_t b;
+    char base[MAX_SMS_LENGTH + 1];
+    char text[MAX_SMS_LENGTH + 1];
+    char delta[MAX_SMS_LENGTH + 1];
+
+    schema_buffer_init(&b, base, sizeof(base));
+    size_t base_len = schema_list_serialize_to(l, &schema_sink_buffer, &b);
+
+    assert_string(
+        "1!MUVE!17#Kisumu district#1#\\-12-no change", base, "Base record"
+    );
+
+    /* Complete record:
+        The text record's fields, after a base of zero. */
+
+    schema_buffer_init(&b, delta, sizeof(delta));
+    schema_list_serialize_delta_to(l, 40, NULL, 0, 0, &schema_sink_buffer, &b);
+
+    assert_string(
+        "4!MUVE!40!0!17#Kisumu district#1#\\-12-no change", delta,
+            "Complete record has no base"
+    );
+
+    schema_info_t o;
+    schema_info_init(&o);
+
+    assert(
+        schema_list_unserialize(l2, &o, delta, strlen(delta), FL_NONE),
+            "Complete record decoded without a base"
+    );
+
+    assert(o.api_version == SMS_DELTA_API_VERSION, "Version reported");
+    assert(o.sequence == 40 && o.base_sequence == 0, "Sequence reported");
+    assert_string("MUVE", o.form_identifier, "Form code reported");
+
+    free(o.form_identifier);
+
+    /* Changes only */
+    schema_item_set(&l->list[1], "Kisumu#2", 9);
+    schema_item_set(&l->list[2], "0", 2);
+
+    schema_buffer_init(&b, delta, sizeof(delta));
+
+    size_t len = schema_list_serialize_delta_to(
+        l, 42, base, base_len, 40, &schema_sink_buffer, &b
+    );
+
+    assert(len == strlen(delta), "Delta length returned");
+    assert_string("4!MUVE!42!40!60!Kisumu\\#2#0", delta, "Delta record");
+
+    uint32_t sequence = 0, base_sequence = 0;
+
+    assert(
+        schema_delta_info(delta, len, &sequence, &base_sequence) &&
+            sequence == 42 && base_sequence == 40,
+        "Sequence numbers found without decoding"
+    );
+
+    schema_list_clear_result(l2);
+    schema_info_init(&o);
+
+    assert(
+        schema_list_unserialize_delta(l2, &o, delta, len, base, base_len),
+            "Delta decoded against its base"
+    );
+
+    assert(o.sequence == 42 && o.base_sequence == 40, "Sequence reported");
+    assert(schema_list_is_complete(l2), "Every field valid");
+
+    free(o.form_identifier);
+
+    schema_buffer_init(&b, text, sizeof(text));
+    schema_list_serialize_to(l, &schema_sink_buffer, &b);
+
+    char again[MAX_SMS_LENGTH + 1];
+    schema_buffer_init(&b, again, sizeof(again));
+    schema_list_serialize_to(l2, &schema_sink_buffer, &b);
+
+    assert_string(text, again, "Decoded delta matches original");
+
+    /* A delta can't be read without its base */
+    schema_list_clear_result(l2);
+
+    assert(
+        !schema_list_unserialize(l2, NULL, delta, len, FL_NONE),
+            "Delta without base rejected"
+    );
+
+    assert(
+        !schema_list_unserialize_delta(l2, NULL, delta, 14, base, base_len),
+            "Truncated bitmap rejected"
+    );
+
+    /* Nothing changed */
+    schema_buffer_init(&b, delta, sizeof(delta));
+
+    len = schema_list_serialize_delta_to(
+        l, 43, text, strlen(text), 42, &schema_sink_buffer, &b
+    );
+
+    assert_string("4!MUVE!43!42!00!", delta, "Empty delta");
+
+    assert(
+        schema_list_unserialize_delta(l2, NULL, delta, len,
+                                      text, strlen(text)),
+            "Empty delta decoded"
+    );
+
+    /* Last field cleared */
+    l->list[4].validity = VL_IS_VALID | VL_IS_NULL;
+
+    schema_buffer_init(&b, delta, sizeof(delta));
+
+    len = schema_list_serialize_delta_to(
+        l, 44, text, strlen(text), 42, &schema_sink_buffer, &b
+    );
+
+    assert_string("4!MUVE!44!42!08!", delta, "Cleared field sent empty");
+
+    assert(
+        schema_list_unserialize_delta(l2, NULL, delta, len,
+                                      text, strlen(text)),
+            "Cleared field decoded"
+    );
+
+    assert(l2->list[4].string_value == NULL ||
+           l2->list[4].string_value[0] == '\0', "Cleared field is empty");
+
+    /* Base from another form */
+    assert(
+        schema_list_serialize_delta_to(l, 45, "1!MUVX!1#2#3#4-5", 16, 42,
+                                       &schema_sink_count, &len) == 0,
+            "Foreign base refused"
+    );
+
+    schema_list_delete(l2);
+    schema_list_delete(l);
+
+    puts("[<] test_delta_serialization");
+}
+
+#endif /* _SCHEMA_ENABLE_DELTA */
+
+
+/** @name test_multipart_serialization */
+
+typedef struct multipart_state {
+
+    schema_list_t *list;
+    unsigned int count;
+    unsigned int accepted;
+    size_t len;
+
+} multipart_state_t;
+
+
+u8 collect_multipart(const char *record, size_t len, void *ctx) {
+
+    multipart_state_t *state = (multipart_state_t *) ctx;
+
+    state->count++;
+    state->len = len;
+
+    if (schema_list_unserialize(state->list, NULL, record, len, FL_NONE)) {
+        state->accepted++;
+    }
+
+    return TRUE;
+}
+
+
+void test_multipart_serialization() {
+
+    puts("[>] test_multipart_serialization");
+
+    SCHEMA_BEGIN(form)
+        SCHEMA_ITEM("s1", TS_STRING, 0, 64)
+        SCHEMA_ITEM("s2", TS_STRING, 0, 64)
+        SCHEMA_ITEM("s3", TS_STRING, 0, 64)
+        SCHEMA_ITEM("s4", TS_STRING, 0, 64)
+        SCHEMA_ITEM("i5", TS_INTEGER, 0, 4)
+    SCHEMA_END(form, "MUVL")
+
+    schema_list_t *l = schema_list_new(&form);
+    schema_list_t *l2 = schema_list_new(&form);
+
+    char value[61];
+
+    for (int n = 0; n < 4; n++) {
+        memset(value, 'a' + n, 60);
+        value[60] = '\0';
+        schema_item_set(&l->list[n], value, sizeof(value));
+        schema_item_validate(l, &l->list[n]);
+    }
+
+    schema_item_set(&l->list[4], "1234", 5);
+    schema_item_validate(l, &l->list[4]);
+
+    /* Longer than one message, but not cut short */
+    u8 *record = schema_list_serialize(l, FL_NONE);
+    size_t len = strlen(record);
+
+    assert(len == 7 + (4 * 61) + 4, "Long record serialized whole");
+    assert(len > MAX_SMS_LENGTH, "Long record needs several messages");
+
+    schema_multipart_t m;
+    char parts[4][MAX_SMS_LENGTH + 1];
+    const char *sms;
+    unsigned int n = 0;
+
+    assert(schema_multipart_init(&m, record, len, 17), "Multipart started");
+
+    while ((sms = schema_multipart_next(&m)) != NULL && n < 4) {
+        assert(strlen(sms) <= MAX_SMS_LENGTH, "Part fits in one message");
+        strcpy(parts[n++], sms);
+    }
+
+    assert(n == 2 && m.total == 2, "Record split in to two parts");
+    assert(strncmp(parts[0], "5!17!1!2!1!MUVL!", 16) == 0, "First header");
+    assert(strncmp(parts[1], "5!17!2!2!", 9) == 0, "Second header");
+
+    /* Reassembly:
+        Parts arrive out of order, some twice, interleaved with
+        parts of another record that shares the reference number. */
+
+    schema_reassembler_t r;
+    multipart_state_t state = { l2, 0, 0, 0 };
+
+    schema_reassembler_init(&r);
+
+    assert(
+        schema_reassembler_add(&r, "+15551234", parts[1], strlen(parts[1]),
+                               &collect_multipart, &state) &&
+        schema_reassembler_add(&r, "+15554321", parts[0], strlen(parts[0]),
+                               &collect_multipart, &state) &&
+        schema_reassembler_add(&r, "+15551234", parts[1], strlen(parts[1]),
+                               &collect_multipart, &state),
+        "Parts buffered"
+    );
+
+    assert(state.count == 0, "Nothing delivered before every part arrives");
+
+    assert(
+        schema_reassembler_add(&r, "+15551234", parts[0], strlen(parts[0]),
+                               &collect_multipart, &state),
+        "Final part accepted"
+    );
+
+    assert(state.count == 1 && state.accepted == 1, "Record delivered once");
+    assert(state.len == len, "Record reassembled whole");
+
+    u8 *again = schema_list_serialize(l2, FL_NONE);
+    assert_string(record, again, "Reassembled record matches original");
+
+    /* Other messages pass through */
+    assert(
+        schema_reassembler_add(&r, "+15551234", "1!MUVL!a#b#c#d#1", 16,
+                               &collect_multipart, &state) &&
+            state.count == 2,
+        "Single message passed through"
+    );
+
+    assert(
+        !schema_reassembler_add(&r, NULL, "5!17!3!2!abc", 12,
+                                &collect_multipart, &state),
+        "Invalid part number rejected"
+    );
+
+    assert(
+        !schema_reassembler_add(&r, NULL, "5!17!1!2!abc", 12,
+                                &collect_multipart, &state),
+        "Short part rejected"
+    );
+
+    schema_reassembler_clear(&r);
+
+    free(again);
+    free(record);
+    schema_list_delete(l2);
+    schema_list_delete(l);
+
+    puts("[<] test_multipart_serialization");
+}
+
+
+/** @name test_push_parser */
+
+void test_push_parser() {
+
+    puts("[>] test_push_parser");
+
+    SCHEMA_BEGIN(form)
+        SCHEMA_ITEM("i1", TS_INTEGER, 0, 4)
+        SCHEMA_ITEM("s2", TS_STRING, 0, 32)
+        SCHEMA_ITEM("i3", TS_INTEGER, 0, 4,
+            SCHEMA_DELIMITER('-'))
+        SCHEMA_ITEM("s4", TS_STRING, 0, 32)
+    SCHEMA_END(form, "MUVP")
+
+    schema_list_t *l = schema_list_new(&form);
+
+    const char *message = "1!MUVP!42#a\\#b\\\\c#\\-7-last";
+    size_t len = strlen(message);
+
+    schema_info_t o;
+    schema_parser_t p;
+
+    /* Every possible split, including inside escape sequences */
+    for (size_t split = 0; split <= len; split++) {
+
+        schema_list_clear_result(l);
+        schema_parser_init(&p, l, &o, FL_NONE);
+
+        assert(schema_parser_feed(&p, message, split), "First piece fed");
+        assert(
+            schema_parser_feed(&p, message + split, len - split),
+                "Second piece fed"
+        );
+
+        assert(schema_parser_finish(&p), "Message accepted");
+        assert(o.field_count == 4, "Every field decoded");
+        assert_string("MUVP", o.form_identifier, "Form code reported");
+
+        free(o.form_identifier);
+    }
+
+    assert(l->list[0].value.integer == 42, "Integer decoded");
+    assert_string("a#b\\c", l->list[1].string_value, "Escapes decoded");
+    assert(l->list[2].value.integer == -7, "Special delimiter decoded");
+    assert_string("last", l->list[3].string_value, "Final field decoded");
+
+    /* One byte at a time */
+    schema_list_clear_result(l);
+    schema_parser_init(&p, l, NULL, FL_NONE);
+
+    for (size_t i = 0; i < len; i++) {
+        schema_parser_feed(&p, message + i, 1);
+    }
+
+    assert(schema_parser_finish(&p), "Byte-at-a-time message accepted");
+    assert_string("last", l->list[3].string_value, "Final field decoded");
+
+    /* Trailing input */
+    schema_parser_init(&p, l, NULL, FL_NONE);
+    schema_parser_feed(&p, "1!MUVP!1#2#3-4#", 15);
+
+    assert(!schema_parser_feed(&p, "5", 1), "Input after last field rejected");
+    assert(!schema_parser_finish(&p), "Message rejected");
+
+    /* Too few fields */
+    schema_parser_init(&p, l, NULL, FL_NONE);
+    schema_parser_feed(&p, "1!MUVP!1#2", 10);
+
+    assert(!schema_parser_finish(&p), "Short message rejected");
+
+    /* Whole-message records are collected, then decoded */
+    const char *complete = "4!MUVP!9!0!5#x#6-y";
+
+    schema_list_clear_result(l);
+    schema_parser_init(&p, l, &o, FL_NONE);
+
+    schema_parser_feed(&p, complete, 5);
+    schema_parser_feed(&p, complete + 5, strlen(complete) - 5);
+
+    assert(schema_parser_finish(&p), "Complete delta record accepted");
+    assert(o.api_version == SMS_DELTA_API_VERSION, "Version reported");
+    assert(o.sequence == 9, "Sequence reported");
+    assert_string("y", l->list[3].string_value, "Final field decoded");
+
+    free(o.form_identifier);
+    schema_list_delete(l);
+
+    puts("[<] test_push_parser");
+}
+
+
+/** @name test_parser_scan */
+
+void test_parser_scan() {
+
+    puts("[>] test_parser_scan");
+
+    SCHEMA_BEGIN(form)
+        SCHEMA_ITEM("s1", TS_STRING, 0, 64)
+        SCHEMA_ITEM("i2", TS_INTEGER, 0, 4)
+        SCHEMA_ITEM("s3", TS_STRING, 0, 64,
+            SCHEMA_DELIMITER('-'))
+        SCHEMA_ITEM("b4", TS_BOOLEAN, 1, 1)
+    SCHEMA_END(form, "MUVS")
+
+    schema_list_t *l = schema_list_new(&form);
+
+    char message[256], s1[64], s3[64];
+    schema_parser_t p;
+
+    /* Escapes on either side of each 16- and 32-byte boundary */
+    const size_t offsets[] = { 0, 1, 15, 16, 17, 31, 32, 33, 39 };
+
+    for (size_t k = 0; k < sizeof(offsets) / sizeof(*offsets); k++) {
+
+        size_t at = offsets[k];
+
+        memset(s1, 'a', 40);
+        s1[40] = '\0';
+        s1[at] = '#';
+
+        memset(s3, 'b', 40);
+        s3[40] = '\0';
+        s3[at] = '-';
+
+        size_t len = sprintf(
+            message, "1!MUVS!%.*s\\#%s#-17#%.*s\\-%s-1",
+                (int) at, s1, &s1[at + 1], (int) at, s3, &s3[at + 1]
+        );
+
+        /* Whole, split everywhere, and one byte at a time */
+        for (size_t split = 0; split <= len + 1; split++) {
+
+            schema_list_clear_result(l);
+            schema_parser_init(&p, l, NULL, FL_NONE);
+
+            if (split <= len) {
+                schema_parser_feed(&p, message, split);
+                schema_parser_feed(&p, message + split, len - split);
+            } else {
+                for (size_t i = 0; i < len; i++) {
+                    schema_parser_feed(&p, message + i, 1);
+                }
+            }
+
+            assert(schema_parser_finish(&p), "Message accepted");
+            assert_string(s1, l->list[0].string_value, "Escaped # decoded");
+            assert(l->list[1].value.integer == -17, "Integer decoded");
+            assert_string(s3, l->list[2].string_value, "Escaped - decoded");
+            assert(l->list[3].value.boolean, "Boolean decoded");
+        }
+    }
+
+    /* Field length limit, with and without escapes */
+    for (size_t n = MAX_SMS_FIELD_LENGTH; n <= MAX_SMS_FIELD_LENGTH + 1; n++) {
+        for (int escaped = 0; escaped <= 1; escaped++) {
+
+            size_t len = sprintf(message, "1!MUVS!");
+
+            for (size_t i = 0; i < n; i++) {
+                if (escaped && i == n - 1) {
+                    message[len++] = SMS_ESCAPE;
+                }
+                message[len++] = 'c';
+            }
+
+            len += sprintf(&message[len], "#1#x-0");
+
+            schema_list_clear_result(l);
+
+            u8 ok = schema_list_unserialize(l, NULL, message, len, FL_NONE);
+
+            if (n == MAX_SMS_FIELD_LENGTH) {
+                assert(ok, "Longest possible field accepted");
+                assert(strlen(l->list[0].string_value) == n, "Field kept");
+            } else {
+                assert(!ok, "Field that is too long rejected");
+            }
+        }
+    }
+
+    /* Spans needn't be null-terminated */
+    schema_item_set_span(&l->list[0], "text#", 4);
+    assert_string("text", l->list[0].string_value, "String span set");
+
+    schema_item_set_span(&l->list[1], "123#", 3);
+    assert(l->list[1].value.integer == 123, "Integer span set");
+    assert_string("123", l->list[1].string_value, "Integer text kept");
+
+    schema_item_set_span(&l->list[3], "0#", 1);
+    assert(!l->list[3].value.boolean, "Boolean span set");
+
+    schema_list_delete(l);
+
+    puts("[<] test_parser_scan");
+}
+
+
+/** @name test_value_arena */
+
+#ifdef _SCHEMA_ENABLE_ARENA
+
+static u8 in_arena(schema_list_t *l, const u8 *p) {
+
+    return (p >= l->arena.base && p < l->arena.base + l->arena.size);
+}
+
+
+void test_value_arena() {
+
+    puts("[>] test_value_arena");
+
+    SCHEMA_BEGIN(form)
+        SCHEMA_ITEM("i1", TS_INTEGER, 0, 4)
+        SCHEMA_ITEM("s2", TS_STRING, 0, 32)
+        SCHEMA_ITEM("c3", TS_SELECT, 1, 1,
+            SCHEMA_SELECT(3, NULL, NULL))
+        SCHEMA_ITEM("s4", TS_STRING, 0, 32)
+    SCHEMA_END(form, "MUVA")
+
+    schema_list_t *l = schema_list_new(&form);
+    const char *message = "1!MUVA!42#a\\\\#3#b\\#c";
+
+    assert(schema_list_enable_arena(l, 0), "Arena enabled");
+    assert(!schema_list_enable_arena(l, 0), "Only one arena per list");
+
+    assert(
+        l->arena.size == 4 * (MAX_SMS_FIELD_LENGTH + 1),
+            "Default arena fits every field"
+    );
+
+    for (int n = 0; n < 3; n++) {
+
+        schema_list_clear_result(l);
+        assert(l->arena.used == 0, "Arena emptied");
+
+        assert(
+            schema_list_unserialize(l, NULL, message,
+                                    strlen(message), FL_NONE),
+                "Message accepted"
+        );
+
+        assert(l->list[0].value.integer == 42, "Integer decoded");
+        assert_string("a\\", l->list[1].string_value, "String decoded");
+        assert(l->list[2].value.integer == 3, "Select decoded");
+        assert_string("b#c", l->list[3].string_value, "Last decoded");
+    }
+
+    assert(in_arena(l, l->list[0].string_value), "Integer text in arena");
+    assert(in_arena(l, l->list[1].string_value), "String in arena");
+    assert(in_arena(l, l->list[3].string_value), "Last field in arena");
+    assert(l->list[3].validity & VL_IN_ARENA, "Item marked");
+    assert(l->list[3].validity & VL_IS_VALID, "Item still valid");
+    assert(l->arena.used == 3 + 3 + 4, "Values packed in arena");
+
+    /* Spans set through the list are copied in to its arena */
+    schema_list_clear_result(l);
+    schema_list_set_numeric(l, &l->list[0], "123#", 3, PR_NORMAL);
+    schema_list_set_string(l, &l->list[1], "xyz#", 3);
+
+    assert(l->list[0].value.integer == 123, "Span decoded");
+    assert_string("xyz", l->list[1].string_value, "Span terminated");
+    assert(in_arena(l, l->list[1].string_value), "Span in arena");
+    assert(l->list[1].validity & VL_IN_ARENA, "Span marked");
+    assert(l->arena.used == 4 + 4, "Spans packed in arena");
+
+    /* Replaced values come from the heap again */
+    schema_item_set_string(&l->list[3], "heap", 5, PR_NORMAL);
+
+    assert(!in_arena(l, l->list[3].string_value), "Value on heap");
+    assert(!(l->list[3].validity & VL_IN_ARENA), "Item not marked");
+
+    schema_list_delete(l);
+
+    /* Values that don't fit come from the heap */
+    l = schema_list_new(&form);
+    schema_list_enable_arena(l, 4);
+
+    assert(
+        schema_list_unserialize(l, NULL, message, strlen(message), FL_NONE),
+            "Message accepted with small arena"
+    );
+
+    assert(in_arena(l, l->list[0].string_value), "First value in arena");
+    assert(!in_arena(l, l->list[1].string_value), "Second value on heap");
+    assert(!(l->list[1].validity & VL_IN_ARENA), "Heap value not marked");
+    assert_string("b#c", l->list[3].string_value, "Last decoded");
+
+    schema_list_delete(l);
+
+    puts("[<] test_value_arena");
+}
+
+#endif /* _SCHEMA_ENABLE_ARENA */
+
+
+/** @name test_kv_store */
+
+
+void test_kv_store() {
+
+    puts("[>] test_kv_store");
+
+    char buf[32];
+    size_t size = 48;
+    muvuku_allocator_t *a = &muvuku_eeprom_allocator;
+
+    muvuku_kv_handle_t h = muvuku_kv_new(a, size);
+    assert(h != NULL, "Created store successfully");
+
+    muvuku_kv_t *kv = muvuku_kv_open(a, h, size);
+    assert(kv != NULL, "Opened store successfully");
+    assert(muvuku_kv_get(kv, 0, buf, sizeof(buf)) == 0, "New store is empty");
+
+    /* Coalescing:
+        Uncommitted writes to one key share a single record. */
+
+    assert(muvuku_kv_set(kv, 0, "+15551234", 9), "Value set");
+    u16 used = kv->used;
+
+    assert(muvuku_kv_set(kv, 0, "+15554321", 9), "Value replaced");
+    assert(muvuku_kv_set(kv, 0, "+1555000", 8), "Value shortened");
+    assert(muvuku_kv_set(kv, 0, "+15559999", 9), "Value lengthened");
+    assert(kv->used == used, "Uncommitted writes are coalesced");
+
+    assert(muvuku_kv_set(kv, 3, "abc", 3), "Second key set");
+    assert(muvuku_kv_get(kv, 0, buf, sizeof(buf)) == 9, "Length correct");
+    assert(memcmp(buf, "+15559999", 9) == 0, "Value correct");
+
+    assert(muvuku_kv_commit(kv), "Commit successful");
+    muvuku_kv_close(kv);
+
+    /* Reopen:
+        Committed values come back; a rewrite of the same value
+        is free, and a new value appends a single record. */
+
+    kv = muvuku_kv_open(a, h, size);
+    assert(kv->used == kv->committed && !kv->dirty, "Store loaded clean");
+
+    memset(buf, '\0', sizeof(buf));
+    assert(muvuku_kv_get(kv, 3, buf, sizeof(buf)) == 3, "Length survives");
+    assert(strcmp(buf, "abc") == 0, "Value survives");
+
+    used = kv->used;
+    assert(muvuku_kv_set(kv, 0, "+15559999", 9), "Unchanged value set");
+    assert(!kv->dirty && kv->used == used, "Unchanged value is free");
+
+    /* Compaction:
+        Keep replacing a committed value until the log fills. */
+
+    int i;
+
+    for (i = 0; i < 8; ++i) {
+        buf[0] = '0' + i;
+        assert(muvuku_kv_set(kv, 0, buf, 9), "Value replaced");
+        assert(muvuku_kv_commit(kv), "Commit successful");
+    }
+
+    assert(kv->used < size, "Log was compacted");
+    muvuku_kv_close(kv);
+
+    kv = muvuku_kv_open(a, h, size);
+    assert(muvuku_kv_get(kv, 0, buf, sizeof(buf)) == 9, "Length correct");
+    assert(buf[0] == '7', "Most recent value survives compaction");
+    assert(muvuku_kv_get(kv, 3, buf, sizeof(buf)) == 3, "Other key kept");
+
+    assert(
+        !muvuku_kv_set(kv, 5, reserved, size),
+            "Oversized value is refused"
+    );
+
+    assert(
+        muvuku_kv_get(kv, 0, NULL, 0) == 9 &&
+            muvuku_kv_get(kv, 3, NULL, 0) == 3,
+        "Refused value leaves others intact"
+    );
+
+    muvuku_kv_close(kv);
+
+    /* Interrupted compaction:
+        The compacted log goes to the other half of the store;
+        until that's complete, the current half stands. */
+
+    kv = muvuku_kv_open(a, h, size);
+    u8 bank = kv->bank;
+
+    buf[0] = 'x';
+    assert(muvuku_kv_set(kv, 0, buf, 9), "Value replaced");
+    assert(kv->compacted, "Compaction pending");
+    assert(muvuku_kv_commit(kv), "Commit successful");
+    assert(kv->bank != bank, "Switched halves");
+
+    muvuku_kv_data_t *d = (muvuku_kv_data_t *) ((u8 *) h + size / 2);
+    muvuku_kv_close(kv);
+
+    if (bank == 0) {
+        d->header.magic = 0; /* As if power failed before the switch */
+    } else {
+        h->header.magic = 0;
+    }
+
+    kv = muvuku_kv_open(a, h, size);
+    assert(kv->bank == bank, "Previous half is current");
+
+    assert(muvuku_kv_get(kv, 0, buf, sizeof(buf)) == 9, "Length correct");
+    assert(buf[0] == '7', "Previous value survives");
+    assert(muvuku_kv_get(kv, 3, NULL, 0) == 3, "Other key survives");
+    muvuku_kv_close(kv);
+
+    /* Version mismatch:
+        A store with a different format starts out empty. */
+
+    h->header.version = MUVUKU_KV_VERSION + 1;
+    d->header.version = MUVUKU_KV_VERSION + 1;
+    kv = muvuku_kv_open(a, h, size);
+    assert(muvuku_kv_get(kv, 3, NULL, 0) == 0, "Old format is discarded");
+    muvuku_kv_close(kv);
+
+    muvuku_kv_delete(a, h);
+
+    /* Settings:
+        Access goes through the in-core copy until closed. */
+
+    muvuku_settings_t s;
+    memset(&s, '\0', sizeof(s));
+
+    s.store = muvuku_kv_new(a, MUVUKU_SETTINGS_STORE_SIZE);
+    s.counters[MUVUKU_COUNTER_SAVED] = muvuku_counter_new(a);
+
+    assert(muvuku_settings_open(&s), "Opened settings");
+    assert(muvuku_settings_set(MUVUKU_SETTING_MSISDN, "+1555", 5), "Set");
+    assert(s.store->header.magic != MUVUKU_KV_MAGIC, "Nothing written yet");
+
+    muvuku_settings_close(&s);
+    assert(s.store->header.magic == MUVUKU_KV_MAGIC, "Written on close");
+
+    assert(muvuku_settings_open(&s), "Reopened settings");
+    assert(muvuku_settings_get(MUVUKU_SETTING_MSISDN, NULL, 0) == 5, "Found");
+
+    assert(
+        muvuku_settings_counter_add(MUVUKU_COUNTER_SAVED, 2) == 2,
+            "Counter updated"
+    );
+
+    assert(
+        muvuku_settings_counter_add(MUVUKU_COUNTER_SENT, 1) == 0,
+            "Missing counter is ignored"
+    );
+
+    muvuku_settings_close(&s);
+
+    assert(muvuku_settings_open(&s), "Reopened settings");
+    assert(muvuku_settings_counter(MUVUKU_COUNTER_SAVED) == 2, "Counted");
+    muvuku_settings_close(&s);
+
+    /* Nesting:
+        Only the outermost close writes back, or closes. */
+
+    assert(muvuku_settings_open(&s), "Opened settings");
+    assert(!muvuku_settings_is_nested(), "Not nested");
+    assert(muvuku_settings_set(MUVUKU_SETTING_MSISDN, "+2555", 5), "Set");
+
+    assert(muvuku_settings_open(&s), "Opened settings again");
+    assert(muvuku_settings_is_nested(), "Nested");
+    muvuku_settings_close(&s);
+
+    assert(!muvuku_settings_is_nested(), "No longer nested");
+    assert(muvuku_settings_counter(MUVUKU_COUNTER_SAVED) == 2, "Still open");
+    assert(muvuku_settings_set(MUVUKU_SETTING_MSISDN, "+3555", 5), "Set");
+    muvuku_settings_close(&s);
+    muvuku_settings_close(&s); /* Unbalanced; ignored */
+
+    char msisdn[5];
+
+    assert(muvuku_settings_open(&s), "Reopened settings");
+    muvuku_settings_get(MUVUKU_SETTING_MSISDN, msisdn, sizeof(msisdn));
+    assert(memcmp(msisdn, "+3555", 5) == 0, "Outer change kept");
+    muvuku_settings_close(&s);
+    assert(muvuku_settings_counter(MUVUKU_COUNTER_SAVED) == 0, "Closed");
+
+    muvuku_counter_delete(a, s.counters[MUVUKU_COUNTER_SAVED]);
+    muvuku_kv_delete(a, s.store);
+
+    puts("[<] test_kv_store");
+}
+
+
+/** @name test_settings_storage */
+
+void test_settings_storage_map() {
+
+    puts("[>] test_settings_storage_map");
+    memset(&reserved, '\0', sizeof(reserved));
+
+    SCHEMA_BEGIN(form1)
+        SCHEMA_ITEM("i", TS_INTEGER, 4, 4)
+    SCHEMA_END(form1, "MUV1")
+
+    schema_list_t *l1 = schema_list_new(&form1);
+
+    SCHEMA_BEGIN(form2)
+        SCHEMA_ITEM("i", TS_INTEGER, 4, 4)
+    SCHEMA_END(form2, "MUV2")
+
+    schema_list_t *l2 = schema_list_new(&form2);
+
+    SCHEMA_BEGIN(form3)
+        SCHEMA_ITEM("i", TS_INTEGER, 4, 4)
+    SCHEMA_END(form3, "MUV3")
+
+    schema_list_t *l3 = schema_list_new(&form3);
+
+    SCHEMA_BEGIN(form4)
+        SCHEMA_ITEM("i", TS_INTEGER, 4, 4)
+    SCHEMA_END(form4, "MUV4")
+
+    schema_list_t *l4 = schema_list_new(&form4);
+
+    SCHEMA_BEGIN(form5)
+        SCHEMA_ITEM("i", TS_INTEGER, 4, 4)
+    SCHEMA_END(form5, "MUV5")
+
+    schema_list_t *l5 = schema_list_new(&form5);
+
+    muvuku_settings_t s;
+    memset(&s, '\0', sizeof(s));
+
+    muvuku_flash_region_t *r =
+        muvuku_flash_region_init(&reserved, sizeof(reserved));
+
+    muvuku_pool_t *p = muvuku_pool_new(
+        &muvuku_flash_allocator, muvuku_flash_region_available(r), 10, r
+    );
+
+    muvuku_cell_t c1 = muvuku_storage_retrieve(&s, p, l1);
+    muvuku_cell_t c2 = muvuku_storage_retrieve(&s, p, l2);
+    muvuku_cell_t c3 = muvuku_storage_retrieve(&s, p, l3);
+
+    muvuku_cell_t cc1 = muvuku_storage_retrieve(&s, p, l1);
+    muvuku_cell_t cc2 = muvuku_storage_retrieve(&s, p, l2);
+    muvuku_cell_t cc3 = muvuku_storage_retrieve(&s, p, l3);
+
+    assert(c1 != INVALID_CELL, "Valid cell returned from write path");
+    assert(c2 != INVALID_CELL, "Valid cell returned from write path");
+    assert(c3 != INVALID_CELL, "Valid cell returned from write path");
+
+    assert(c1 == cc1, "Proper cell returned from read path");
+    assert(c2 == cc2, "Proper cell returned from read path");
+    assert(c3 == cc3, "Proper cell returned from read path");
+
+    assert(muvuku_pool_address(p, c1) != NULL, "Valid cell address");
+    assert(muvuku_pool_address(p, c2) != NULL, "Valid cell address");
+    assert(muvuku_pool_address(p, c3) != NULL, "Valid cell address");
+
+    muvuku_pool_t *o = muvuku_pool_new(
+        &muvuku_eeprom_allocator, 512, 10, NULL
+    );
+
+    muvuku_cell_t o2 = muvuku_storage_retrieve_overflow(&s, o, l2);
+
+    assert(o2 != INVALID_CELL, "Valid overflow cell returned");
+    assert(muvuku_storage_retrieve(&s, p, l2) == c2, "Cell is unchanged");
+
+    assert(
+        muvuku_storage_retrieve_overflow(&s, o, l2) == o2,
+            "Proper overflow cell returned from read path"
+    );
+
+    /* Delta bases:
+        One record per form, replaced in place. */
+
+    uint32_t sequence = 0;
+    char base[MAX_SMS_LENGTH + 1];
+
+    muvuku_pool_t *b = muvuku_pool_new(
+        &muvuku_eeprom_allocator, 1024, 4, NULL
+    );
+
+    assert(
+        muvuku_storage_base_read(&s, b, l2, &sequence,
+                                 base, sizeof(base)) == 0,
+            "Form has no base yet"
+    );
+
+    assert(
+        muvuku_storage_base_write(&s, b, l2, 7, "1!MUV2!1234", 11) &&
+            muvuku_storage_base_write(&s, b, l2, 9, "1!MUV2!4321", 11),
+        "Base written and replaced"
+    );
+
+    assert(
+        muvuku_storage_base_read(&s, b, l2, &sequence,
+                                 base, sizeof(base)) == 11 &&
+            sequence == 9 && memcmp(base, "1!MUV2!4321", 11) == 0,
+        "Latest base read back"
+    );
+
+    assert(
+        muvuku_storage_base_clear(&s, b, l2) &&
+            muvuku_storage_base_read(&s, b, l2, &sequence,
+                                     base, sizeof(base)) == 0,
+        "Base cleared"
+    );
+
+    assert(muvuku_storage_retrieve(&s, p, l2) == c2, "Cell is unchanged");
+
+    assert(
+        muvuku_storage_retrieve_overflow(&s, o, l2) == o2,
+            "Overflow cell is unchanged"
+    );
+
+    muvuku_pool_delete(b);
+
+    muvuku_tieredlist_t *t = muvuku_storage_list(&s, p, o, l4);
+
+    assert(t != NULL && t->overflow != NULL, "Opened tiered storage");
+    assert(muvuku_tieredlist_size(t) == 0, "Tiered storage is empty");
+
+    muvuku_tieredlist_close(t);
+    muvuku_pool_delete(o);
+}
+
+
+/** @name test_transport */
+
+/* Read back everything a sink wrote to `fd` */
+static size_t read_sink(int fd, char *buf, size_t n) {
+
+    size_t rv = 0;
+    ssize_t len;
+
+    while (rv < n - 1 && (len = read(fd, buf + rv, n - 1 - rv)) > 0) {
+        rv += (size_t) len;
+    }
+
+    buf[rv] = '\0';
+    return rv;
+}
+
+
+void test_transport() {
+
+    puts("[>] test_transport");
+
+    muvuku_subsystem_init_transport();
+    muvuku_transport_t *t = muvuku_transport;
+
+    assert(t == &muvuku_file_transport, "File sink is the default");
+
+    muvuku_subsystem_init_transport();
+    assert(muvuku_transport == t, "Duplicate initialization ignored");
+
+    void *file_context = muvuku_file_transport.context;
+    void *loopback_context = muvuku_loopback_transport.context;
+
+    char *records[] = {
+        "1!MUVT!1#abc", "1!MUVT!22#de\\#f", "1!MUVT!333#ghijklmnop"
+    };
+
+    char expected[MAX_SMS_LENGTH * 2];
+    char buf[MAX_SMS_LENGTH * 2];
+
+    /* Batched messages, as `muvuku_action_send` sends them */
+    schema_batch_t b;
+    schema_batch_init(&b);
+
+    for (int i = 0; i < 3; ++i) {
+        assert(schema_batch_add(&b, records[i], strlen(records[i])),
+               "Record batched");
+    }
+
+    char message[MAX_SMS_LENGTH + 1];
+    size_t len = strlen(schema_batch_message(&b));
+
+    memcpy(message, schema_batch_message(&b), len + 1);
+
+    size_t expected_len = len + strlen(records[0]) + 2;
+
+    memcpy(expected, message, len + 1);
+    memcpy(expected + len + 1, records[0], strlen(records[0]) + 1);
+
+    /* File sink */
+    char path[] = "/tmp/muvuku-transport-XXXXXX";
+    int fd = mkstemp(path);
+
+    assert(fd >= 0, "Temporary file created");
+
+    muvuku_sink_t k;
+    muvuku_sink_init(&k, path);
+    muvuku_file_transport.context = &k;
+
+    muvuku_session_t x;
+
+    assert(muvuku_session_begin(&x, NULL, 4), "File session started");
+    assert(muvuku_session_send(&x, message, 3), "Batch sent to file");
+    assert(muvuku_session_send(&x, records[0], 1), "Record sent to file");
+    assert(muvuku_session_end(&x), "File session finished");
+
+    assert(x.sent == 4 && x.messages == 2, "Session counted records");
+
+    assert(k.count == 2 && k.size == len + strlen(records[0]),
+           "File sink counted messages");
+
+    assert(
+        read_sink(fd, buf, sizeof(buf)) == expected_len &&
+            memcmp(expected, buf, expected_len) == 0,
+        "File holds each message, NUL-terminated"
+    );
+
+    close(fd);
+    unlink(path);
+
+    /* Loopback, to a stand-in gateway */
+    struct sockaddr_un addr;
+    memset(&addr, '\0', sizeof(addr));
+
+    addr.sun_family = AF_UNIX;
+    sprintf(addr.sun_path, "/tmp/muvuku-loopback-%d", (int) getpid());
+    unlink(addr.sun_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    assert(
+        listener >= 0 &&
+            bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+            listen(listener, 1) == 0,
+        "Stand-in gateway listening"
+    );
+
+    muvuku_sink_init(&k, addr.sun_path);
+    muvuku_loopback_transport.context = &k;
+    muvuku_transport = &muvuku_loopback_transport;
+
+    assert(muvuku_session_begin(&x, NULL, 4), "Loopback session started");
+    assert(muvuku_session_send(&x, message, 3), "Batch sent to loopback");
+    assert(muvuku_session_send(&x, records[0], 1), "Record sent to loopback");
+    assert(muvuku_session_end(&x), "Loopback session finished");
+
+    fd = accept(listener, NULL, NULL);
+    assert(fd >= 0, "Stand-in gateway accepted");
+
+    assert(
+        read_sink(fd, buf, sizeof(buf)) == expected_len &&
+            memcmp(expected, buf, expected_len) == 0,
+        "Gateway received each message, NUL-terminated"
+    );
+
+    close(fd);
+    close(listener);
+    unlink(addr.sun_path);
+
+    /* No gateway listening */
+    assert(!muvuku_session_begin(&x, NULL, 1), "Loopback refused");
+    assert(!muvuku_session_send(&x, records[0], 1), "Nothing sent");
+    assert(!muvuku_session_end(&x) && x.sent == 0, "Session failed");
+    assert(k.count == 2 && k.failures == 0, "Nothing attempted");
+
+    muvuku_transport = t;
+    muvuku_file_transport.context = file_context;
+    muvuku_loopback_transport.context = loopback_context;
+
+    puts("[<] test_transport");
+}
+
+
+/** @name test_session */
+
+/* Scripted transport:
+    Each send attempt returns the next of `results`. */
+
+typedef struct script_state {
+
+    const u8 *results;
+    int attempts;
+    int statuses;
+    int ended;
+    u8 end_result;
+
+} script_state_t;
+
+
+static u8 script_begin(void *context, schema_list_t *settings) {
+    return TRUE;
+}
+
+
+static u8 script_send(void *context, const char *s,
+                      size_t len, schema_list_t *settings) {
+
+    script_state_t *ss = (script_state_t *) context;
+    return ss->results[ss->attempts++];
+}
+
+
+static u8 script_end(void *context) {
+
+    script_state_t *ss = (script_state_t *) context;
+
+    ss->ended++;
+    return ss->end_result;
+}
+
+
+static void script_status(void *context, u8 result) {
+
+    script_state_t *ss = (script_state_t *) context;
+    ss->statuses++;
+}
+
+
+void test_session() {
+
+    puts("[>] test_session");
+
+    muvuku_subsystem_init_transport();
+
+    muvuku_session_t x;
+    muvuku_transport_t *t = muvuku_transport;
+
+    muvuku_transport_t script = {
+        &script_begin, &script_send, &script_end, &script_status, NULL
+    };
+
+    muvuku_transport = &script;
+
+    /* Fail fast:
+        The third message fails at the network; the fourth
+        isn't even attempted, and the session says how far it got. */
+
+    const u8 network[] = {
+        MUVUKU_SEND_OK, MUVUKU_SEND_OK, MUVUKU_SEND_FAILED, MUVUKU_SEND_OK
+    };
+
+    script_state_t ss = { network, 0, 0, 0, TRUE };
+    script.context = &ss;
+
+    assert(muvuku_session_begin(&x, NULL, 5), "Session started");
+    assert(muvuku_session_send(&x, "2!1!A!1\n1!A!2", 2), "First sent");
+    assert(muvuku_session_send(&x, "1!A!3", 1), "Second sent");
+    assert(!muvuku_session_send(&x, "1!A!4", 1), "Third failed");
+    assert(!muvuku_session_send(&x, "1!A!5", 1), "Fourth refused");
+
+    assert(ss.attempts == 3 && ss.statuses == 3, "Stopped at first failure");
+    assert(x.stopped && x.result == MUVUKU_SEND_FAILED, "Session stopped");
+
+    assert(!muvuku_session_end(&x), "Session reports failure");
+    assert(ss.ended == 1, "Transport session closed");
+    assert(x.sent == 3 && x.total == 5, "Sent 3 of 5");
+
+    /* Busy handset:
+        Tried again, straight away, until it gives in. */
+
+    const u8 busy[] = {
+        MUVUKU_SEND_BUSY, MUVUKU_SEND_BUSY, MUVUKU_SEND_OK,
+        MUVUKU_SEND_BUSY, MUVUKU_SEND_BUSY, MUVUKU_SEND_BUSY,
+        MUVUKU_SEND_OK
+    };
+
+    memset(&ss, '\0', sizeof(ss));
+    ss.results = busy;
+    ss.end_result = TRUE;
+
+    assert(muvuku_session_begin(&x, NULL, 3), "Session started");
+    assert(muvuku_session_send(&x, "1!A!1", 1), "Sent on third attempt");
+    assert(x.attempts == 3, "Attempts counted");
+
+    /* ...unless it doesn't */
+    assert(!muvuku_session_send(&x, "1!A!2", 1), "Too busy");
+    assert(ss.attempts == 3 + MUVUKU_SESSION_ATTEMPTS, "Attempts limited");
+    assert(x.result == MUVUKU_SEND_BUSY, "Busy is the last result");
+
+    assert(!muvuku_session_send(&x, "1!A!3", 1), "Refused once stopped");
+    assert(!muvuku_session_end(&x) && x.sent == 1, "Sent 1 of 3");
+
+    /* Lost in the transport:
+        Every send succeeded, but the session didn't end cleanly;
+        none of the messages can be assumed to have arrived. */
+
+    const u8 lost[] = { MUVUKU_SEND_OK, MUVUKU_SEND_OK };
+
+    memset(&ss, '\0', sizeof(ss));
+    ss.results = lost;
+    ss.end_result = FALSE;
+
+    assert(muvuku_session_begin(&x, NULL, 2), "Session started");
+    assert(muvuku_session_send(&x, "1!A!1", 1), "First sent");
+    assert(muvuku_session_send(&x, "1!A!2", 1), "Second sent");
+    assert(!muvuku_session_end(&x) && x.sent == 0, "Nothing delivered");
+
+    assert(!muvuku_session_end(&x), "Session ends only once");
+    assert(ss.ended == 1, "Transport session closed once");
+
+    muvuku_transport = t;
+    puts("[<] test_session");
+}
+
+
+#if defined(_SCHEMA_ENABLE_ACK) && defined(_SCHEMA_PROVIDE_UNSERIALIZE)
+
+/** @name test_acknowledgements */
+
+/* Gateway stand-in:
+    Reads what the SIM sent, as the gateway would, and lists every
+    sequenced record in an acknowledgement -- unless its message is
+    the one chosen to be lost on the way. */
+
+typedef struct standin_state {
+
+    schema_ack_t ack;
+    unsigned int messages;
+    unsigned int lost;
+    unsigned int records;
+
+} standin_state_t;
+
+
+static u8 standin_record(const char *record, size_t len, void *ctx) {
+
+    uint32_t sequence;
+    standin_state_t *g = (standin_state_t *) ctx;
+
+    if (schema_sequence_read(record, len, &sequence) > 0) {
+        g->records++;
+        return schema_ack_add(&g->ack, sequence);
+    }
+
+    return TRUE;
+}
+
+
+static void standin_receive(standin_state_t *g, const char *buf, size_t n) {
+
+    size_t len;
+
+    for (const char *p = buf; p < buf + n; p += len + 1) {
+
+        len = strlen(p);
+
+        if (++g->messages != g->lost) {
+            schema_batch_split(p, len, standin_record, g);
+        }
+    }
+}
+
+
+/* Pack `s` in to GSM 7-bit septets at `dst`; returns octets used */
+static size_t pack_septets(const char *s, u8 *dst) {
+
+    size_t i, n = strlen(s), len = (n * 7 + 7) / 8;
+    memset(dst, '\0', len);
+
+    for (i = 0; i < n; ++i) {
+
+        size_t bit = i * 7;
+        u8 septet = (u8) s[i] & 0x7f;
+
+        dst[bit / 8] |= (u8) (septet << (bit % 8));
+
+        if (bit % 8 > 1) {
+            dst[bit / 8 + 1] |= (u8) (septet >> (8 - bit % 8));
+        }
+    }
+
+    return len;
+}
+
+
+/* Build an SMS-PP download envelope for `text`, from 15551234 */
+static size_t build_envelope(u8 *dst, const char *text, u8 dcs) {
+
+    u8 tpdu[MAX_SMS_LENGTH + 32];
+    size_t n = 0, i = 0;
+
+    tpdu[n++] = 0x04;                               /* SMS-DELIVER */
+    tpdu[n++] = 8;                                  /* Address digits */
+    tpdu[n++] = 0x91;
+    tpdu[n++] = 0x51; tpdu[n++] = 0x55;
+    tpdu[n++] = 0x21; tpdu[n++] = 0x43;
+    tpdu[n++] = 0x7f;                               /* SIM data download */
+    tpdu[n++] = dcs;
+
+    memset(&tpdu[n], 0x11, 7);                      /* Timestamp */
+    n += 7;
+
+    tpdu[n++] = (u8) strlen(text);
+
+    if (dcs == 0xf6) {
+        memcpy(&tpdu[n], text, strlen(text));
+        n += strlen(text);
+    } else {
+        n += pack_septets(text, &tpdu[n]);
+    }
+
+    dst[i++] = 0xd1;
+    dst[i++] = 0x81;
+    dst[i++] = (u8) (n + 2 + 4 + 2);
+
+    /* Device identities: network to SIM */
+    dst[i++] = 0x82; dst[i++] = 0x02; dst[i++] = 0x83; dst[i++] = 0x81;
+
+    dst[i++] = 0x8b;
+    dst[i++] = 0x81;
+    dst[i++] = (u8) n;
+
+    memcpy(&dst[i], tpdu, n);
+    return (i + n);
+}
+
+
+/* Transmit:
+    As `muvuku_action_send` does, less multipart records. */
+
+typedef struct transmit_state {
+
+    muvuku_session_t *x;
+    schema_batch_t *b;
+
+} transmit_state_t;
+
+
+static int transmit_flush(transmit_state_t *u) {
+
+    const char *message = schema_batch_message(u->b);
+
+    if (u->b->count > 0 && !muvuku_session_send(u->x, message, u->b->count)) {
+        return FALSE;
+    }
+
+    schema_batch_init(u->b);
+    return TRUE;
+}
+
+
+static int transmit_record(muvuku_stringlist_t *sl,
+                           char *src, size_t len, void *ptr) {
+
+    char record[MAX_SMS_LENGTH + 1];
+    transmit_state_t *u = (transmit_state_t *) ptr;
+
+    len = scalar_min(len, MAX_SMS_LENGTH);
+    memset(record, '\0', sizeof(record));
+
+    muvuku_pool_read(sl->pool, record, src, len);
+    len = strlen(record);
+
+    if (schema_batch_add(u->b, record, len)) {
+        return TRUE;
+    }
+
+    return (transmit_flush(u) && schema_batch_add(u->b, record, len));
+}
+
+
+/* Iterator callback: true if no record is in the acknowledgement */
+static int unacknowledged(muvuku_stringlist_t *sl,
+                          char *src, size_t len, void *ptr) {
+
+    uint32_t sequence;
+    char record[MAX_SMS_LENGTH + 1];
+
+    const char *ack = (const char *) ptr;
+
+    len = scalar_min(len, MAX_SMS_LENGTH);
+    memset(record, '\0', sizeof(record));
+
+    muvuku_pool_read(sl->pool, record, src, len);
+
+    return (
+        !schema_sequence_read(record, strlen(record), &sequence) ||
+            !schema_ack_contains(ack, strlen(ack), sequence)
+    );
+}
+
+
+void test_acknowledgements() {
+
+    puts("[>] test_acknowledgements");
+
+    char buf[MAX_SMS_LENGTH * 8];
+    const char *m;
+    schema_ack_t a;
+
+    /* Sequenced records */
+    uint32_t sequence = 0;
+    size_t n = schema_sequence_header(buf, 4294967295u);
+
+    memcpy(&buf[n], "1!MUVA!1", 9);
+
+    assert(n == SCHEMA_SEQUENCE_HEADER_MAX, "Longest header");
+    assert_string(buf, "6!4294967295!1!MUVA!1", "Header written");
+
+    assert(
+        schema_sequence_read(buf, strlen(buf), &sequence) == n &&
+            sequence == 4294967295u,
+        "Header read back"
+    );
+
+    assert(!schema_sequence_read("1!MUVA!1", 8, &sequence), "Unsequenced");
+    assert(!schema_sequence_read("6!12", 4, &sequence), "Incomplete");
+    assert(!schema_sequence_read("6!!1!MUVA!1", 11, &sequence), "No number");
+
+    /* Lists, ranges and bitmaps:
+        Whichever is shorter; consecutive numbers make a range. */
+
+    schema_ack_init(&a);
+    assert_string(schema_ack_message(&a), "7!", "Empty acknowledgement");
+
+    for (uint32_t i = 1; i <= 5; ++i) {
+        assert(schema_ack_add(&a, i), "Added");
+    }
+
+    assert(schema_ack_add(&a, 3), "Duplicate ignored");
+    assert_string(schema_ack_message(&a), "7!1-5", "Range");
+
+    schema_ack_init(&a);
+    schema_ack_add(&a, 40);
+    schema_ack_add(&a, 42);
+    schema_ack_add(&a, 47);
+
+    assert_string(schema_ack_message(&a), "7!40*a1", "Bitmap");
+
+    schema_ack_add(&a, 500);
+    schema_ack_add(&a, 3);
+
+    m = schema_ack_message(&a);
+    assert_string(m, "7!40*a1,500,3", "Windows in order of arrival");
+
+    uint32_t listed[] = { 3, 40, 42, 47, 500 };
+    uint32_t unlisted[] = { 0, 1, 39, 41, 43, 44, 48, 499, 501 };
+
+    for (n = 0; n < sizeof(listed) / sizeof(*listed); ++n) {
+        assert(schema_ack_contains(m, strlen(m), listed[n]), "Listed");
+    }
+
+    for (n = 0; n < sizeof(unlisted) / sizeof(*unlisted); ++n) {
+        assert(!schema_ack_contains(m, strlen(m), unlisted[n]), "Unlisted");
+    }
+
+    /* Written by hand */
+    m = "7!3,10-12,40*A1";
+
+    assert(schema_ack_is_valid(m, strlen(m)), "Well-formed");
+    assert(schema_ack_contains(m, strlen(m), 11), "Within range");
+    assert(schema_ack_contains(m, strlen(m), 47), "Upper-case bitmap");
+    assert(!schema_ack_contains(m, strlen(m), 13), "Outside range");
+
+    const char *malformed[] = {
+        "7!", "7!3,", "7!,3", "7!5-3", "7!4*", "7!4*g", "7!3x", "6!3",
+        "7!3--4", "7!99999999999", "7:3"
+    };
+
+    for (n = 0; n < sizeof(malformed) / sizeof(*malformed); ++n) {
+        assert(
+            !schema_ack_is_valid(malformed[n], strlen(malformed[n])) &&
+                !schema_ack_contains(malformed[n], strlen(malformed[n]), 3),
+            "Malformed acknowledgement lists nothing"
+        );
+    }
+
+    /* Full acknowledgement:
+        Every third number, far apart enough to need a window each,
+        until a message is full; nothing added is lost. */
+
+    uint32_t next = 1000000;
+    unsigned int added = 0;
+
+    schema_ack_init(&a);
+
+    while (schema_ack_add(&a, next)) {
+        added++;
+        next += (added % 4 == 0 ? 1000 : 3);
+    }
+
+    m = schema_ack_message(&a);
+    assert(strlen(m) <= MAX_SMS_LENGTH, "Fits in a message");
+    assert(added == a.count && added > 20, "Counted");
+    assert(!schema_ack_contains(m, strlen(m), next), "Refused, not listed");
+
+    for (uint32_t i = 0, v = 1000000; i < added; ++i) {
+        assert(schema_ack_contains(m, strlen(m), v), "Still listed");
+        v += ((i + 1) % 4 == 0 ? 1000 : 3);
+    }
+
+    schema_ack_init(&a);
+    assert(schema_ack_add(&a, next), "Fits in the next message");
+
+    /* End to end:
+        Sequenced records go out in batches through the file sink;
+        the stand-in loses one message, and acknowledges the rest.
+        Only acknowledged records are reclaimed, in every form. */
+
+    memset(&reserved, '\0', sizeof(reserved));
+
+    SCHEMA_BEGIN(form1)
+        SCHEMA_ITEM("i", TS_INTEGER, 1, 4)
+    SCHEMA_END(form1, "MUVA")
+
+    SCHEMA_BEGIN(form2)
+        SCHEMA_ITEM("i", TS_INTEGER, 1, 4)
+    SCHEMA_END(form2, "MUVB")
+
+    schema_list_t *l1 = schema_list_new(&form1);
+    schema_list_t *l2 = schema_list_new(&form2);
+
+    muvuku_settings_t s;
+    memset(&s, '\0', sizeof(s));
+
+    muvuku_flash_region_t *r =
+        muvuku_flash_region_init(&reserved, sizeof(reserved));
+
+    /* Delta bases:
+        Carved out of flash first, as `muvuku_settings_create` does;
+        `muvuku_storage_acknowledge` opens them with the flash allocator. */
+
+    #ifdef _SCHEMA_ENABLE_DELTA
+        muvuku_pool_t *bp = muvuku_pool_new_aligned(
+            &muvuku_flash_allocator, MUVUKU_PAGE_SIZE * (1 + 4), 4, r
+        );
+
+        assert(bp != NULL, "Created base pool");
+    #endif /* _SCHEMA_ENABLE_DELTA */
+
+    muvuku_pool_t *p = muvuku_pool_new(
+        &muvuku_flash_allocator, muvuku_flash_region_available(r), 4, r
+    );
+
+    muvuku_pool_t *o = muvuku_pool_new(
+        &muvuku_eeprom_allocator, 512, 4, NULL
+    );
+
+    muvuku_tieredlist_t *t1 = muvuku_storage_list(&s, p, o, l1);
+    muvuku_tieredlist_t *t2 = muvuku_storage_list(&s, p, o, l2);
+
+    assert(t1 != NULL && t2 != NULL, "Opened storage");
+
+    /* Saved before acknowledgements were enabled */
+    assert(muvuku_tieredlist_add(t1, "1!MUVA!0", 9), "Old record saved");
+
+    for (uint32_t i = 1; i <= 30; ++i) {
+
+        muvuku_tieredlist_t *t = (i % 3 == 0 ? t2 : t1);
+        n = schema_sequence_header(buf, i);
+
+        n += sprintf(&buf[n], "1!%s!%u", (i % 3 == 0 ? "MUVB" : "MUVA"), i);
+        assert(muvuku_tieredlist_add(t, buf, n + 1), "Record saved");
+    }
+
+    char path[] = "/tmp/muvuku-ack-XXXXXX";
+    int fd = mkstemp(path);
+
+    assert(fd >= 0, "Temporary file created");
+
+    muvuku_subsystem_init_transport();
+
+    muvuku_sink_t k;
+    muvuku_sink_init(&k, path);
+
+    void *file_context = muvuku_file_transport.context;
+    muvuku_transport_t *saved = muvuku_transport;
+
+    muvuku_file_transport.context = &k;
+    muvuku_transport = &muvuku_file_transport;
+
+    schema_batch_t b;
+    muvuku_session_t x;
+
+    transmit_state_t u = { &x, &b };
+    schema_batch_init(&b);
+
+    assert(muvuku_session_begin(&x, NULL, 31), "Session started");
+    muvuku_tieredlist_each(t1, transmit_record, &u);
+    muvuku_tieredlist_each(t2, transmit_record, &u);
+
+    assert(transmit_flush(&u), "Last batch sent");
+    assert(muvuku_session_end(&x) && x.sent == 31, "Everything sent");
+
+    standin_state_t g;
+    memset(&g, '\0', sizeof(g));
+
+    schema_ack_init(&g.ack);
+    g.lost = 2;
+
+    n = read_sink(fd, buf, sizeof(buf));
+    standin_receive(&g, buf, n);
+
+    m = schema_ack_message(&g.ack);
+
+    assert(g.messages == k.count && g.messages > 2, "Several messages");
+    assert(g.records > 0 && g.records < 30, "One message lost");
+    assert(g.ack.count == g.records, "Received records acknowledged");
+
+    n = muvuku_storage_acknowledge(&s, p, o, m, strlen(m));
+    assert(n == g.records, "Acknowledged records reclaimed");
+
+    size_t left = muvuku_tieredlist_count(t1) + muvuku_tieredlist_count(t2);
+
+    assert(left == 31 - g.records, "Lost and old records kept");
+    assert(muvuku_tieredlist_each(t1, unacknowledged, (void *) m), "Kept");
+    assert(muvuku_tieredlist_each(t2, unacknowledged, (void *) m), "Kept");
+
+    /* Again, and with nonsense */
+    assert(!muvuku_storage_acknowledge(&s, p, o, m, strlen(m)), "Repeated");
+    assert(!muvuku_storage_acknowledge(&s, p, o, "7!1-", 4), "Malformed");
+    assert(!muvuku_storage_acknowledge(&s, p, o, "6!1-30", 6), "Not an ack");
+
+    assert(
+        muvuku_tieredlist_count(t1) + muvuku_tieredlist_count(t2) == left,
+        "Nothing else reclaimed"
+    );
+
+    /* Delta bases:
+        Only a complete record the gateway has is a base; the newest
+        one acknowledged wins, and an older one never replaces it. */
+
+    #ifdef _SCHEMA_ENABLE_DELTA
+        char base[MAX_SMS_LENGTH + 1];
+
+        m = "4!PSMS!41!0!a!b";
+
+        assert(
+            schema_delta_base(m, strlen(m), &sequence,
+                              base, sizeof(base)) == 10 &&
+                sequence == 41 && memcmp(base, "1!PSMS!a!b", 10) == 0,
+            "Complete delta record is a base"
+        );
+
+        m = "4!PSMS!42!41!40!c";
+
+        assert(
+            !schema_delta_base(m, strlen(m), &sequence, base, sizeof(base)),
+            "Partial delta record isn't"
+        );
+
+        assert(
+            !schema_delta_base("1!PSMS!a!b", 10, &sequence,
+                               base, sizeof(base)),
+            "Text record isn't"
+        );
+
+        s.base_pool = muvuku_pool_handle(bp);
+
+        const char *deltas[] = {
+            "6!31!4!MUVA!31!0!7", "6!32!4!MUVA!32!0!8", "6!33!4!MUVA!33!32!8!9"
+        };
+
+        for (n = 0; n < 3; ++n) {
+            assert(
+                muvuku_tieredlist_add(t1, deltas[n], strlen(deltas[n]) + 1),
+                    "Delta record saved"
+            );
+        }
+
+        assert(
+            !muvuku_storage_base_read(&s, bp, l1, &sequence,
+                                      base, sizeof(base)),
+            "No base until acknowledged"
+        );
+
+        m = "7!32-33";
+        assert(muvuku_storage_acknowledge(&s, p, o, m, 7) == 2, "Reclaimed");
+
+        assert(
+            muvuku_storage_base_read(&s, bp, l1, &sequence,
+                                     base, sizeof(base)) == 8 &&
+                sequence == 32 && memcmp(base, "1!MUVA!8", 8) == 0,
+            "Acknowledged base kept"
+        );
+
+        m = "7!31";
+        assert(muvuku_storage_acknowledge(&s, p, o, m, 4) == 1, "Reclaimed");
+
+        assert(
+            muvuku_storage_base_read(&s, bp, l1, &sequence,
+                                     base, sizeof(base)) == 8 &&
+                sequence == 32,
+            "Older base ignored"
+        );
+
+        s.base_pool = NULL;
+        muvuku_pool_delete(bp);
+    #endif /* _SCHEMA_ENABLE_DELTA */
+
+    /* Delivered by SMS:
+        Only from the gateway's number, in either alphabet. */
+
+    u8 envelope[MAX_SMS_LENGTH + 64];
+    const u8 gateway[] = { 5, 0x91, 0x51, 0x55, 0x21, 0x43 };
+    const u8 stranger[] = { 5, 0x91, 0x51, 0x55, 0x21, 0x44 };
+    const u8 national[] = { 5, 0x81, 0x50, 0x55, 0x21, 0x43 };
+    const u8 neighbour[] = { 5, 0x81, 0x50, 0x55, 0x21, 0x44 };
+    const u8 shortcode[] = { 3, 0x81, 0x21, 0x43 };
+
+    char text[MAX_SMS_LENGTH + 1];
+    const char *reply = "7!3,10-12,40*a1";
+
+    n = build_envelope(envelope, reply, 0xf2);
+
+    assert(
+        muvuku_sms_envelope_text(envelope, gateway, text, sizeof(text)) ==
+            strlen(reply),
+        "Acknowledgement received"
+    );
+
+    assert_string(text, reply, "Seven-bit text unpacked");
+
+    assert(
+        !muvuku_sms_envelope_text(envelope, stranger, text, sizeof(text)),
+        "Stranger ignored"
+    );
+
+    assert(
+        muvuku_sms_envelope_text(envelope, national, text, sizeof(text)),
+        "National form of gateway number accepted"
+    );
+
+    assert(
+        !muvuku_sms_envelope_text(envelope, neighbour, text, sizeof(text)),
+        "National form of stranger ignored"
+    );
+
+    assert(
+        !muvuku_sms_envelope_text(envelope, shortcode, text, sizeof(text)),
+        "Short tail ignored"
+    );
+
+    n = build_envelope(envelope, reply, 0xf6);
+
+    assert(
+        muvuku_sms_envelope_text(envelope, gateway, text, sizeof(text)) ==
+            strlen(reply),
+        "Eight-bit acknowledgement received"
+    );
+
+    assert_string(text, reply, "Eight-bit text copied");
+
+    envelope[0] = 0xd0;
+
+    assert(
+        !muvuku_sms_envelope_text(envelope, gateway, text, sizeof(text)),
+        "Not an SMS-PP download"
+    );
+
+    muvuku_session_end(&x);
+
+    muvuku_file_transport.context = file_context;
+    muvuku_transport = saved;
+
+    close(fd);
+    unlink(path);
+
+    muvuku_tieredlist_close(t1);
+    muvuku_tieredlist_close(t2);
+    muvuku_pool_delete(o);
+
+    schema_list_delete(l1);
+    schema_list_delete(l2);
+
+    puts("[<] test_acknowledgements");
+}
+
+#endif /* _SCHEMA_ENABLE_ACK && _SCHEMA_PROVIDE_UNSERIALIZE */
+
+
+#ifdef _ENABLE_AUTO_TRANSMIT
+
+/** @name test_schedule */
+
+/* Seconds until the schedule `h` next starts an attempt, or zero
+    if it doesn't within two days; advances `h` to that point. */
+
+static uint32_t schedule_wait(muvuku_schedule_t *h) {
+
+    uint32_t rv;
+
+    for (rv = 1; rv <= 2 * MUVUKU_SCHEDULE_DAY; ++rv) {
+        if (muvuku_schedule_tick(h, 1)) {
+            return rv;
+        }
+    }
+
+    return 0;
+}
+
+
+/* Event download envelope, reporting the location status `status` */
+static void location_envelope(u8 *dst, u8 status) {
+
+    const u8 envelope[] = {
+        0xd6, 0x0a,
+            0x99, 0x01, 0x03,           /* Event list: location status */
+            0x82, 0x02, 0x82, 0x81,     /* Device identities */
+            0x9b, 0x01, status          /* Location status */
+    };
+
+    memcpy(dst, envelope, sizeof(envelope));
+}
+
+
+/* Flaky transport:
+    The file transport, but refusing every message while `refuse`
+    is set, as a network would with no credit left. */
+
+typedef struct flaky_state {
+
+    u8 refuse;
+    unsigned int refused;
+
+} flaky_state_t;
+
+
+static u8 flaky_begin(void *context, schema_list_t *settings) {
+
+    muvuku_transport_t *t = &muvuku_file_transport;
+    return t->batch_begin(t->context, settings);
+}
+
+
+static u8 flaky_send(void *context, const char *s,
+                     size_t len, schema_list_t *settings) {
+
+    flaky_state_t *f = (flaky_state_t *) context;
+    muvuku_transport_t *t = &muvuku_file_transport;
+
+    if (f->refuse) {
+        f->refused++;
+        return MUVUKU_SEND_FAILED;
+    }
+
+    return t->send(t->context, s, len, settings);
+}
+
+
+static u8 flaky_end(void *context) {
+
+    muvuku_transport_t *t = &muvuku_file_transport;
+    return t->batch_end(t->context);
+}
+
+
+static void flaky_status(void *context, u8 result) {
+}
+
+
+/* Occurrences of `needle` in the `n` bytes at `s`, NULs and all */
+static unsigned int sink_count(const char *s, size_t n, const char *needle) {
+
+    unsigned int rv = 0;
+    size_t i, len = strlen(needle);
+
+    for (i = 0; i + len <= n; ++i) {
+        rv += (memcmp(&s[i], needle, len) == 0);
+    }
+
+    return rv;
+}
+
+
+/* Save record number `i` in `t`, for the form `code` */
+static void schedule_save(muvuku_tieredlist_t *t,
+                          const char *code, unsigned int i) {
+
+    size_t n = 0;
+    char buf[MAX_SMS_LENGTH];
+
+    #ifdef _SCHEMA_ENABLE_ACK
+        n = schema_sequence_header(buf, i);
+    #endif /* _SCHEMA_ENABLE_ACK */
+
+    n += sprintf(
+        &buf[n], "1!%s!%u#xyzzy#abcdefghijklmnopqrstuvwxyz", code, i
+    );
+
+    assert(muvuku_tieredlist_add(t, buf, n + 1), "Record saved");
+}
+
+
+void test_schedule() {
+
+    puts("[>] test_schedule");
+
+    muvuku_schedule_t h;
+    uint32_t wait, backoff;
+    u8 envelope[16];
+
+    /* Attempts:
+        Due straight away; one at a time; spaced out while there's
+        more to send, and not at all once there isn't. */
+
+    muvuku_schedule_init(&h);
+
+    assert(
+        muvuku_schedule_tick(&h, MUVUKU_SCHEDULE_TICK) ==
+            MUVUKU_SCHEDULE_MESSAGES,
+        "Due at once"
+    );
+
+    assert(!muvuku_schedule_tick(&h, MUVUKU_SCHEDULE_TICK), "One at a time");
+
+    muvuku_schedule_done(&h, 2, TRUE, 5);
+    assert(h.spent == 2 && h.pending, "Attempt counted");
+
+    assert(schedule_wait(&h) == MUVUKU_SCHEDULE_INTERVAL, "Spaced out");
+
+    muvuku_schedule_done(&h, 1, TRUE, 0);
+    assert(!schedule_wait(&h), "Nothing left to send");
+
+    muvuku_schedule_event(&h, MUVUKU_EVENT_MENU_OPEN);
+    muvuku_schedule_event(&h, MUVUKU_EVENT_MENU_CLOSE);
+
+    assert(schedule_wait(&h) == 1, "Records may have been saved");
+
+    /* Abandoned attempt */
+    assert(
+        schedule_wait(&h) == MUVUKU_SCHEDULE_BACKOFF_MAX,
+        "Attempt given up on"
+    );
+
+    /* Backoff:
+        Doubling after each failure, up to the maximum; a success
+        starts over. */
+
+    for (backoff = MUVUKU_SCHEDULE_BACKOFF_MIN;
+            backoff < 4 * MUVUKU_SCHEDULE_BACKOFF_MAX; backoff *= 2) {
+
+        muvuku_schedule_done(&h, 0, FALSE, 0);
+
+        assert(
+            schedule_wait(&h) ==
+                scalar_min(backoff, MUVUKU_SCHEDULE_BACKOFF_MAX),
+            "Backed off"
+        );
+    }
+
+    muvuku_schedule_done(&h, 1, TRUE, 1);
+    assert(schedule_wait(&h) == MUVUKU_SCHEDULE_INTERVAL, "Back to normal");
+
+    muvuku_schedule_done(&h, 0, FALSE, 0);
+
+    assert(
+        schedule_wait(&h) == MUVUKU_SCHEDULE_BACKOFF_MIN,
+        "Backoff starts over"
+    );
+
+    /* Handset busy:
+        Not while the menu is open, nor just after a key press. */
+
+    muvuku_schedule_done(&h, 0, TRUE, 1);
+    muvuku_schedule_event(&h, MUVUKU_EVENT_MENU_OPEN);
+
+    assert(!schedule_wait(&h), "Not while the menu is open");
+
+    muvuku_schedule_event(&h, MUVUKU_EVENT_MENU_CLOSE);
+    assert(schedule_wait(&h) == 1, "Menu closed");
+
+    muvuku_schedule_done(&h, 0, TRUE, 1);
+    h.next = h.now;
+
+    muvuku_schedule_action(&h, ACTION_EVENT_USER_ACTIVITY, NULL);
+
+    assert(
+        schedule_wait(&h) == MUVUKU_SCHEDULE_QUIET,
+        "Quiet after a key press"
+    );
+
+    muvuku_schedule_done(&h, 0, TRUE, 1);
+    h.next = h.now;
+
+    muvuku_schedule_action(&h, ACTION_EVENT_USER_ACTIVITY, NULL);
+    muvuku_schedule_action(&h, ACTION_EVENT_IDLE_SCREEN, NULL);
+
+    assert(schedule_wait(&h) == 1, "Idle screen ends the quiet");
+
+    /* Coverage:
+        Nothing without service; straight away once it's back. */
+
+    muvuku_schedule_done(&h, 0, FALSE, 0);
+    muvuku_schedule_done(&h, 0, FALSE, 0);
+
+    location_envelope(envelope, 0x02);
+    muvuku_schedule_action(&h, ACTION_EVENT_LOCATION_STATUS, envelope);
+
+    assert(!h.registered && !schedule_wait(&h), "No service");
+
+    location_envelope(envelope, 0x00);
+    muvuku_schedule_action(&h, ACTION_EVENT_LOCATION_STATUS, envelope);
+
+    assert(h.registered && schedule_wait(&h) == 1, "Service regained");
+
+    location_envelope(envelope, 0x01);
+    envelope[0] = 0xd1;
+
+    muvuku_schedule_action(&h, ACTION_EVENT_LOCATION_STATUS, envelope);
+    assert(h.registered, "Not an event download");
+
+    /* Daily budget:
+        Once it's spent, nothing until the next day. */
+
+    muvuku_schedule_init(&h);
+
+    while (muvuku_schedule_tick(&h, MUVUKU_SCHEDULE_TICK)) {
+        muvuku_schedule_done(&h, h.allowance, TRUE, 1);
+        h.next = h.now;
+    }
+
+    assert(h.spent == MUVUKU_SCHEDULE_BUDGET, "Budget spent");
+
+    wait = schedule_wait(&h);
+
+    assert(
+        h.now % MUVUKU_SCHEDULE_DAY == 0 && wait > 0 &&
+            wait < MUVUKU_SCHEDULE_DAY,
+        "Budget renewed the next day"
+    );
+
+    assert(
+        h.spent == 0 && h.allowance == MUVUKU_SCHEDULE_MESSAGES,
+        "Full allowance"
+    );
+
+    /* Restart:
+        The budget spent today, and a run of failures, are kept
+        in persistent counters; the day itself starts over. */
+
+    unsigned int c;
+    muvuku_settings_t rs;
+    muvuku_allocator_t *a = &muvuku_eeprom_allocator;
+
+    memset(&rs, '\0', sizeof(rs));
+    rs.store = muvuku_kv_new(a, MUVUKU_SETTINGS_STORE_SIZE);
+
+    for (c = MUVUKU_COUNTER_BACKGROUND; c < MUVUKU_NR_COUNTERS; ++c) {
+        rs.counters[c] = muvuku_counter_new(a);
+    }
+
+    assert(muvuku_settings_open(&rs), "Opened settings");
+
+    muvuku_schedule_init(&h);
+    muvuku_schedule_restore(&h);
+
+    assert(schedule_wait(&h) == 1, "Nothing to restore");
+
+    muvuku_schedule_done(&h, 2, TRUE, 1);
+    schedule_wait(&h);
+    muvuku_schedule_done(&h, 0, FALSE, 1);
+    schedule_wait(&h);
+    muvuku_schedule_done(&h, 0, FALSE, 1);
+
+    muvuku_schedule_init(&h);
+    muvuku_schedule_restore(&h);
+
+    assert(h.spent == 2, "Budget restored");
+
+    assert(
+        schedule_wait(&h) == 2 * MUVUKU_SCHEDULE_BACKOFF_MIN,
+        "Still backing off"
+    );
+
+    muvuku_schedule_done(&h, 1, TRUE, 1);
+
+    muvuku_schedule_init(&h);
+    muvuku_schedule_restore(&h);
+
+    assert(h.spent == 3 && schedule_wait(&h) == 1, "Failures forgotten");
+
+    for (wait = 0; wait < MUVUKU_SCHEDULE_DAY; wait += 21600) {
+        muvuku_schedule_tick(&h, 21600);
+    }
+
+    muvuku_schedule_done(&h, 1, TRUE, 1);
+
+    muvuku_schedule_init(&h);
+    muvuku_schedule_restore(&h);
+
+    assert(h.spent == 1, "New day restored");
+
+    muvuku_settings_close(&rs);
+
+    for (c = MUVUKU_COUNTER_BACKGROUND; c < MUVUKU_NR_COUNTERS; ++c) {
+        muvuku_counter_delete(a, rs.counters[c]);
+    }
+
+    muvuku_kv_delete(a, rs.store);
+
+    /* Driver:
+        A simulated day on the handset, with a STATUS command every
+        tick, and events along the way. Records are saved in two
+        forms, and sent through a transport that fails for a while;
+        the gateway, if there is one, acknowledges what it gets. */
+
+    memset(&reserved, '\0', sizeof(reserved));
+
+    SCHEMA_BEGIN(form1)
+        SCHEMA_ITEM("i", TS_INTEGER, 1, 4)
+    SCHEMA_END(form1, "MUVC")
+
+    SCHEMA_BEGIN(form2)
+        SCHEMA_ITEM("i", TS_INTEGER, 1, 4)
+    SCHEMA_END(form2, "MUVD")
+
+    schema_list_t *l1 = schema_list_new(&form1);
+    schema_list_t *l2 = schema_list_new(&form2);
+
+    muvuku_settings_t s;
+    memset(&s, '\0', sizeof(s));
+
+    muvuku_flash_region_t *r =
+        muvuku_flash_region_init(&reserved, sizeof(reserved));
+
+    muvuku_pool_t *p = muvuku_pool_new(
+        &muvuku_flash_allocator, muvuku_flash_region_available(r), 4, r
+    );
+
+    muvuku_pool_t *o = muvuku_pool_new(
+        &muvuku_eeprom_allocator, 512, 4, NULL
+    );
+
+    muvuku_tieredlist_t *t1 = muvuku_storage_list(&s, p, o, l1);
+    muvuku_tieredlist_t *t2 = muvuku_storage_list(&s, p, o, l2);
+
+    assert(t1 != NULL && t2 != NULL, "Opened storage");
+
+    unsigned int i, saved = 0;
+
+    for (i = 0; i < 6; ++i) {
+        schedule_save(t1, "MUVC", ++saved);
+        schedule_save(t2, "MUVD", ++saved);
+    }
+
+    char path[] = "/tmp/muvuku-schedule-XXXXXX";
+    int fd = mkstemp(path);
+
+    assert(fd >= 0, "Temporary file created");
+
+    muvuku_subsystem_init_transport();
+
+    muvuku_sink_t k;
+    muvuku_sink_init(&k, path);
+
+    flaky_state_t f = { FALSE, 0 };
+
+    muvuku_transport_t flaky = {
+        flaky_begin, flaky_send, flaky_end, flaky_status, &f
+    };
+
+    void *file_context = muvuku_file_transport.context;
+    muvuku_transport_t *saved_transport = muvuku_transport;
+
+    muvuku_file_transport.context = &k;
+    muvuku_transport = &flaky;
+
+    char buf[MAX_SMS_LENGTH * 32];
+    char *received = buf;
+
+    uint32_t now, last = 0;
+    unsigned int attempts = 0, failures = 0, delivered = 0;
+
+    muvuku_schedule_init(&h);
+
+    location_envelope(envelope, 0x02);
+    muvuku_schedule_action(&h, ACTION_EVENT_LOCATION_STATUS, envelope);
+
+    for (now = MUVUKU_SCHEDULE_TICK;
+            now <= MUVUKU_SCHEDULE_DAY; now += MUVUKU_SCHEDULE_TICK) {
+
+        switch (now) {
+
+            /* In coverage, and in use, at half past midnight */
+            case 1800:
+                location_envelope(envelope, 0x00);
+                muvuku_schedule_action(
+                    &h, ACTION_EVENT_LOCATION_STATUS, envelope
+                );
+                muvuku_schedule_action(&h, ACTION_EVENT_USER_ACTIVITY, NULL);
+                break;
+
+            /* A few more records, saved from the menu */
+            case 9000:
+                assert(muvuku_tieredlist_count(t1) +
+                           muvuku_tieredlist_count(t2) == 0, "Drained");
+                muvuku_schedule_event(&h, MUVUKU_EVENT_MENU_OPEN);
+                break;
+
+            case 9300:
+                schedule_save(t2, "MUVD", ++saved);
+                schedule_save(t2, "MUVD", ++saved);
+                schedule_save(t2, "MUVD", ++saved);
+                break;
+
+            case 9600:
+                muvuku_schedule_event(&h, MUVUKU_EVENT_MENU_CLOSE);
+                break;
+
+            /* Out of credit for an hour, with records waiting */
+            case 20010:
+                muvuku_schedule_event(&h, MUVUKU_EVENT_MENU_OPEN);
+                schedule_save(t1, "MUVC", ++saved);
+                schedule_save(t1, "MUVC", ++saved);
+                muvuku_schedule_event(&h, MUVUKU_EVENT_MENU_CLOSE);
+                f.refuse = TRUE;
+                break;
+
+            case 23610:
+                f.refuse = FALSE;
+                break;
+        }
+
+        if (!muvuku_schedule_action(&h, ACTION_STATUS, NULL)) {
+            continue;
+        }
+
+        unsigned long count = k.count;
+        u8 refuse = f.refuse;
+
+        assert(now > 1800 + MUVUKU_SCHEDULE_TICK, "Only in coverage, idle");
+        assert(now < 9000 || now >= 9600, "Not while the menu is open");
+
+        assert(
+            last == 0 || now - last >= MUVUKU_SCHEDULE_BACKOFF_MIN,
+            "Spaced out"
+        );
+
+        u8 result = muvuku_schedule_drain(&h, &s, p, o, NULL);
+
+        attempts++;
+        last = now;
+
+        assert(result == !refuse, "Refused while out of credit");
+        assert(k.count - count <= MUVUKU_SCHEDULE_MESSAGES, "A few at a time");
+
+        failures += !result;
+
+        /* What the gateway received */
+        size_t n = read_sink(fd, received, sizeof(buf) - (received - buf));
+
+        delivered += sink_count(received, n, "#xyzzy#");
+
+        #ifdef _SCHEMA_ENABLE_ACK
+            char ack[MAX_SMS_LENGTH + 1];
+            char *a = ack + sprintf(ack, "7!");
+
+            for (i = 1; i <= saved; ++i) {
+
+                char header[SCHEMA_SEQUENCE_HEADER_MAX + 1];
+                header[schema_sequence_header(header, i)] = '\0';
+
+                if (sink_count(received, n, header) > 0) {
+                    a += sprintf(a, "%s%u", (a > ack + 2 ? "," : ""), i);
+                }
+            }
+
+            if (a > ack + 2) {
+                muvuku_storage_acknowledge(&s, p, o, ack, strlen(ack));
+            }
+        #endif /* _SCHEMA_ENABLE_ACK */
+
+        received += n;
+    }
+
+    assert(
+        muvuku_tieredlist_count(t1) + muvuku_tieredlist_count(t2) == 0,
+        "Everything sent"
+    );
+
+    assert(delivered == saved && saved == 17, "Each record exactly once");
+    assert(failures >= 4 && f.refused == failures, "Backed off");
+    assert(h.spent <= MUVUKU_SCHEDULE_BUDGET, "Within budget");
+    assert(!h.pending, "Nothing pending");
+
+    muvuku_file_transport.context = file_context;
+    muvuku_transport = saved_transport;
+
+    close(fd);
+    unlink(path);
+
+    muvuku_tieredlist_close(t1);
+    muvuku_tieredlist_close(t2);
+    muvuku_pool_delete(o);
+
+    schema_list_delete(l1);
+    schema_list_delete(l2);
+
+    puts("[<] test_schedule");
+}
+
+#endif /* _ENABLE_AUTO_TRANSMIT */
+
+
+extern void _prototype_progmem_write(void *dst, void *src);
+
+
+/** @name test_prototype_progmem_write */
+
+void test_prototype_progmem_write() {
+
+    puts("[>] test_progmem_write");
+    memset(&reserved, '\0', sizeof(reserved));
+
+    unsigned int i = 0;
+    unsigned char buf[MUVUKU_PAGE_SIZE] = { 0 };
+    unsigned char *p = muvuku_align_page(&reserved, unsigned char, TRUE);
+
+    for (i = 0; i < MUVUKU_PAGE_SIZE; ++i) {
+        buf[i] = (i % 256);
+    }
+    
+    _prototype_progmem_write(p, buf);
+    
+    for (i = 0; i < MUVUKU_PAGE_SIZE; ++i) {
+        assert(p[i] == (i % 256), "Value matches expected");
+    }
+
+    puts("[<] test_progmem_write");
+}
+
+
+/** @name test_prototype_flash_zero */
+
+void test_prototype_flash_zero() {
+
+    puts("[>] test_prototype_flash_zero");
+    memset(&reserved, '\0', sizeof(reserved));
+
+    unsigned int i = 0;
+    unsigned int len = (MUVUKU_PAGE_SIZE * 8);
+    unsigned char *buf = muvuku_align_page(&reserved, unsigned char, TRUE);
+
+    memset(buf, 0, len);
+
+    for (i = 0; i < len; ++i) {
+        buf[i] = (i % 256);
+    }
+
+    /* Zero between 10 and 501, inclusive */
+    int l1 = 10, s1 = (MUVUKU_PAGE_SIZE * 2) - 20;
+    muvuku_flash_zero(&buf[l1], s1);
+ 
+    /* Zero between 1025 and 1535, inclusive */
+    int l2 = (MUVUKU_PAGE_SIZE * 4) + 1, s2 = (MUVUKU_PAGE_SIZE * 2) - 1;
+    muvuku_flash_zero(&buf[l2], s2);
+
+    for (i = 0; i < len; ++i) {
+        if ((i >= l1 && i < l1 + s1) || (i >= l2 && i < l2 + s2)) {
+            assert(buf[i] == 0, "Value is zero");
+        } else {
+            assert(buf[i] == (i % 256), "Value matches expected");
+        }
+    }
+
+    puts("[<] test_prototype_flash_zero");
+}
+
+
+
+/** @name test_flash_pool */
+
+void test_flash_pool() {
+
+    puts("[>] test_flash_pool");
+    memset(&reserved, '\0', sizeof(reserved));
+
+    muvuku_flash_region_t *r =
+        muvuku_flash_region_init(&reserved, sizeof(reserved));
+
+    muvuku_pool_t *pool = muvuku_pool_new(
+        &muvuku_flash_allocator, sizeof(reserved) - MUVUKU_PAGE_SIZE, 16, r
+    );
+
+    assert(pool == NULL, "Oversized pool is refused");
+
+    pool = muvuku_pool_new(
+        &muvuku_flash_allocator, muvuku_flash_region_available(r), 16, r
+    );
+
+    assert(pool != NULL, "Created flash pool successfully");
+    assert(muvuku_is_page_aligned(pool->pool), "Pool is page-aligned");
+
+    muvuku_pool_delete(pool);
+
+    puts("[<] test_flash_pool");
+}
+
+
+/** @name test_flash_pool_aligned */
+
+void test_flash_pool_aligned() {
+
+    puts("[>] test_flash_pool_aligned");
+    memset(&reserved, '\0', sizeof(reserved));
+
+    unsigned int i;
+    size_t pgsz = MUVUKU_PAGE_SIZE;
+
+    muvuku_flash_region_t *r =
+        muvuku_flash_region_init(&reserved, sizeof(reserved));
+
+    muvuku_pool_t *pool = muvuku_pool_new_aligned(
+        &muvuku_flash_allocator, pgsz * 9, 4, r
+    );
+
+    assert(pool != NULL, "Created aligned pool successfully");
+
+    size_t cell_size = muvuku_pool_cell_size(pool);
+    assert(cell_size == pgsz * 2, "Cells rounded to whole pages");
+
+    u8 *x1 = muvuku_pool_acquire(pool);
+    assert(x1 == (u8 *) pool->pool + pgsz, "Metadata has its own page");
+
+    for (i = 2; i <= 4; ++i) {
+        u8 *x = muvuku_pool_acquire(pool);
+        assert(muvuku_is_page_aligned(x), "Cell is page-aligned");
+        assert(x == x1 + (cell_size * (i - 1)), "Cells are contiguous");
+        assert(muvuku_pool_cell(pool, x) == i, "Cell number correct");
+    }
+
+    muvuku_pool_delete(pool);
+
+    pool = muvuku_pool_new_aligned(
+        &muvuku_flash_allocator, pgsz * 4, 4, r
+    );
+
+    assert(pool == NULL, "Pool without a page per cell is refused");
+
+    puts("[<] test_flash_pool_aligned");
+}
+
+
+/** @name test_flash_region */
+
+void test_flash_region() {
+
+    puts("[>] test_flash_region");
+    memset(&reserved, '\0', sizeof(reserved));
+
+    size_t pgsz = MUVUKU_PAGE_SIZE;
+
+    muvuku_flash_region_t *r =
+        muvuku_flash_region_init(&reserved, sizeof(reserved));
+
+    assert(r != NULL, "Region initialized successfully");
+    assert(muvuku_is_page_aligned(r), "Extent table is page-aligned");
+
+    size_t total = muvuku_flash_region_available(r);
+    assert(total >= sizeof(reserved) - (pgsz * 2), "Region is usable");
+
+    u8 *x1 = muvuku_flash_allocator.alloc(1, r);
+    u8 *x2 = muvuku_flash_allocator.alloc(pgsz * 2, r);
+    u8 *x3 = muvuku_flash_allocator.alloc(pgsz + 1, r);
+
+    assert(x1 && x2 && x3, "Allocations successful");
+    assert(muvuku_is_page_aligned(x1), "Allocation is page-aligned");
+    assert(x1 == (u8 *) r + pgsz, "Allocation follows extent table");
+    assert(x2 == x1 + pgsz, "Allocation rounded up to one page");
+    assert(x3 == x2 + (pgsz * 2), "Allocations are contiguous");
+
+    assert(
+        muvuku_flash_region_available(r) == total - (pgsz * 5),
+            "Available space reflects allocations"
+    );
+
+    /* Release middle extent:
+        A smaller allocation should reuse the hole it left. */
+
+    muvuku_flash_allocator.free(x2);
+
+    u8 *x4 = muvuku_flash_allocator.alloc(pgsz, r);
+    assert(x4 == x2, "Free space is reused");
+
+    u8 *x5 = muvuku_flash_allocator.alloc(pgsz * 2, r);
+    assert(x5 == x3 + (pgsz * 2), "Oversized request skips hole");
+
+    /* Table is persistent:
+        Opening the region again must not discard extents. */
+
+    r = muvuku_flash_region_init(&reserved, sizeof(reserved));
+
+    assert(
+        muvuku_flash_region_available(r) == total - (pgsz * 7),
+            "Extent table survives reinitialization"
+    );
+
+    muvuku_flash_allocator.free(x1);
+    muvuku_flash_allocator.free(x3);
+    muvuku_flash_allocator.free(x4);
+    muvuku_flash_allocator.free(x5);
+
+    assert(
+        muvuku_flash_region_available(r) == total,
+            "All extents returned to region"
+    );
+
+    assert(
+        muvuku_flash_allocator.alloc(total + 1, r) == NULL,
+            "Oversized allocation fails"
+    );
+
+    puts("[<] test_flash_region");
+}
+
+
+/** @name test_align_page*/
+
+void test_align_page() {
+
+    puts("[>] test_align_page");
+
+    void *p1 = NULL;
+    void *p2 = muvuku_align_page(p1, void, TRUE);
+    assert(p1 == p2, "Aligned pointer left unchanged");
+
+    puts("[<] test_align_page");
+}
+
+/** @name main */
+
+int main(int argc, char *argv[]) {
+
+    muvuku_subsystem_init_pool();
+
+    test_align_page();
+    test_prototype_progmem_write();
+    test_prototype_flash_zero();
+
+    test_simple_serialization();
+    test_selective_serialization();
+    test_date_serialization();
+    test_list_counts();
+    test_schema_descriptors();
+
+    test_eeprom_pool();
+    test_pool_wear();
+    test_eeprom_counter();
+    test_stringlist_pool(&muvuku_eeprom_allocator, sizeof(reserved), NULL);
+
+    test_flash_region();
     test_flash_pool();
-    test_stringlist_pool(&muvuku_flash_allocator, &reserved);
+    test_flash_pool_aligned();
+
+    test_stringlist_pool(
+        &muvuku_flash_allocator,
+            muvuku_flash_region_available(muvuku_flash_region), NULL
+    );
+
+    test_tiered_stringlist();
+    test_streaming_serialization();
+    test_batch_serialization();
+
+    #ifdef _SCHEMA_ENABLE_COMPACT
+      test_compact_serialization();
+    #endif /* _SCHEMA_ENABLE_COMPACT */
+
+    #ifdef _SCHEMA_ENABLE_DELTA
+      test_delta_serialization();
+    #endif /* _SCHEMA_ENABLE_DELTA */
+
+    test_multipart_serialization();
+    test_push_parser();
+    test_parser_scan();
+
+    #ifdef _SCHEMA_ENABLE_ARENA
+      test_value_arena();
+    #endif /* _SCHEMA_ENABLE_ARENA */
+
 
     test_settings_storage_map();
+    test_kv_store();
+    test_transport();
+    test_session();
+
+    #if defined(_SCHEMA_ENABLE_ACK) && defined(_SCHEMA_PROVIDE_UNSERIALIZE)
+      test_acknowledgements();
+    #endif /* _SCHEMA_ENABLE_ACK && _SCHEMA_PROVIDE_UNSERIALIZE */
+
+    #ifdef _ENABLE_AUTO_TRANSMIT
+      test_schedule();
+    #endif /* _ENABLE_AUTO_TRANSMIT */
 
     return 0;
 